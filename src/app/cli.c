@@ -8,6 +8,10 @@
 #include <stdio.h>
 #include <string.h>
 #include "../engine/nanocad.h"
+#include "../engine/diagnostics.h"
+#include "../engine/snapshot.h"
+#include "../engine/doccache.h"
+#include "../engine/cachemgr.h"
 #include "../graphics/sdl_graphics.h"
 
 // Constant definitions.
@@ -16,6 +20,8 @@
 // Function prototypes.
 void usage(char **argv);
 void print_welcome();
+int extract_thumb(int argc, char **argv);
+bool parse_flag(int argc, char **argv, int *arg);
 
 /**
  * The program's main entry point.
@@ -27,22 +33,40 @@ void print_welcome();
 int main(int argc, char **argv) {
 	// Show a little version message.
 	print_welcome();
+
+	// Pulling the thumbnail out of a snapshot doesn't need the engine.
+	if ((argc > 1) && (strcmp(argv[1], "--thumb") == 0)) {
+		return extract_thumb(argc, argv);
+	}
+
 	nanocad_init();
 
+	// Go through the flags that come before the file.
+	int file_arg = 1;
+	while ((file_arg < argc) && (strncmp(argv[file_arg], "--", 2) == 0)) {
+		if (!parse_flag(argc, argv, &file_arg)) {
+			diag_drain();
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	// Check for command line arguments.
-	if (argc < 2) {
+	if (argc <= file_arg) {
 		// TODO: Present the command prompt.
 		printf("Not implemented!\n");
 		exit(EXIT_FAILURE);
-	} else if (strcmp(argv[1], "-h") == 0) {
+	} else if (strcmp(argv[file_arg], "-h") == 0) {
 		usage(argv);
 		exit(EXIT_SUCCESS);
 	}
 
 	// Parse the file.
-	if (!nanocad_parse_file(argv[1])) {
+	if (!nanocad_parse_file(argv[file_arg])) {
+		diag_drain();
 		return EXIT_FAILURE;
 	}
+	diag_drain();
 	
 #ifndef MEMCHECK
 	// Initialize the graphics.
@@ -59,6 +83,85 @@ int main(int argc, char **argv) {
 	return 0;
 }
 
+/**
+ * Parses a flag that takes a value.
+ *
+ * @param  argc Number of command-line arguments passed to the program.
+ * @param  argv Array of command-line arguments passed to the program.
+ * @param  arg  Index of the flag, which gets moved past its value.
+ * @return      TRUE if the flag was valid.
+ */
+bool parse_flag(int argc, char **argv, int *arg) {
+	if ((*arg + 1) >= argc) {
+		return false;
+	}
+
+	const char *flag = argv[*arg];
+	const char *value = argv[*arg + 1];
+	*arg += 2;
+
+	if (strcmp(flag, "--cache") == 0) {
+		// Keep the parsed documents around for the next time.
+		return doccache_init(value, DOCCACHE_DEFAULT_SIZE);
+	} else if (strcmp(flag, "--budget") == 0) {
+		// Memory shared by every cache.
+		long megabytes = atol(value);
+		if (megabytes <= 0) {
+			return false;
+		}
+
+		cachemgr_set_budget((uint64_t)megabytes * 1024 * 1024);
+		return true;
+	} else if (strcmp(flag, "--evict") == 0) {
+		// How the caches make room.
+		if (strcmp(value, "lru") == 0) {
+			cachemgr_set_policy(CACHEMGR_POLICY_LRU);
+		} else if (strcmp(value, "cost") == 0) {
+			cachemgr_set_policy(CACHEMGR_POLICY_COST);
+		} else {
+			return false;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Copies the thumbnail of a snapshot to a PNG file and shows what's in the
+ * header, without reading the rest of the snapshot.
+ *
+ * @param  argc Number of command-line arguments passed to the program.
+ * @param  argv Array of command-line arguments passed to the program.
+ * @return      Program return code.
+ */
+int extract_thumb(int argc, char **argv) {
+	snapshot_header_t header;
+
+	if (argc < 4) {
+		usage(argv);
+		return EXIT_FAILURE;
+	}
+
+	if (!snapshot_extract_thumb(argv[2], argv[3], &header)) {
+		diag_drain();
+		return EXIT_FAILURE;
+	}
+
+	printf("Thumbnail: %ux%u pixels (%u bytes) written to %s\n",
+		   header.thumb_width, header.thumb_height, header.thumb_len, argv[3]);
+	printf("Extents: (%ld, %ld) to (%ld, %ld)\n", header.min.x, header.min.y,
+		   header.max.x, header.max.y);
+	printf("Contents: %llu objects (%llu coordinates), %llu dimensions, %u "
+		   "layers\n", (unsigned long long)header.objects,
+		   (unsigned long long)header.coords,
+		   (unsigned long long)header.dimensions, header.layers);
+	printf("Written by engine v%s\n", header.engine);
+
+	return EXIT_SUCCESS;
+}
+
 /**
  * Prints a little "welcome" message.
  */
@@ -73,10 +176,24 @@ void print_welcome() {
  * @param argv List of command line arguments.
  */
 void usage(char **argv) {
-	printf("Usage: %s [-h] [filename]\n", argv[0]);
+	printf("Usage: %s [-h] [--cache dir] [--budget mb] [--evict policy] "
+		   "[filename]\n", argv[0]);
+	printf("       %s --thumb snapshot png\n", argv[0]);
 	printf("\nArguments:\n");
 	printf("    filename    A CAD file to be interpreted.\n");
+	printf("    dir         Folder to cache the parsed documents in.\n");
+	printf("    mb          Megabytes of memory shared by every cache.\n");
+	printf("    policy      Which entries go first when the caches are full: "
+		   "lru or cost.\n");
+	printf("    snapshot    A binary snapshot written by the snapshot "
+		   "command.\n");
+	printf("    png         Where to put the thumbnail of the snapshot.\n");
 	printf("\nFlags:\n");
-	printf("    -h    Shows this message.\n");
+	printf("    -h         Shows this message.\n");
+	printf("    --cache    Loads documents that were parsed before from a "
+		   "cache.\n");
+	printf("    --budget   Sets the memory budget of the caches.\n");
+	printf("    --evict    Sets how the caches make room.\n");
+	printf("    --thumb    Extracts the thumbnail of a snapshot.\n");
 }
 
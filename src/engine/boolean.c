@@ -0,0 +1,97 @@
+/**
+ * engine/boolean.c
+ * Boolean operations (union, intersection and difference) between the closed
+ * outlines of two sets of lines.
+ *
+ * Both sets of lines go into the same planar graph, which splits them where
+ * they cross and tells which faces are inside of each set. Lines don't have a
+ * direction in a drawing, so a face is inside a set if crossing its lines an
+ * odd number of times is needed to get there (even-odd rule). Neighbouring
+ * faces kept by the operation are then merged into single regions with their
+ * holes.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include "diagnostics.h"
+#include "boolean.h"
+
+// Internal functions.
+bool keep_face(const uint8_t op, const int32_t *wind);
+
+
+/**
+ * Applies a boolean operation between the closed outlines formed by two sets
+ * of lines.
+ *
+ * @param  op     Operation to apply (BOOLEAN_*).
+ * @param  a      Lines of the first operand.
+ * @param  b      Lines of the second operand (subtracted from the first).
+ * @param  snap   Endpoints closer than this are considered the same point.
+ * @param  result Resulting regions. Must be initialized.
+ * @return        TRUE if the operation was successful.
+ */
+bool boolean_apply(const uint8_t op, const object_filter_t *a,
+				   const object_filter_t *b, const long snap,
+				   region_set_t *result) {
+	planar_segments_t segs = { 0, 0, NULL };
+	planar_graph_t graph;
+
+	if (op > BOOLEAN_SUBTRACT) {
+		diag_report(DIAG_ERROR, DIAG_CODE_GENERIC, op,
+					"Invalid boolean operation: %u.", op);
+		return false;
+	}
+
+	// Split both operands against each other.
+	regions_collect(a, 0, &segs);
+	regions_collect(b, 1, &segs);
+
+	planar_init(&graph);
+	if (!planar_build(&graph, segs.list, segs.count, 2, snap, true)) {
+		free(segs.list);
+		return false;
+	}
+
+	free(segs.list);
+
+	// Merge the kept faces into regions.
+	bool *kept = malloc(sizeof(bool) * (graph.face_count + 1));
+	for (size_t f = 0; f < graph.face_count; f++) {
+		kept[f] = keep_face(op, &graph.face_wind[f * 2]);
+	}
+
+	bool success = regions_merge_faces(result, &graph, kept);
+	result->segment_count = graph.segment_count;
+	result->intersection_count = graph.intersection_count;
+	result->pruned_count = graph.pruned_count;
+
+	free(kept);
+	planar_free(&graph);
+
+	return success;
+}
+
+/**
+ * Checks if a face should be kept by an operation.
+ *
+ * @param  op   Operation being applied.
+ * @param  wind Winding numbers of the face for both operands.
+ * @return      TRUE if the face is part of the result.
+ */
+bool keep_face(const uint8_t op, const int32_t *wind) {
+	bool in_a = (wind[0] & 1) != 0;
+	bool in_b = (wind[1] & 1) != 0;
+
+	switch (op) {
+	case BOOLEAN_UNION:
+		return in_a || in_b;
+	case BOOLEAN_INTERSECT:
+		return in_a && in_b;
+	case BOOLEAN_SUBTRACT:
+		return in_a && !in_b;
+	}
+
+	return false;
+}
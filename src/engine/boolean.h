@@ -0,0 +1,28 @@
+/**
+ * engine/boolean.h
+ * Boolean operations (union, intersection and difference) between the closed
+ * outlines of two sets of lines.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _BOOLEAN_H
+#define _BOOLEAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "nanocad.h"
+#include "regions.h"
+
+// Operations.
+#define BOOLEAN_UNION     0
+#define BOOLEAN_INTERSECT 1
+#define BOOLEAN_SUBTRACT  2
+
+// Operation.
+bool boolean_apply(const uint8_t op, const object_filter_t *a,
+				   const object_filter_t *b, const long snap,
+				   region_set_t *result);
+
+#endif
@@ -0,0 +1,350 @@
+/**
+ * engine/cachemgr.c
+ * Keeps every in-memory cache under a single global memory budget.
+ *
+ * Caches register themselves and keep the manager posted about how much
+ * memory they take up and how often they're hit or missed. Each of them
+ * knows which of its own entries should go first, so when everything
+ * together goes over the budget the manager only has to pick between the
+ * entries they offer: the least recently used one, or the one that is the
+ * cheapest to recreate for the memory it takes up. Caches that can't give
+ * anything up are pinned: they show up in the statistics but don't count
+ * towards the budget, since no amount of evicting would get them under it.
+ * Trimming only happens when the owner of the main loop asks for it, so an
+ * entry is never pulled from under whoever has just looked it up.
+ *
+ * Nothing in here is thread-safe, caches are only used from the main thread.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cachemgr.h"
+
+// Registered cache.
+typedef struct {
+	bool                 registered;
+	void                *data;
+	cachemgr_victim_func victim;
+	cachemgr_evict_func  evict;
+	cachemgr_stats_t     stats;
+} cachemgr_slot_t;
+
+// Registered caches.
+cachemgr_slot_t cachemgr_slots[CACHEMGR_MAX_CACHES];
+size_t cachemgr_total = 0;   // Memory that can be evicted.
+size_t cachemgr_pinned = 0;  // Memory of caches that can't give anything up.
+uint64_t cachemgr_clock = 0;
+
+// Configuration.
+uint64_t cachemgr_budget = CACHEMGR_DEFAULT_BUDGET;
+uint8_t cachemgr_policy = CACHEMGR_POLICY_LRU;
+
+// Internal functions.
+cachemgr_slot_t* cachemgr_slot(const int id);
+bool cachemgr_better_victim(const cachemgr_victim_t *a,
+							const cachemgr_victim_t *b);
+size_t* cachemgr_counter(const cachemgr_slot_t *slot);
+double cachemgr_megabytes(const uint64_t bytes);
+
+
+/**
+ * Sets the global memory budget shared by every cache. It's only enforced
+ * the next time the caches are trimmed.
+ *
+ * @param bytes Memory budget in bytes.
+ */
+void cachemgr_set_budget(const uint64_t bytes) {
+	cachemgr_budget = bytes;
+}
+
+/**
+ * Gets the global memory budget shared by every cache.
+ *
+ * @return Memory budget in bytes.
+ */
+uint64_t cachemgr_get_budget() {
+	return cachemgr_budget;
+}
+
+/**
+ * Sets how the entries to be evicted are picked.
+ *
+ * @param policy CACHEMGR_POLICY_LRU or CACHEMGR_POLICY_COST.
+ */
+void cachemgr_set_policy(const uint8_t policy) {
+	cachemgr_policy = policy;
+}
+
+/**
+ * Registers a cache with the manager.
+ *
+ * @param  name   Name of the cache in the statistics.
+ * @param  data   Cache that gets passed to the callbacks.
+ * @param  victim Finds the entry to be evicted next. NULL if the cache only
+ *                reports its size and can't give anything up, in which case
+ *                its memory doesn't count towards the budget.
+ * @param  evict  Evicts the entry that was offered as a victim.
+ * @return        ID of the cache or -1 if there's no room for it. Every other
+ *                function simply ignores -1, so the cache keeps working.
+ */
+int cachemgr_register(const char *name, void *data,
+					  cachemgr_victim_func victim, cachemgr_evict_func evict) {
+	for (int id = 0; id < CACHEMGR_MAX_CACHES; id++) {
+		cachemgr_slot_t *slot = &cachemgr_slots[id];
+		if (slot->registered) {
+			continue;
+		}
+
+		memset(slot, 0, sizeof(cachemgr_slot_t));
+		strncpy(slot->stats.name, name, CACHEMGR_NAME_SIZE - 1);
+		slot->registered = true;
+		slot->data = data;
+		slot->victim = victim;
+		slot->evict = evict;
+
+		return id;
+	}
+
+	return -1;
+}
+
+/**
+ * Removes a cache from the manager, usually right before it's freed.
+ *
+ * @param id ID of the cache.
+ */
+void cachemgr_unregister(const int id) {
+	cachemgr_slot_t *slot = cachemgr_slot(id);
+	if (slot == NULL) {
+		return;
+	}
+
+	*cachemgr_counter(slot) -= slot->stats.bytes;
+	slot->registered = false;
+}
+
+/**
+ * Reports how much memory a cache is taking up now.
+ *
+ * @param id      ID of the cache.
+ * @param bytes   Memory used by the cache.
+ * @param entries Number of entries in the cache.
+ */
+void cachemgr_resize(const int id, const size_t bytes, const size_t entries) {
+	cachemgr_slot_t *slot = cachemgr_slot(id);
+	if (slot == NULL) {
+		return;
+	}
+
+	size_t *total = cachemgr_counter(slot);
+	*total = *total - slot->stats.bytes + bytes;
+	slot->stats.bytes = bytes;
+	slot->stats.entries = entries;
+}
+
+/**
+ * Reports that something was found in a cache.
+ *
+ * @param id ID of the cache.
+ */
+void cachemgr_hit(const int id) {
+	cachemgr_slot_t *slot = cachemgr_slot(id);
+	if (slot != NULL) {
+		slot->stats.hits++;
+	}
+}
+
+/**
+ * Reports that something had to be created because it wasn't in a cache.
+ *
+ * @param id ID of the cache.
+ */
+void cachemgr_miss(const int id) {
+	cachemgr_slot_t *slot = cachemgr_slot(id);
+	if (slot != NULL) {
+		slot->stats.misses++;
+	}
+}
+
+/**
+ * Reports that an entry was thrown away, either because the manager asked
+ * for it or because the cache ran out of its own room.
+ *
+ * @param id ID of the cache.
+ */
+void cachemgr_evicted(const int id) {
+	cachemgr_slot_t *slot = cachemgr_slot(id);
+	if (slot != NULL) {
+		slot->stats.evictions++;
+	}
+}
+
+/**
+ * Advances the clock used to tell which entries were used the longest time
+ * ago. It's shared by every cache so their entries can be compared.
+ *
+ * @return Tick to be stored in the entry that was just used.
+ */
+uint64_t cachemgr_tick() {
+	return ++cachemgr_clock;
+}
+
+/**
+ * Gets a monotonic timestamp for measuring how long an entry took to create.
+ *
+ * @return Current time in microseconds.
+ */
+uint64_t cachemgr_now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+/**
+ * Evicts entries from the caches until everything fits in the budget again.
+ * Should be called at a point where nobody is holding on to any entry.
+ *
+ * @return Number of entries that were evicted.
+ */
+size_t cachemgr_trim() {
+	size_t evicted = 0;
+
+	while (cachemgr_total > cachemgr_budget) {
+		cachemgr_slot_t *chosen = NULL;
+		cachemgr_victim_t best;
+
+		// Pick the best entry out of the ones each cache would give up.
+		for (int id = 0; id < CACHEMGR_MAX_CACHES; id++) {
+			cachemgr_slot_t *slot = &cachemgr_slots[id];
+			cachemgr_victim_t victim;
+
+			if (!slot->registered || (slot->victim == NULL) ||
+					!slot->victim(slot->data, &victim)) {
+				continue;
+			}
+
+			if ((chosen == NULL) || cachemgr_better_victim(&victim, &best)) {
+				chosen = slot;
+				best = victim;
+			}
+		}
+
+		// Stop if there's nothing left to give up or the cache didn't shrink.
+		size_t before = cachemgr_total;
+		if (chosen == NULL) {
+			break;
+		}
+
+		chosen->evict(chosen->data);
+		evicted++;
+
+		if (cachemgr_total >= before) {
+			break;
+		}
+	}
+
+	return evicted;
+}
+
+/**
+ * Gets the counters of every registered cache.
+ *
+ * @param  stats Array that will hold the counters.
+ * @param  max   Number of elements in the array.
+ * @return       Number of caches that were put in the array.
+ */
+size_t cachemgr_get_stats(cachemgr_stats_t *stats, const size_t max) {
+	size_t count = 0;
+
+	for (int id = 0; (id < CACHEMGR_MAX_CACHES) && (count < max); id++) {
+		if (cachemgr_slots[id].registered) {
+			stats[count++] = cachemgr_slots[id].stats;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Prints how much memory each cache takes up and how well it's doing.
+ */
+void cachemgr_print_stats() {
+	cachemgr_stats_t stats[CACHEMGR_MAX_CACHES];
+	size_t count = cachemgr_get_stats(stats, CACHEMGR_MAX_CACHES);
+
+	printf("Caches: %.1fMB of a %.1fMB budget (%s eviction), %.1fMB pinned\n",
+		   cachemgr_megabytes(cachemgr_total),
+		   cachemgr_megabytes(cachemgr_budget),
+		   (cachemgr_policy == CACHEMGR_POLICY_COST) ? "cost" : "LRU",
+		   cachemgr_megabytes(cachemgr_pinned));
+	for (size_t i = 0; i < count; i++) {
+		printf("    %s: %.1fMB in %zu entries - %llu hits, %llu misses, %llu "
+			   "evictions\n", stats[i].name,
+			   cachemgr_megabytes(stats[i].bytes), stats[i].entries,
+			   (unsigned long long)stats[i].hits,
+			   (unsigned long long)stats[i].misses,
+			   (unsigned long long)stats[i].evictions);
+	}
+}
+
+/**
+ * Gets a registered cache.
+ *
+ * @param  id ID of the cache.
+ * @return    Cache slot or NULL if there's no cache with that ID.
+ */
+cachemgr_slot_t* cachemgr_slot(const int id) {
+	if ((id < 0) || (id >= CACHEMGR_MAX_CACHES) ||
+			!cachemgr_slots[id].registered) {
+		return NULL;
+	}
+
+	return &cachemgr_slots[id];
+}
+
+/**
+ * Gets the total that the memory of a cache counts towards.
+ *
+ * @param  slot Registered cache.
+ * @return      Evictable total, or the pinned one if it can't evict anything.
+ */
+size_t* cachemgr_counter(const cachemgr_slot_t *slot) {
+	return (slot->victim != NULL) ? &cachemgr_total : &cachemgr_pinned;
+}
+
+/**
+ * Checks if an entry should be evicted before another one under the current
+ * policy.
+ *
+ * @param  a Entry being considered.
+ * @param  b Best entry so far.
+ * @return   TRUE if a should go before b.
+ */
+bool cachemgr_better_victim(const cachemgr_victim_t *a,
+							const cachemgr_victim_t *b) {
+	if (cachemgr_policy == CACHEMGR_POLICY_COST) {
+		// Compare the cost per byte without dividing by a zero size.
+		double cost_a = (double)a->cost * (double)b->bytes;
+		double cost_b = (double)b->cost * (double)a->bytes;
+
+		if (cost_a != cost_b) {
+			return cost_a < cost_b;
+		}
+	}
+
+	return a->used < b->used;
+}
+
+/**
+ * Converts a size to megabytes for printing.
+ *
+ * @param  bytes Size in bytes.
+ * @return       Size in megabytes.
+ */
+double cachemgr_megabytes(const uint64_t bytes) {
+	return (double)bytes / (1024 * 1024);
+}
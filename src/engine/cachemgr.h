@@ -0,0 +1,74 @@
+/**
+ * engine/cachemgr.h
+ * Keeps every in-memory cache under a single global memory budget.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _CACHEMGR_H
+#define _CACHEMGR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Defaults. The budget can be changed at build time for each deployment.
+#ifndef CACHEMGR_DEFAULT_BUDGET
+#define CACHEMGR_DEFAULT_BUDGET (128ULL * 1024 * 1024)
+#endif
+#define CACHEMGR_MAX_CACHES     16
+#define CACHEMGR_NAME_SIZE      24
+
+// Eviction policies.
+#define CACHEMGR_POLICY_LRU  0  // Least recently used entry goes first.
+#define CACHEMGR_POLICY_COST 1  // Cheapest entry to recreate per byte first.
+
+// Entry a cache is willing to give up next.
+typedef struct {
+	size_t   bytes;
+	uint64_t used;  // Tick of the last time it was used.
+	uint64_t cost;  // Microseconds it took to create.
+} cachemgr_victim_t;
+
+// Finds the entry that would be evicted next. Returns FALSE if there's none.
+typedef bool (*cachemgr_victim_func)(void *data, cachemgr_victim_t *victim);
+
+// Evicts the entry that was last offered as a victim.
+typedef void (*cachemgr_evict_func)(void *data);
+
+// Counters of a single cache.
+typedef struct {
+	char     name[CACHEMGR_NAME_SIZE];
+	size_t   bytes;
+	size_t   entries;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} cachemgr_stats_t;
+
+// Configuration.
+void cachemgr_set_budget(const uint64_t bytes);
+uint64_t cachemgr_get_budget();
+void cachemgr_set_policy(const uint8_t policy);
+
+// Registration.
+int cachemgr_register(const char *name, void *data,
+					  cachemgr_victim_func victim, cachemgr_evict_func evict);
+void cachemgr_unregister(const int id);
+
+// Reporting.
+void cachemgr_resize(const int id, const size_t bytes, const size_t entries);
+void cachemgr_hit(const int id);
+void cachemgr_miss(const int id);
+void cachemgr_evicted(const int id);
+uint64_t cachemgr_tick();
+uint64_t cachemgr_now_us();
+
+// Enforcing the budget.
+size_t cachemgr_trim();
+
+// Statistics.
+size_t cachemgr_get_stats(cachemgr_stats_t *stats, const size_t max);
+void cachemgr_print_stats();
+
+#endif
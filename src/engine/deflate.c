@@ -0,0 +1,809 @@
+/**
+ * engine/deflate.c
+ * Deflate compressor that works on independent pieces of a buffer, so they
+ * can be compressed in parallel and simply put one after the other.
+ *
+ * Every piece is compressed on its own, with the data right before it (up to
+ * the size of the window) used as history to find matches in, just like a
+ * single compressor going through the whole buffer would. Pieces end on a byte
+ * boundary with an empty stored block (a sync flush), unless they're the last
+ * one, which ends with the final block of the stream. Blocks use dynamic
+ * Huffman codes, or the fixed ones when those turn out smaller.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "deflate.h"
+
+// Match finding.
+#define DEFLATE_HASH_BITS   15
+#define DEFLATE_HASH_SIZE   (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MIN_MATCH   3
+#define DEFLATE_MAX_MATCH   258
+#define DEFLATE_LAZY_LIMIT  32   // Matches this long are taken right away.
+#define DEFLATE_GOOD_MATCH  8    // Pending matches this long cut the search.
+#define DEFLATE_FAST_CHAIN  4
+#define DEFLATE_CHAIN       64
+#define DEFLATE_FAST_NICE   32   // Matches this long end the search.
+#define DEFLATE_NICE        128
+
+// Huffman codes.
+#define DEFLATE_LITLEN_CODES 286
+#define DEFLATE_FIXED_CODES  288
+#define DEFLATE_DIST_CODES   30
+#define DEFLATE_CL_CODES     19
+#define DEFLATE_MAX_BITS     15
+#define DEFLATE_MAX_CL_BITS  7
+
+// Adler-32.
+#define DEFLATE_ADLER_BASE 65521
+#define DEFLATE_ADLER_NMAX 5552
+
+// Output bit stream.
+typedef struct {
+	uint8_t  *data;
+	size_t    len;
+	size_t    capacity;
+	uint64_t  bits;
+	uint8_t   count;
+} bit_stream_t;
+
+// Literals and matches waiting to be written as a block.
+typedef struct {
+	size_t   count;
+	uint16_t litlen[DEFLATE_BLOCK_TOKENS];  // Literal or match length.
+	uint16_t dist[DEFLATE_BLOCK_TOKENS];    // Match distance, 0 for literals.
+} token_block_t;
+
+// Hash chains of the positions seen so far.
+typedef struct {
+	const uint8_t *data;
+	size_t         base;  // First byte of the history.
+	size_t         end;
+	int32_t       *head;
+	int32_t       *prev;
+	uint16_t       max_chain;
+	uint16_t       nice_len;
+} matcher_t;
+
+// Match lengths and distances.
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+	67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5,
+	5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+	769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+	11, 11, 12, 12, 13, 13
+};
+
+// Order the code length code lengths are stored in.
+static const uint8_t code_length_order[DEFLATE_CL_CODES] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Symbol lookup tables, built on first use.
+static uint8_t length_code[DEFLATE_MAX_MATCH + 1];
+static uint8_t dist_code[512];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// Internal functions.
+void deflate_tables_build();
+uint8_t dist_symbol(const uint16_t dist);
+void bits_put(bit_stream_t *bs, const uint32_t value, const uint8_t count);
+void bits_align(bit_stream_t *bs);
+void matcher_insert(matcher_t *m, const size_t pos);
+size_t matcher_find(const matcher_t *m, const size_t pos, uint16_t *dist);
+void token_push(bit_stream_t *bs, token_block_t *block, const uint16_t litlen,
+				const uint16_t dist);
+void block_write(bit_stream_t *bs, const token_block_t *block,
+				 const bool final);
+void block_tokens(bit_stream_t *bs, const token_block_t *block,
+				  const uint8_t *llen, const uint16_t *lcode,
+				  const uint8_t *dlen, const uint16_t *dcode);
+size_t block_cost(const uint32_t *lfreq, const uint32_t *dfreq,
+				  const uint8_t *llen, const uint8_t *dlen);
+void huffman_lengths(const uint32_t *freq, const uint16_t count,
+					 const uint8_t limit, uint8_t *lengths);
+void huffman_codes(const uint8_t *lengths, const uint16_t count,
+				   uint16_t *codes);
+
+
+/**
+ * Compresses a piece of a buffer as a run of deflate blocks that can be put
+ * right after the ones of the piece before it.
+ *
+ * @param  data  Whole buffer. Data before the piece is used as history.
+ * @param  start First byte of the piece.
+ * @param  end   Byte after the last one of the piece.
+ * @param  level Compression level (DEFLATE_*).
+ * @param  last  This is the last piece of the stream.
+ * @param  len   Length of the compressed data.
+ * @return       Compressed data. Has to be freed by the caller.
+ */
+uint8_t* deflate_piece(const uint8_t *data, const size_t start,
+					   const size_t end, const uint8_t level, const bool last,
+					   size_t *len) {
+	bit_stream_t bs;
+	matcher_t m;
+	token_block_t *block = malloc(sizeof(token_block_t));
+	bool lazy = level != DEFLATE_FAST;
+
+	pthread_once(&tables_once, deflate_tables_build);
+
+	bs.capacity = ((end - start) / 2) + 64;
+	bs.data = malloc(bs.capacity);
+	bs.len = 0;
+	bs.bits = 0;
+	bs.count = 0;
+	block->count = 0;
+
+	// Set up the hash chains with the history before the piece.
+	m.data = data;
+	m.base = (start > DEFLATE_WINDOW) ? (start - DEFLATE_WINDOW) : 0;
+	m.end = end;
+	m.head = malloc(sizeof(int32_t) * DEFLATE_HASH_SIZE);
+	m.prev = malloc(sizeof(int32_t) * ((end - m.base) + 1));
+	uint16_t chain = lazy ? DEFLATE_CHAIN : DEFLATE_FAST_CHAIN;
+	m.nice_len = lazy ? DEFLATE_NICE : DEFLATE_FAST_NICE;
+	memset(m.head, 0xFF, sizeof(int32_t) * DEFLATE_HASH_SIZE);
+	for (size_t pos = m.base; pos < start; pos++) {
+		matcher_insert(&m, pos);
+	}
+
+	// Go through the piece, deferring each match by a byte in case a longer
+	// one starts there.
+	size_t pos = start;
+	size_t prev_len = 0;
+	uint16_t prev_dist = 0;
+	while (pos < end) {
+		uint16_t dist = 0;
+		m.max_chain = (prev_len >= DEFLATE_GOOD_MATCH) ?
+			(DEFLATE_CHAIN / 4) : chain;
+		size_t match = matcher_find(&m, pos, &dist);
+		matcher_insert(&m, pos);
+
+		if (prev_len > 0) {
+			if (match > prev_len) {
+				// The one starting here is better.
+				token_push(&bs, block, data[pos - 1], 0);
+				prev_len = match;
+				prev_dist = dist;
+				pos++;
+				continue;
+			}
+
+			token_push(&bs, block, (uint16_t)prev_len, prev_dist);
+			for (size_t i = pos + 1; i < (pos - 1 + prev_len); i++) {
+				matcher_insert(&m, i);
+			}
+			pos = pos - 1 + prev_len;
+			prev_len = 0;
+			continue;
+		}
+
+		if (match == 0) {
+			token_push(&bs, block, data[pos], 0);
+			pos++;
+		} else if (lazy && (match < DEFLATE_LAZY_LIMIT)) {
+			prev_len = match;
+			prev_dist = dist;
+			pos++;
+		} else {
+			token_push(&bs, block, (uint16_t)match, dist);
+			for (size_t i = pos + 1; i < (pos + match); i++) {
+				matcher_insert(&m, i);
+			}
+			pos += match;
+		}
+	}
+	if (prev_len > 0) {
+		token_push(&bs, block, (uint16_t)prev_len, prev_dist);
+	}
+
+	// Finish the stream or leave it on a byte boundary for the next piece.
+	if (last) {
+		block_write(&bs, block, true);
+		bits_align(&bs);
+	} else {
+		if (block->count > 0) {
+			block_write(&bs, block, false);
+		}
+
+		bits_put(&bs, 0, 3);
+		bits_align(&bs);
+		bits_put(&bs, 0x0000, 16);
+		bits_put(&bs, 0xFFFF, 16);
+	}
+
+	free(m.head);
+	free(m.prev);
+	free(block);
+
+	*len = bs.len;
+	return bs.data;
+}
+
+/**
+ * Updates a running Adler-32 checksum with some data.
+ *
+ * @param  adler Running checksum (1 to start a new one).
+ * @param  data  Data to be added.
+ * @param  len   Length of the data.
+ * @return       Updated checksum.
+ */
+uint32_t deflate_adler32(uint32_t adler, const uint8_t *data, size_t len) {
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+
+	while (len > 0) {
+		size_t n = (len > DEFLATE_ADLER_NMAX) ? DEFLATE_ADLER_NMAX : len;
+		len -= n;
+
+		while (n-- > 0) {
+			a += *data++;
+			b += a;
+		}
+
+		a %= DEFLATE_ADLER_BASE;
+		b %= DEFLATE_ADLER_BASE;
+	}
+
+	return (b << 16) | a;
+}
+
+/**
+ * Combines the Adler-32 checksums of two pieces of data into the one of both
+ * of them put together.
+ *
+ * @param  first      Checksum of the first piece.
+ * @param  second     Checksum of the second piece.
+ * @param  second_len Length of the second piece.
+ * @return            Checksum of both pieces.
+ */
+uint32_t deflate_adler32_combine(const uint32_t first, const uint32_t second,
+								 const size_t second_len) {
+	uint32_t rem = (uint32_t)(second_len % DEFLATE_ADLER_BASE);
+	uint32_t a = first & 0xFFFF;
+	uint32_t b = (uint32_t)(((uint64_t)rem * a) % DEFLATE_ADLER_BASE);
+
+	a += (second & 0xFFFF) + DEFLATE_ADLER_BASE - 1;
+	b += (first >> 16) + (second >> 16) + DEFLATE_ADLER_BASE - rem;
+	if (a >= DEFLATE_ADLER_BASE) {
+		a -= DEFLATE_ADLER_BASE;
+	}
+	if (a >= DEFLATE_ADLER_BASE) {
+		a -= DEFLATE_ADLER_BASE;
+	}
+	if (b >= (DEFLATE_ADLER_BASE << 1)) {
+		b -= DEFLATE_ADLER_BASE << 1;
+	}
+	if (b >= DEFLATE_ADLER_BASE) {
+		b -= DEFLATE_ADLER_BASE;
+	}
+
+	return (b << 16) | a;
+}
+
+/**
+ * Builds the lookup tables from match lengths and distances to their codes.
+ */
+void deflate_tables_build() {
+	for (uint8_t code = 0; code < 29; code++) {
+		for (uint16_t i = 0; i < (1 << length_extra[code]); i++) {
+			length_code[length_base[code] + i] = code;
+		}
+	}
+
+	for (uint8_t code = 0; code < DEFLATE_DIST_CODES; code++) {
+		for (uint32_t i = 0; i < (1u << dist_extra[code]); i++) {
+			uint32_t d = dist_base[code] + i - 1;
+			if (d < 256) {
+				dist_code[d] = code;
+			} else {
+				dist_code[256 + (d >> 7)] = code;
+			}
+		}
+	}
+}
+
+/**
+ * Gets the code of a match distance.
+ *
+ * @param  dist Match distance.
+ * @return      Distance code.
+ */
+uint8_t dist_symbol(const uint16_t dist) {
+	return (dist <= 256) ? dist_code[dist - 1] :
+		dist_code[256 + ((dist - 1) >> 7)];
+}
+
+/**
+ * Appends bits to the stream, least significant first.
+ *
+ * @param bs    Bit stream.
+ * @param value Bits to be appended.
+ * @param count Number of bits.
+ */
+void bits_put(bit_stream_t *bs, const uint32_t value, const uint8_t count) {
+	bs->bits |= (uint64_t)value << bs->count;
+	bs->count += count;
+
+	while (bs->count >= 8) {
+		if (bs->len == bs->capacity) {
+			bs->capacity *= 2;
+			bs->data = realloc(bs->data, bs->capacity);
+		}
+
+		bs->data[bs->len++] = (uint8_t)bs->bits;
+		bs->bits >>= 8;
+		bs->count -= 8;
+	}
+}
+
+/**
+ * Pads the stream with zeros up to the next byte boundary.
+ *
+ * @param bs Bit stream.
+ */
+void bits_align(bit_stream_t *bs) {
+	if (bs->count > 0) {
+		bits_put(bs, 0, 8 - bs->count);
+	}
+}
+
+/**
+ * Adds a position to the hash chains.
+ *
+ * @param m   Match finder.
+ * @param pos Position in the buffer.
+ */
+void matcher_insert(matcher_t *m, const size_t pos) {
+	if ((pos + DEFLATE_MIN_MATCH) > m->end) {
+		return;
+	}
+
+	const uint8_t *p = m->data + pos;
+	uint32_t hash = ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) &
+		(DEFLATE_HASH_SIZE - 1);
+
+	m->prev[pos - m->base] = m->head[hash];
+	m->head[hash] = (int32_t)(pos - m->base);
+}
+
+/**
+ * Finds the longest match for the data at a position.
+ *
+ * @param  m    Match finder.
+ * @param  pos  Position in the buffer.
+ * @param  dist How far back the match is.
+ * @return      Length of the match or 0 if there isn't one.
+ */
+size_t matcher_find(const matcher_t *m, const size_t pos, uint16_t *dist) {
+	if ((pos + DEFLATE_MIN_MATCH) > m->end) {
+		return 0;
+	}
+
+	const uint8_t *p = m->data + pos;
+	uint32_t hash = ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) &
+		(DEFLATE_HASH_SIZE - 1);
+	size_t max_len = m->end - pos;
+	max_len = (max_len > DEFLATE_MAX_MATCH) ? DEFLATE_MAX_MATCH : max_len;
+	size_t best = DEFLATE_MIN_MATCH - 1;
+	uint16_t chain = m->max_chain;
+
+	for (int32_t cand = m->head[hash]; (cand >= 0) && (chain > 0);
+			cand = m->prev[cand], chain--) {
+		const uint8_t *c = m->data + m->base + cand;
+		if ((size_t)(p - c) > DEFLATE_WINDOW) {
+			break;
+		}
+
+		// Quickly skip the ones that can't be any better.
+		if ((c[best] != p[best]) || (c[0] != p[0])) {
+			continue;
+		}
+
+		size_t len = 0;
+		while ((len < max_len) && (c[len] == p[len])) {
+			len++;
+		}
+
+		if (len > best) {
+			best = len;
+			*dist = (uint16_t)(p - c);
+			if ((len == max_len) || (len >= m->nice_len)) {
+				break;
+			}
+		}
+	}
+
+	return (best >= DEFLATE_MIN_MATCH) ? best : 0;
+}
+
+/**
+ * Adds a literal or a match to the block, writing it out if it's full.
+ *
+ * @param bs     Bit stream.
+ * @param block  Block being put together.
+ * @param litlen Literal byte or match length.
+ * @param dist   Match distance or 0 for literals.
+ */
+void token_push(bit_stream_t *bs, token_block_t *block, const uint16_t litlen,
+				const uint16_t dist) {
+	if (block->count == DEFLATE_BLOCK_TOKENS) {
+		block_write(bs, block, false);
+		block->count = 0;
+	}
+
+	block->litlen[block->count] = litlen;
+	block->dist[block->count] = dist;
+	block->count++;
+}
+
+/**
+ * Writes out a block with whichever Huffman codes make it smaller.
+ *
+ * @param bs    Bit stream.
+ * @param block Literals and matches of the block.
+ * @param final This is the last block of the stream.
+ */
+void block_write(bit_stream_t *bs, const token_block_t *block,
+				 const bool final) {
+	uint32_t lfreq[DEFLATE_FIXED_CODES] = { 0 };
+	uint32_t dfreq[DEFLATE_DIST_CODES] = { 0 };
+	uint8_t llen[DEFLATE_FIXED_CODES] = { 0 };
+	uint8_t dlen[DEFLATE_DIST_CODES] = { 0 };
+	uint16_t lcode[DEFLATE_FIXED_CODES];
+	uint16_t dcode[DEFLATE_DIST_CODES];
+
+	// Count the symbols.
+	for (size_t i = 0; i < block->count; i++) {
+		if (block->dist[i] == 0) {
+			lfreq[block->litlen[i]]++;
+		} else {
+			lfreq[257 + length_code[block->litlen[i]]]++;
+			dfreq[dist_symbol(block->dist[i])]++;
+		}
+	}
+	lfreq[256] = 1;
+
+	huffman_lengths(lfreq, DEFLATE_LITLEN_CODES, DEFLATE_MAX_BITS, llen);
+	huffman_lengths(dfreq, DEFLATE_DIST_CODES, DEFLATE_MAX_BITS, dlen);
+
+	// Run-length encode the code lengths of both codes.
+	uint16_t hlit = DEFLATE_LITLEN_CODES;
+	uint16_t hdist = DEFLATE_DIST_CODES;
+	while ((hlit > 257) && (llen[hlit - 1] == 0)) {
+		hlit--;
+	}
+	while ((hdist > 1) && (dlen[hdist - 1] == 0)) {
+		hdist--;
+	}
+
+	uint8_t lengths[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+	uint8_t rle_sym[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+	uint8_t rle_extra[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+	uint32_t clfreq[DEFLATE_CL_CODES] = { 0 };
+	size_t total = hlit + hdist;
+	size_t rle_count = 0;
+
+	memcpy(lengths, llen, hlit);
+	memcpy(lengths + hlit, dlen, hdist);
+	for (size_t i = 0; i < total; ) {
+		uint8_t value = lengths[i];
+		size_t run = 1;
+		while (((i + run) < total) && (lengths[i + run] == value)) {
+			run++;
+		}
+		i += run;
+
+		if (value == 0) {
+			while (run >= 11) {
+				size_t n = (run > 138) ? 138 : run;
+				rle_sym[rle_count] = 18;
+				rle_extra[rle_count++] = (uint8_t)(n - 11);
+				run -= n;
+			}
+			if (run >= 3) {
+				rle_sym[rle_count] = 17;
+				rle_extra[rle_count++] = (uint8_t)(run - 3);
+				run = 0;
+			}
+		} else {
+			rle_sym[rle_count] = value;
+			rle_extra[rle_count++] = 0;
+			run--;
+
+			while (run >= 3) {
+				size_t n = (run > 6) ? 6 : run;
+				rle_sym[rle_count] = 16;
+				rle_extra[rle_count++] = (uint8_t)(n - 3);
+				run -= n;
+			}
+		}
+
+		while (run-- > 0) {
+			rle_sym[rle_count] = value;
+			rle_extra[rle_count++] = 0;
+		}
+	}
+
+	for (size_t i = 0; i < rle_count; i++) {
+		clfreq[rle_sym[i]]++;
+	}
+
+	uint8_t cllen[DEFLATE_CL_CODES];
+	uint16_t clcode[DEFLATE_CL_CODES];
+	uint8_t hclen = DEFLATE_CL_CODES;
+	huffman_lengths(clfreq, DEFLATE_CL_CODES, DEFLATE_MAX_CL_BITS, cllen);
+	while ((hclen > 4) && (cllen[code_length_order[hclen - 1]] == 0)) {
+		hclen--;
+	}
+
+	// Check if the fixed codes would be smaller.
+	size_t dynamic_cost = 14 + (3 * hclen) +
+		block_cost(lfreq, dfreq, llen, dlen);
+	for (size_t i = 0; i < rle_count; i++) {
+		dynamic_cost += cllen[rle_sym[i]] + ((rle_sym[i] == 16) ? 2 :
+			(rle_sym[i] == 17) ? 3 : (rle_sym[i] == 18) ? 7 : 0);
+	}
+
+	uint8_t fixed_llen[DEFLATE_FIXED_CODES];
+	uint8_t fixed_dlen[DEFLATE_DIST_CODES];
+	for (uint16_t i = 0; i < DEFLATE_FIXED_CODES; i++) {
+		fixed_llen[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	memset(fixed_dlen, 5, DEFLATE_DIST_CODES);
+	size_t fixed_cost = block_cost(lfreq, dfreq, fixed_llen, fixed_dlen);
+
+	bits_put(bs, final ? 1 : 0, 1);
+	if (fixed_cost <= dynamic_cost) {
+		bits_put(bs, 1, 2);
+		huffman_codes(fixed_llen, DEFLATE_FIXED_CODES, lcode);
+		huffman_codes(fixed_dlen, DEFLATE_DIST_CODES, dcode);
+		block_tokens(bs, block, fixed_llen, lcode, fixed_dlen, dcode);
+		return;
+	}
+
+	// Dynamic codes header.
+	bits_put(bs, 2, 2);
+	bits_put(bs, hlit - 257, 5);
+	bits_put(bs, hdist - 1, 5);
+	bits_put(bs, hclen - 4, 4);
+	for (uint8_t i = 0; i < hclen; i++) {
+		bits_put(bs, cllen[code_length_order[i]], 3);
+	}
+
+	huffman_codes(cllen, DEFLATE_CL_CODES, clcode);
+	for (size_t i = 0; i < rle_count; i++) {
+		uint8_t sym = rle_sym[i];
+
+		bits_put(bs, clcode[sym], cllen[sym]);
+		if (sym == 16) {
+			bits_put(bs, rle_extra[i], 2);
+		} else if (sym == 17) {
+			bits_put(bs, rle_extra[i], 3);
+		} else if (sym == 18) {
+			bits_put(bs, rle_extra[i], 7);
+		}
+	}
+
+	huffman_codes(llen, DEFLATE_LITLEN_CODES, lcode);
+	huffman_codes(dlen, DEFLATE_DIST_CODES, dcode);
+	block_tokens(bs, block, llen, lcode, dlen, dcode);
+}
+
+/**
+ * Writes the literals and matches of a block, followed by its end.
+ *
+ * @param bs    Bit stream.
+ * @param block Literals and matches of the block.
+ * @param llen  Literal and length code lengths.
+ * @param lcode Literal and length codes.
+ * @param dlen  Distance code lengths.
+ * @param dcode Distance codes.
+ */
+void block_tokens(bit_stream_t *bs, const token_block_t *block,
+				  const uint8_t *llen, const uint16_t *lcode,
+				  const uint8_t *dlen, const uint16_t *dcode) {
+	for (size_t i = 0; i < block->count; i++) {
+		uint16_t litlen = block->litlen[i];
+		uint16_t dist = block->dist[i];
+
+		if (dist == 0) {
+			bits_put(bs, lcode[litlen], llen[litlen]);
+			continue;
+		}
+
+		uint8_t lc = length_code[litlen];
+		uint8_t dc = dist_symbol(dist);
+
+		bits_put(bs, lcode[257 + lc], llen[257 + lc]);
+		bits_put(bs, litlen - length_base[lc], length_extra[lc]);
+		bits_put(bs, dcode[dc], dlen[dc]);
+		bits_put(bs, dist - dist_base[dc], dist_extra[dc]);
+	}
+
+	bits_put(bs, lcode[256], llen[256]);
+}
+
+/**
+ * Calculates how many bits the symbols of a block take with some codes.
+ *
+ * @param  lfreq Literal and length code counts.
+ * @param  dfreq Distance code counts.
+ * @param  llen  Literal and length code lengths.
+ * @param  dlen  Distance code lengths.
+ * @return       Size of the block data in bits.
+ */
+size_t block_cost(const uint32_t *lfreq, const uint32_t *dfreq,
+				  const uint8_t *llen, const uint8_t *dlen) {
+	size_t bits = 0;
+
+	for (uint16_t i = 0; i < DEFLATE_LITLEN_CODES; i++) {
+		bits += (size_t)lfreq[i] * llen[i];
+		if (i > 256) {
+			bits += (size_t)lfreq[i] * length_extra[i - 257];
+		}
+	}
+
+	for (uint8_t i = 0; i < DEFLATE_DIST_CODES; i++) {
+		bits += (size_t)dfreq[i] * (dlen[i] + dist_extra[i]);
+	}
+
+	return bits;
+}
+
+/**
+ * Calculates the Huffman code lengths for a set of symbols, keeping them
+ * under a limit.
+ *
+ * @param freq    How many times each symbol is used.
+ * @param count   Number of symbols.
+ * @param limit   Longest code allowed.
+ * @param lengths Code length of each symbol (0 for unused ones).
+ */
+void huffman_lengths(const uint32_t *freq, const uint16_t count,
+					 const uint8_t limit, uint8_t *lengths) {
+	uint16_t syms[DEFLATE_FIXED_CODES];
+	uint32_t weight[DEFLATE_FIXED_CODES * 2];
+	uint16_t parent[DEFLATE_FIXED_CODES * 2];
+	uint16_t depth[DEFLATE_FIXED_CODES * 2];
+	uint16_t bl_count[DEFLATE_MAX_BITS + 1] = { 0 };
+	uint16_t n = 0;
+
+	memset(lengths, 0, count);
+	for (uint16_t i = 0; i < count; i++) {
+		if (freq[i] > 0) {
+			syms[n++] = i;
+		}
+	}
+
+	if (n == 0) {
+		return;
+	} else if (n == 1) {
+		lengths[syms[0]] = 1;
+		return;
+	}
+
+	// Sort the symbols from the least to the most used.
+	for (uint16_t i = 1; i < n; i++) {
+		uint16_t sym = syms[i];
+		uint16_t j = i;
+
+		while ((j > 0) && (freq[syms[j - 1]] > freq[sym])) {
+			syms[j] = syms[j - 1];
+			j--;
+		}
+		syms[j] = sym;
+	}
+
+	// Build the tree with a queue of leaves and one of inner nodes.
+	uint16_t leaf = 0;
+	uint16_t inner = n;
+	uint16_t next = n;
+	for (uint16_t i = 0; i < n; i++) {
+		weight[i] = freq[syms[i]];
+	}
+	while (next < ((2 * n) - 1)) {
+		uint16_t pick[2];
+
+		for (uint8_t k = 0; k < 2; k++) {
+			if ((leaf < n) && ((inner >= next) ||
+							   (weight[leaf] <= weight[inner]))) {
+				pick[k] = leaf++;
+			} else {
+				pick[k] = inner++;
+			}
+		}
+
+		weight[next] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = next;
+		parent[pick[1]] = next;
+		next++;
+	}
+
+	// Get the depth of the leaves, clamped to the limit.
+	depth[next - 1] = 0;
+	for (int32_t i = next - 2; i >= 0; i--) {
+		depth[i] = depth[parent[i]] + 1;
+	}
+	for (uint16_t i = 0; i < n; i++) {
+		bl_count[(depth[i] > limit) ? limit : depth[i]]++;
+	}
+
+	// Push leaves down until the code fits exactly again.
+	uint32_t total = 0;
+	for (uint8_t bits = limit; bits > 0; bits--) {
+		total += (uint32_t)bl_count[bits] << (limit - bits);
+	}
+	while (total != (1u << limit)) {
+		bl_count[limit]--;
+		for (uint8_t bits = limit - 1; bits > 0; bits--) {
+			if (bl_count[bits] > 0) {
+				bl_count[bits]--;
+				bl_count[bits + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	// The least used symbols get the longest codes.
+	uint16_t i = 0;
+	for (uint8_t bits = limit; bits > 0; bits--) {
+		for (uint16_t k = 0; k < bl_count[bits]; k++) {
+			lengths[syms[i++]] = bits;
+		}
+	}
+}
+
+/**
+ * Calculates the canonical Huffman codes from their lengths, with their bits
+ * reversed to be written out least significant first.
+ *
+ * @param lengths Code length of each symbol.
+ * @param count   Number of symbols.
+ * @param codes   Code of each symbol.
+ */
+void huffman_codes(const uint8_t *lengths, const uint16_t count,
+				   uint16_t *codes) {
+	uint16_t bl_count[DEFLATE_MAX_BITS + 1] = { 0 };
+	uint16_t next[DEFLATE_MAX_BITS + 1];
+	uint16_t code = 0;
+
+	for (uint16_t i = 0; i < count; i++) {
+		bl_count[lengths[i]]++;
+	}
+	bl_count[0] = 0;
+
+	for (uint8_t bits = 1; bits <= DEFLATE_MAX_BITS; bits++) {
+		code = (uint16_t)((code + bl_count[bits - 1]) << 1);
+		next[bits] = code;
+	}
+
+	for (uint16_t i = 0; i < count; i++) {
+		uint8_t len = lengths[i];
+		if (len == 0) {
+			codes[i] = 0;
+			continue;
+		}
+
+		uint16_t c = next[len]++;
+		uint16_t reversed = 0;
+		for (uint8_t b = 0; b < len; b++) {
+			reversed = (uint16_t)((reversed << 1) | ((c >> b) & 1));
+		}
+		codes[i] = reversed;
+	}
+}
@@ -0,0 +1,34 @@
+/**
+ * engine/deflate.h
+ * Deflate compressor that works on independent pieces of a buffer, so they
+ * can be compressed in parallel and simply put one after the other.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _DEFLATE_H
+#define _DEFLATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Compression levels.
+#define DEFLATE_FAST    0
+#define DEFLATE_DEFAULT 1
+
+// Limits.
+#define DEFLATE_WINDOW       32768  // How far back matches can reach.
+#define DEFLATE_BLOCK_TOKENS 16384  // Literals and matches per block.
+
+// Compressing.
+uint8_t* deflate_piece(const uint8_t *data, const size_t start,
+					   const size_t end, const uint8_t level, const bool last,
+					   size_t *len);
+
+// Checksums.
+uint32_t deflate_adler32(uint32_t adler, const uint8_t *data, size_t len);
+uint32_t deflate_adler32_combine(const uint32_t first, const uint32_t second,
+								 const size_t second_len);
+
+#endif
@@ -0,0 +1,523 @@
+/**
+ * engine/diagnostics.c
+ * Rate-limited and deduplicated diagnostic messages for the engine and its
+ * wrappers.
+ *
+ * Reporting a diagnostic never does any I/O. Messages go through a
+ * deduplication table and a per-second rate limiter before being queued into
+ * a lock-free ring buffer, which is later drained by whoever owns the main
+ * loop (or the embedding application) through diag_drain().
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include "diagnostics.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+// Ring buffer slot. The sequence number is stored minus the slot index, so
+// that a zeroed ring is already a valid empty ring.
+typedef struct {
+	size_t       seq;
+	diagnostic_t diag;
+} diag_slot_t;
+
+// Deduplication table entry.
+typedef struct {
+	uint64_t id;
+	uint64_t last_ms;
+	uint32_t suppressed;
+} diag_dedup_t;
+
+// Ring buffer.
+diag_slot_t diag_ring[DIAG_RING_SIZE];
+size_t diag_head = 0;
+size_t diag_tail = 0;
+bool diag_draining = false;
+
+// Deduplication and rate limiting.
+diag_dedup_t diag_dedup_table[DIAG_DEDUP_TABLE_SIZE];
+uint64_t diag_rate_window = 0;
+uint32_t diag_rate_count = 0;
+
+// Configuration.
+diag_callback_t diag_callback = NULL;
+void *diag_callback_data = NULL;
+uint8_t diag_min_severity = DIAG_INFO;
+uint32_t diag_rate_limit = DIAG_DEFAULT_RATE_LIMIT;
+uint32_t diag_dedup_ms = DIAG_DEFAULT_DEDUP_MS;
+
+// Counters.
+diag_stats_t diag_stats;
+
+// Internal functions.
+uint64_t diag_now_ms();
+uint64_t diag_hash(const uint16_t code, const long key, const char *format,
+				   va_list args);
+uint64_t diag_hash_bytes(uint64_t hash, const void *data, size_t len);
+bool diag_filter(const uint64_t id, uint32_t *repeated);
+bool diag_enqueue(const diagnostic_t *diag);
+void diag_deliver(const diagnostic_t *diag);
+void diag_print(const diagnostic_t *diag, void *data);
+
+
+/**
+ * Sets the function that will receive the drained diagnostics. By default they
+ * are printed to stderr.
+ *
+ * @param callback Function to be called for each diagnostic or NULL to use
+ *                 the default one.
+ * @param data     User data to be passed to the callback.
+ */
+void diag_set_callback(diag_callback_t callback, void *data) {
+	diag_callback = callback;
+	diag_callback_data = data;
+}
+
+/**
+ * Sets the minimum severity of the diagnostics that should be reported.
+ *
+ * @param severity Minimum severity level.
+ */
+void diag_set_min_severity(const uint8_t severity) {
+	diag_min_severity = severity;
+}
+
+/**
+ * Sets the maximum number of diagnostics that can be reported per second.
+ * Fatal diagnostics are never rate limited.
+ *
+ * @param per_second Maximum number of diagnostics per second.
+ */
+void diag_set_rate_limit(const uint32_t per_second) {
+	diag_rate_limit = per_second;
+}
+
+/**
+ * Sets for how long a repeated diagnostic is suppressed after it has been
+ * reported.
+ *
+ * @param ms Deduplication window in milliseconds.
+ */
+void diag_set_dedup_window(const uint32_t ms) {
+	diag_dedup_ms = ms;
+}
+
+/**
+ * Reports a diagnostic. This is safe to be called from hot paths and from
+ * multiple threads since it never does any I/O, except for fatal diagnostics
+ * which are delivered right away before the caller bails out.
+ *
+ * Diagnostics are considered duplicates if they share the same code, key,
+ * format and arguments, so the same call site reporting different things isn't
+ * merged. The message is only formatted once it has made it through the
+ * deduplication and the rate limiter.
+ *
+ * @param  severity Severity level.
+ * @param  code     Diagnostic code.
+ * @param  key      Code-specific key (layer number, line number, etc.).
+ * @param  format   printf-style format string.
+ * @return          TRUE if the diagnostic was queued or delivered.
+ */
+bool diag_report(const uint8_t severity, const uint16_t code, const long key,
+				 const char *format, ...) {
+	diagnostic_t diag;
+	uint32_t repeated = 0;
+	va_list args;
+
+	// Check if we should even care about this.
+	if (severity < diag_min_severity) {
+		return false;
+	}
+	__atomic_add_fetch(&diag_stats.reported, 1, __ATOMIC_RELAXED);
+
+	// Deduplicate and rate limit everything that isn't fatal.
+	if (severity < DIAG_FATAL) {
+		va_start(args, format);
+		uint64_t id = diag_hash(code, key, format, args);
+		va_end(args);
+
+		if (!diag_filter(id, &repeated)) {
+			return false;
+		}
+	}
+
+	// Build the diagnostic.
+	va_start(args, format);
+	vsnprintf(diag.message, DIAG_MESSAGE_MAX_SIZE, format, args);
+	va_end(args);
+	diag.severity = severity;
+	diag.code = code;
+	diag.key = key;
+	diag.repeated = repeated;
+
+	// Fatal diagnostics skip the queue since we're about to die.
+	if (severity == DIAG_FATAL) {
+		diag_drain();
+		diag_deliver(&diag);
+		return true;
+	}
+
+	return diag_enqueue(&diag);
+}
+
+/**
+ * Delivers all the queued diagnostics to the callback. This should be called
+ * outside of any hot path, like once per frame or after parsing a file. Only
+ * one thread drains the queue at a time.
+ *
+ * @return Number of diagnostics delivered.
+ */
+size_t diag_drain() {
+	size_t count = 0;
+
+	// Make sure we are the only ones draining.
+	if (__atomic_exchange_n(&diag_draining, true, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	while (true) {
+		size_t pos = diag_tail;
+		size_t index = pos & (DIAG_RING_SIZE - 1);
+		diag_slot_t *slot = &diag_ring[index];
+		size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) + index;
+
+		// Check if the slot has been published yet.
+		if (seq != (pos + 1)) {
+			break;
+		}
+
+		diag_deliver(&slot->diag);
+		count++;
+
+		// Release the slot for the next lap around the ring.
+		diag_tail = pos + 1;
+		__atomic_store_n(&slot->seq, (pos + DIAG_RING_SIZE) - index,
+						 __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&diag_draining, false, __ATOMIC_RELEASE);
+	return count;
+}
+
+/**
+ * Gets the diagnostic counters.
+ *
+ * @param stats Structure that will hold the counters.
+ */
+void diag_get_stats(diag_stats_t *stats) {
+	stats->reported = __atomic_load_n(&diag_stats.reported, __ATOMIC_RELAXED);
+	stats->suppressed = __atomic_load_n(&diag_stats.suppressed,
+										__ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&diag_stats.dropped, __ATOMIC_RELAXED);
+	stats->delivered = __atomic_load_n(&diag_stats.delivered,
+									   __ATOMIC_RELAXED);
+}
+
+/**
+ * Gets a human-readable name for a severity level.
+ *
+ * @param  severity Severity level.
+ * @return          Name of the severity level.
+ */
+const char* diag_severity_name(const uint8_t severity) {
+	switch (severity) {
+	case DIAG_DEBUG:
+		return "Debug";
+	case DIAG_INFO:
+		return "Info";
+	case DIAG_WARNING:
+		return "Warning";
+	case DIAG_ERROR:
+		return "Error";
+	case DIAG_FATAL:
+		return "Fatal";
+	}
+
+	return "Unknown";
+}
+
+/**
+ * Checks a diagnostic against the deduplication table and the rate limiter.
+ * Races between threads can only let an extra duplicate through.
+ *
+ * @param  id       Identity of the diagnostic from diag_hash().
+ * @param  repeated Number of duplicates suppressed since the last time this
+ *                  diagnostic went through.
+ * @return          TRUE if the diagnostic should be queued.
+ */
+bool diag_filter(const uint64_t id, uint32_t *repeated) {
+	uint64_t now = diag_now_ms();
+	diag_dedup_t *entry = &diag_dedup_table[id & (DIAG_DEDUP_TABLE_SIZE - 1)];
+
+	// Check if we've seen this one recently.
+	if (__atomic_load_n(&entry->id, __ATOMIC_ACQUIRE) == id) {
+		uint64_t last = __atomic_load_n(&entry->last_ms, __ATOMIC_RELAXED);
+
+		if ((now - last) < diag_dedup_ms) {
+			__atomic_add_fetch(&entry->suppressed, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&diag_stats.suppressed, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		*repeated = __atomic_exchange_n(&entry->suppressed, 0,
+										__ATOMIC_RELAXED);
+		__atomic_store_n(&entry->last_ms, now, __ATOMIC_RELAXED);
+	} else {
+		// Take over the table entry.
+		__atomic_store_n(&entry->suppressed, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->last_ms, now, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->id, id, __ATOMIC_RELEASE);
+	}
+
+	// Rate limit whatever made it through the deduplication.
+	uint64_t window = now / 1000;
+	if (__atomic_load_n(&diag_rate_window, __ATOMIC_RELAXED) != window) {
+		__atomic_store_n(&diag_rate_window, window, __ATOMIC_RELAXED);
+		__atomic_store_n(&diag_rate_count, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_fetch_add(&diag_rate_count, 1, __ATOMIC_RELAXED) >=
+			diag_rate_limit) {
+		__atomic_add_fetch(&diag_stats.dropped, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Puts a diagnostic into the ring buffer. Multiple threads can do this at the
+ * same time without any locks.
+ *
+ * @param  diag Diagnostic to be queued.
+ * @return      TRUE if there was space for it in the ring.
+ */
+bool diag_enqueue(const diagnostic_t *diag) {
+	size_t pos = __atomic_load_n(&diag_head, __ATOMIC_RELAXED);
+
+	while (true) {
+		size_t index = pos & (DIAG_RING_SIZE - 1);
+		diag_slot_t *slot = &diag_ring[index];
+		size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) + index;
+
+		if (seq == pos) {
+			// Slot is free, try to claim it.
+			if (__atomic_compare_exchange_n(&diag_head, &pos, pos + 1, true,
+											__ATOMIC_RELAXED,
+											__ATOMIC_RELAXED)) {
+				slot->diag = *diag;
+				__atomic_store_n(&slot->seq, (pos + 1) - index,
+								 __ATOMIC_RELEASE);
+				return true;
+			}
+		} else if (seq < pos) {
+			// The ring is full.
+			__atomic_add_fetch(&diag_stats.dropped, 1, __ATOMIC_RELAXED);
+			return false;
+		} else {
+			// Someone else got this slot first.
+			pos = __atomic_load_n(&diag_head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/**
+ * Delivers a diagnostic to the callback.
+ *
+ * @param diag Diagnostic to be delivered.
+ */
+void diag_deliver(const diagnostic_t *diag) {
+	if (diag_callback != NULL) {
+		diag_callback(diag, diag_callback_data);
+	} else {
+		diag_print(diag, NULL);
+	}
+
+	__atomic_add_fetch(&diag_stats.delivered, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Default diagnostic callback that prints everything to stderr.
+ *
+ * @param diag Diagnostic to be printed.
+ * @param data Unused.
+ */
+void diag_print(const diagnostic_t *diag, void *data) {
+	if (diag->repeated > 0) {
+		fprintf(stderr, "%s: %s (repeated %u more times)\n",
+				diag_severity_name(diag->severity), diag->message,
+				diag->repeated);
+	} else {
+		fprintf(stderr, "%s: %s\n", diag_severity_name(diag->severity),
+				diag->message);
+	}
+}
+
+/**
+ * Gets a monotonic timestamp.
+ *
+ * @return Milliseconds since some arbitrary point in time.
+ */
+uint64_t diag_now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+}
+
+/**
+ * Calculates the identity of a diagnostic for deduplication without having to
+ * format its message. The arguments are picked out of the list by going
+ * through the conversions in the format string, and strings are hashed by
+ * their contents (up to the size of a message) instead of their address.
+ *
+ * @param  code   Diagnostic code.
+ * @param  key    Code-specific key.
+ * @param  format printf-style format string.
+ * @param  args   Arguments of the format string.
+ * @return        Non-zero diagnostic identity.
+ */
+uint64_t diag_hash(const uint16_t code, const long key, const char *format,
+				   va_list args) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	hash = diag_hash_bytes(hash, &code, sizeof(code));
+	hash = diag_hash_bytes(hash, &key, sizeof(key));
+	hash = diag_hash_bytes(hash, &format, sizeof(format));
+
+	for (const char *c = strchr(format, '%'); c != NULL;
+			c = strchr(c + 1, '%')) {
+		uint8_t longs = 0;
+		bool size = false;
+		bool wide = false;
+		int precision = -1;
+
+		// Skip the flags and grab the width and precision if they are
+		// arguments.
+		c++;
+		while ((*c != '\0') && (strchr("-+ #0", *c) != NULL)) {
+			c++;
+		}
+		while ((*c >= '0') && (*c <= '9')) {
+			c++;
+		}
+		if (*c == '*') {
+			int width = va_arg(args, int);
+			hash = diag_hash_bytes(hash, &width, sizeof(width));
+			c++;
+		}
+		if (*c == '.') {
+			c++;
+			if (*c == '*') {
+				precision = va_arg(args, int);
+				hash = diag_hash_bytes(hash, &precision, sizeof(precision));
+				c++;
+			} else {
+				precision = 0;
+				while ((*c >= '0') && (*c <= '9')) {
+					precision = (precision * 10) + (*c - '0');
+					c++;
+				}
+			}
+		}
+
+		// Length modifiers.
+		while ((*c != '\0') && (strchr("hlLqjzt", *c) != NULL)) {
+			if (*c == 'l') {
+				longs++;
+			} else if (*c == 'j') {
+				longs = 2;
+			} else if ((*c == 'z') || (*c == 't')) {
+				size = true;
+			} else if ((*c == 'L') || (*c == 'q')) {
+				wide = true;
+			}
+			c++;
+		}
+
+		// Pull out the argument of the conversion.
+		switch (*c) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+		case 'c': {
+			uint64_t value;
+			if (size) {
+				value = (uint64_t)va_arg(args, size_t);
+			} else if (longs > 1) {
+				value = (uint64_t)va_arg(args, long long);
+			} else if (longs == 1) {
+				value = (uint64_t)va_arg(args, long);
+			} else {
+				value = (uint64_t)va_arg(args, int);
+			}
+			hash = diag_hash_bytes(hash, &value, sizeof(value));
+			break;
+		}
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A': {
+			double value;
+			if (wide) {
+				value = (double)va_arg(args, long double);
+			} else {
+				value = va_arg(args, double);
+			}
+			hash = diag_hash_bytes(hash, &value, sizeof(value));
+			break;
+		}
+		case 's': {
+			const char *str = va_arg(args, const char *);
+			size_t max = ((precision >= 0) &&
+						  (precision < DIAG_MESSAGE_MAX_SIZE)) ?
+				(size_t)precision : DIAG_MESSAGE_MAX_SIZE;
+			if (str != NULL) {
+				hash = diag_hash_bytes(hash, str, strnlen(str, max));
+			}
+			break;
+		}
+		case 'p':
+		case 'n': {
+			void *value = va_arg(args, void *);
+			hash = diag_hash_bytes(hash, &value, sizeof(value));
+			break;
+		}
+		case '\0':
+			c--;
+			break;
+		}
+	}
+	hash ^= hash >> 29;
+
+	return hash | 1;
+}
+
+/**
+ * Mixes some bytes into a FNV-1a hash.
+ *
+ * @param  hash Hash so far.
+ * @param  data Bytes to be mixed in.
+ * @param  len  Number of bytes.
+ * @return      Updated hash.
+ */
+uint64_t diag_hash_bytes(uint64_t hash, const void *data, size_t len) {
+	const uint8_t *bytes = (const uint8_t *)data;
+
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	return hash;
+}
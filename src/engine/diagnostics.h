@@ -0,0 +1,72 @@
+/**
+ * engine/diagnostics.h
+ * Rate-limited and deduplicated diagnostic messages for the engine and its
+ * wrappers.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _DIAGNOSTICS_H
+#define _DIAGNOSTICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Constant definitions.
+#define DIAG_MESSAGE_MAX_SIZE   160
+#define DIAG_RING_SIZE          256  // Must be a power of 2.
+#define DIAG_DEDUP_TABLE_SIZE   256  // Must be a power of 2.
+#define DIAG_DEFAULT_RATE_LIMIT 20   // Messages per second.
+#define DIAG_DEFAULT_DEDUP_MS   5000
+
+// Severity levels.
+#define DIAG_DEBUG   0
+#define DIAG_INFO    1
+#define DIAG_WARNING 2
+#define DIAG_ERROR   3
+#define DIAG_FATAL   4
+
+// Diagnostic codes.
+#define DIAG_CODE_GENERIC  0
+#define DIAG_CODE_PARSE    1
+#define DIAG_CODE_VARIABLE 2
+#define DIAG_CODE_LAYER    3
+#define DIAG_CODE_IO       4
+#define DIAG_CODE_RENDER   5
+
+// Diagnostic message structure.
+typedef struct {
+	uint8_t  severity;
+	uint16_t code;
+	long     key;
+	uint32_t repeated;
+	char     message[DIAG_MESSAGE_MAX_SIZE];
+} diagnostic_t;
+
+// Diagnostic counters.
+typedef struct {
+	uint64_t reported;
+	uint64_t suppressed;
+	uint64_t dropped;
+	uint64_t delivered;
+} diag_stats_t;
+
+// Callback that receives the diagnostics when they are drained.
+typedef void (*diag_callback_t)(const diagnostic_t *diag, void *data);
+
+// Configuration.
+void diag_set_callback(diag_callback_t callback, void *data);
+void diag_set_min_severity(const uint8_t severity);
+void diag_set_rate_limit(const uint32_t per_second);
+void diag_set_dedup_window(const uint32_t ms);
+
+// Reporting.
+bool diag_report(const uint8_t severity, const uint16_t code, const long key,
+				 const char *format, ...)
+	__attribute__((format(printf, 4, 5)));
+size_t diag_drain();
+void diag_get_stats(diag_stats_t *stats);
+const char* diag_severity_name(const uint8_t severity);
+
+#endif
@@ -0,0 +1,410 @@
+/**
+ * engine/doccache.c
+ * On-disk cache of parsed documents, keyed by a hash of their contents.
+ *
+ * Every document that gets parsed from a file is saved as a binary snapshot
+ * named after a 128-bit hash of the file contents and the engine version, so
+ * the next time the same file is parsed by the same engine it's simply read
+ * back instead. Only the lines before the first command that produces some
+ * output go into it, the rest of the file is always parsed. The folder is
+ * kept under a size budget by throwing away the snapshots that were used the
+ * longest time ago, with their modification time being bumped every time
+ * they're used. Snapshots are written to a temporary file first and renamed
+ * into place, so several processes can share a cache.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "nanocad.h"
+#include "diagnostics.h"
+#include "snapshot.h"
+#include "doccache.h"
+
+// Snapshot found in the cache folder.
+typedef struct {
+	char            name[DOCCACHE_KEY_SIZE + sizeof(DOCCACHE_EXTENSION)];
+	uint64_t        size;
+	struct timespec used;
+} doccache_entry_t;
+
+// Configuration.
+char doccache_dir[DOCCACHE_PATH_MAX - DOCCACHE_KEY_SIZE - 32];
+uint64_t doccache_max_bytes = DOCCACHE_DEFAULT_SIZE;
+bool doccache_on = false;
+
+// Counters.
+doccache_stats_t doccache_stats;
+
+// Internal functions.
+void doccache_evict(const char *keep);
+int doccache_compare_used(const void *a, const void *b);
+void doccache_hash(const uint8_t *data, const size_t len, uint64_t *h1,
+				   uint64_t *h2);
+uint64_t doccache_mix(uint64_t k);
+uint64_t doccache_read64(const uint8_t *p);
+uint64_t doccache_rotl(const uint64_t x, const uint8_t r);
+
+
+/**
+ * Turns on the cache.
+ *
+ * @param  dir       Folder to keep the snapshots in. Created if it doesn't
+ *                   exist yet.
+ * @param  max_bytes Most the snapshots in it can take up together.
+ * @return           TRUE if the cache is ready to be used.
+ */
+bool doccache_init(const char *dir, const uint64_t max_bytes) {
+	if (strlen(dir) >= sizeof(doccache_dir)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"The cache folder path is too long: %s", dir);
+		return false;
+	}
+
+	if ((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+					"Couldn't create the cache folder: %s", dir);
+		return false;
+	}
+
+	strcpy(doccache_dir, dir);
+	doccache_max_bytes = max_bytes;
+	doccache_on = true;
+
+	return true;
+}
+
+/**
+ * Turns off the cache.
+ */
+void doccache_disable() {
+	doccache_on = false;
+}
+
+/**
+ * Checks if the cache is turned on.
+ *
+ * @return TRUE if the cache should be used.
+ */
+bool doccache_enabled() {
+	return doccache_on;
+}
+
+/**
+ * Works out the key of a document, which changes along with its contents or
+ * the version of the engine or the snapshot format.
+ *
+ * @param data Contents of the document file.
+ * @param len  Length of the contents.
+ * @param key  Where to put the key.
+ */
+void doccache_key(const char *data, const size_t len,
+				  char key[DOCCACHE_KEY_SIZE]) {
+	const char *version = ENGINE_VERSION;
+	uint64_t h1 = SNAPSHOT_VERSION;
+	uint64_t h2 = SNAPSHOT_VERSION;
+
+	// Seed the hash of the contents with the versions.
+	doccache_hash((const uint8_t *)version, strlen(version), &h1, &h2);
+	doccache_hash((const uint8_t *)data, len, &h1, &h2);
+
+	snprintf(key, DOCCACHE_KEY_SIZE, "%016llx%016llx", (unsigned long long)h1,
+			 (unsigned long long)h2);
+}
+
+/**
+ * Looks for the snapshot of a document in the cache, marking it as just used
+ * if it's found.
+ *
+ * @param  key  Key of the document.
+ * @param  path Where to put the path of the snapshot.
+ * @return      TRUE if the snapshot is in the cache.
+ */
+bool doccache_lookup(const char *key, char path[DOCCACHE_PATH_MAX]) {
+	snprintf(path, DOCCACHE_PATH_MAX, "%s/%s%s", doccache_dir, key,
+			 DOCCACHE_EXTENSION);
+
+	if (utimensat(AT_FDCWD, path, NULL, 0) != 0) {
+		doccache_stats.misses++;
+		return false;
+	}
+
+	doccache_stats.hits++;
+	return true;
+}
+
+/**
+ * Saves the current document in the cache and makes room for it by evicting
+ * the snapshots that were used the longest time ago.
+ *
+ * @param  key Key of the document.
+ * @return     TRUE if the snapshot was saved.
+ */
+bool doccache_store(const char *key) {
+	char path[DOCCACHE_PATH_MAX];
+	char temp[DOCCACHE_PATH_MAX];
+
+	snprintf(path, DOCCACHE_PATH_MAX, "%s/%s%s", doccache_dir, key,
+			 DOCCACHE_EXTENSION);
+	snprintf(temp, DOCCACHE_PATH_MAX, "%s/%s.%ld.tmp", doccache_dir, key,
+			 (long)getpid());
+
+	if (!snapshot_write_file(temp, NULL)) {
+		unlink(temp);
+		return false;
+	}
+
+	if (rename(temp, path) != 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+					"Couldn't put the snapshot in the cache: %s", path);
+		unlink(temp);
+		return false;
+	}
+
+	doccache_stats.stores++;
+	doccache_evict(key);
+
+	return true;
+}
+
+/**
+ * Gets the cache counters.
+ *
+ * @param stats Where to put the counters.
+ */
+void doccache_get_stats(doccache_stats_t *stats) {
+	*stats = doccache_stats;
+}
+
+/**
+ * Prints how well the cache is doing, if it's turned on.
+ */
+void doccache_print_stats() {
+	doccache_stats_t stats;
+
+	if (!doccache_on) {
+		return;
+	}
+
+	doccache_get_stats(&stats);
+	printf("Document cache: %s - %llu hits, %llu misses, %llu stores, %llu "
+		   "evictions\n", doccache_dir, (unsigned long long)stats.hits,
+		   (unsigned long long)stats.misses, (unsigned long long)stats.stores,
+		   (unsigned long long)stats.evictions);
+}
+
+/**
+ * Evicts the snapshots that were used the longest time ago until everything
+ * fits in the budget.
+ *
+ * @param keep Key of the snapshot that was just stored, which only goes if
+ *             it's bigger than the whole budget.
+ */
+void doccache_evict(const char *keep) {
+	char path[sizeof(doccache_dir) + NAME_MAX + 2];
+	doccache_entry_t *entries;
+	struct dirent *ent;
+	struct stat st;
+	size_t count = 0;
+	size_t capacity = 64;
+	uint64_t total = 0;
+
+	DIR *dir = opendir(doccache_dir);
+	if (dir == NULL) {
+		return;
+	}
+
+	// Gather every snapshot in the folder.
+	entries = malloc(sizeof(doccache_entry_t) * capacity);
+	while ((ent = readdir(dir)) != NULL) {
+		size_t len = strlen(ent->d_name);
+		size_t ext = strlen(DOCCACHE_EXTENSION);
+
+		if ((len != (DOCCACHE_KEY_SIZE - 1 + ext)) ||
+				(strcmp(ent->d_name + len - ext, DOCCACHE_EXTENSION) != 0)) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", doccache_dir, ent->d_name);
+		if (stat(path, &st) != 0) {
+			continue;
+		}
+
+		if (count == capacity) {
+			capacity *= 2;
+			entries = realloc(entries, sizeof(doccache_entry_t) * capacity);
+		}
+
+		strcpy(entries[count].name, ent->d_name);
+		entries[count].size = (uint64_t)st.st_size;
+		entries[count].used = st.st_mtim;
+		total += entries[count].size;
+		count++;
+	}
+	closedir(dir);
+
+	// Throw away the oldest ones, leaving the new one for last.
+	qsort(entries, count, sizeof(doccache_entry_t), doccache_compare_used);
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; (i < count) && (total > doccache_max_bytes); i++) {
+			bool is_new = strncmp(entries[i].name, keep,
+								  DOCCACHE_KEY_SIZE - 1) == 0;
+			if ((entries[i].size == 0) || (is_new != (pass == 1))) {
+				continue;
+			}
+
+			snprintf(path, sizeof(path), "%s/%s", doccache_dir,
+					 entries[i].name);
+			if (unlink(path) == 0) {
+				doccache_stats.evictions++;
+			}
+
+			total -= entries[i].size;
+			entries[i].size = 0;
+		}
+	}
+
+	free(entries);
+}
+
+/**
+ * Orders cache entries from the one that was used the longest time ago.
+ *
+ * @param  a First entry.
+ * @param  b Second entry.
+ * @return   Negative if a was used before b, positive if after.
+ */
+int doccache_compare_used(const void *a, const void *b) {
+	const struct timespec *ta = &((const doccache_entry_t *)a)->used;
+	const struct timespec *tb = &((const doccache_entry_t *)b)->used;
+
+	if (ta->tv_sec != tb->tv_sec) {
+		return (ta->tv_sec < tb->tv_sec) ? -1 : 1;
+	} else if (ta->tv_nsec != tb->tv_nsec) {
+		return (ta->tv_nsec < tb->tv_nsec) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Adds some data to a running 128-bit hash, based on MurmurHash3.
+ *
+ * @param data Data to be hashed.
+ * @param len  Length of the data.
+ * @param h1   First half of the hash, also used as its seed.
+ * @param h2   Second half of the hash, also used as its seed.
+ */
+void doccache_hash(const uint8_t *data, const size_t len, uint64_t *h1,
+				   uint64_t *h2) {
+	const uint64_t c1 = 0x87C37B91114253D5ULL;
+	const uint64_t c2 = 0x4CF5AD432745937FULL;
+	uint64_t a = *h1;
+	uint64_t b = *h2;
+	size_t blocks = len / 16;
+
+	// Body, 16 bytes at a time.
+	for (size_t i = 0; i < blocks; i++) {
+		uint64_t k1 = doccache_read64(data + (i * 16));
+		uint64_t k2 = doccache_read64(data + (i * 16) + 8);
+
+		k1 *= c1;
+		k1 = doccache_rotl(k1, 31);
+		k1 *= c2;
+		a ^= k1;
+		a = doccache_rotl(a, 27);
+		a += b;
+		a = (a * 5) + 0x52DCE729;
+
+		k2 *= c2;
+		k2 = doccache_rotl(k2, 33);
+		k2 *= c1;
+		b ^= k2;
+		b = doccache_rotl(b, 31);
+		b += a;
+		b = (b * 5) + 0x38495AB5;
+	}
+
+	// Whatever is left.
+	const uint8_t *tail = data + (blocks * 16);
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	for (size_t i = len & 15; i > 0; i--) {
+		if (i > 8) {
+			k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+		} else {
+			k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+		}
+	}
+
+	k2 *= c2;
+	k2 = doccache_rotl(k2, 33);
+	k2 *= c1;
+	b ^= k2;
+	k1 *= c1;
+	k1 = doccache_rotl(k1, 31);
+	k1 *= c2;
+	a ^= k1;
+
+	// Finish it off.
+	a ^= (uint64_t)len;
+	b ^= (uint64_t)len;
+	a += b;
+	b += a;
+	a = doccache_mix(a);
+	b = doccache_mix(b);
+	a += b;
+	b += a;
+
+	*h1 = a;
+	*h2 = b;
+}
+
+/**
+ * Final mix of a half of the hash, so every bit affects every other one.
+ *
+ * @param  k Half of the hash.
+ * @return   Mixed half.
+ */
+uint64_t doccache_mix(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xFF51AFD7ED558CCDULL;
+	k ^= k >> 33;
+	k *= 0xC4CEB9FE1A85EC53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+/**
+ * Reads a 64-bit little-endian number from a place that may not be aligned.
+ *
+ * @param  p Where it's stored.
+ * @return   The number.
+ */
+uint64_t doccache_read64(const uint8_t *p) {
+	uint64_t value = 0;
+	for (uint8_t i = 0; i < 8; i++) {
+		value |= (uint64_t)p[i] << (i * 8);
+	}
+
+	return value;
+}
+
+/**
+ * Rotates a 64-bit number to the left.
+ *
+ * @param  x Number to be rotated.
+ * @param  r Number of bits to rotate it by.
+ * @return   Rotated number.
+ */
+uint64_t doccache_rotl(const uint64_t x, const uint8_t r) {
+	return (x << r) | (x >> (64 - r));
+}
@@ -0,0 +1,44 @@
+/**
+ * engine/doccache.h
+ * On-disk cache of parsed documents, keyed by a hash of their contents.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _DOCCACHE_H
+#define _DOCCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Defaults.
+#define DOCCACHE_DEFAULT_SIZE (256ULL * 1024 * 1024)
+#define DOCCACHE_KEY_SIZE     33  // 128-bit hash in hex.
+#define DOCCACHE_PATH_MAX     512
+#define DOCCACHE_EXTENSION    ".snap"
+
+// Cache counters.
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stores;
+	uint64_t evictions;
+} doccache_stats_t;
+
+// Configuration.
+bool doccache_init(const char *dir, const uint64_t max_bytes);
+void doccache_disable();
+bool doccache_enabled();
+
+// Caching.
+void doccache_key(const char *data, const size_t len,
+				  char key[DOCCACHE_KEY_SIZE]);
+bool doccache_lookup(const char *key, char path[DOCCACHE_PATH_MAX]);
+bool doccache_store(const char *key);
+
+// Statistics.
+void doccache_get_stats(doccache_stats_t *stats);
+void doccache_print_stats();
+
+#endif
@@ -0,0 +1,563 @@
+/**
+ * engine/export.c
+ * Streaming exporters for plotters and cutting tables (G-code and HPGL).
+ *
+ * Objects are written as they come out of the object store, in a single pass
+ * through the buffers of the writer, so exporting doesn't need any memory that
+ * grows with the drawing (unless the optimized path order is used).
+ *
+ * Big drawings are split into chunks of objects that get formatted in parallel
+ * into memory and are then stitched together in order. Only the first object
+ * of a chunk depends on where the previous one left the tool, so that one is
+ * left out and written while stitching, which keeps the output exactly the
+ * same as writing everything in a single pass.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "diagnostics.h"
+#include "pathorder.h"
+#include "threadpool.h"
+#include "export.h"
+
+// Number of objects fetched from the store at a time.
+#define EXPORT_SPAN_BLOCK 64
+
+// Output state of a plotter.
+typedef struct {
+	writer_t               *out;
+	const export_options_t *opts;
+	export_stats_t         *stats;
+
+	bool                    down;      // Pen is down (or cutting).
+	bool                    placed;    // Position is known.
+	coord_t                 pos;
+} plotter_t;
+
+// Chunk of objects formatted by a parallel task.
+typedef struct {
+	writer_t       out;
+	export_stats_t stats;
+	plotter_t      plot;
+	bool           empty;           // Nothing in it gets drawn.
+	object_span_t  first;           // Left out to be written while stitching.
+	bool           first_reversed;
+} export_chunk_t;
+
+// Everything the chunk formatting tasks need.
+typedef struct {
+	const export_options_t *opts;
+	const path_order_t     *order;  // NULL to go in the order of the store.
+	size_t                  parts;
+	size_t                  part;   // Part of the first chunk of the round.
+	export_chunk_t         *chunks;
+} export_job_t;
+
+// Internal functions.
+void plot_str(plotter_t *plot, const char *str);
+void plot_long(plotter_t *plot, const long value);
+void plot_xy(plotter_t *plot, const char *x, const char *y,
+			 const char *sep, const coord_t coord);
+void plot_begin(plotter_t *plot);
+void plot_end(plotter_t *plot);
+void plot_move(plotter_t *plot, const coord_t coord);
+void plot_line(plotter_t *plot, const coord_t coord);
+void plot_circle(plotter_t *plot, const coord_t center, const coord_t start,
+				 const bool reversed);
+void plot_object(plotter_t *plot, const coord_t *coord, const uint8_t count,
+				 const uint8_t type, const bool reversed);
+void plot_skip(plotter_t *plot, const coord_t *coord, const uint8_t count,
+			   const uint8_t type, const bool reversed);
+void export_chunked(plotter_t *plot, const path_order_t *order,
+					const size_t steps);
+void export_chunk_task(void *data, const size_t index);
+void export_chunk_object(export_chunk_t *chunk, const coord_t *coord,
+						 const uint8_t count, const uint8_t type,
+						 const bool reversed);
+
+
+/**
+ * Initializes the export settings with the defaults of a format.
+ *
+ * @param opts   Export settings.
+ * @param format Output format (EXPORT_*).
+ */
+void export_options_init(export_options_t *opts, const uint8_t format) {
+	opts->format = format;
+	nanocad_filter_init(&opts->filter);
+	opts->ordered = false;
+	opts->feed = EXPORT_DEFAULT_FEED;
+	opts->safe_z = EXPORT_DEFAULT_SAFE_Z;
+	opts->cut_z = EXPORT_DEFAULT_CUT_Z;
+	opts->pen = 1;
+}
+
+/**
+ * Exports the document to a file.
+ *
+ * @param  filename Path of the file to be written.
+ * @param  opts     Export settings.
+ * @param  stats    Export statistics or NULL if they aren't needed.
+ * @return          TRUE if the file was written.
+ */
+bool export_file(const char *filename, const export_options_t *opts,
+				 export_stats_t *stats) {
+	writer_t out;
+	if (!writer_open_file(&out, filename)) {
+		return false;
+	}
+
+	bool success = export_write(&out, opts, stats);
+	if (!writer_close(&out)) {
+		success = false;
+	}
+	if (stats != NULL) {
+		stats->bytes = out.stats.bytes;
+		stats->syscalls = out.stats.syscalls;
+	}
+
+	if (!success) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Couldn't write the export file: %s", filename);
+	}
+
+	return success;
+}
+
+/**
+ * Exports the document through a writer, which can be sending it to a file,
+ * a socket or keeping it in memory. The byte and write counts of the
+ * statistics are taken from the writer once everything was flushed.
+ *
+ * @param  out   Writer to send the output to.
+ * @param  opts  Export settings.
+ * @param  stats Export statistics or NULL if they aren't needed.
+ * @return       TRUE if everything was written.
+ */
+bool export_write(writer_t *out, const export_options_t *opts,
+				  export_stats_t *stats) {
+	export_stats_t dummy;
+	plotter_t plotter;
+	plotter_t *plot = &plotter;
+
+	plot->out = out;
+	plot->opts = opts;
+	plot->stats = (stats == NULL) ? &dummy : stats;
+	plot->down = false;
+	plot->placed = false;
+	memset(plot->stats, 0, sizeof(export_stats_t));
+
+	plot_begin(plot);
+	if (opts->ordered) {
+		// Go through the objects in the order that keeps the travel short.
+		path_order_t order;
+
+		pathorder_init(&order);
+		pathorder_build(&opts->filter, &order);
+		if ((threadpool_get_threads() > 1) &&
+				(order.count > EXPORT_CHUNK_SIZE)) {
+			export_chunked(plot, &order, order.count);
+		} else {
+			for (size_t i = 0; i < order.count; i++) {
+				object_t obj = nanocad_get_object(order.object[i]);
+				plot_object(plot, obj.coord, obj.coord_count, obj.type,
+							order.reversed[i]);
+			}
+		}
+		pathorder_free(&order);
+	} else if ((threadpool_get_threads() > 1) &&
+			   (nanocad_get_object_count() > EXPORT_CHUNK_SIZE)) {
+		export_chunked(plot, NULL, nanocad_get_object_count());
+	} else {
+		// Stream the objects straight out of the store.
+		object_iterator_t iter;
+		object_span_t spans[EXPORT_SPAN_BLOCK];
+		size_t count;
+
+		nanocad_object_iter_init(&iter, &opts->filter, 0, 1);
+		while ((count = nanocad_object_iter_next(&iter, spans,
+												 EXPORT_SPAN_BLOCK)) > 0) {
+			for (size_t i = 0; i < count; i++) {
+				plot_object(plot, spans[i].coord, spans[i].coord_count,
+							spans[i].type, false);
+			}
+		}
+	}
+	plot_end(plot);
+
+	bool success = writer_flush(out);
+	plot->stats->bytes = out->stats.bytes;
+	plot->stats->syscalls = out->stats.syscalls;
+
+	return success;
+}
+
+/**
+ * Appends a string to the output.
+ *
+ * @param plot Plotter.
+ * @param str  String to be appended.
+ */
+void plot_str(plotter_t *plot, const char *str) {
+	writer_str(plot->out, str);
+}
+
+/**
+ * Appends an integer to the output.
+ *
+ * @param plot  Plotter.
+ * @param value Number to be appended.
+ */
+void plot_long(plotter_t *plot, const long value) {
+	writer_long(plot->out, value);
+}
+
+/**
+ * Appends a pair of coordinates to the output, in the units of the format.
+ *
+ * @param plot  Plotter.
+ * @param x     Text to put before the X coordinate.
+ * @param y     Text to put between the X and Y coordinates.
+ * @param sep   Text to put after the Y coordinate.
+ * @param coord Coordinates.
+ */
+void plot_xy(plotter_t *plot, const char *x, const char *y,
+			 const char *sep, const coord_t coord) {
+	long scale = (plot->opts->format == EXPORT_HPGL) ? EXPORT_HPGL_UNITS : 1;
+
+	plot_str(plot, x);
+	plot_long(plot, coord.x * scale);
+	plot_str(plot, y);
+	plot_long(plot, coord.y * scale);
+	plot_str(plot, sep);
+}
+
+/**
+ * Writes the preamble of the output.
+ *
+ * @param plot Plotter.
+ */
+void plot_begin(plotter_t *plot) {
+	if (plot->opts->format == EXPORT_HPGL) {
+		plot_str(plot, "IN;SP");
+		plot_long(plot, plot->opts->pen);
+		plot_str(plot, ";\n");
+	} else {
+		plot_str(plot, "G21\nG90\nG0 Z");
+		plot_long(plot, plot->opts->safe_z);
+		plot_str(plot, "\n");
+	}
+}
+
+/**
+ * Lifts the tool and writes the end of the output.
+ *
+ * @param plot Plotter.
+ */
+void plot_end(plotter_t *plot) {
+	if (plot->opts->format == EXPORT_HPGL) {
+		plot_str(plot, "PU;SP0;\n");
+	} else {
+		if (plot->down) {
+			plot_str(plot, "G0 Z");
+			plot_long(plot, plot->opts->safe_z);
+			plot_str(plot, "\n");
+		}
+		plot_str(plot, "M2\n");
+	}
+
+	plot->down = false;
+}
+
+/**
+ * Moves the tool somewhere without drawing (or cutting) along the way.
+ *
+ * @param plot  Plotter.
+ * @param coord Where to move to.
+ */
+void plot_move(plotter_t *plot, const coord_t coord) {
+	if (plot->placed && !plot->down && (plot->pos.x == coord.x) &&
+			(plot->pos.y == coord.y)) {
+		return;
+	}
+
+	if (plot->opts->format == EXPORT_HPGL) {
+		plot_xy(plot, "PU", ",", ";\n", coord);
+	} else {
+		if (plot->down) {
+			plot_str(plot, "G0 Z");
+			plot_long(plot, plot->opts->safe_z);
+			plot_str(plot, "\n");
+		}
+		plot_xy(plot, "G0 X", " Y", "\n", coord);
+	}
+
+	if (plot->down) {
+		plot->stats->pen_lifts++;
+	}
+	plot->down = false;
+	plot->placed = true;
+	plot->pos = coord;
+}
+
+/**
+ * Draws (or cuts) a line from the current position.
+ *
+ * @param plot  Plotter.
+ * @param coord Where the line ends.
+ */
+void plot_line(plotter_t *plot, const coord_t coord) {
+	if (plot->opts->format == EXPORT_HPGL) {
+		plot_xy(plot, "PD", ",", ";\n", coord);
+	} else {
+		if (!plot->down) {
+			plot_str(plot, "G1 Z");
+			plot_long(plot, plot->opts->cut_z);
+			plot_str(plot, " F");
+			plot_long(plot, plot->opts->feed);
+			plot_str(plot, "\n");
+		}
+		plot_xy(plot, "G1 X", " Y", "\n", coord);
+	}
+
+	plot->down = true;
+	plot->pos = coord;
+}
+
+/**
+ * Draws (or cuts) a full circle.
+ *
+ * @param plot     Plotter.
+ * @param center   Center of the circle.
+ * @param start    Point on the circle where the tool starts and ends.
+ * @param reversed Go around it counter-clockwise.
+ */
+void plot_circle(plotter_t *plot, const coord_t center, const coord_t start,
+				 const bool reversed) {
+	if (plot->opts->format == EXPORT_HPGL) {
+		// HPGL draws circles around the pen position.
+		double dx = (double)(start.x - center.x);
+		double dy = (double)(start.y - center.y);
+
+		plot_move(plot, center);
+		plot_str(plot, "CI");
+		plot_long(plot, lround(sqrt((dx * dx) + (dy * dy)) *
+							   EXPORT_HPGL_UNITS));
+		plot_str(plot, ";\n");
+		return;
+	}
+
+	if (!plot->down || (plot->pos.x != start.x) ||
+			(plot->pos.y != start.y)) {
+		plot_move(plot, start);
+	}
+	if (!plot->down) {
+		plot_str(plot, "G1 Z");
+		plot_long(plot, plot->opts->cut_z);
+		plot_str(plot, " F");
+		plot_long(plot, plot->opts->feed);
+		plot_str(plot, "\n");
+		plot->down = true;
+	}
+
+	plot_xy(plot, reversed ? "G3 X" : "G2 X", " Y", "", start);
+	plot_str(plot, " I");
+	plot_long(plot, center.x - start.x);
+	plot_str(plot, " J");
+	plot_long(plot, center.y - start.y);
+	plot_str(plot, "\n");
+}
+
+/**
+ * Draws (or cuts) an object, only lifting the tool if it doesn't start where
+ * the last one ended.
+ *
+ * @param plot     Plotter.
+ * @param coord    Points of the object.
+ * @param count    Number of points.
+ * @param type     Object type.
+ * @param reversed Go through the points from the last to the first.
+ */
+void plot_object(plotter_t *plot, const coord_t *coord, const uint8_t count,
+				 const uint8_t type, const bool reversed) {
+	if (count < 2) {
+		return;
+	}
+
+	plot->stats->objects++;
+	if (type == TYPE_CIRCLE) {
+		plot_circle(plot, coord[0], coord[1], reversed);
+		return;
+	}
+
+	// Start from the right end of the object.
+	const coord_t *first = reversed ? &coord[count - 1] : &coord[0];
+	if (!plot->down || (plot->pos.x != first->x) ||
+			(plot->pos.y != first->y)) {
+		plot_move(plot, *first);
+	}
+
+	for (uint8_t i = 1; i < count; i++) {
+		plot_line(plot, reversed ? coord[count - 1 - i] : coord[i]);
+	}
+}
+
+/**
+ * Puts the tool where drawing an object would leave it, without writing
+ * anything.
+ *
+ * @param plot     Plotter.
+ * @param coord    Points of the object.
+ * @param count    Number of points.
+ * @param type     Object type.
+ * @param reversed Go through the points from the last to the first.
+ */
+void plot_skip(plotter_t *plot, const coord_t *coord, const uint8_t count,
+			   const uint8_t type, const bool reversed) {
+	plot->placed = true;
+	if (type == TYPE_CIRCLE) {
+		// HPGL circles are drawn from the center with the pen up.
+		plot->down = plot->opts->format != EXPORT_HPGL;
+		plot->pos = plot->down ? coord[1] : coord[0];
+		return;
+	}
+
+	plot->down = true;
+	plot->pos = reversed ? coord[0] : coord[count - 1];
+}
+
+/**
+ * Formats the objects in chunks spread across the thread pool, writing them
+ * out in order a round at a time so only a few chunks are kept in memory.
+ *
+ * @param plot  Plotter, after the preamble was written.
+ * @param order Drawing order or NULL to go in the order of the store.
+ * @param steps Number of steps in the drawing order or objects in the store.
+ */
+void export_chunked(plotter_t *plot, const path_order_t *order,
+					const size_t steps) {
+	export_job_t job;
+	size_t round = threadpool_get_threads() * 2;
+
+	job.opts = plot->opts;
+	job.order = order;
+	job.parts = (steps + EXPORT_CHUNK_SIZE - 1) / EXPORT_CHUNK_SIZE;
+	job.chunks = malloc(sizeof(export_chunk_t) * round);
+	for (size_t i = 0; i < round; i++) {
+		writer_init_memory(&job.chunks[i].out);
+	}
+
+	for (job.part = 0; job.part < job.parts; job.part += round) {
+		size_t count = job.parts - job.part;
+		count = (count > round) ? round : count;
+		threadpool_run(export_chunk_task, &job, count);
+
+		// Stitch the chunks together, each starting where the last one left.
+		for (size_t i = 0; i < count; i++) {
+			export_chunk_t *chunk = &job.chunks[i];
+			const char *data;
+			size_t len;
+
+			if (chunk->empty) {
+				continue;
+			}
+
+			plot_object(plot, chunk->first.coord, chunk->first.coord_count,
+						chunk->first.type, chunk->first_reversed);
+			data = writer_data(&chunk->out, &len);
+			writer_write(plot->out, data, len);
+
+			plot->stats->objects += chunk->stats.objects;
+			plot->stats->pen_lifts += chunk->stats.pen_lifts;
+			plot->down = chunk->plot.down;
+			plot->placed = chunk->plot.placed;
+			plot->pos = chunk->plot.pos;
+		}
+	}
+
+	for (size_t i = 0; i < round; i++) {
+		writer_close(&job.chunks[i].out);
+	}
+	free(job.chunks);
+}
+
+/**
+ * Formats a chunk of objects into memory.
+ *
+ * @param data  Export job.
+ * @param index Chunk in the current round.
+ */
+void export_chunk_task(void *data, const size_t index) {
+	export_job_t *job = (export_job_t *)data;
+	export_chunk_t *chunk = &job->chunks[index];
+	size_t part = job->part + index;
+
+	writer_rewind(&chunk->out);
+	memset(&chunk->stats, 0, sizeof(export_stats_t));
+	chunk->plot.out = &chunk->out;
+	chunk->plot.opts = job->opts;
+	chunk->plot.stats = &chunk->stats;
+	chunk->plot.down = false;
+	chunk->plot.placed = false;
+	chunk->empty = true;
+
+	if (job->order != NULL) {
+		// Split the drawing order the same way the iterator splits the store.
+		size_t steps = job->order->count;
+		size_t extra = steps % job->parts;
+		size_t start = (steps / job->parts) * part +
+			((part < extra) ? part : extra);
+		size_t end = start + (steps / job->parts) + ((part < extra) ? 1 : 0);
+
+		for (size_t i = start; i < end; i++) {
+			object_t obj = nanocad_get_object(job->order->object[i]);
+			export_chunk_object(chunk, obj.coord, obj.coord_count, obj.type,
+								job->order->reversed[i]);
+		}
+	} else {
+		object_iterator_t iter;
+		object_span_t spans[EXPORT_SPAN_BLOCK];
+		size_t count;
+
+		nanocad_object_iter_init(&iter, &job->opts->filter, part, job->parts);
+		while ((count = nanocad_object_iter_next(&iter, spans,
+												 EXPORT_SPAN_BLOCK)) > 0) {
+			for (size_t i = 0; i < count; i++) {
+				export_chunk_object(chunk, spans[i].coord,
+									spans[i].coord_count, spans[i].type, false);
+			}
+		}
+	}
+}
+
+/**
+ * Formats an object of a chunk. The first one that gets drawn is only
+ * remembered, since how it starts depends on the chunks before it.
+ *
+ * @param chunk    Chunk being formatted.
+ * @param coord    Points of the object.
+ * @param count    Number of points.
+ * @param type     Object type.
+ * @param reversed Go through the points from the last to the first.
+ */
+void export_chunk_object(export_chunk_t *chunk, const coord_t *coord,
+						 const uint8_t count, const uint8_t type,
+						 const bool reversed) {
+	if (count < 2) {
+		return;
+	}
+
+	if (chunk->empty) {
+		chunk->empty = false;
+		chunk->first.coord = coord;
+		chunk->first.coord_count = count;
+		chunk->first.type = type;
+		chunk->first_reversed = reversed;
+		plot_skip(&chunk->plot, coord, count, type, reversed);
+		return;
+	}
+
+	plot_object(&chunk->plot, coord, count, type, reversed);
+}
@@ -0,0 +1,57 @@
+/**
+ * engine/export.h
+ * Streaming exporters for plotters and cutting tables (G-code and HPGL).
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _EXPORT_H
+#define _EXPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "nanocad.h"
+#include "writer.h"
+
+// Export formats.
+#define EXPORT_GCODE 0
+#define EXPORT_HPGL  1
+
+// Defaults.
+#define EXPORT_DEFAULT_FEED   1000  // mm/min
+#define EXPORT_DEFAULT_SAFE_Z 5
+#define EXPORT_DEFAULT_CUT_Z  -1
+#define EXPORT_HPGL_UNITS     40    // Plotter units per millimeter.
+#define EXPORT_CHUNK_SIZE     16384 // Objects formatted by each parallel task.
+
+// Export settings.
+typedef struct {
+	uint8_t         format;
+	object_filter_t filter;
+	bool            ordered;  // Follow the optimized path order.
+	long            feed;     // G-code cutting feed rate.
+	long            safe_z;   // G-code height for moving around.
+	long            cut_z;    // G-code height for cutting.
+	uint8_t         pen;      // HPGL pen number.
+} export_options_t;
+
+// Statistics of an export.
+typedef struct {
+	size_t objects;
+	size_t pen_lifts;
+	size_t bytes;
+	size_t syscalls;  // Writes it took to send the output.
+} export_stats_t;
+
+// Settings.
+void export_options_init(export_options_t *opts, const uint8_t format);
+
+// Exporting.
+bool export_file(const char *filename, const export_options_t *opts,
+				 export_stats_t *stats);
+bool export_write(writer_t *out, const export_options_t *opts,
+				  export_stats_t *stats);
+
+#endif
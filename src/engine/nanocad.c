@@ -6,11 +6,26 @@
  */
 
 #include "nanocad.h"
+#include "diagnostics.h"
+#include "regions.h"
+#include "boolean.h"
+#include "offset.h"
+#include "pathorder.h"
+#include "export.h"
+#include "tiles.h"
+#include "png.h"
+#include "snapshot.h"
+#include "doccache.h"
+#include "numfmt.h"
+#include "threadpool.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 // Line parsing stage definitions.
 #define PARSING_START      0
@@ -28,18 +43,19 @@
 #define OPERATION_WIDTH  'w'
 #define OPERATION_HEIGHT 'h'
 
-// Variable type definitions.
-#define VARIABLE_FIXED  '$'
-#define VARIABLE_COORD  '@'
-#define VARIABLE_OBJECT '&'
+// Number of objects checked against the bounds in one go while iterating.
+#define ITER_BLOCK_SIZE 256
 
 // Stored structures.
 object_container    objects;
+bounds_column       bounds;
 variable_container  variables;
 history_container   history;
 layer_container     layers;
 dimension_container dimensions;
 variable_t          last_object;
+uint32_t            revision;
+damage_list         damage;
 
 // Command type definitions.
 #define VALID_OBJECTS_SIZE 3
@@ -55,6 +71,16 @@ char nosubstitute_commands[NOVARSUBS_COMMAND_SIZE][ARGUMENT_MAX_SIZE] = {
 	"inspect"
 };
 
+// Handler of a command. Returns FALSE if the command failed.
+typedef bool (*command_handler_t)(const int argc, char **argv);
+
+// Command that isn't an object.
+typedef struct {
+	char              name[COMMAND_MAX_SIZE];
+	command_handler_t handler;
+	bool              output;  // Produces something besides the document.
+} command_t;
+
 /**
  * Internal functions.
  */
@@ -64,15 +90,18 @@ void chomp(char *str);
 int is_obj_command(const char *command);
 bool is_no_substitute_command(const char *command);
 long to_base_unit(const char *str);
+double to_base_value(const char *str);
 uint8_t hex_to_dec(const char *hex);
 
 // History.
-void add_history_line(const char *line);
+void add_history_line(const char *line, const size_t len);
+void add_history_buffer(const char *data, const size_t len);
 
 // Variables.
 variable_t* get_variable(const char *name);
 void variable_strval(const char *name, const uint8_t coord_index,
 					 char strval[ARGUMENT_MAX_SIZE]);
+void coord_strval(const coord_t coord, char strval[ARGUMENT_MAX_SIZE]);
 void set_variable(const char *name, const char *value);
 int substitute_variables(const char *command, char arg[ARGUMENT_MAX_SIZE]);
 
@@ -83,9 +112,15 @@ void set_layer(const uint8_t num, const char *name, const char *color);
 
 // Parsing.
 void parse_rgb_color(const char *str, rgba_color_t *color);
-int parse_line(const char *line, char *command, char **arguments);
+int parse_line(const char *line, const size_t len, char *command,
+			   char **arguments);
 void parse_coordinates(coord_t *coord, const char *arg, const coord_t *base);
-bool parse_command(const char *line);
+bool parse_command(const char *line, const size_t len);
+const char* next_line(const char *line, const char *end, size_t *len);
+bool parse_buffer(const char *data, const size_t len,
+				  const unsigned int first_line);
+size_t document_prefix(const char *data, const size_t len,
+					   unsigned int *lines);
 bool parse_file(const char *filename);
 
 // Coordinates.
@@ -96,11 +131,80 @@ bool create_dimension(const int argc, char **argv, const bool is_offset);
 
 // Objects.
 void create_object(const int type, const int argc, char **argv);
+void append_object(const object_t obj);
 object_t get_object(const size_t i);
 
+// Bounding boxes.
+int32_t clamp_int32(const long value);
+void update_object_bounds(const size_t i);
+void add_damage(const coord_t min, const coord_t max, const bool text);
+void add_full_damage();
+size_t cull_boxes(const bounds_column *column, const size_t start,
+				  const size_t count, const coord_t min, const coord_t max,
+				  uint32_t *mask);
+
+// Iteration.
+bool filter_coords(const object_filter_t *filter, const coord_t *coord,
+				   const size_t count);
+bool filter_object(const object_filter_t *filter, const object_t *obj);
+
+// Analysis.
+bool find_regions(const int argc, char **argv);
+bool apply_boolean(const uint8_t op, const int argc, char **argv);
+bool apply_offset(const int argc, char **argv);
+void draw_regions(const region_set_t *set, const uint8_t layer);
+bool order_paths(const int argc, char **argv);
+
+// Snapshots.
+bool document_is_empty();
+bool load_snapshot(const char *filename);
+
+// Exporting.
+bool export_plot(const uint8_t format, const int argc, char **argv);
+bool export_tiles(const int argc, char **argv);
+bool export_snapshot(const int argc, char **argv);
+
 // Debug.
 bool inspect(char *thing);
 
+// Commands.
+const command_t* find_command(const char *command);
+bool is_output_line(const char *line, const size_t len);
+bool command_dimen(const int argc, char **argv);
+bool command_odimen(const int argc, char **argv);
+bool command_set(const int argc, char **argv);
+bool command_layer(const int argc, char **argv);
+bool command_list(const int argc, char **argv);
+bool command_inspect(const int argc, char **argv);
+bool command_union(const int argc, char **argv);
+bool command_intersect(const int argc, char **argv);
+bool command_subtract(const int argc, char **argv);
+bool command_gcode(const int argc, char **argv);
+bool command_hpgl(const int argc, char **argv);
+
+// Commands that aren't objects. The ones that print or write something
+// besides changing the document are marked as output, since that can't come
+// out of the document cache.
+#define COMMANDS_SIZE 16
+command_t commands[COMMANDS_SIZE] = {
+	{ "dimen",     command_dimen,     false },
+	{ "odimen",    command_odimen,    false },
+	{ "set",       command_set,       false },
+	{ "layer",     command_layer,     false },
+	{ "list",      command_list,      true  },
+	{ "inspect",   command_inspect,   true  },
+	{ "regions",   find_regions,      true  },
+	{ "union",     command_union,     true  },
+	{ "intersect", command_intersect, true  },
+	{ "subtract",  command_subtract,  true  },
+	{ "offset",    apply_offset,      true  },
+	{ "pathorder", order_paths,       true  },
+	{ "gcode",     command_gcode,     true  },
+	{ "hpgl",      command_hpgl,      true  },
+	{ "tiles",     export_tiles,      true  },
+	{ "snapshot",  export_snapshot,   true  }
+};
+
 
 /**
  * Initializes the engine.
@@ -108,10 +212,15 @@ bool inspect(char *thing);
 void nanocad_init() {
 	// Initialize the container counts.
 	objects.count = 0;
+	bounds.count = 0;
+	bounds.capacity = 0;
 	variables.count = 0;
 	history.count = 0;
 	layers.count = 0;
 	dimensions.count = 0;
+	revision = 0;
+	damage.full = true;
+	damage.count = 0;
 	
 	// Initialize last object.
 	last_object.type = '&';
@@ -152,9 +261,38 @@ void nanocad_destroy() {
 	// Free all of the containers.
 	free(variables.list);
 	free(objects.list);
+	free(bounds.min_x);
+	free(bounds.min_y);
+	free(bounds.max_x);
+	free(bounds.max_y);
 	free(history.lines);
 	free(layers.list);
 	free(dimensions.list);
+
+	// Stop the worker threads.
+	threadpool_shutdown();
+}
+
+/**
+ * Gets the document revision. It gets incremented every time the document is
+ * changed, so it can be used to check if anything derived from it is stale.
+ *
+ * @return Current document revision.
+ */
+uint32_t nanocad_get_revision() {
+	return revision;
+}
+
+/**
+ * Takes the list of areas that were changed since the last time it was taken
+ * and starts a new one.
+ *
+ * @param dmg Where to put the changed areas.
+ */
+void nanocad_take_damage(damage_list *dmg) {
+	*dmg = damage;
+	damage.full = false;
+	damage.count = 0;
 }
 
 /**
@@ -164,7 +302,19 @@ void nanocad_destroy() {
  * @return      TRUE if the parsing went fine.
  */
 bool nanocad_parse_command(const char *line) {
-	return parse_command(line);
+	return parse_command(line, strlen(line));
+}
+
+/**
+ * Parses a whole in-memory buffer of nanoCAD commands. The buffer doesn't need
+ * to be NULL terminated and may use any kind of line endings.
+ *
+ * @param  data Buffer containing the commands.
+ * @param  len  Length of the buffer in bytes.
+ * @return      TRUE if everything went OK.
+ */
+bool nanocad_parse_buffer(const char *data, size_t len) {
+	return parse_buffer(data, len, 1);
 }
 
 /**
@@ -177,6 +327,37 @@ bool nanocad_parse_file(const char *filename) {
 	return parse_file(filename);
 }
 
+/**
+ * Loads a binary snapshot into the engine. Snapshots can only be loaded into
+ * an empty document.
+ *
+ * @param  filename Path to the snapshot.
+ * @return          TRUE if the document was loaded.
+ */
+bool nanocad_load_snapshot(const char *filename) {
+	return load_snapshot(filename);
+}
+
+/**
+ * Gets a variable by its name, including the last object one as "^".
+ *
+ * @param  name Variable name without its type prefix.
+ * @return      Variable pointer or NULL if it wasn't found.
+ */
+variable_t* nanocad_get_variable(const char *name) {
+	return get_variable(name);
+}
+
+/**
+ * Retrieves the internal variable container for external use. It doesn't
+ * include the last object variable.
+ *
+ * @param container Pointer to the internal variable container.
+ */
+void nanocad_get_variable_container(variable_container *container) {
+	*container = variables;
+}
+
 /**
  * Gets a layer object based on its layer number.
  * 
@@ -206,6 +387,46 @@ void nanocad_get_object_container(object_container *container) {
 	*container = objects;
 }
 
+/**
+ * Gets the number of objects in the document.
+ *
+ * @return Number of objects.
+ */
+size_t nanocad_get_object_count() {
+	return objects.count;
+}
+
+/**
+ * Retrieves the internal object bounding box column for external use. Index i
+ * of each array is the bounding box of object i.
+ *
+ * @param column Pointer to the internal bounds column.
+ */
+void nanocad_get_bounds_column(bounds_column *column) {
+	*column = bounds;
+}
+
+/**
+ * Tests a range of object bounding boxes against a query rectangle.
+ *
+ * @param  min   Bottom-left corner of the query rectangle.
+ * @param  max   Top-right corner of the query rectangle.
+ * @param  start Index of the first object to be tested.
+ * @param  count Number of objects to be tested.
+ * @param  mask  Visibility bitmask with at least (count + 31) / 32 words. Bit
+ *               i is set if object (start + i) touches the query rectangle.
+ * @return       Number of objects that touch the query rectangle.
+ */
+size_t nanocad_cull_bounds(const coord_t min, const coord_t max,
+						   const size_t start, const size_t count,
+						   uint32_t *mask) {
+	if (start + count > bounds.count) {
+		return 0;
+	}
+
+	return cull_boxes(&bounds, start, count, min, max, mask);
+}
+
 /**
  * Retrieves the internal dimension container for external use.
  * 
@@ -215,6 +436,181 @@ void nanocad_get_dimension_container(dimension_container *container) {
 	*container = dimensions;
 }
 
+/**
+ * Retrieves the internal layer container for external use.
+ *
+ * @param container Pointer to the internal layer container.
+ */
+void nanocad_get_layer_container(layer_container *container) {
+	*container = layers;
+}
+
+/**
+ * Initializes a filter that matches everything.
+ *
+ * @param filter Filter to be initialized.
+ */
+void nanocad_filter_init(object_filter_t *filter) {
+	filter->type = FILTER_ANY_TYPE;
+	filter->layer_num = FILTER_ANY_LAYER;
+	filter->use_bounds = false;
+	filter->min.x = 0;
+	filter->min.y = 0;
+	filter->max.x = 0;
+	filter->max.y = 0;
+}
+
+/**
+ * Initializes an object iterator over a part of the object list. Splitting the
+ * list into parts allows several threads to iterate over the document at the
+ * same time, each with its own iterator, as long as the document isn't being
+ * modified meanwhile.
+ *
+ * @param iter   Iterator to be initialized.
+ * @param filter Filter to be applied or NULL to match every object.
+ * @param part   Which part of the object list to iterate over (0-based).
+ * @param parts  Number of parts to split the object list into.
+ */
+void nanocad_object_iter_init(object_iterator_t *iter,
+							  const object_filter_t *filter,
+							  const size_t part, const size_t parts) {
+	// Set the filter.
+	if (filter == NULL) {
+		nanocad_filter_init(&iter->filter);
+	} else {
+		iter->filter = *filter;
+	}
+
+	// Calculate the range of this part.
+	if ((parts == 0) || (part >= parts)) {
+		iter->pos = objects.count;
+		iter->end = objects.count;
+		return;
+	}
+
+	iter->pos = (objects.count / parts) * part +
+		((part < (objects.count % parts)) ? part : (objects.count % parts));
+	iter->end = iter->pos + (objects.count / parts) +
+		((part < (objects.count % parts)) ? 1 : 0);
+}
+
+/**
+ * Gets the next chunk of objects that match the iterator's filter.
+ *
+ * @param  iter  Iterator to be advanced.
+ * @param  spans Array that will be populated with the matching objects.
+ * @param  max   Maximum number of spans to be returned.
+ * @return       Number of spans populated. 0 means the iteration has ended.
+ */
+size_t nanocad_object_iter_next(object_iterator_t *iter, object_span_t *spans,
+								const size_t max) {
+	uint32_t mask[ITER_BLOCK_SIZE / 32];
+	size_t count = 0;
+
+	while ((iter->pos < iter->end) && (count < max)) {
+		// Work in blocks that never overflow the spans array.
+		size_t block = iter->end - iter->pos;
+		block = (block > (max - count)) ? (max - count) : block;
+		block = (block > ITER_BLOCK_SIZE) ? ITER_BLOCK_SIZE : block;
+
+		// Cull the whole block against the filter bounds in one go.
+		if (iter->filter.use_bounds) {
+			cull_boxes(&bounds, iter->pos, block, iter->filter.min,
+					   iter->filter.max, mask);
+		} else {
+			memset(mask, 0xFF, sizeof(mask));
+		}
+
+		for (size_t i = 0; i < block; i++) {
+			const object_t *obj = &objects.list[iter->pos + i];
+
+			// Populate the span if the object matches our filter.
+			if ((mask[i / 32] & (1u << (i % 32))) &&
+					filter_object(&iter->filter, obj)) {
+				spans[count].index = iter->pos + i;
+				spans[count].type = obj->type;
+				spans[count].layer_num = obj->layer_num;
+				spans[count].coord_count = obj->coord_count;
+				spans[count].coord = obj->coord;
+				count++;
+			}
+		}
+
+		iter->pos += block;
+	}
+
+	return count;
+}
+
+/**
+ * Calls a visitor function for every object that matches a filter.
+ *
+ * @param  filter  Filter to be applied or NULL to match every object.
+ * @param  visitor Function to be called for each object.
+ * @param  data    User data to be passed to the visitor.
+ * @return         Number of objects visited.
+ */
+size_t nanocad_visit_objects(const object_filter_t *filter,
+							 object_visitor_t visitor, void *data) {
+	object_iterator_t iter;
+	object_span_t spans[64];
+	size_t visited = 0;
+	size_t count;
+
+	nanocad_object_iter_init(&iter, filter, 0, 1);
+	while ((count = nanocad_object_iter_next(&iter, spans, 64)) > 0) {
+		for (size_t i = 0; i < count; i++) {
+			visited++;
+
+			if (!visitor(&spans[i], data)) {
+				return visited;
+			}
+		}
+	}
+
+	return visited;
+}
+
+/**
+ * Calls a visitor function for every dimension that matches a filter. The
+ * object type part of the filter is ignored.
+ *
+ * @param  filter  Filter to be applied or NULL to match every dimension.
+ * @param  visitor Function to be called for each dimension.
+ * @param  data    User data to be passed to the visitor.
+ * @return         Number of dimensions visited.
+ */
+size_t nanocad_visit_dimensions(const object_filter_t *filter,
+								dimension_visitor_t visitor, void *data) {
+	size_t visited = 0;
+
+	for (size_t i = 0; i < dimensions.count; i++) {
+		const dimension_t *dimen = &dimensions.list[i];
+
+		if (filter != NULL) {
+			// Check the layer.
+			if ((filter->layer_num != FILTER_ANY_LAYER) &&
+					(filter->layer_num != dimen->layer_num)) {
+				continue;
+			}
+
+			// Check the bounds.
+			coord_t coord[4] = { dimen->start, dimen->end, dimen->line_start,
+								 dimen->line_end };
+			if (!filter_coords(filter, coord, 4)) {
+				continue;
+			}
+		}
+
+		visited++;
+		if (!visitor(dimen, i, data)) {
+			break;
+		}
+	}
+
+	return visited;
+}
+
 /**
  * Prints some debug information about a variable or layer.
  * Warning: This function alters the contents of "*thing".
@@ -238,8 +634,8 @@ void set_layer(const uint8_t num, const char *name, const char *color) {
 	
 	// Check if the user is trying to mess with the 0 layer.
 	if ((num == 0) && (layers.count > 0)) {
-		printf("Can't alter any parameters of the 0 layer. The 0 layer is "
-			   "read-only.\n");
+		diag_report(DIAG_FATAL, DIAG_CODE_LAYER, 0, "Can't alter any "
+					"parameters of the 0 layer. The 0 layer is read-only.");
 		exit(EXIT_FAILURE);
 	}
 	
@@ -253,6 +649,8 @@ void set_layer(const uint8_t num, const char *name, const char *color) {
 	// Dynamically add the new layer to the array.
 	layers.list = realloc(layers.list, sizeof(layer_t) * (layers.count + 1));
 	layers.list[layers.count++] = layer;
+	add_full_damage();
+	revision++;
 	
 #ifdef DEBUG
 	print_layer_info(*get_layer(num));
@@ -351,8 +749,9 @@ void set_variable(const char *name, const char *value) {
 		// Ignore find if it is the last object variable.
 		if (old_var->name[0] != '^') {
 			// TODO: Check if already exists, if so, override.
-			printf("Variable '%s' already exists. Can't set a new value\n", name);
-			printf("This will be implemented in the future.\n");
+			diag_report(DIAG_FATAL, DIAG_CODE_VARIABLE, 0, "Variable '%s' "
+						"already exists. Can't set a new value. This will be "
+						"implemented in the future.", name);
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -382,13 +781,14 @@ void set_variable(const char *name, const char *value) {
 				var.value = &objects.list[obj_index];
 			}
 		} else {
-			printf("Couldn't parse object index when assigning object to "
-				   "variable.\n");
+			diag_report(DIAG_FATAL, DIAG_CODE_VARIABLE, 0, "Couldn't parse "
+						"object index when assigning object to variable.");
 			exit(EXIT_FAILURE);
 		}
 		break;
 	default:
-		printf("Invalid variable type '%c' in %s\n", var.type, var.name);
+		diag_report(DIAG_FATAL, DIAG_CODE_VARIABLE, var.type,
+					"Invalid variable type '%c' in %s", var.type, var.name);
 		exit(EXIT_FAILURE);
 	}
 
@@ -435,6 +835,30 @@ variable_t* get_variable(const char *name) {
 	return NULL;
 }
 
+/**
+ * Gets the string representation of a coordinate in a command.
+ *
+ * @param coord  Coordinate.
+ * @param strval String representation of the coordinate.
+ */
+void coord_strval(const coord_t coord, char strval[ARGUMENT_MAX_SIZE]) {
+	char str[(NUMFMT_MAX_SIZE * 2) + 4];
+	size_t len = 0;
+
+	str[len++] = 'x';
+	len += numfmt_long(str + len, coord.x);
+	str[len++] = ';';
+	str[len++] = 'y';
+	len += numfmt_long(str + len, coord.y);
+
+	// Truncate it just like snprintf would.
+	if (len >= ARGUMENT_MAX_SIZE) {
+		len = ARGUMENT_MAX_SIZE - 1;
+	}
+	memcpy(strval, str, len);
+	strval[len] = '\0';
+}
+
 /**
  * Gets a string representation of the variable value to be substituted into
  * a command.
@@ -448,39 +872,43 @@ void variable_strval(const char *name, const uint8_t coord_index,
 	// Check if there is any variable with this name.
 	variable_t *var = get_variable(name);
 	if (var == NULL) {
-		printf("Variable '%s' not found\n", name);
+		diag_report(DIAG_FATAL, DIAG_CODE_VARIABLE, 0,
+					"Variable '%s' not found", name);
 		exit(EXIT_FAILURE);
 	}
 
 	// Output the correct string depending on the variable type.
 	switch (var->type) {
 	case VARIABLE_FIXED:
-		// Fixed Value
-		snprintf(strval, ARGUMENT_MAX_SIZE, "%f", *((double*)var->value));
+		// Fixed Value (commands can't take exponents, so tiny ones are 0)
+		if (fabs(*((double*)var->value)) < NUMFMT_MIN_FIXED) {
+			strcpy(strval, "0");
+		} else {
+			numfmt_double(strval, *((double*)var->value));
+		}
 		break;
 	case VARIABLE_COORD:
 		// Coordinate
-		snprintf(strval, ARGUMENT_MAX_SIZE, "x%ld;y%ld",
-				 ((coord_t*)var->value)->x, ((coord_t*)var->value)->y);
+		coord_strval(*((coord_t*)var->value), strval);
 		break;
 	case VARIABLE_OBJECT:
 		// Object
 		if (coord_index < ((object_t*)var->value)->coord_count) {
 			// Requested coordinate found.
-			snprintf(strval, ARGUMENT_MAX_SIZE, "x%ld;y%ld",
-					 ((object_t*)var->value)->coord[coord_index].x,
-					 ((object_t*)var->value)->coord[coord_index].y);
+			coord_strval(((object_t*)var->value)->coord[coord_index], strval);
 		} else {
 			// Wrong coordinate index.
-			printf("Variable '&%s[%d]' index is greater than the maximum "
-				   "allowed for this type of object: %d\n", name, coord_index,
-				   ((object_t*)var->value)->coord_count);
+			diag_report(DIAG_FATAL, DIAG_CODE_VARIABLE, coord_index,
+						"Variable '&%s[%d]' index is greater than the maximum "
+						"allowed for this type of object: %d", name,
+						coord_index, ((object_t*)var->value)->coord_count);
 			exit(EXIT_FAILURE);
 		}
 		break;
 	default:
-		printf("Invalid variable type '%c' in variable '%s'\n",
-			   var->type, var->name);
+		diag_report(DIAG_FATAL, DIAG_CODE_VARIABLE, var->type,
+					"Invalid variable type '%c' in variable '%s'", var->type,
+					var->name);
 		exit(EXIT_FAILURE);
 	}
 }
@@ -558,7 +986,8 @@ void calc_coordinate(const char oper, const coord_t base, coord_t *coord) {
 		coord->y += base.y;
 		break;
 	default:
-		printf("Invalid coordinate operation: %c.\n", oper);
+		diag_report(DIAG_FATAL, DIAG_CODE_PARSE, oper,
+					"Invalid coordinate operation: %c.", oper);
 		exit(EXIT_FAILURE);
 	}
 }
@@ -603,7 +1032,8 @@ void parse_coordinates(coord_t *coord, const char *arg, const coord_t *base) {
 					stage = PARSING_HEIGHT;
 				}
 			} else {
-				printf("Unknown first coordinate letter: %c.\n", c);
+				diag_report(DIAG_FATAL, DIAG_CODE_PARSE, c,
+							"Unknown first coordinate letter: %c.", c);
 				exit(EXIT_FAILURE);
 			}
 			break;
@@ -621,7 +1051,8 @@ void parse_coordinates(coord_t *coord, const char *arg, const coord_t *base) {
 				cur_pos = 0;
 				stage = PARSING_COORDY;
 			} else {
-				printf("Unknown next argument start for coordinate: %c.\n", c);
+				diag_report(DIAG_FATAL, DIAG_CODE_PARSE, c, "Unknown next "
+							"argument start for coordinate: %c.", c);
 				exit(EXIT_FAILURE);
 			}
 			break;
@@ -804,7 +1235,8 @@ bool create_dimension(const int argc, char **argv, const bool is_offset) {
 			dimen.line_end.x = dimen.end.x - (offset * delta.y);
 			dimen.line_end.y = dimen.end.y;
 		} else {
-			printf("Unknown dimension offset direction: '%s'\n", argv[2]);
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, 0,
+						"Unknown dimension offset direction: '%s'", argv[2]);
 			return false;
 		}
 	} else {
@@ -817,10 +1249,45 @@ bool create_dimension(const int argc, char **argv, const bool is_offset) {
 	dimensions.list = realloc(dimensions.list,
 							  sizeof(dimension_t) * (dimensions.count + 1));
 	dimensions.list[dimensions.count++] = dimen;
+	revision++;
+
+	// Mark the area covered by every point of the dimension as changed.
+	coord_t dmin = dimen.start;
+	coord_t dmax = dimen.start;
+	const coord_t points[3] = { dimen.end, dimen.line_start, dimen.line_end };
+	for (uint8_t i = 0; i < 3; i++) {
+		dmin.x = (points[i].x < dmin.x) ? points[i].x : dmin.x;
+		dmin.y = (points[i].y < dmin.y) ? points[i].y : dmin.y;
+		dmax.x = (points[i].x > dmax.x) ? points[i].x : dmax.x;
+		dmax.y = (points[i].y > dmax.y) ? points[i].y : dmax.y;
+	}
+	add_damage(dmin, dmax, true);
 
 	return true;
 }
 
+/**
+ * Appends an object to the object array and marks its area as changed.
+ *
+ * @param obj Object to be appended. Its coordinates are now owned by the
+ *            object array.
+ */
+void append_object(const object_t obj) {
+	objects.list = realloc(objects.list,
+						   sizeof(object_t) * (objects.count + 1));
+	objects.list[objects.count++] = obj;
+	update_object_bounds(objects.count - 1);
+	revision++;
+
+	// Mark the area covered by the new object as changed.
+	if (obj.coord_count > 0) {
+		const size_t i = objects.count - 1;
+		coord_t omin = { bounds.min_x[i], bounds.min_y[i] };
+		coord_t omax = { bounds.max_x[i], bounds.max_y[i] };
+		add_damage(omin, omax, false);
+	}
+}
+
 /**
  * Creates a object in the object array.
  *
@@ -833,6 +1300,8 @@ void create_object(const int type, const int argc, char **argv) {
 	object_t obj;
 	obj.type = (uint8_t)type;
 	obj.layer_num = 0;
+	obj.coord_count = 0;
+	obj.coord = NULL;
 	
 	// Allocate the correct amount of memory for each type of object.
 	switch (type) {
@@ -845,10 +1314,8 @@ void create_object(const int type, const int argc, char **argv) {
 	}
 
 	// Dynamically add the new object to the array.
-	objects.list = realloc(objects.list,
-						   sizeof(object_t) * (objects.count + 1));
-	objects.list[objects.count++] = obj;
-	
+	append_object(obj);
+
 	// Pass the object index as a string to the variable setting function.
 	char str_idx[VARIABLE_MAX_SIZE];
 	snprintf(str_idx, VARIABLE_MAX_SIZE, "%lu", objects.count - 1);
@@ -934,8 +1401,9 @@ int substitute_variables(const char *command, char arg[ARGUMENT_MAX_SIZE]) {
 					end = char_count + 1;
 					break;
 				} else {
-					printf("Variable '%s' index ending not found. Instead got "
-						   "a '%c'.\n", var_name, c);
+					diag_report(DIAG_FATAL, DIAG_CODE_VARIABLE, c,
+								"Variable '%s' index ending not found. "
+								"Instead got a '%c'.", var_name, c);
 					exit(EXIT_FAILURE);
 				}
 			} else {
@@ -1016,7 +1484,8 @@ bool inspect(char *thing) {
 		variable_t *var = get_variable(thing);
 		
 		if (var == NULL) {
-			printf("Variable '%c%s' not found.\n", type, thing);
+			diag_report(DIAG_ERROR, DIAG_CODE_VARIABLE, 0,
+						"Variable '%c%s' not found.", type, thing);
 			return false;
 		} else {
 			print_variable_info(*var);
@@ -1027,14 +1496,16 @@ bool inspect(char *thing) {
 		layer_t *layer = get_layer(layer_num);
 		
 		if (layer == NULL) {
-			printf("Layer '%d' not found.\n", layer_num);
+			diag_report(DIAG_ERROR, DIAG_CODE_LAYER, layer_num,
+						"Layer '%d' not found.", layer_num);
 			return false;
 		} else {
 			print_layer_info(*layer);
 		}
 	} else {
 		// Invalid
-		printf("Invalid type of thing to inspect: '%c'.\n", type);
+		diag_report(DIAG_ERROR, DIAG_CODE_PARSE, type,
+					"Invalid type of thing to inspect: '%c'.", type);
 		return false;
 	}
 	
@@ -1042,160 +1513,608 @@ bool inspect(char *thing) {
 }
 
 /**
- * Parses a command and executes it.
+ * Finds the closed regions formed by the lines and prints them.
  *
- * @param  line A command line without the newline character at the end.
- * @return      TRUE if the parsing went fine.
+ * @param  argc Number of arguments.
+ * @param  argv Optional layer (l<num>) and snapping distance (s<dist>).
+ * @return      TRUE if the regions were found.
  */
-bool parse_command(const char *line) {
-	int argc;
-	char command[COMMAND_MAX_SIZE];
-	char *argv[ARGUMENT_ARRAY_MAX_SIZE];
+bool find_regions(const int argc, char **argv) {
+	object_filter_t filter;
+	region_set_t set;
+	long snap = 0;
+
+	// Parse the modifier arguments.
+	nanocad_filter_init(&filter);
+	filter.type = TYPE_LINE;
+	for (int i = 0; i < argc; i++) {
+		if (argv[i][0] == 'l') {
+			filter.layer_num = parse_layer_num(argv[i]);
+		} else if (argv[i][0] == 's') {
+			snap = to_base_unit(argv[i] + 1);
+		} else {
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i,
+						"Invalid regions argument '%s'.", argv[i]);
+			return false;
+		}
+	}
 
-	// Ignoring empty lines and comments.
-	if ((line[0] == '\0') || (line[0] == '#')) {
-		add_history_line(line);
-		return true;
+	regions_init(&set);
+	if (!regions_find(&filter, snap, &set)) {
+		return false;
 	}
 
-	// Parse the line.
-	if ((argc = parse_line(line, command, argv)) >= 0) {
-#ifdef DEBUG
-		printf("Command: %s - Arg. Count: %d\n", command, argc);
-		for (int i = 0; i < argc; i++) {
-			printf("Argument %d: %s\n", i, argv[i]);
+	printf("Regions: %zu (%zu segments, %zu intersections, %zu dangling "
+		   "edges)\n", set.count, set.segment_count, set.intersection_count,
+		   set.pruned_count);
+	for (size_t i = 0; i < set.count; i++) {
+		const region_t *region = &set.list[i];
+		const coord_t *start = &set.points[set.rings[region->outer].start];
+
+		printf("    Region %zu: x%ld;y%ld - Area: %.1f - Corners: %zu - "
+			   "Holes: %zu\n", i, start->x, start->y, region->area,
+			   set.rings[region->outer].count, region->hole_count);
+	}
+
+	regions_free(&set);
+	return true;
+}
+
+/**
+ * Applies a boolean operation between the closed outlines of two layers and
+ * draws the resulting outlines in another layer.
+ *
+ * @param  op   Operation to apply (BOOLEAN_*).
+ * @param  argc Number of arguments.
+ * @param  argv Layers of both operands and the result (l<num>), and an
+ *              optional snapping distance (s<dist>).
+ * @return      TRUE if the operation was successful.
+ */
+bool apply_boolean(const uint8_t op, const int argc, char **argv) {
+	object_filter_t filters[2];
+	region_set_t set;
+	uint8_t layer_count = 0;
+	uint8_t dest = 0;
+	long snap = 0;
+
+	// Parse the arguments.
+	for (int i = 0; i < argc; i++) {
+		if ((argv[i][0] == 'l') && (layer_count < 2)) {
+			nanocad_filter_init(&filters[layer_count]);
+			filters[layer_count].type = TYPE_LINE;
+			filters[layer_count].layer_num = parse_layer_num(argv[i]);
+			layer_count++;
+		} else if ((argv[i][0] == 'l') && (layer_count == 2)) {
+			dest = parse_layer_num(argv[i]);
+			layer_count++;
+		} else if (argv[i][0] == 's') {
+			snap = to_base_unit(argv[i] + 1);
+		} else {
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i,
+						"Invalid boolean operation argument '%s'.", argv[i]);
+			return false;
 		}
-#endif
-		// Check which type of command this is.
-		int type = -1;
-		if ((type = is_obj_command(command)) > 0) {
-			// Command will generate a object.
-			create_object(type, argc, argv);
-#ifdef DEBUG
-			print_object_info(objects.list[objects.count - 1]);
-#endif
-		} else if (strcmp("dimen", command) == 0) {
-			// Dimension command.
-			if (!create_dimension(argc, argv, false)) {
-				return false;
-			}
-		} else if (strcmp("odimen", command) == 0) {
-			// Offset dimension command.
-			if (!create_dimension(argc, argv, true)) {
+	}
+
+	if (layer_count != 3) {
+		diag_report(DIAG_ERROR, DIAG_CODE_PARSE, layer_count,
+					"Boolean operations need two layers to operate on and "
+					"one for the result.");
+		return false;
+	}
+
+	regions_init(&set);
+	if (!boolean_apply(op, &filters[0], &filters[1], snap, &set)) {
+		return false;
+	}
+
+	draw_regions(&set, dest);
+	regions_free(&set);
+
+	return true;
+}
+
+/**
+ * Offsets the closed outlines and open paths of a layer and draws the result
+ * in another layer.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Layers of the lines and the result (l<num>), the offset
+ *              distance, and optionally the join type (j<type>) and a snapping
+ *              distance (s<dist>).
+ * @return      TRUE if the offsetting was successful.
+ */
+bool apply_offset(const int argc, char **argv) {
+	object_filter_t filter;
+	region_set_t set;
+	uint8_t layer_count = 0;
+	uint8_t dest = 0;
+	uint8_t join = OFFSET_JOIN_MITRE;
+	long distance = 0;
+	bool has_distance = false;
+	long snap = 0;
+
+	// Parse the arguments.
+	nanocad_filter_init(&filter);
+	filter.type = TYPE_LINE;
+	for (int i = 0; i < argc; i++) {
+		if ((argv[i][0] == 'l') && (layer_count == 0)) {
+			filter.layer_num = parse_layer_num(argv[i]);
+			layer_count++;
+		} else if ((argv[i][0] == 'l') && (layer_count == 1)) {
+			dest = parse_layer_num(argv[i]);
+			layer_count++;
+		} else if (argv[i][0] == 'j') {
+			if (strcmp(argv[i] + 1, "mitre") == 0) {
+				join = OFFSET_JOIN_MITRE;
+			} else if (strcmp(argv[i] + 1, "round") == 0) {
+				join = OFFSET_JOIN_ROUND;
+			} else if (strcmp(argv[i] + 1, "square") == 0) {
+				join = OFFSET_JOIN_SQUARE;
+			} else {
+				diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i,
+							"Invalid offset join type '%s'.", argv[i] + 1);
 				return false;
 			}
-		} else if (strcmp("set", command) == 0) {
-			// Command will set a variable.
-			set_variable(argv[0], argv[1]);
-#ifdef DEBUG
-			print_variable_info(variables.list[variables.count - 1]);
-#endif
-		} else if (strcmp("layer", command) == 0) {
-			// Set layer attributes command.
-			set_layer((uint8_t)strtoul(argv[0], NULL, 10), argv[1], argv[2]);
-		} else if (strcmp("list", command) == 0) {
-			// List lines command.
-			print_line_history();
-		} else if (strcmp("inspect", command) == 0) {
-			// Inspect command.
-			if (!inspect(argv[0])) {
+		} else if (argv[i][0] == 's') {
+			snap = to_base_unit(argv[i] + 1);
+		} else if (!has_distance && ((isdigit(argv[i][0]) ||
+									  (argv[i][0] == '-') ||
+									  (argv[i][0] == '+') ||
+									  (argv[i][0] == '.')))) {
+			// The drawing can't hold anything finer than the base unit, so
+			// don't let a kerf get silently rounded away.
+			double value = to_base_value(argv[i]);
+			distance = lround(value);
+			if ((distance == 0) || (fabs(value - distance) > 1e-6)) {
+				diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i, "Offset distance "
+							"'%s' isn't a non-zero whole number of "
+							"millimeters, which is the resolution of the "
+							"drawing.", argv[i]);
 				return false;
 			}
+			has_distance = true;
 		} else {
-			// Not a known command.
-			printf("Unknown command '%s'.\n", command);
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i,
+						"Invalid offset argument '%s'.", argv[i]);
 			return false;
 		}
-		
-		// Cleaning up the arguments.
-		for (uint8_t i = 0; i < argc; i++) {
-			free(argv[i]);
-		}
+	}
 
-		// Add line to the history and return.
-		add_history_line(line);
-		return true;
+	if ((layer_count != 2) || !has_distance) {
+		diag_report(DIAG_ERROR, DIAG_CODE_PARSE, layer_count,
+					"Offsetting needs the layer to offset, a distance and a "
+					"layer for the result.");
+		return false;
 	}
 
-	return false;
+	regions_init(&set);
+	if (!offset_apply(&filter, distance, join, snap, &set)) {
+		return false;
+	}
+
+	draw_regions(&set, dest);
+	regions_free(&set);
+
+	return true;
 }
 
 /**
- * Converts a raw string to a long in the base unit.
+ * Draws the outlines of a set of regions as lines and prints a summary.
  *
- * @param  str Raw string in a coordinate form.
- * @return     Number in the base unit.
+ * @param set   Regions to be drawn.
+ * @param layer Layer where the lines will be drawn in.
  */
-long to_base_unit(const char *str) {
-	long num = 0;
-	char unit[3];
-	char strnum[ARGUMENT_MAX_SIZE];
-	uint8_t stage = PARSING_NUMBER;
-	uint8_t cur_pos = 0;
-	unit[0] = '\0';
-
-	// Iterate over the coordinate string until we hit the NULL terminator.
-	while (*str != '\0') {
-		// Get the current character.
-		char c = *str++;
-
-		switch (stage) {
-		case PARSING_NUMBER:
-			if (((c >= 0x30) && (c <= 0x39)) || 
-				((c >= 0x2B) && (c <= 0x2E))) {
-				// Character is a number.
-				strnum[cur_pos++] = c;
-				strnum[cur_pos] = '\0';
-			} else if ((c >= 0x61) && (c <= 0x7A)) {
-				// Character is a letter.
-				cur_pos = 0;
-				stage = PARSING_UNIT;
-				unit[cur_pos++] = c;
-				unit[cur_pos] = '\0';
-			} else {
-				// Invalid character.
-				printf("Invalid character found while trying to parse a "
-					   "number: %c.\n", c);
-				exit(EXIT_FAILURE);
-			}
-			break;
-		case PARSING_UNIT:
-			if ((c >= 0x61) && (c <= 0x7A)) {
-				// Character is a letter.
-				unit[cur_pos++] = c;
-				unit[cur_pos] = '\0';
-			} else {
-				// Invalid character.
-				printf("Invalid character found while trying to parse a "
-					   "unit: %c.\n", c);
-				exit(EXIT_FAILURE);
-			}
-			break;
+void draw_regions(const region_set_t *set, const uint8_t layer) {
+	double area = 0;
+
+	for (size_t r = 0; r < set->ring_count; r++) {
+		const region_ring_t *ring = &set->rings[r];
+
+		for (size_t i = 0; i < ring->count; i++) {
+			object_t obj;
+			obj.type = TYPE_LINE;
+			obj.layer_num = layer;
+			obj.coord_count = 2;
+			obj.coord = (coord_t *)malloc(sizeof(coord_t) * 2);
+			obj.coord[0] = set->points[ring->start + i];
+			obj.coord[1] = set->points[ring->start + ((i + 1) % ring->count)];
+
+			append_object(obj);
 		}
 	}
 
-	// Parse number from string and convert it.
+	for (size_t i = 0; i < set->count; i++) {
+		area += set->list[i].area;
+	}
+	printf("Result: %zu regions, %zu holes, %zu outline points - Area: "
+		   "%.1f\n", set->count, set->hole_count, set->point_count, area);
+}
+
+/**
+ * Finds a drawing order that keeps the pen travel short and prints how much
+ * it saves.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Optional layer (l<num>).
+ * @return      TRUE if the order was found.
+ */
+bool order_paths(const int argc, char **argv) {
+	object_filter_t filter;
+	path_order_t order;
+
+	// Parse the modifier arguments.
+	nanocad_filter_init(&filter);
+	for (int i = 0; i < argc; i++) {
+		if (argv[i][0] == 'l') {
+			filter.layer_num = parse_layer_num(argv[i]);
+		} else {
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i,
+						"Invalid path order argument '%s'.", argv[i]);
+			return false;
+		}
+	}
+
+	pathorder_init(&order);
+	if (!pathorder_build(&filter, &order)) {
+		return false;
+	}
+
+	printf("Path order: %zu objects in %zu chains - Travel: %.1f before, "
+		   "%.1f after (%.1f after nearest neighbour)\n", order.count,
+		   order.chain_count, order.travel_before, order.travel_after,
+		   order.travel_nearest);
+
+	pathorder_free(&order);
+	return true;
+}
+
+/**
+ * Exports the document for a plotter or cutting table.
+ *
+ * @param  format Output format (EXPORT_*).
+ * @param  argc   Number of arguments.
+ * @param  argv   File name, followed by the optional feed rate (f<feed>),
+ *                tool heights (z<safe>;<cut>), pen number (p<num>), layer
+ *                (l<num>) and the flag to use the optimized path order (o).
+ * @return        TRUE if the file was written.
+ */
+bool export_plot(const uint8_t format, const int argc, char **argv) {
+	export_options_t opts;
+	export_stats_t stats;
+
+	if (argc < 1) {
+		diag_report(DIAG_ERROR, DIAG_CODE_PARSE, argc,
+					"Exporting needs the name of the file to write to.");
+		return false;
+	}
+
+	// Parse the modifier arguments.
+	export_options_init(&opts, format);
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] == 'l') {
+			opts.filter.layer_num = parse_layer_num(argv[i]);
+		} else if (strcmp(argv[i], "o") == 0) {
+			opts.ordered = true;
+		} else if ((argv[i][0] == 'f') && (format == EXPORT_GCODE)) {
+			opts.feed = to_base_unit(argv[i] + 1);
+		} else if ((argv[i][0] == 'z') && (format == EXPORT_GCODE) &&
+				   (strchr(argv[i], ';') != NULL)) {
+			char heights[ARGUMENT_MAX_SIZE];
+			strcpy(heights, argv[i] + 1);
+			*strchr(heights, ';') = '\0';
+
+			opts.safe_z = to_base_unit(heights);
+			opts.cut_z = to_base_unit(strchr(argv[i], ';') + 1);
+		} else if ((argv[i][0] == 'p') && (format == EXPORT_HPGL)) {
+			opts.pen = (uint8_t)atoi(argv[i] + 1);
+		} else {
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i,
+						"Invalid export argument '%s'.", argv[i]);
+			return false;
+		}
+	}
+
+	if (!export_file(argv[0], &opts, &stats)) {
+		return false;
+	}
+
+	printf("Exported %zu objects to %s (%zu bytes in %zu writes, %zu pen "
+		   "lifts)\n", stats.objects, argv[0], stats.bytes, stats.syscalls,
+		   stats.pen_lifts);
+	return true;
+}
+
+/**
+ * Exports the document as a deep zoom tile pyramid for web viewers.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Pyramid name, followed by the optional resolution in
+ *              millimeters per pixel (r<mm>), layer (l<num>) and the flag to
+ *              encode the tiles quickly for previews (f).
+ * @return      TRUE if the pyramid was written.
+ */
+bool export_tiles(const int argc, char **argv) {
+	tiles_options_t opts;
+	tiles_stats_t stats;
+
+	if (argc < 1) {
+		diag_report(DIAG_ERROR, DIAG_CODE_PARSE, argc,
+					"Tiling needs the name of the pyramid to write.");
+		return false;
+	}
+
+	// Parse the modifier arguments.
+	tiles_options_init(&opts);
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] == 'l') {
+			opts.filter.layer_num = parse_layer_num(argv[i]);
+		} else if (argv[i][0] == 'r') {
+			opts.resolution = to_base_unit(argv[i] + 1);
+		} else if (strcmp(argv[i], "f") == 0) {
+			opts.png_mode = PNG_FAST;
+		} else {
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, i,
+						"Invalid tiles argument '%s'.", argv[i]);
+			return false;
+		}
+	}
+
+	if (!tiles_export(argv[0], &opts, &stats)) {
+		return false;
+	}
+
+	printf("Tiled %s.dzi: %ux%u pixels in %u levels - %zu tiles written, "
+		   "%zu empty ones skipped\n", argv[0], stats.width, stats.height,
+		   stats.levels, stats.written, stats.skipped);
+	return true;
+}
+
+/**
+ * Checks if nothing was done to the document since the engine was started.
+ *
+ * @return TRUE if the document is empty.
+ */
+bool document_is_empty() {
+	return (objects.count == 0) && (dimensions.count == 0) &&
+		(variables.count == 0) && (last_object.name == NULL) &&
+		(layers.count == 1) && (history.count == 0);
+}
+
+/**
+ * Loads a binary snapshot into an empty document.
+ *
+ * @param  filename Path to the snapshot.
+ * @return          TRUE if the document was loaded.
+ */
+bool load_snapshot(const char *filename) {
+	snapshot_t snap;
+
+	if (!document_is_empty()) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0, "Snapshots can only be "
+					"loaded into an empty document: %s", filename);
+		return false;
+	}
+
+	if (!snapshot_read(filename, &snap)) {
+		return false;
+	}
+
+	if ((snap.layers.count == 0) || (snap.layers.list[0].num != 0)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_LAYER, 0,
+					"Snapshot without the 0 layer: %s", filename);
+		snapshot_free(&snap);
+		return false;
+	}
+
+	// Take over everything in the snapshot, starting with the layers that
+	// replace the default one.
+	for (size_t i = 0; i < layers.count; i++) {
+		free(layers.list[i].name);
+	}
+	free(layers.list);
+	layers = snap.layers;
+	objects = snap.objects;
+	dimensions = snap.dimensions;
+	variables = snap.variables;
+
+	// The last object variable comes along as "^".
+	for (size_t i = 0; i < variables.count; i++) {
+		if (strcmp(variables.list[i].name, "^") == 0) {
+			last_object = variables.list[i];
+			memmove(&variables.list[i], &variables.list[i + 1],
+					sizeof(variable_t) * (variables.count - i - 1));
+			variables.count--;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < objects.count; i++) {
+		update_object_bounds(i);
+	}
+
+	add_full_damage();
+	revision++;
+
+	return true;
+}
+
+/**
+ * Writes a binary snapshot of the document, with a thumbnail of it.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Name of the snapshot file.
+ * @return      TRUE if the snapshot was written.
+ */
+bool export_snapshot(const int argc, char **argv) {
+	snapshot_header_t header;
+
+	if (argc < 1) {
+		diag_report(DIAG_ERROR, DIAG_CODE_PARSE, argc,
+					"Snapshots need the name of the file to write to.");
+		return false;
+	}
+
+	if (!snapshot_write_file(argv[0], &header)) {
+		return false;
+	}
+
+	printf("Snapshot %s: %llu objects, %llu dimensions, %u layers with a "
+		   "%ux%u thumbnail (%u bytes)\n", argv[0],
+		   (unsigned long long)header.objects,
+		   (unsigned long long)header.dimensions, header.layers,
+		   header.thumb_width, header.thumb_height, header.thumb_len);
+	return true;
+}
+
+/**
+ * Parses a command and executes it.
+ *
+ * @param  line A command line without the newline character at the end. It
+ *              doesn't need to be NULL terminated.
+ * @param  len  Length of the command line.
+ * @return      TRUE if the parsing went fine.
+ */
+bool parse_command(const char *line, const size_t len) {
+	int argc;
+	char command[COMMAND_MAX_SIZE];
+	char *argv[ARGUMENT_ARRAY_MAX_SIZE];
+
+	// Ignoring empty lines and comments.
+	if ((len == 0) || (line[0] == '\0') || (line[0] == '#')) {
+		add_history_line(line, len);
+		return true;
+	}
+
+	// Parse the line.
+	if ((argc = parse_line(line, len, command, argv)) >= 0) {
+#ifdef DEBUG
+		printf("Command: %s - Arg. Count: %d\n", command, argc);
+		for (int i = 0; i < argc; i++) {
+			printf("Argument %d: %s\n", i, argv[i]);
+		}
+#endif
+		// Check which type of command this is.
+		int type = -1;
+		const command_t *cmd = NULL;
+		if ((type = is_obj_command(command)) > 0) {
+			// Command will generate a object.
+			create_object(type, argc, argv);
+#ifdef DEBUG
+			print_object_info(objects.list[objects.count - 1]);
+#endif
+		} else if ((cmd = find_command(command)) != NULL) {
+			// Any other command.
+			if (!cmd->handler(argc, argv)) {
+				return false;
+			}
+		} else {
+			// Not a known command.
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, 0,
+						"Unknown command '%s'.", command);
+			return false;
+		}
+		
+		// Cleaning up the arguments.
+		for (uint8_t i = 0; i < argc; i++) {
+			free(argv[i]);
+		}
+
+		// Add line to the history and return.
+		add_history_line(line, len);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Converts a raw string to a long in the base unit.
+ *
+ * @param  str Raw string in a coordinate form.
+ * @return     Number in the base unit.
+ */
+long to_base_unit(const char *str) {
+	return (long)to_base_value(str);
+}
+
+/**
+ * Converts a raw string to a number in the base unit without truncating it,
+ * so callers can tell if it can be represented in the drawing.
+ *
+ * @param  str Raw string in a coordinate form.
+ * @return     Number in the base unit.
+ */
+double to_base_value(const char *str) {
+	double num = 0;
+	char unit[3];
+	char strnum[ARGUMENT_MAX_SIZE];
+	uint8_t stage = PARSING_NUMBER;
+	uint8_t cur_pos = 0;
+	unit[0] = '\0';
+
+	// Iterate over the coordinate string until we hit the NULL terminator.
+	while (*str != '\0') {
+		// Get the current character.
+		char c = *str++;
+
+		switch (stage) {
+		case PARSING_NUMBER:
+			if (((c >= 0x30) && (c <= 0x39)) || 
+				((c >= 0x2B) && (c <= 0x2E))) {
+				// Character is a number.
+				strnum[cur_pos++] = c;
+				strnum[cur_pos] = '\0';
+			} else if ((c >= 0x61) && (c <= 0x7A)) {
+				// Character is a letter.
+				cur_pos = 0;
+				stage = PARSING_UNIT;
+				unit[cur_pos++] = c;
+				unit[cur_pos] = '\0';
+			} else {
+				// Invalid character.
+				diag_report(DIAG_FATAL, DIAG_CODE_PARSE, c, "Invalid character "
+							"found while trying to parse a number: %c.", c);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case PARSING_UNIT:
+			if ((c >= 0x61) && (c <= 0x7A)) {
+				// Character is a letter.
+				unit[cur_pos++] = c;
+				unit[cur_pos] = '\0';
+			} else {
+				// Invalid character.
+				diag_report(DIAG_FATAL, DIAG_CODE_PARSE, c, "Invalid character "
+							"found while trying to parse a unit: %c.", c);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+	}
+
+	// Parse number from string and convert it.
 	double orig = atof(strnum);
 	if (unit[0] == '\0') {
 		// Already at the base unit.
-		num = (long)orig;
+		num = orig;
 	} else if (!strcmp(unit, "m")) {
 		// Meters.
-		num = (long)(orig * 1000);
+		num = orig * 1000;
 	} else if (!strcmp(unit, "cm")) {
 		// Centimeters.
-		num = (long)(orig * 10);
+		num = orig * 10;
 	} else if (!strcmp(unit, "mm")) {
 		// Millimeters.
-		num = (long)orig;
+		num = orig;
 	} else {
 		// Invalid unit.
-		printf("Invalid unit: %s\n", unit);
+		diag_report(DIAG_FATAL, DIAG_CODE_PARSE, 0, "Invalid unit: %s", unit);
 		exit(EXIT_FAILURE);
 	}
 
 #ifdef DEBUG
-	printf("Number: %s - Unit: %s - Double: %f - Final: %ld\n", strnum, unit,
+	printf("Number: %s - Unit: %s - Double: %f - Final: %f\n", strnum, unit,
 		   orig, num);
 #endif
 
@@ -1218,6 +2137,175 @@ int is_obj_command(const char *command) {
 	return -1;
 }
 
+/**
+ * Finds a command that isn't an object.
+ *
+ * @param  command Command name to look for.
+ * @return         Command or NULL if there's no command with that name.
+ */
+const command_t* find_command(const char *command) {
+	for (uint8_t i = 0; i < COMMANDS_SIZE; i++) {
+		if (strcmp(command, commands[i].name) == 0) {
+			return &commands[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Checks if a line runs a command that produces some output, without parsing
+ * the rest of it.
+ *
+ * @param  line Command line without the newline character at the end.
+ * @param  len  Length of the command line.
+ * @return      TRUE if the command on the line produces output.
+ */
+bool is_output_line(const char *line, const size_t len) {
+	char command[COMMAND_MAX_SIZE];
+	size_t i = 0;
+
+	// Pick out the command the same way it gets parsed.
+	while ((i < len) && ((i + 1) < COMMAND_MAX_SIZE) && (line[i] != ' ') &&
+			(line[i] != '\t') && (line[i] != '#') && (line[i] != '\0')) {
+		command[i] = line[i];
+		i++;
+	}
+	command[i] = '\0';
+	chomp(command);
+
+	const command_t *cmd = find_command(command);
+	return (cmd != NULL) && cmd->output;
+}
+
+/**
+ * Dimension command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Dimension arguments.
+ * @return      TRUE if the dimension was created.
+ */
+bool command_dimen(const int argc, char **argv) {
+	return create_dimension(argc, argv, false);
+}
+
+/**
+ * Offset dimension command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Dimension arguments.
+ * @return      TRUE if the dimension was created.
+ */
+bool command_odimen(const int argc, char **argv) {
+	return create_dimension(argc, argv, true);
+}
+
+/**
+ * Set variable command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Name and value of the variable.
+ * @return      Always TRUE.
+ */
+bool command_set(const int argc, char **argv) {
+	set_variable(argv[0], argv[1]);
+#ifdef DEBUG
+	print_variable_info(variables.list[variables.count - 1]);
+#endif
+
+	return true;
+}
+
+/**
+ * Set layer attributes command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Number, name and color of the layer.
+ * @return      Always TRUE.
+ */
+bool command_layer(const int argc, char **argv) {
+	set_layer((uint8_t)strtoul(argv[0], NULL, 10), argv[1], argv[2]);
+	return true;
+}
+
+/**
+ * List lines command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Unused.
+ * @return      Always TRUE.
+ */
+bool command_list(const int argc, char **argv) {
+	print_line_history();
+	return true;
+}
+
+/**
+ * Inspect command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Thing to be inspected.
+ * @return      TRUE if the inspecting was successful.
+ */
+bool command_inspect(const int argc, char **argv) {
+	return inspect(argv[0]);
+}
+
+/**
+ * Boolean union command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Boolean operation arguments.
+ * @return      TRUE if the operation was successful.
+ */
+bool command_union(const int argc, char **argv) {
+	return apply_boolean(BOOLEAN_UNION, argc, argv);
+}
+
+/**
+ * Boolean intersection command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Boolean operation arguments.
+ * @return      TRUE if the operation was successful.
+ */
+bool command_intersect(const int argc, char **argv) {
+	return apply_boolean(BOOLEAN_INTERSECT, argc, argv);
+}
+
+/**
+ * Boolean difference command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Boolean operation arguments.
+ * @return      TRUE if the operation was successful.
+ */
+bool command_subtract(const int argc, char **argv) {
+	return apply_boolean(BOOLEAN_SUBTRACT, argc, argv);
+}
+
+/**
+ * G-code export command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Export arguments.
+ * @return      TRUE if the file was written.
+ */
+bool command_gcode(const int argc, char **argv) {
+	return export_plot(EXPORT_GCODE, argc, argv);
+}
+
+/**
+ * HPGL export command.
+ *
+ * @param  argc Number of arguments.
+ * @param  argv Export arguments.
+ * @return      TRUE if the file was written.
+ */
+bool command_hpgl(const int argc, char **argv) {
+	return export_plot(EXPORT_HPGL, argc, argv);
+}
+
 /**
  * Checks if a command is of a type that shouldn't have its arguments variables
  * substituted by their values. This is mostly used for debugging commands.
@@ -1265,34 +2353,57 @@ void print_line_history() {
  * Adds a line to the command history.
  * 
  * @param line Line to be added to the history.
+ * @param len  Length of the line.
  */
-void add_history_line(const char *line) {
+void add_history_line(const char *line, const size_t len) {
 	// Dynamically add a new line to the array.
 	history.lines = realloc(history.lines, sizeof(char*) * (history.count + 1));
-	history.lines[history.count++] = strdup(line);
+	history.lines[history.count++] = strndup(line, len);
+}
+
+/**
+ * Adds every line of a buffer to the history, just like parsing it would.
+ *
+ * @param data Buffer containing the commands.
+ * @param len  Length of the buffer in bytes.
+ */
+void add_history_buffer(const char *data, const size_t len) {
+	const char *end = data + len;
+	const char *line = data;
+
+	while (line < end) {
+		size_t line_len;
+		const char *next = next_line(line, end, &line_len);
+
+		add_history_line(line, line_len);
+		line = next;
+	}
 }
 
 /**
  * Parses a command line and separates each part.
  *
  * @param  line      The command line without the newline character at the end.
+ * @param  len       Length of the command line.
  * @param  command   Pointer to a string that will contain the command after
  *                   parsing.
  * @param  arguments Array of strings that will contain the arguemnts.
  * @return           Number of arguments found for the command or -1 if there
  *                   was an error while parsing.
  */
-int parse_line(const char *line, char *command, char **arguments) {
+int parse_line(const char *line, const size_t len, char *command,
+			   char **arguments) {
 	uint8_t stage = PARSING_COMMAND;
 	uint16_t cur_cpos = 0;
 	int argc = -1;
 	char cur_arg[ARGUMENT_MAX_SIZE];
+	const char *eol = line + len;
 	
 	// Reset the command string.
 	command[0] = '\0';
 
-	// Iterate over the line string until we hit the NULL terminator.
-	while (*line != '\0') {
+	// Iterate over the line until we hit its end or a NULL terminator.
+	while ((line < eol) && (*line != '\0')) {
 		// Get the current character.
 		char c = *line++;
 		
@@ -1317,8 +2428,8 @@ int parse_line(const char *line, char *command, char **arguments) {
 					command[cur_cpos++] = c;
 					command[cur_cpos] = '\0';
 				} else {
-					printf("ERROR: Command maximum character limit "
-						   "exceeded.\n");
+					diag_report(DIAG_ERROR, DIAG_CODE_PARSE, 0, "Command "
+								"maximum character limit exceeded.");
 					return -1;
 				}
 			}
@@ -1333,7 +2444,8 @@ int parse_line(const char *line, char *command, char **arguments) {
 				cur_arg[0] = '\0';
 
 				if (argc == ARGUMENT_ARRAY_MAX_SIZE) {
-					printf("Maximum number of arguments exceeded.\n");
+					diag_report(DIAG_ERROR, DIAG_CODE_PARSE, 0,
+								"Maximum number of arguments exceeded.");
 					return -1;
 				}
 			} else if ((c == ' ') || (c == '\t')) {
@@ -1356,8 +2468,9 @@ int parse_line(const char *line, char *command, char **arguments) {
 					cur_arg[cur_cpos++] = c;
 					cur_arg[cur_cpos] = '\0';
 				} else {
-					printf("Maximum argument character size exceeded on "
-						   "argument number %d.\n", argc);
+					diag_report(DIAG_ERROR, DIAG_CODE_PARSE, argc,
+								"Maximum argument character size exceeded on "
+								"argument number %d.", argc);
 					return -1;
 				}
 			}
@@ -1366,8 +2479,9 @@ int parse_line(const char *line, char *command, char **arguments) {
 			// Check if we are starting with the right variable type.
 			if (cur_cpos == 0) {
 				if ((c != ' ') && (c != '\t') && (c != '&')) {
-					printf("Unknown first character for a object variable "
-						   "'%c'\n", c);
+					diag_report(DIAG_ERROR, DIAG_CODE_PARSE, c, "Unknown "
+								"first character for a object variable '%c'",
+								c);
 					return -1;
 				} else if (c == '&') {
 					cur_arg[cur_cpos++] = c;
@@ -1383,8 +2497,8 @@ int parse_line(const char *line, char *command, char **arguments) {
 			}
 			break;
 		default:
-			printf("ERROR: Unknown line parsing state. This shouldn't "
-				   "happen.\n");
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, stage, "Unknown line "
+						"parsing state. This shouldn't happen.");
 			return -1;
 		}
 	}
@@ -1413,52 +2527,178 @@ int parse_line(const char *line, char *command, char **arguments) {
 }
 
 /**
- * Parses a nanoCAD formatted file.
+ * Parses a buffer of nanoCAD commands line by line without copying it. Lines
+ * can be terminated by "\n", "\r\n" or "\r".
  *
- * @param  filename Path to the file to be parsed.
- * @return          TRUE if everything went OK.
+ * @param  data       Buffer containing the commands.
+ * @param  len        Length of the buffer in bytes.
+ * @param  first_line Number of the first line in the buffer for the errors.
+ * @return            TRUE if everything went OK.
  */
-bool parse_file(const char *filename) {
-	// Open the CAD file for parsing.
-	FILE *fp = fopen(filename, "r");
-	if (fp == NULL) {
-		printf("Couldn't open the CAD file: %s\n", filename);
-		return false;
-	}
+bool parse_buffer(const char *data, const size_t len,
+				  const unsigned int first_line) {
+	const char *end = data + len;
+	const char *line = data;
+	unsigned int linenum = first_line;
 
-	// Go through each line.
-	char *line;
-	size_t len = 0;
-	ssize_t read;
-	unsigned int linenum = 1;
-	while ((read = getline(&line, &len, fp)) != -1) {
-		// Remove the trailling newline.
-		if (line[read - 1] == '\n') {
-			line[read - 1] = '\0';
-		}
+	while (line < end) {
+		size_t line_len;
+		const char *next = next_line(line, end, &line_len);
 
 #ifdef DEBUG
-		if (linenum > 1) {
+		if (linenum > first_line) {
 			printf("\n\n");
 		}
 
-		printf("Line %d: %s\n", linenum, line);
+		printf("Line %d: %.*s\n", linenum, (int)line_len, line);
 #endif
 
 		// Parse lines.
-		if (!parse_command(line)) {
-			printf("Failed to parse line %d: %s\n", linenum, line);
+		if (!parse_command(line, line_len)) {
+			diag_report(DIAG_ERROR, DIAG_CODE_PARSE, linenum,
+						"Failed to parse line %d: %.*s", linenum,
+						(int)line_len, line);
 			return false;
 		}
 
+		line = next;
 		linenum++;
 	}
 
-	// Some clean-up.
+	return true;
+}
+
+/**
+ * Finds how much of a buffer only builds up the document, which is every line
+ * before the first command that produces some output.
+ *
+ * @param  data  Buffer containing the commands.
+ * @param  len   Length of the buffer in bytes.
+ * @param  lines Where to put the number of lines in it.
+ * @return       Length of that part of the buffer in bytes.
+ */
+size_t document_prefix(const char *data, const size_t len,
+					   unsigned int *lines) {
+	const char *end = data + len;
+	const char *line = data;
+
+	*lines = 0;
+	while (line < end) {
+		size_t line_len;
+		const char *next = next_line(line, end, &line_len);
+
+		if (is_output_line(line, line_len)) {
+			break;
+		}
+
+		line = next;
+		(*lines)++;
+	}
+
+	// The last line may not have an ending.
+	return (line < end) ? (size_t)(line - data) : len;
+}
+
+/**
+ * Finds the end of a line in a buffer that may use any kind of line endings.
+ *
+ * @param  line Start of the line.
+ * @param  end  End of the buffer.
+ * @param  len  Where to put the length of the line, without its ending.
+ * @return      Start of the next line.
+ */
+const char* next_line(const char *line, const char *end, size_t *len) {
+	const char *eol = line;
+	while ((eol < end) && (*eol != '\n') && (*eol != '\r')) {
+		eol++;
+	}
+	*len = (size_t)(eol - line);
+
+	// Skip over the line ending, treating "\r\n" as a single one.
+	if ((eol < end) && (*eol == '\r') && ((eol + 1) < end) &&
+			(eol[1] == '\n')) {
+		eol++;
+	}
+
+	return eol + 1;
+}
+
+/**
+ * Parses a nanoCAD formatted file.
+ *
+ * @param  filename Path to the file to be parsed.
+ * @return          TRUE if everything went OK.
+ */
+bool parse_file(const char *filename) {
+	// Open the CAD file for parsing.
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Couldn't open the CAD file: %s", filename);
+		return false;
+	}
+
+	// Get the file size.
+	long len = -1;
+	if (fseek(fp, 0, SEEK_END) == 0) {
+		len = ftell(fp);
+		rewind(fp);
+	}
+
+	if (len < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Couldn't get the size of the CAD file: %s", filename);
+		fclose(fp);
+		return false;
+	}
+
+	// Read the whole file into memory in one go.
+	char *data = malloc((size_t)len + 1);
+	if (data == NULL) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Not enough memory to read the CAD file: %s", filename);
+		fclose(fp);
+		return false;
+	}
+
+	if (fread(data, 1, (size_t)len, fp) != (size_t)len) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Couldn't read the CAD file: %s", filename);
+		fclose(fp);
+		free(data);
+		return false;
+	}
 	fclose(fp);
-	free(line);
 
-	return true;
+	// The document built up by the lines before the first command that
+	// produces some output comes straight out of the cache if it was parsed
+	// before. Everything from that command on is always parsed, so the output
+	// is the same as if the whole file had been.
+	size_t done = 0;
+	unsigned int lines = 0;
+	if (doccache_enabled() && document_is_empty()) {
+		char key[DOCCACHE_KEY_SIZE];
+		char path[DOCCACHE_PATH_MAX];
+
+		done = document_prefix(data, (size_t)len, &lines);
+		if (done > 0) {
+			doccache_key(data, done, key);
+			if (doccache_lookup(key, path) && load_snapshot(path)) {
+				add_history_buffer(data, done);
+			} else if (parse_buffer(data, done, 1)) {
+				doccache_store(key);
+			} else {
+				free(data);
+				return false;
+			}
+		}
+	}
+
+	// Parse whatever is left and clean up.
+	bool ret = parse_buffer(data + done, (size_t)len - done, lines + 1);
+	free(data);
+
+	return ret;
 }
 
 /**
@@ -1471,6 +2711,269 @@ object_t get_object(const size_t i) {
 	return objects.list[i];
 }
 
+/**
+ * Checks if a set of coordinates touches the bounds rectangle of a filter.
+ *
+ * @param  filter Filter to be checked against.
+ * @param  coord  Array of coordinates.
+ * @param  count  Number of coordinates in the array.
+ * @return        TRUE if the coordinates are inside the filter bounds or if
+ *                the filter doesn't have any bounds.
+ */
+bool filter_coords(const object_filter_t *filter, const coord_t *coord,
+				   const size_t count) {
+	coord_t min;
+	coord_t max;
+
+	if (!filter->use_bounds || (count == 0)) {
+		return true;
+	}
+
+	// Calculate the bounding box of the coordinates.
+	min = coord[0];
+	max = coord[0];
+	for (size_t i = 1; i < count; i++) {
+		min.x = (coord[i].x < min.x) ? coord[i].x : min.x;
+		min.y = (coord[i].y < min.y) ? coord[i].y : min.y;
+		max.x = (coord[i].x > max.x) ? coord[i].x : max.x;
+		max.y = (coord[i].y > max.y) ? coord[i].y : max.y;
+	}
+
+	return (min.x <= filter->max.x) && (max.x >= filter->min.x) &&
+		(min.y <= filter->max.y) && (max.y >= filter->min.y);
+}
+
+/**
+ * Checks if an object matches the type and layer of a filter. The bounds are
+ * checked separately against the bounds column.
+ *
+ * @param  filter Filter to be checked against.
+ * @param  obj    Object to be checked.
+ * @return        TRUE if the object matches the filter.
+ */
+bool filter_object(const object_filter_t *filter, const object_t *obj) {
+	if ((filter->type != FILTER_ANY_TYPE) && (filter->type != obj->type)) {
+		return false;
+	}
+
+	if ((filter->layer_num != FILTER_ANY_LAYER) &&
+			(filter->layer_num != obj->layer_num)) {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Clamps a coordinate value to fit in the bounds column.
+ *
+ * @param  value Coordinate value.
+ * @return       Clamped value.
+ */
+int32_t clamp_int32(const long value) {
+	if (value > INT32_MAX) {
+		return INT32_MAX;
+	} else if (value < INT32_MIN) {
+		return INT32_MIN;
+	}
+
+	return (int32_t)value;
+}
+
+/**
+ * Marks an area of the document as changed. If the damage list gets full
+ * everything is considered to be changed.
+ *
+ * @param min  Bottom-left corner of the changed area.
+ * @param max  Top-right corner of the changed area.
+ * @param text Is there text around this area?
+ */
+void add_damage(const coord_t min, const coord_t max, const bool text) {
+	if (damage.full) {
+		return;
+	}
+
+	if (damage.count >= DAMAGE_LIST_SIZE) {
+		add_full_damage();
+		return;
+	}
+
+	damage.list[damage.count].min = min;
+	damage.list[damage.count].max = max;
+	damage.list[damage.count].text = text;
+	damage.count++;
+}
+
+/**
+ * Marks the whole document as changed.
+ */
+void add_full_damage() {
+	damage.full = true;
+	damage.count = 0;
+}
+
+/**
+ * Updates the bounding box of an object. This must be called every time an
+ * object is created or has its coordinates changed.
+ *
+ * @param i Index of the object.
+ */
+void update_object_bounds(const size_t i) {
+	const object_t *obj = &objects.list[i];
+	long min_x = 0;
+	long min_y = 0;
+	long max_x = 0;
+	long max_y = 0;
+
+	// Grow the column if needed.
+	if (i >= bounds.capacity) {
+		bounds.capacity = (bounds.capacity == 0) ? 64 : bounds.capacity * 2;
+		bounds.min_x = realloc(bounds.min_x, sizeof(int32_t) * bounds.capacity);
+		bounds.min_y = realloc(bounds.min_y, sizeof(int32_t) * bounds.capacity);
+		bounds.max_x = realloc(bounds.max_x, sizeof(int32_t) * bounds.capacity);
+		bounds.max_y = realloc(bounds.max_y, sizeof(int32_t) * bounds.capacity);
+	}
+
+	// Calculate the bounding box. Objects without coordinates get an empty box
+	// that will never touch anything.
+	if (obj->coord_count > 0) {
+		min_x = obj->coord[0].x;
+		min_y = obj->coord[0].y;
+		max_x = obj->coord[0].x;
+		max_y = obj->coord[0].y;
+
+		for (uint8_t c = 1; c < obj->coord_count; c++) {
+			min_x = (obj->coord[c].x < min_x) ? obj->coord[c].x : min_x;
+			min_y = (obj->coord[c].y < min_y) ? obj->coord[c].y : min_y;
+			max_x = (obj->coord[c].x > max_x) ? obj->coord[c].x : max_x;
+			max_y = (obj->coord[c].y > max_y) ? obj->coord[c].y : max_y;
+		}
+	} else {
+		min_x = INT32_MAX;
+		min_y = INT32_MAX;
+		max_x = INT32_MIN;
+		max_y = INT32_MIN;
+	}
+
+	bounds.min_x[i] = clamp_int32(min_x);
+	bounds.min_y[i] = clamp_int32(min_y);
+	bounds.max_x[i] = clamp_int32(max_x);
+	bounds.max_y[i] = clamp_int32(max_y);
+
+	if (i >= bounds.count) {
+		bounds.count = i + 1;
+	}
+}
+
+/**
+ * Tests a range of bounding boxes against a query rectangle. Boxes are tested
+ * 16 (AVX-512), 8 (AVX2) or 4 (SSE2) at a time depending on what the compiler
+ * is allowed to use, with a branch-free scalar loop for the rest.
+ *
+ * @param  column Bounds column.
+ * @param  start  Index of the first box to be tested.
+ * @param  count  Number of boxes to be tested.
+ * @param  min    Bottom-left corner of the query rectangle.
+ * @param  max    Top-right corner of the query rectangle.
+ * @param  mask   Visibility bitmask with at least (count + 31) / 32 words.
+ * @return        Number of boxes that touch the query rectangle.
+ */
+size_t cull_boxes(const bounds_column *column, const size_t start,
+				  const size_t count, const coord_t min, const coord_t max,
+				  uint32_t *mask) {
+	const int32_t *min_x = column->min_x + start;
+	const int32_t *min_y = column->min_y + start;
+	const int32_t *max_x = column->max_x + start;
+	const int32_t *max_y = column->max_y + start;
+	const int32_t qmin_x = clamp_int32(min.x);
+	const int32_t qmin_y = clamp_int32(min.y);
+	const int32_t qmax_x = clamp_int32(max.x);
+	const int32_t qmax_y = clamp_int32(max.y);
+	size_t visible = 0;
+	size_t i = 0;
+
+	memset(mask, 0, sizeof(uint32_t) * ((count + 31) / 32));
+
+#if defined(__AVX512F__)
+	const __m512i vmin_x = _mm512_set1_epi32(qmin_x);
+	const __m512i vmin_y = _mm512_set1_epi32(qmin_y);
+	const __m512i vmax_x = _mm512_set1_epi32(qmax_x);
+	const __m512i vmax_y = _mm512_set1_epi32(qmax_y);
+
+	for (; (i + 16) <= count; i += 16) {
+		__mmask16 bits = _mm512_cmple_epi32_mask(
+			_mm512_loadu_si512(min_x + i), vmax_x);
+		bits &= _mm512_cmpge_epi32_mask(_mm512_loadu_si512(max_x + i), vmin_x);
+		bits &= _mm512_cmple_epi32_mask(_mm512_loadu_si512(min_y + i), vmax_y);
+		bits &= _mm512_cmpge_epi32_mask(_mm512_loadu_si512(max_y + i), vmin_y);
+
+		mask[i / 32] |= (uint32_t)bits << (i % 32);
+		visible += __builtin_popcount(bits);
+	}
+#elif defined(__AVX2__)
+	const __m256i vmin_x = _mm256_set1_epi32(qmin_x);
+	const __m256i vmin_y = _mm256_set1_epi32(qmin_y);
+	const __m256i vmax_x = _mm256_set1_epi32(qmax_x);
+	const __m256i vmax_y = _mm256_set1_epi32(qmax_y);
+
+	for (; (i + 8) <= count; i += 8) {
+		// A box is hidden if it's completely beyond any side of the query.
+		__m256i out = _mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_cmpgt_epi32(
+					_mm256_loadu_si256((const __m256i*)(min_x + i)), vmax_x),
+				_mm256_cmpgt_epi32(
+					vmin_x, _mm256_loadu_si256((const __m256i*)(max_x + i)))),
+			_mm256_or_si256(
+				_mm256_cmpgt_epi32(
+					_mm256_loadu_si256((const __m256i*)(min_y + i)), vmax_y),
+				_mm256_cmpgt_epi32(
+					vmin_y, _mm256_loadu_si256((const __m256i*)(max_y + i)))));
+		uint32_t bits = ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(out))
+			& 0xFF;
+
+		mask[i / 32] |= bits << (i % 32);
+		visible += __builtin_popcount(bits);
+	}
+#elif defined(__SSE2__)
+	const __m128i vmin_x = _mm_set1_epi32(qmin_x);
+	const __m128i vmin_y = _mm_set1_epi32(qmin_y);
+	const __m128i vmax_x = _mm_set1_epi32(qmax_x);
+	const __m128i vmax_y = _mm_set1_epi32(qmax_y);
+
+	for (; (i + 4) <= count; i += 4) {
+		// A box is hidden if it's completely beyond any side of the query.
+		__m128i out = _mm_or_si128(
+			_mm_or_si128(
+				_mm_cmpgt_epi32(
+					_mm_loadu_si128((const __m128i*)(min_x + i)), vmax_x),
+				_mm_cmpgt_epi32(
+					vmin_x, _mm_loadu_si128((const __m128i*)(max_x + i)))),
+			_mm_or_si128(
+				_mm_cmpgt_epi32(
+					_mm_loadu_si128((const __m128i*)(min_y + i)), vmax_y),
+				_mm_cmpgt_epi32(
+					vmin_y, _mm_loadu_si128((const __m128i*)(max_y + i)))));
+		uint32_t bits = ~(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(out))
+			& 0xF;
+
+		mask[i / 32] |= bits << (i % 32);
+		visible += __builtin_popcount(bits);
+	}
+#endif
+
+	// Take care of whatever is left.
+	for (; i < count; i++) {
+		uint32_t bit = (uint32_t)((min_x[i] <= qmax_x) & (max_x[i] >= qmin_x) &
+								  (min_y[i] <= qmax_y) & (max_y[i] >= qmin_y));
+
+		mask[i / 32] |= bit << (i % 32);
+		visible += bit;
+	}
+
+	return visible;
+}
+
 /**
  * Frees up all of the memory used up in a array.
  * 
@@ -1519,8 +3022,9 @@ uint8_t hex_to_dec(const char *hex) {
 			dec += (hex[digit] - 'a' + 10) * (uint8_t)pow(16, power);
 		} else {
 			// Invalid character.
-			printf("Invalid hexadecimal character '%c' in '%s'.\n",
-				   hex[digit], hex);
+			diag_report(DIAG_FATAL, DIAG_CODE_PARSE, hex[digit],
+						"Invalid hexadecimal character '%c' in '%s'.",
+						hex[digit], hex);
 			exit(EXIT_FAILURE);
 		}
 		
@@ -18,12 +18,22 @@
 #define ARGUMENT_MAX_SIZE       30  // no dynamic-sized string and arrays for
 #define VARIABLE_MAX_SIZE       15  // you.
 #define ARGUMENT_ARRAY_MAX_SIZE 5
+#define DAMAGE_LIST_SIZE        32
 
 // Object type definitions.
 #define TYPE_LINE   1
 #define TYPE_RECT   2
 #define TYPE_CIRCLE 3
 
+// Variable type definitions.
+#define VARIABLE_FIXED  '$'
+#define VARIABLE_COORD  '@'
+#define VARIABLE_OBJECT '&'
+
+// Object filter wildcards.
+#define FILTER_ANY_TYPE  0
+#define FILTER_ANY_LAYER -1
+
 // RGBA color structure.
 typedef struct {
 	uint8_t r;
@@ -52,6 +62,16 @@ typedef struct {
 	object_t *list;
 } object_container;
 
+// Object bounding box column (one array per box side).
+typedef struct {
+	size_t   count;
+	size_t   capacity;
+	int32_t *min_x;
+	int32_t *min_y;
+	int32_t *max_x;
+	int32_t *max_y;
+} bounds_column;
+
 // Dimension structure.
 typedef struct {
 	coord_t start;
@@ -99,24 +119,94 @@ typedef struct {
 	layer_t *list;
 } layer_container;
 
+// Object filter structure.
+typedef struct {
+	uint8_t type;        // Object type or FILTER_ANY_TYPE.
+	int16_t layer_num;   // Layer number or FILTER_ANY_LAYER.
+	bool    use_bounds;  // Only match things touching the min-max rectangle.
+	coord_t min;
+	coord_t max;
+} object_filter_t;
+
+// Read-only view of an object and its contiguous coordinate array.
+typedef struct {
+	size_t         index;
+	uint8_t        type;
+	uint8_t        layer_num;
+	uint8_t        coord_count;
+	const coord_t *coord;
+} object_span_t;
+
+// Changed area of the document.
+typedef struct {
+	coord_t min;
+	coord_t max;
+	bool    text;  // Has text around it that may spill outside the box.
+} damage_rect_t;
+
+// Areas of the document that changed since the last time they were taken.
+typedef struct {
+	bool          full;  // Too much changed, or something that affects all.
+	size_t        count;
+	damage_rect_t list[DAMAGE_LIST_SIZE];
+} damage_list;
+
+// Object iterator state.
+typedef struct {
+	object_filter_t filter;
+	size_t          pos;
+	size_t          end;
+} object_iterator_t;
+
+// Visitor callbacks. Return FALSE to stop the iteration.
+typedef bool (*object_visitor_t)(const object_span_t *span, void *data);
+typedef bool (*dimension_visitor_t)(const dimension_t *dimen,
+									const size_t index, void *data);
+
 // Initialization and clean-up.
 void nanocad_init();
 void nanocad_destroy();
+uint32_t nanocad_get_revision();
+void nanocad_take_damage(damage_list *damage);
 
 // General parsing.
 bool nanocad_parse_command(const char *line);
+bool nanocad_parse_buffer(const char *data, size_t len);
 bool nanocad_parse_file(const char *filename);
+bool nanocad_load_snapshot(const char *filename);
+
+// Variable functions.
+variable_t* nanocad_get_variable(const char *name);
+void nanocad_get_variable_container(variable_container *container);
 
 // Layer functions.
 layer_t* nanocad_get_layer(const uint8_t num);
+void nanocad_get_layer_container(layer_container *container);
 
 // Object functions.
 object_t nanocad_get_object(const size_t i);
+size_t nanocad_get_object_count();
 void nanocad_get_object_container(object_container *container);
+void nanocad_get_bounds_column(bounds_column *column);
+size_t nanocad_cull_bounds(const coord_t min, const coord_t max,
+						   const size_t start, const size_t count,
+						   uint32_t *mask);
 
 // Dimension functions.
 void nanocad_get_dimension_container(dimension_container *container);
 
+// Iteration functions.
+void nanocad_filter_init(object_filter_t *filter);
+void nanocad_object_iter_init(object_iterator_t *iter,
+							  const object_filter_t *filter,
+							  const size_t part, const size_t parts);
+size_t nanocad_object_iter_next(object_iterator_t *iter, object_span_t *spans,
+								const size_t max);
+size_t nanocad_visit_objects(const object_filter_t *filter,
+							 object_visitor_t visitor, void *data);
+size_t nanocad_visit_dimensions(const object_filter_t *filter,
+								dimension_visitor_t visitor, void *data);
+
 // Debug functions.
 void print_object_info(const object_t object);
 void print_variable_info(const variable_t var);
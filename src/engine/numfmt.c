@@ -0,0 +1,461 @@
+/**
+ * engine/numfmt.c
+ * Fast and locale independent number formatting for the exporters.
+ *
+ * Doubles are written with the shortest number of digits that still reads
+ * back as the exact same value, using the Grisu2 algorithm by Florian
+ * Loitsch ("Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers"). It works with a 64-bit approximation of the value scaled by a
+ * cached power of ten, so it never needs big integers or the C library.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "numfmt.h"
+
+// Layout of a double.
+#define DOUBLE_SIGNIFICAND_BITS 52
+#define DOUBLE_EXPONENT_BIAS    (0x3FF + DOUBLE_SIGNIFICAND_BITS)
+#define DOUBLE_HIDDEN_BIT       0x0010000000000000ULL
+#define DOUBLE_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DOUBLE_EXPONENT_MASK    0x7FF0000000000000ULL
+
+// Range of decimal exponents written without an exponent.
+#define NUMFMT_MAX_FIXED_DIGITS 21
+
+// Floating point number with a 64-bit significand (f * 2^e).
+typedef struct {
+	uint64_t f;
+	int      e;
+} diy_fp_t;
+
+// Powers of ten from 10^-348 to 10^340 in steps of 8, normalized to 64 bits.
+static const uint64_t cached_powers_f[] = {
+	0xFA8FD5A0081C0288ULL, 0xBAAEE17FA23EBF76ULL, 0x8B16FB203055AC76ULL,
+	0xCF42894A5DCE35EAULL, 0x9A6BB0AA55653B2DULL, 0xE61ACF033D1A45DFULL,
+	0xAB70FE17C79AC6CAULL, 0xFF77B1FCBEBCDC4FULL, 0xBE5691EF416BD60CULL,
+	0x8DD01FAD907FFC3CULL, 0xD3515C2831559A83ULL, 0x9D71AC8FADA6C9B5ULL,
+	0xEA9C227723EE8BCBULL, 0xAECC49914078536DULL, 0x823C12795DB6CE57ULL,
+	0xC21094364DFB5637ULL, 0x9096EA6F3848984FULL, 0xD77485CB25823AC7ULL,
+	0xA086CFCD97BF97F4ULL, 0xEF340A98172AACE5ULL, 0xB23867FB2A35B28EULL,
+	0x84C8D4DFD2C63F3BULL, 0xC5DD44271AD3CDBAULL, 0x936B9FCEBB25C996ULL,
+	0xDBAC6C247D62A584ULL, 0xA3AB66580D5FDAF6ULL, 0xF3E2F893DEC3F126ULL,
+	0xB5B5ADA8AAFF80B8ULL, 0x87625F056C7C4A8BULL, 0xC9BCFF6034C13053ULL,
+	0x964E858C91BA2655ULL, 0xDFF9772470297EBDULL, 0xA6DFBD9FB8E5B88FULL,
+	0xF8A95FCF88747D94ULL, 0xB94470938FA89BCFULL, 0x8A08F0F8BF0F156BULL,
+	0xCDB02555653131B6ULL, 0x993FE2C6D07B7FACULL, 0xE45C10C42A2B3B06ULL,
+	0xAA242499697392D3ULL, 0xFD87B5F28300CA0EULL, 0xBCE5086492111AEBULL,
+	0x8CBCCC096F5088CCULL, 0xD1B71758E219652CULL, 0x9C40000000000000ULL,
+	0xE8D4A51000000000ULL, 0xAD78EBC5AC620000ULL, 0x813F3978F8940984ULL,
+	0xC097CE7BC90715B3ULL, 0x8F7E32CE7BEA5C70ULL, 0xD5D238A4ABE98068ULL,
+	0x9F4F2726179A2245ULL, 0xED63A231D4C4FB27ULL, 0xB0DE65388CC8ADA8ULL,
+	0x83C7088E1AAB65DBULL, 0xC45D1DF942711D9AULL, 0x924D692CA61BE758ULL,
+	0xDA01EE641A708DEAULL, 0xA26DA3999AEF774AULL, 0xF209787BB47D6B85ULL,
+	0xB454E4A179DD1877ULL, 0x865B86925B9BC5C2ULL, 0xC83553C5C8965D3DULL,
+	0x952AB45CFA97A0B3ULL, 0xDE469FBD99A05FE3ULL, 0xA59BC234DB398C25ULL,
+	0xF6C69A72A3989F5CULL, 0xB7DCBF5354E9BECEULL, 0x88FCF317F22241E2ULL,
+	0xCC20CE9BD35C78A5ULL, 0x98165AF37B2153DFULL, 0xE2A0B5DC971F303AULL,
+	0xA8D9D1535CE3B396ULL, 0xFB9B7CD9A4A7443CULL, 0xBB764C4CA7A44410ULL,
+	0x8BAB8EEFB6409C1AULL, 0xD01FEF10A657842CULL, 0x9B10A4E5E9913129ULL,
+	0xE7109BFBA19C0C9DULL, 0xAC2820D9623BF429ULL, 0x80444B5E7AA7CF85ULL,
+	0xBF21E44003ACDD2DULL, 0x8E679C2F5E44FF8FULL, 0xD433179D9C8CB841ULL,
+	0x9E19DB92B4E31BA9ULL, 0xEB96BF6EBADF77D9ULL, 0xAF87023B9BF0EE6BULL,
+};
+static const int16_t cached_powers_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+	-954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+	-688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+	-422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+	-157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+	109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+	641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+	907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+// Pairs of decimal digits from 00 to 99.
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536"
+	"37383940414243444546474849505152535455565758596061626364656667686970717273"
+	"7475767778798081828384858687888990919293949596979899";
+
+// Powers of ten that fit in 64 bits.
+static const uint64_t powers_of_ten[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL
+};
+
+// Internal functions.
+size_t format_digits(char *buf, uint64_t value);
+diy_fp_t diy_multiply(const diy_fp_t a, const diy_fp_t b);
+diy_fp_t diy_normalize(diy_fp_t x);
+void grisu_round(char *digits, const size_t len, const uint64_t delta,
+				 uint64_t rest, const uint64_t ten_kappa, const uint64_t wp_w);
+size_t grisu_digits(const diy_fp_t w, const diy_fp_t mp, uint64_t delta,
+					char *digits, int *k);
+size_t grisu2(const double value, char *digits, int *k);
+size_t layout_digits(char *buf, const char *digits, const size_t len,
+					 const int k);
+
+
+/**
+ * Formats an integer.
+ *
+ * @param  buf   Buffer with at least NUMFMT_MAX_SIZE characters.
+ * @param  value Number to be formatted.
+ * @return       Length of the number.
+ */
+size_t numfmt_long(char *buf, const long value) {
+	if (value < 0) {
+		buf[0] = '-';
+		return format_digits(buf + 1, 0ULL - (uint64_t)value) + 1;
+	}
+
+	return format_digits(buf, (uint64_t)value);
+}
+
+/**
+ * Formats a fixed-point number, dropping trailing zeros of the fraction.
+ *
+ * @param  buf      Buffer with at least NUMFMT_MAX_SIZE characters.
+ * @param  value    Number scaled by 10^decimals.
+ * @param  decimals Number of decimal places in the value (up to 18).
+ * @return          Length of the number.
+ */
+size_t numfmt_fixed(char *buf, const int64_t value, const uint8_t decimals) {
+	uint64_t mag = (value < 0) ? (0ULL - (uint64_t)value) : (uint64_t)value;
+	uint64_t scale = powers_of_ten[(decimals > 18) ? 18 : decimals];
+	uint64_t frac = mag % scale;
+	size_t len = 0;
+
+	if (value < 0) {
+		buf[len++] = '-';
+	}
+	len += format_digits(buf + len, mag / scale);
+	if (frac == 0) {
+		return len;
+	}
+
+	// Write the fraction with its leading zeros and drop the trailing ones.
+	buf[len++] = '.';
+	for (uint64_t place = scale / 10; place > 0; place /= 10) {
+		buf[len++] = (char)('0' + ((frac / place) % 10));
+		if ((frac % place) == 0) {
+			break;
+		}
+	}
+	buf[len] = '\0';
+
+	return len;
+}
+
+/**
+ * Formats a double with the shortest number of digits that reads back as the
+ * same value. Numbers from NUMFMT_MIN_FIXED up to 10^21 are written without
+ * an exponent.
+ *
+ * @param  buf   Buffer with at least NUMFMT_MAX_SIZE characters.
+ * @param  value Number to be formatted.
+ * @return       Length of the number.
+ */
+size_t numfmt_double(char *buf, const double value) {
+	char digits[20];
+	size_t len = 0;
+	int k;
+
+	if (isnan(value)) {
+		strcpy(buf, "nan");
+		return 3;
+	}
+
+	if (signbit(value)) {
+		buf[len++] = '-';
+	}
+
+	if (isinf(value)) {
+		strcpy(buf + len, "inf");
+		return len + 3;
+	} else if (value == 0) {
+		strcpy(buf + len, "0");
+		return len + 1;
+	}
+
+	size_t count = grisu2(fabs(value), digits, &k);
+	return len + layout_digits(buf + len, digits, count, k);
+}
+
+/**
+ * Writes the digits of an unsigned integer.
+ *
+ * @param  buf   Buffer to write to.
+ * @param  value Number to be written.
+ * @return       Number of digits.
+ */
+size_t format_digits(char *buf, uint64_t value) {
+	char tmp[20];
+	size_t pos = sizeof(tmp);
+
+	// Two digits at a time from the end.
+	while (value >= 100) {
+		size_t pair = (size_t)(value % 100) * 2;
+		value /= 100;
+		tmp[--pos] = digit_pairs[pair + 1];
+		tmp[--pos] = digit_pairs[pair];
+	}
+
+	if (value >= 10) {
+		tmp[--pos] = digit_pairs[(value * 2) + 1];
+		tmp[--pos] = digit_pairs[value * 2];
+	} else {
+		tmp[--pos] = (char)('0' + value);
+	}
+
+	size_t len = sizeof(tmp) - pos;
+	memcpy(buf, tmp + pos, len);
+	buf[len] = '\0';
+
+	return len;
+}
+
+/**
+ * Multiplies two floating point numbers, rounding the result to 64 bits.
+ *
+ * @param  a First number.
+ * @param  b Second number.
+ * @return   Product of both.
+ */
+diy_fp_t diy_multiply(const diy_fp_t a, const diy_fp_t b) {
+	const uint64_t mask = 0xFFFFFFFFULL;
+	uint64_t ah = a.f >> 32;
+	uint64_t al = a.f & mask;
+	uint64_t bh = b.f >> 32;
+	uint64_t bl = b.f & mask;
+	uint64_t hh = ah * bh;
+	uint64_t lh = al * bh;
+	uint64_t hl = ah * bl;
+	uint64_t ll = al * bl;
+	uint64_t mid = (ll >> 32) + (lh & mask) + (hl & mask) + (1ULL << 31);
+	diy_fp_t result;
+
+	result.f = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+	result.e = a.e + b.e + 64;
+
+	return result;
+}
+
+/**
+ * Shifts a floating point number until its highest bit is set.
+ *
+ * @param  x Number to be normalized.
+ * @return   Normalized number.
+ */
+diy_fp_t diy_normalize(diy_fp_t x) {
+	while ((x.f & (1ULL << 63)) == 0) {
+		x.f <<= 1;
+		x.e--;
+	}
+
+	return x;
+}
+
+/**
+ * Nudges the last digit down while that brings the result closer to the
+ * real value without leaving the range that reads back as it.
+ *
+ * @param digits    Digits generated so far.
+ * @param len       Number of digits.
+ * @param delta     Size of the range.
+ * @param rest      Distance from the digits to the top of the range.
+ * @param ten_kappa Value of one unit of the last digit.
+ * @param wp_w      Distance from the real value to the top of the range.
+ */
+void grisu_round(char *digits, const size_t len, const uint64_t delta,
+				 uint64_t rest, const uint64_t ten_kappa,
+				 const uint64_t wp_w) {
+	while ((rest < wp_w) && ((delta - rest) >= ten_kappa) &&
+			(((rest + ten_kappa) < wp_w) ||
+			 ((wp_w - rest) > ((rest + ten_kappa) - wp_w)))) {
+		digits[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+/**
+ * Generates the shortest digits inside of the range that reads back as the
+ * value.
+ *
+ * @param  w      Scaled value.
+ * @param  mp     Scaled top of the range.
+ * @param  delta  Size of the range.
+ * @param  digits Buffer for the digits.
+ * @param  k      Decimal exponent, adjusted by the digits dropped.
+ * @return        Number of digits.
+ */
+size_t grisu_digits(const diy_fp_t w, const diy_fp_t mp, uint64_t delta,
+					char *digits, int *k) {
+	const int shift = -mp.e;
+	const uint64_t one = 1ULL << shift;
+	const uint64_t wp_w = mp.f - w.f;
+	uint32_t p1 = (uint32_t)(mp.f >> shift);
+	uint64_t p2 = mp.f & (one - 1);
+	size_t len = 0;
+	int kappa = 1;
+
+	while ((kappa < 10) && (p1 >= powers_of_ten[kappa])) {
+		kappa++;
+	}
+
+	// Integer part.
+	while (kappa > 0) {
+		uint32_t pow = (uint32_t)powers_of_ten[kappa - 1];
+		uint32_t d = p1 / pow;
+		p1 %= pow;
+
+		if ((d != 0) || (len != 0)) {
+			digits[len++] = (char)('0' + d);
+		}
+		kappa--;
+
+		uint64_t rest = ((uint64_t)p1 << shift) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			grisu_round(digits, len, delta, rest,
+						powers_of_ten[kappa] << shift, wp_w);
+			return len;
+		}
+	}
+
+	// Fractional part.
+	while (true) {
+		p2 *= 10;
+		delta *= 10;
+
+		char d = (char)(p2 >> shift);
+		if ((d != 0) || (len != 0)) {
+			digits[len++] = (char)('0' + d);
+		}
+		p2 &= one - 1;
+		kappa--;
+
+		if (p2 < delta) {
+			*k += kappa;
+			grisu_round(digits, len, delta, p2, one,
+						(-kappa < 20) ? (wp_w * powers_of_ten[-kappa]) : 0);
+			return len;
+		}
+	}
+}
+
+/**
+ * Gets the shortest digits that read back as a positive value.
+ *
+ * @param  value  Number to be converted. Must be positive and finite.
+ * @param  digits Buffer for at least 18 digits.
+ * @param  k      Decimal exponent of the last digit.
+ * @return        Number of digits.
+ */
+size_t grisu2(const double value, char *digits, int *k) {
+	uint64_t bits;
+	diy_fp_t v;
+
+	// Split the double up.
+	memcpy(&bits, &value, sizeof(bits));
+	int biased = (int)((bits & DOUBLE_EXPONENT_MASK) >>
+					   DOUBLE_SIGNIFICAND_BITS);
+	v.f = bits & DOUBLE_SIGNIFICAND_MASK;
+	if (biased != 0) {
+		v.f += DOUBLE_HIDDEN_BIT;
+		v.e = biased - DOUBLE_EXPONENT_BIAS;
+	} else {
+		v.e = 1 - DOUBLE_EXPONENT_BIAS;
+	}
+
+	// Boundaries halfway to the neighbouring doubles.
+	diy_fp_t plus = { (v.f << 1) + 1, v.e - 1 };
+	diy_fp_t minus;
+	plus = diy_normalize(plus);
+	if (v.f == DOUBLE_HIDDEN_BIT) {
+		minus.f = (v.f << 2) - 1;
+		minus.e = v.e - 2;
+	} else {
+		minus.f = (v.f << 1) - 1;
+		minus.e = v.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	// Scale everything by a power of ten that puts the exponent in range.
+	double dk = ((-61 - plus.e) * 0.30102999566398114) + 347;
+	int ik = (int)dk;
+	if ((dk - ik) > 0) {
+		ik++;
+	}
+	size_t index = (size_t)((ik >> 3) + 1);
+	diy_fp_t c = { cached_powers_f[index], cached_powers_e[index] };
+	*k = -(-348 + ((int)index * 8));
+
+	diy_fp_t w = diy_multiply(diy_normalize(v), c);
+	diy_fp_t wp = diy_multiply(plus, c);
+	diy_fp_t wm = diy_multiply(minus, c);
+	wm.f++;
+	wp.f--;
+
+	return grisu_digits(w, wp, wp.f - wm.f, digits, k);
+}
+
+/**
+ * Lays out the digits of a number with the decimal point or an exponent.
+ *
+ * @param  buf    Buffer to write to.
+ * @param  digits Significant digits.
+ * @param  len    Number of digits.
+ * @param  k      Decimal exponent of the last digit.
+ * @return        Length of the number.
+ */
+size_t layout_digits(char *buf, const char *digits, const size_t len,
+					 const int k) {
+	int point = (int)len + k;  // Digits before the decimal point.
+	size_t pos = 0;
+
+	if ((k >= 0) && (point <= NUMFMT_MAX_FIXED_DIGITS)) {
+		// Integer, padded with zeros.
+		memcpy(buf, digits, len);
+		memset(buf + len, '0', (size_t)k);
+		pos = (size_t)point;
+	} else if ((point > 0) && (point <= NUMFMT_MAX_FIXED_DIGITS)) {
+		// Decimal point in the middle of the digits.
+		memcpy(buf, digits, (size_t)point);
+		buf[point] = '.';
+		memcpy(buf + point + 1, digits + point, len - (size_t)point);
+		pos = len + 1;
+	} else if ((point <= 0) && (point > -6)) {
+		// Leading zeros after the decimal point.
+		buf[pos++] = '0';
+		buf[pos++] = '.';
+		memset(buf + pos, '0', (size_t)-point);
+		pos += (size_t)-point;
+		memcpy(buf + pos, digits, len);
+		pos += len;
+	} else {
+		// Exponent form, with a single digit before the decimal point.
+		buf[pos++] = digits[0];
+		if (len > 1) {
+			buf[pos++] = '.';
+			memcpy(buf + pos, digits + 1, len - 1);
+			pos += len - 1;
+		}
+
+		buf[pos++] = 'e';
+		buf[pos++] = (point - 1 < 0) ? '-' : '+';
+		pos += format_digits(buf + pos, (uint64_t)abs(point - 1));
+	}
+	buf[pos] = '\0';
+
+	return pos;
+}
@@ -0,0 +1,25 @@
+/**
+ * engine/numfmt.h
+ * Fast and locale independent number formatting for the exporters.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _NUMFMT_H
+#define _NUMFMT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Constants.
+#define NUMFMT_MAX_SIZE  32    // Enough for any number plus the terminator.
+#define NUMFMT_MIN_FIXED 1e-6  // Smaller numbers are written with an exponent.
+
+// Formatting. Every function NULL terminates the buffer and returns the
+// length of the number.
+size_t numfmt_long(char *buf, const long value);
+size_t numfmt_fixed(char *buf, const int64_t value, const uint8_t decimals);
+size_t numfmt_double(char *buf, const double value);
+
+#endif
@@ -0,0 +1,453 @@
+/**
+ * engine/offset.c
+ * Offsetting of closed outlines and open paths (kerf compensation).
+ *
+ * The lines are first split into the closed areas they form (using the
+ * even-odd rule, like the boolean operations) and the open paths that dangle
+ * from them. Every ring of an area goes around it counter-clockwise (and
+ * clockwise around holes), so offsetting is just a matter of moving each edge
+ * to its right and joining the corners. Open paths are treated as a ring that
+ * goes along the path and comes back, which offsets both sides and turns the
+ * joins at each end into caps.
+ *
+ * The raw offset rings overlap themselves around concave corners and where
+ * the offset is larger than the features, so they get cleaned up by only
+ * keeping what has a positive winding number. Each area and path is offset
+ * and cleaned up as a separate task in the thread pool, and the results are
+ * merged in the end.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "diagnostics.h"
+#include "threadpool.h"
+#include "offset.h"
+
+// Points of the raw offset ring being built.
+typedef struct {
+	size_t   count;
+	size_t   capacity;
+	int64_t *x;
+	int64_t *y;
+} ring_points_t;
+
+// Open path (vertex indices of the planar graph).
+typedef struct {
+	size_t start;
+	size_t count;
+} offset_path_t;
+
+// Everything the offsetting tasks need.
+typedef struct {
+	const planar_graph_t *graph;
+	const region_set_t   *areas;
+	size_t               *path_vertices;
+	offset_path_t        *paths;
+	size_t                path_count;
+	double                distance;
+	uint8_t               join;
+	region_set_t         *results;
+} offset_job_t;
+
+// Internal functions.
+void offset_task(void *data, const size_t index);
+void offset_ring(planar_segments_t *segs, const double *x, const double *y,
+				 const size_t count, const double distance,
+				 const uint8_t join);
+void add_join(ring_points_t *ring, const double px, const double py,
+			  const double ex1, const double ey1, const double ex2,
+			  const double ey2, const double distance, const uint8_t join);
+void add_point(ring_points_t *ring, const double x, const double y);
+void push_ring(planar_segments_t *segs, const region_set_t *set,
+			   const size_t ring);
+size_t find_paths(const planar_graph_t *graph, size_t **vertices,
+				  offset_path_t **paths);
+
+
+/**
+ * Offsets the closed areas and open paths formed by some lines.
+ *
+ * @param  filter   Lines to be offset.
+ * @param  distance How much to grow the areas (negative to shrink them).
+ *                  Open paths are only offset when growing.
+ * @param  join     How to join the edges around corners (OFFSET_JOIN_*).
+ * @param  snap     Endpoints closer than this are considered the same point.
+ * @param  result   Resulting regions. Must be initialized.
+ * @return          TRUE if the offsetting was successful.
+ */
+bool offset_apply(const object_filter_t *filter, const long distance,
+				  const uint8_t join, const long snap, region_set_t *result) {
+	planar_segments_t segs = { 0, 0, NULL };
+	planar_graph_t graph;
+	region_set_t areas;
+	offset_job_t job;
+
+	if (join > OFFSET_JOIN_SQUARE) {
+		diag_report(DIAG_ERROR, DIAG_CODE_GENERIC, join,
+					"Invalid offset join type: %u.", join);
+		return false;
+	}
+
+	// Split the lines keeping the dangling ones as open paths.
+	regions_collect(filter, 0, &segs);
+	planar_init(&graph);
+	if (!planar_build(&graph, segs.list, segs.count, 1, snap, false)) {
+		free(segs.list);
+		return false;
+	}
+
+	// Get the areas out of the faces inside of the outlines.
+	bool *inside = malloc(sizeof(bool) * (graph.face_count + 1));
+	for (size_t f = 0; f < graph.face_count; f++) {
+		inside[f] = (graph.face_wind[f] & 1) != 0;
+	}
+
+	regions_init(&areas);
+	bool success = regions_merge_faces(&areas, &graph, inside);
+	free(inside);
+	if (!success) {
+		planar_free(&graph);
+		free(segs.list);
+		return false;
+	}
+
+	// Offset every area and path on its own.
+	job.graph = &graph;
+	job.areas = &areas;
+	job.path_count = (distance > 0) ?
+		find_paths(&graph, &job.path_vertices, &job.paths) : 0;
+	job.distance = (double)distance;
+	job.join = join;
+	job.results = malloc(sizeof(region_set_t) *
+						 (areas.count + job.path_count + 1));
+	for (size_t i = 0; i < (areas.count + job.path_count); i++) {
+		regions_init(&job.results[i]);
+	}
+
+	threadpool_run(offset_task, &job, areas.count + job.path_count);
+
+	// Merge everything together.
+	segs.count = 0;
+	for (size_t i = 0; i < (areas.count + job.path_count); i++) {
+		for (size_t r = 0; r < job.results[i].ring_count; r++) {
+			push_ring(&segs, &job.results[i], r);
+		}
+
+		regions_free(&job.results[i]);
+	}
+
+	success = regions_from_boundary(result, segs.list, segs.count);
+	result->segment_count = graph.segment_count;
+	result->intersection_count = graph.intersection_count;
+
+	if (job.path_count > 0) {
+		free(job.path_vertices);
+		free(job.paths);
+	}
+	free(job.results);
+	free(segs.list);
+	regions_free(&areas);
+	planar_free(&graph);
+
+	return success;
+}
+
+/**
+ * Offsets a single area or open path and cleans up its outline.
+ *
+ * @param data  Offsetting job.
+ * @param index Area index, followed by the path indices.
+ */
+void offset_task(void *data, const size_t index) {
+	offset_job_t *job = (offset_job_t *)data;
+	planar_segments_t segs = { 0, 0, NULL };
+	double *x;
+	double *y;
+
+	if (index < job->areas->count) {
+		// Offset every ring of the area.
+		const region_set_t *areas = job->areas;
+		const region_t *area = &areas->list[index];
+
+		for (size_t h = 0; h <= area->hole_count; h++) {
+			const region_ring_t *ring = (h == 0) ? &areas->rings[area->outer] :
+				&areas->rings[areas->holes[area->first_hole + h - 1]];
+
+			x = malloc(sizeof(double) * ring->count);
+			y = malloc(sizeof(double) * ring->count);
+			for (size_t i = 0; i < ring->count; i++) {
+				x[i] = (double)areas->points[ring->start + i].x;
+				y[i] = (double)areas->points[ring->start + i].y;
+			}
+
+			offset_ring(&segs, x, y, ring->count, job->distance, job->join);
+			free(x);
+			free(y);
+		}
+	} else {
+		// Go along the path and back.
+		const offset_path_t *path = &job->paths[index - job->areas->count];
+		const size_t *vertices = &job->path_vertices[path->start];
+		size_t count = (path->count * 2) - 2;
+
+		x = malloc(sizeof(double) * count);
+		y = malloc(sizeof(double) * count);
+		for (size_t i = 0; i < count; i++) {
+			size_t v = (i < path->count) ? vertices[i] :
+				vertices[count - i];
+			x[i] = (double)job->graph->x[v];
+			y[i] = (double)job->graph->y[v];
+		}
+
+		offset_ring(&segs, x, y, count, job->distance, job->join);
+		free(x);
+		free(y);
+	}
+
+	regions_from_boundary(&job->results[index], segs.list, segs.count);
+	free(segs.list);
+}
+
+/**
+ * Builds the raw offset of a ring, moving every edge to its right.
+ *
+ * @param segs     Where the offset edges get appended to.
+ * @param x        Vertices X.
+ * @param y        Vertices Y.
+ * @param count    Number of vertices.
+ * @param distance Offset distance.
+ * @param join     Join type.
+ */
+void offset_ring(planar_segments_t *segs, const double *x, const double *y,
+				 const size_t count, const double distance,
+				 const uint8_t join) {
+	ring_points_t ring = { 0, 0, NULL, NULL };
+
+	if (count < 2) {
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		size_t prev = (i + count - 1) % count;
+		size_t next = (i + 1) % count;
+		double ex1 = x[i] - x[prev];
+		double ey1 = y[i] - y[prev];
+		double ex2 = x[next] - x[i];
+		double ey2 = y[next] - y[i];
+		double len1 = hypot(ex1, ey1);
+		double len2 = hypot(ex2, ey2);
+
+		if ((len1 == 0) || (len2 == 0)) {
+			continue;
+		}
+
+		add_join(&ring, x[i], y[i], ex1 / len1, ey1 / len1, ex2 / len2,
+				 ey2 / len2, distance, join);
+	}
+
+	// Close the ring.
+	for (size_t i = 0; i < ring.count; i++) {
+		size_t next = (i + 1) % ring.count;
+		if ((ring.x[i] != ring.x[next]) || (ring.y[i] != ring.y[next])) {
+			planar_push_segment(segs, ring.x[i], ring.y[i], ring.x[next],
+								ring.y[next], 0);
+		}
+	}
+
+	free(ring.x);
+	free(ring.y);
+}
+
+/**
+ * Adds the corner of an offset ring.
+ *
+ * @param ring     Ring being built.
+ * @param px       Corner X.
+ * @param py       Corner Y.
+ * @param ex1      Direction of the edge coming into the corner (unit).
+ * @param ey1      Direction of the edge coming into the corner (unit).
+ * @param ex2      Direction of the edge leaving the corner (unit).
+ * @param ey2      Direction of the edge leaving the corner (unit).
+ * @param distance Offset distance.
+ * @param join     Join type.
+ */
+void add_join(ring_points_t *ring, const double px, const double py,
+			  const double ex1, const double ey1, const double ex2,
+			  const double ey2, const double distance, const uint8_t join) {
+	double cross = (ex1 * ey2) - (ey1 * ex2);
+	double dot = (ex1 * ex2) + (ey1 * ey2);
+	double ax = px + (distance * ey1);
+	double ay = py - (distance * ex1);
+	double bx = px + (distance * ey2);
+	double by = py - (distance * ex2);
+	double angle = atan2(cross, dot);
+	double d = fabs(distance);
+
+	// Going straight ahead.
+	if ((cross == 0) && (dot > 0)) {
+		add_point(ring, ax, ay);
+		return;
+	}
+
+	// Turning back counts as a left turn, so ends of paths get capped.
+	if (cross == 0) {
+		angle = M_PI;
+	}
+
+	// The offset edges overlap on the inside of the corner, so just go
+	// through the corner and let the clean up take care of the rest.
+	if ((angle * distance) < 0) {
+		add_point(ring, ax, ay);
+		add_point(ring, px, py);
+		add_point(ring, bx, by);
+		return;
+	}
+
+	// Fill the gap on the outside of the corner.
+	if ((join == OFFSET_JOIN_ROUND) && (d > OFFSET_ROUND_TOLERANCE)) {
+		double step = 2 * acos(1 - (OFFSET_ROUND_TOLERANCE / d));
+		size_t steps = (size_t)ceil(fabs(angle) / step);
+
+		for (size_t i = 0; i <= steps; i++) {
+			double a = (angle * i) / steps;
+			double nx = (ey1 * cos(a)) + (ex1 * sin(a));
+			double ny = (ey1 * sin(a)) - (ex1 * cos(a));
+
+			add_point(ring, px + (distance * nx), py + (distance * ny));
+		}
+	} else if ((join == OFFSET_JOIN_MITRE) &&
+			   (1 / cos(fabs(angle) / 2) <= OFFSET_MITRE_LIMIT)) {
+		double t = d * tan(fabs(angle) / 2);
+		add_point(ring, ax + (ex1 * t), ay + (ey1 * t));
+	} else {
+		double t = d * tan(fabs(angle) / 4);
+		add_point(ring, ax + (ex1 * t), ay + (ey1 * t));
+		add_point(ring, bx - (ex2 * t), by - (ey2 * t));
+	}
+}
+
+/**
+ * Adds a point to the ring being built.
+ *
+ * @param ring Ring being built.
+ * @param x    Point X.
+ * @param y    Point Y.
+ */
+void add_point(ring_points_t *ring, const double x, const double y) {
+	if (ring->count >= ring->capacity) {
+		ring->capacity = (ring->capacity == 0) ? 64 : ring->capacity * 2;
+		ring->x = realloc(ring->x, sizeof(int64_t) * ring->capacity);
+		ring->y = realloc(ring->y, sizeof(int64_t) * ring->capacity);
+	}
+
+	ring->x[ring->count] = (int64_t)llround(x);
+	ring->y[ring->count] = (int64_t)llround(y);
+	ring->count++;
+}
+
+/**
+ * Appends the edges of a region ring to the list.
+ *
+ * @param segs Segment list.
+ * @param set  Region set.
+ * @param ring Ring index.
+ */
+void push_ring(planar_segments_t *segs, const region_set_t *set,
+			   const size_t ring) {
+	const region_ring_t *r = &set->rings[ring];
+
+	for (size_t i = 0; i < r->count; i++) {
+		const coord_t *a = &set->points[r->start + i];
+		const coord_t *b = &set->points[r->start + ((i + 1) % r->count)];
+		planar_push_segment(segs, a->x, a->y, b->x, b->y, 0);
+	}
+}
+
+/**
+ * Chains the dangling edges of a planar graph into open paths.
+ *
+ * @param  graph    Planar graph.
+ * @param  vertices Where the vertices of every path get stored.
+ * @param  paths    Where the paths get stored.
+ * @return          Number of paths.
+ */
+size_t find_paths(const planar_graph_t *graph, size_t **vertices,
+				  offset_path_t **paths) {
+	size_t half_count = graph->edge_count * 2;
+	size_t *degree = calloc(graph->vertex_count + 1, sizeof(size_t));
+	size_t *start = calloc(graph->vertex_count + 2, sizeof(size_t));
+	size_t *adj = malloc(sizeof(size_t) * (half_count + 1));
+	bool *used = calloc(graph->edge_count + 1, sizeof(bool));
+	size_t path_count = 0;
+	size_t vertex_count = 0;
+
+	// Adjacency of the edges with the same face on both sides.
+	for (size_t he = 0; he < half_count; he++) {
+		if (graph->face[he] == graph->face[he ^ 1]) {
+			degree[graph->origin[he]]++;
+		}
+	}
+	for (size_t v = 0; v < graph->vertex_count; v++) {
+		start[v + 1] = start[v] + degree[v];
+	}
+	size_t *fill = malloc(sizeof(size_t) * (graph->vertex_count + 1));
+	memcpy(fill, start, sizeof(size_t) * (graph->vertex_count + 1));
+	for (size_t he = 0; he < half_count; he++) {
+		if (graph->face[he] == graph->face[he ^ 1]) {
+			adj[fill[graph->origin[he]]++] = he;
+		}
+	}
+	free(fill);
+
+	*vertices = malloc(sizeof(size_t) * (half_count + 1));
+	*paths = malloc(sizeof(offset_path_t) * (graph->edge_count + 1));
+
+	// Walk from every vertex that isn't in the middle of a path.
+	for (size_t v = 0; v < graph->vertex_count; v++) {
+		if (degree[v] == 2) {
+			continue;
+		}
+
+		for (size_t i = start[v]; i < start[v + 1]; i++) {
+			size_t he = adj[i];
+			if (used[he / 2]) {
+				continue;
+			}
+
+			offset_path_t *path = &(*paths)[path_count++];
+			path->start = vertex_count;
+			path->count = 1;
+			(*vertices)[vertex_count++] = v;
+
+			while (true) {
+				size_t to = graph->origin[he ^ 1];
+				used[he / 2] = true;
+				(*vertices)[vertex_count++] = to;
+				path->count++;
+
+				// Keep going while there's only one way forward.
+				if (degree[to] != 2) {
+					break;
+				}
+
+				size_t forward = adj[start[to]];
+				if (forward == (he ^ 1)) {
+					forward = adj[start[to] + 1];
+				}
+				if (used[forward / 2]) {
+					break;
+				}
+				he = forward;
+			}
+		}
+	}
+
+	free(degree);
+	free(start);
+	free(adj);
+	free(used);
+
+	return path_count;
+}
@@ -0,0 +1,30 @@
+/**
+ * engine/offset.h
+ * Offsetting of closed outlines and open paths (kerf compensation).
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _OFFSET_H
+#define _OFFSET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "nanocad.h"
+#include "regions.h"
+
+// Join types.
+#define OFFSET_JOIN_MITRE  0
+#define OFFSET_JOIN_ROUND  1
+#define OFFSET_JOIN_SQUARE 2
+
+// Limits.
+#define OFFSET_MITRE_LIMIT     2.0   // Times the distance, from the corner.
+#define OFFSET_ROUND_TOLERANCE 0.25  // Maximum distance from the true arc.
+
+// Operation.
+bool offset_apply(const object_filter_t *filter, const long distance,
+				  const uint8_t join, const long snap, region_set_t *result);
+
+#endif
@@ -0,0 +1,1013 @@
+/**
+ * engine/pathorder.c
+ * Drawing order of the objects that keeps the pen travel of plotters and
+ * cutters short.
+ *
+ * Ordering goes through a couple of passes:
+ *
+ *   1. Objects that share an endpoint are joined into chains, flipping them
+ *      as needed, so they can be drawn without lifting the pen.
+ *   2. Starting from the origin, the chain with the closest end is always
+ *      drawn next (nearest neighbour), entering it from that end.
+ *   3. The tour is improved with 2-opt moves, which reverse a run of chains
+ *      whenever that shortens the travel, only looking at chain ends that
+ *      are close by.
+ *   4. Closed chains are rotated to start at whichever of their vertices
+ *      is the closest to where the pen comes from and goes to next.
+ *
+ * If all of that still ends up travelling more than the command order, the
+ * command order is used instead.
+ *
+ * Chain ends are kept in a uniform grid for both the nearest neighbour
+ * queries and the 2-opt candidates, so the whole thing stays close to linear.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "diagnostics.h"
+#include "pathorder.h"
+
+// Constants.
+#define PATHORDER_NONE            SIZE_MAX
+#define PATHORDER_CANDIDATE_RINGS 2  // Grid rings searched for 2-opt moves.
+
+// Objects being gathered from the document. Segment s goes from point 2s to
+// point 2s + 1.
+typedef struct {
+	size_t   count;
+	size_t   capacity;
+	size_t  *object;
+	int64_t *x;
+	int64_t *y;
+} segment_list_t;
+
+// Point in the hash of segment ends.
+typedef struct {
+	size_t point;    // Any segment end at the point.
+	size_t waiting;  // Segment end that wasn't paired up yet.
+} end_slot_t;
+
+// Uniform grid of points. Only the first live items of each cell are valid.
+typedef struct {
+	int64_t  min_x;
+	int64_t  min_y;
+	int64_t  size;
+	size_t   cols;
+	size_t   rows;
+	size_t  *start;
+	size_t  *live;
+	size_t  *items;
+	size_t   count;
+} point_grid_t;
+
+// Chains of segments and the tour going through them. The ends of chain c are
+// 2c (where it starts) and 2c + 1 (where it ends).
+typedef struct {
+	size_t   count;
+	size_t  *steps;  // Segment ends the pen enters each segment from.
+	size_t  *start;
+	int64_t *x;      // Per chain end.
+	int64_t *y;
+	bool    *done;
+
+	size_t  *tour;   // Chain at each position. Position 0 is the origin.
+	bool    *flip;   // Chain is entered from its end.
+	size_t  *pos;    // Position of each chain.
+} chain_set_t;
+
+// Internal functions.
+bool gather_segments(const object_span_t *span, void *data);
+void link_ends(const segment_list_t *segs, size_t *link);
+void build_chains(const segment_list_t *segs, const size_t *link,
+				  chain_set_t *chains);
+double distance(const int64_t x1, const int64_t y1, const int64_t x2,
+				const int64_t y2);
+void point_grid_build(point_grid_t *grid, const size_t *ids, const size_t count,
+				const int64_t *x, const int64_t *y);
+void point_grid_free(point_grid_t *grid);
+size_t point_grid_col(const point_grid_t *grid, const int64_t x);
+size_t point_grid_row(const point_grid_t *grid, const int64_t y);
+size_t point_grid_nearest(point_grid_t *grid, const chain_set_t *chains,
+					const int64_t x, const int64_t y);
+void nearest_in_cell(point_grid_t *grid, const chain_set_t *chains,
+					 const size_t cell, const int64_t x, const int64_t y,
+					 size_t *best, double *best_dist);
+void order_nearest(chain_set_t *chains);
+void renumber_chains(chain_set_t *chains);
+size_t exit_end(const chain_set_t *chains, const size_t pos);
+size_t entry_end(const chain_set_t *chains, const size_t pos);
+double edge_length(const chain_set_t *chains, const size_t pos);
+double move_gain(const chain_set_t *chains, size_t a, size_t b);
+void reverse_run(chain_set_t *chains, const size_t a, const size_t b);
+void order_two_opt(chain_set_t *chains);
+void rotate_closed_chains(const segment_list_t *segs, chain_set_t *chains);
+double tour_travel(const chain_set_t *chains);
+void order_commands(const segment_list_t *segs, path_order_t *order);
+
+
+/**
+ * Initializes an empty path order.
+ *
+ * @param order Path order.
+ */
+void pathorder_init(path_order_t *order) {
+	memset(order, 0, sizeof(path_order_t));
+}
+
+/**
+ * Frees everything allocated by a path order.
+ *
+ * @param order Path order.
+ */
+void pathorder_free(path_order_t *order) {
+	free(order->object);
+	free(order->reversed);
+	free(order->chain_start);
+
+	pathorder_init(order);
+}
+
+/**
+ * Finds a drawing order for the objects of the document that keeps the pen
+ * travel between them short. Objects may be drawn backwards.
+ *
+ * @param  filter Which objects should be ordered.
+ * @param  order  Path order to be populated. Must be initialized.
+ * @return        TRUE if the order was found.
+ */
+bool pathorder_build(const object_filter_t *filter, path_order_t *order) {
+	segment_list_t segs = { 0, 0, NULL, NULL, NULL };
+	chain_set_t chains;
+
+	pathorder_free(order);
+	nanocad_visit_objects(filter, gather_segments, &segs);
+
+	// Travel in command order.
+	int64_t px = 0;
+	int64_t py = 0;
+	for (size_t s = 0; s < segs.count; s++) {
+		order->travel_before += distance(px, py, segs.x[s * 2],
+										 segs.y[s * 2]);
+		px = segs.x[(s * 2) + 1];
+		py = segs.y[(s * 2) + 1];
+	}
+
+	// Join the segments into chains and order them.
+	size_t *link = malloc(sizeof(size_t) * ((segs.count * 2) + 1));
+	link_ends(&segs, link);
+	build_chains(&segs, link, &chains);
+	free(link);
+
+	order_nearest(&chains);
+	order->travel_nearest = tour_travel(&chains);
+	renumber_chains(&chains);
+	order_two_opt(&chains);
+	rotate_closed_chains(&segs, &chains);
+	order->travel_after = tour_travel(&chains);
+
+	// Lay the steps out in the order they should be drawn.
+	order->count = segs.count;
+	order->object = malloc(sizeof(size_t) * (segs.count + 1));
+	order->reversed = malloc(sizeof(bool) * (segs.count + 1));
+	order->chain_count = chains.count;
+	order->chain_start = malloc(sizeof(size_t) * (chains.count + 1));
+	size_t step = 0;
+	for (size_t p = 1; p <= chains.count; p++) {
+		size_t c = chains.tour[p];
+		size_t first = chains.start[c];
+		size_t last = chains.start[c + 1];
+
+		order->chain_start[p - 1] = step;
+		for (size_t i = first; i < last; i++) {
+			size_t end = chains.flip[p] ? (chains.steps[first + last - i - 1]
+										   ^ 1) : chains.steps[i];
+
+			order->object[step] = segs.object[end >> 1];
+			order->reversed[step] = (end & 1) != 0;
+			step++;
+		}
+	}
+	order->chain_start[chains.count] = step;
+
+	// Never do worse than just following the commands.
+	if (order->travel_after > order->travel_before) {
+		order_commands(&segs, order);
+	}
+
+	free(segs.object);
+	free(segs.x);
+	free(segs.y);
+	free(chains.steps);
+	free(chains.start);
+	free(chains.x);
+	free(chains.y);
+	free(chains.done);
+	free(chains.tour);
+	free(chains.flip);
+	free(chains.pos);
+
+	return true;
+}
+
+/**
+ * Object visitor that gathers the endpoints of every object.
+ *
+ * @param  span Object being visited.
+ * @param  data Segment list.
+ * @return      Always TRUE to keep going.
+ */
+bool gather_segments(const object_span_t *span, void *data) {
+	segment_list_t *segs = (segment_list_t *)data;
+
+	if (span->coord_count < 2) {
+		return true;
+	}
+
+	if (segs->count == segs->capacity) {
+		segs->capacity = (segs->capacity == 0) ? 1024 : segs->capacity * 2;
+		segs->object = realloc(segs->object, sizeof(size_t) * segs->capacity);
+		segs->x = realloc(segs->x, sizeof(int64_t) * segs->capacity * 2);
+		segs->y = realloc(segs->y, sizeof(int64_t) * segs->capacity * 2);
+	}
+
+	size_t s = segs->count++;
+	segs->object[s] = span->index;
+	segs->x[s * 2] = span->coord[0].x;
+	segs->y[s * 2] = span->coord[0].y;
+	segs->x[(s * 2) + 1] = span->coord[span->coord_count - 1].x;
+	segs->y[(s * 2) + 1] = span->coord[span->coord_count - 1].y;
+
+	return true;
+}
+
+/**
+ * Pairs up the segment ends that are at the same point, so the pen can go
+ * from one segment straight into the other.
+ *
+ * @param segs Segments.
+ * @param link Other segment end paired with each one or PATHORDER_NONE.
+ */
+void link_ends(const segment_list_t *segs, size_t *link) {
+	size_t count = segs->count * 2;
+	size_t size = 16;
+	while (size < (count * 2)) {
+		size *= 2;
+	}
+
+	// Every point gets a slot with one of its ends and an end still waiting
+	// to be paired up there.
+	end_slot_t *slots = malloc(sizeof(end_slot_t) * size);
+	for (size_t i = 0; i < size; i++) {
+		slots[i].point = PATHORDER_NONE;
+	}
+
+	for (size_t e = 0; e < count; e++) {
+		uint64_t hash = ((uint64_t)segs->x[e] * 0x9E3779B97F4A7C15ULL) ^
+			((uint64_t)segs->y[e] * 0xC2B2AE3D27D4EB4FULL);
+		size_t i = (size_t)(hash ^ (hash >> 29)) & (size - 1);
+
+		link[e] = PATHORDER_NONE;
+		while ((slots[i].point != PATHORDER_NONE) &&
+				((segs->x[slots[i].point] != segs->x[e]) ||
+				 (segs->y[slots[i].point] != segs->y[e]))) {
+			i = (i + 1) & (size - 1);
+		}
+
+		// Pair them two by two, never with the other end of the same segment.
+		if (slots[i].point == PATHORDER_NONE) {
+			slots[i].point = e;
+			slots[i].waiting = e;
+		} else if (slots[i].waiting == PATHORDER_NONE) {
+			slots[i].waiting = e;
+		} else if ((slots[i].waiting >> 1) != (e >> 1)) {
+			link[slots[i].waiting] = e;
+			link[e] = slots[i].waiting;
+			slots[i].waiting = PATHORDER_NONE;
+		}
+	}
+
+	free(slots);
+}
+
+/**
+ * Follows the paired segment ends to build the chains.
+ *
+ * @param segs   Segments.
+ * @param link   Other segment end paired with each one.
+ * @param chains Chain set to be populated.
+ */
+void build_chains(const segment_list_t *segs, const size_t *link,
+				  chain_set_t *chains) {
+	bool *visited = calloc(segs->count + 1, sizeof(bool));
+
+	chains->count = 0;
+	chains->steps = malloc(sizeof(size_t) * (segs->count + 1));
+	chains->start = malloc(sizeof(size_t) * (segs->count + 2));
+	chains->x = malloc(sizeof(int64_t) * ((segs->count + 1) * 2));
+	chains->y = malloc(sizeof(int64_t) * ((segs->count + 1) * 2));
+
+	size_t step = 0;
+	for (size_t s = 0; s < segs->count; s++) {
+		if (visited[s]) {
+			continue;
+		}
+
+		// Walk backwards to where the chain starts. Loops have no start, so
+		// they begin with the segment we started from.
+		size_t entry = s * 2;
+		while (link[entry] != PATHORDER_NONE) {
+			size_t prev = link[entry] ^ 1;
+			if ((prev >> 1) == s) {
+				entry = s * 2;
+				break;
+			}
+
+			entry = prev;
+		}
+
+		// Walk forward through the chain.
+		size_t c = chains->count++;
+		chains->start[c] = step;
+		chains->x[c * 2] = segs->x[entry];
+		chains->y[c * 2] = segs->y[entry];
+		while (true) {
+			chains->steps[step++] = entry;
+			visited[entry >> 1] = true;
+
+			size_t next = link[entry ^ 1];
+			if ((next == PATHORDER_NONE) || visited[next >> 1]) {
+				break;
+			}
+
+			entry = next;
+		}
+		chains->x[(c * 2) + 1] = segs->x[entry ^ 1];
+		chains->y[(c * 2) + 1] = segs->y[entry ^ 1];
+	}
+	chains->start[chains->count] = step;
+
+	// The origin is a chain of its own, always at the start of the tour.
+	chains->x[chains->count * 2] = 0;
+	chains->y[chains->count * 2] = 0;
+	chains->x[(chains->count * 2) + 1] = 0;
+	chains->y[(chains->count * 2) + 1] = 0;
+
+	chains->done = calloc(chains->count + 1, sizeof(bool));
+	chains->tour = malloc(sizeof(size_t) * (chains->count + 1));
+	chains->flip = calloc(chains->count + 1, sizeof(bool));
+	chains->pos = malloc(sizeof(size_t) * (chains->count + 1));
+	chains->tour[0] = chains->count;
+	chains->pos[chains->count] = 0;
+
+	free(visited);
+}
+
+/**
+ * Distance between two points.
+ *
+ * @param  x1 First point X.
+ * @param  y1 First point Y.
+ * @param  x2 Second point X.
+ * @param  y2 Second point Y.
+ * @return    Euclidean distance between them.
+ */
+double distance(const int64_t x1, const int64_t y1, const int64_t x2,
+				const int64_t y2) {
+	double dx = (double)(x2 - x1);
+	double dy = (double)(y2 - y1);
+
+	return sqrt((dx * dx) + (dy * dy));
+}
+
+/**
+ * Builds a uniform grid with about one point per cell.
+ *
+ * @param grid  Grid to be built.
+ * @param ids   Points to put in it.
+ * @param count Number of points.
+ * @param x     X coordinate of each point ID.
+ * @param y     Y coordinate of each point ID.
+ */
+void point_grid_build(point_grid_t *grid, const size_t *ids, const size_t count,
+				const int64_t *x, const int64_t *y) {
+	int64_t max_x = INT64_MIN;
+	int64_t max_y = INT64_MIN;
+
+	grid->min_x = INT64_MAX;
+	grid->min_y = INT64_MAX;
+	for (size_t i = 0; i < count; i++) {
+		size_t id = ids[i];
+
+		if (x[id] < grid->min_x) grid->min_x = x[id];
+		if (y[id] < grid->min_y) grid->min_y = y[id];
+		if (x[id] > max_x) max_x = x[id];
+		if (y[id] > max_y) max_y = y[id];
+	}
+	if (count == 0) {
+		grid->min_x = grid->min_y = max_x = max_y = 0;
+	}
+
+	// Size the cells for about one point each.
+	double width = (double)(max_x - grid->min_x) + 1;
+	double height = (double)(max_y - grid->min_y) + 1;
+	grid->size = (int64_t)ceil(sqrt((width * height) / (double)(count + 1)));
+	if (grid->size < 1) {
+		grid->size = 1;
+	}
+	while ((((width / grid->size) + 1) * ((height / grid->size) + 1)) >
+			((double)count * 2) + 16) {
+		grid->size = (grid->size * 5 / 4) + 1;
+	}
+	grid->cols = (size_t)((max_x - grid->min_x) / grid->size) + 1;
+	grid->rows = (size_t)((max_y - grid->min_y) / grid->size) + 1;
+
+	// Bucket the points in the cells.
+	size_t cells = grid->cols * grid->rows;
+	grid->start = calloc(cells + 1, sizeof(size_t));
+	grid->live = calloc(cells + 1, sizeof(size_t));
+	grid->items = malloc(sizeof(size_t) * (count + 1));
+	grid->count = count;
+	for (size_t i = 0; i < count; i++) {
+		size_t cell = (point_grid_row(grid, y[ids[i]]) * grid->cols) +
+			point_grid_col(grid, x[ids[i]]);
+		grid->live[cell]++;
+	}
+
+	size_t total = 0;
+	for (size_t cell = 0; cell < cells; cell++) {
+		grid->start[cell] = total;
+		total += grid->live[cell];
+		grid->live[cell] = 0;
+	}
+	grid->start[cells] = total;
+
+	for (size_t i = 0; i < count; i++) {
+		size_t cell = (point_grid_row(grid, y[ids[i]]) * grid->cols) +
+			point_grid_col(grid, x[ids[i]]);
+		grid->items[grid->start[cell] + grid->live[cell]++] = ids[i];
+	}
+}
+
+/**
+ * Frees everything allocated by a grid.
+ *
+ * @param grid Grid.
+ */
+void point_grid_free(point_grid_t *grid) {
+	free(grid->start);
+	free(grid->live);
+	free(grid->items);
+}
+
+/**
+ * Gets the grid column of a coordinate, clamped to the grid.
+ *
+ * @param  grid Grid.
+ * @param  x    X coordinate.
+ * @return      Column index.
+ */
+size_t point_grid_col(const point_grid_t *grid, const int64_t x) {
+	if (x <= grid->min_x) {
+		return 0;
+	}
+
+	size_t col = (size_t)((x - grid->min_x) / grid->size);
+	return (col >= grid->cols) ? (grid->cols - 1) : col;
+}
+
+/**
+ * Gets the grid row of a coordinate, clamped to the grid.
+ *
+ * @param  grid Grid.
+ * @param  y    Y coordinate.
+ * @return      Row index.
+ */
+size_t point_grid_row(const point_grid_t *grid, const int64_t y) {
+	if (y <= grid->min_y) {
+		return 0;
+	}
+
+	size_t row = (size_t)((y - grid->min_y) / grid->size);
+	return (row >= grid->rows) ? (grid->rows - 1) : row;
+}
+
+/**
+ * Finds the closest end of a chain that wasn't drawn yet.
+ *
+ * @param  grid   Grid of chain ends.
+ * @param  chains Chain set.
+ * @param  x      X coordinate of the pen.
+ * @param  y      Y coordinate of the pen.
+ * @return        Closest chain end or PATHORDER_NONE if all were drawn.
+ */
+size_t point_grid_nearest(point_grid_t *grid, const chain_set_t *chains,
+					const int64_t x, const int64_t y) {
+	long col = (long)point_grid_col(grid, x);
+	long row = (long)point_grid_row(grid, y);
+	long max_ring = (long)((grid->cols > grid->rows) ? grid->cols :
+						   grid->rows);
+	size_t best = PATHORDER_NONE;
+	double best_dist = INFINITY;
+
+	for (long r = 0; r <= max_ring; r++) {
+		for (long cr = row - r; cr <= (row + r); cr++) {
+			if ((cr < 0) || (cr >= (long)grid->rows)) {
+				continue;
+			}
+
+			// Only the sides of the ring in the rows between its top and
+			// bottom.
+			bool edge = (cr == (row - r)) || (cr == (row + r));
+			for (long cc = col - r; cc <= (col + r);
+					cc += (edge || (r == 0)) ? 1 : (2 * r)) {
+				if ((cc >= 0) && (cc < (long)grid->cols)) {
+					nearest_in_cell(grid, chains,
+									((size_t)cr * grid->cols) + (size_t)cc,
+									x, y, &best, &best_dist);
+				}
+			}
+		}
+
+		// Nothing in the next ring can be closer than this.
+		if ((best != PATHORDER_NONE) &&
+				(best_dist <= (double)r * (double)grid->size)) {
+			break;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Looks for a chain end closer than the best one found so far in a grid cell,
+ * dropping the ends of the chains that were already drawn.
+ *
+ * @param grid      Grid of chain ends.
+ * @param chains    Chain set.
+ * @param cell      Cell to look in.
+ * @param x         X coordinate of the pen.
+ * @param y         Y coordinate of the pen.
+ * @param best      Closest chain end found so far.
+ * @param best_dist Distance to the closest chain end.
+ */
+void nearest_in_cell(point_grid_t *grid, const chain_set_t *chains,
+					 const size_t cell, const int64_t x, const int64_t y,
+					 size_t *best, double *best_dist) {
+	size_t first = grid->start[cell];
+	size_t i = first;
+
+	while (i < (first + grid->live[cell])) {
+		size_t end = grid->items[i];
+
+		if (chains->done[end >> 1]) {
+			grid->items[i] = grid->items[first + --grid->live[cell]];
+			grid->count--;
+			continue;
+		}
+
+		double d = distance(x, y, chains->x[end], chains->y[end]);
+		if ((d < *best_dist) || ((d == *best_dist) && (end < *best))) {
+			*best_dist = d;
+			*best = end;
+		}
+		i++;
+	}
+}
+
+/**
+ * Builds the tour by always going to the closest chain end next.
+ *
+ * @param chains Chain set.
+ */
+void order_nearest(chain_set_t *chains) {
+	point_grid_t grid;
+	size_t *ids = malloc(sizeof(size_t) * ((chains->count * 2) + 1));
+	size_t live = chains->count * 2;
+	int64_t x = 0;
+	int64_t y = 0;
+
+	for (size_t e = 0; e < live; e++) {
+		ids[e] = e;
+	}
+	point_grid_build(&grid, ids, live, chains->x, chains->y);
+
+	for (size_t p = 1; p <= chains->count; p++) {
+		size_t end = point_grid_nearest(&grid, chains, x, y);
+		size_t c = end >> 1;
+
+		chains->tour[p] = c;
+		chains->flip[p] = (end & 1) != 0;
+		chains->pos[c] = p;
+		chains->done[c] = true;
+		x = chains->x[end ^ 1];
+		y = chains->y[end ^ 1];
+		live -= 2;
+
+		// Shrink the grid as it empties, so the searches don't have to go
+		// through lots of empty cells.
+		if ((live > 64) && (live < (grid.count / 4))) {
+			size_t n = 0;
+			for (size_t i = 0; i < (grid.cols * grid.rows); i++) {
+				for (size_t k = 0; k < grid.live[i]; k++) {
+					size_t e = grid.items[grid.start[i] + k];
+					if (!chains->done[e >> 1]) {
+						ids[n++] = e;
+					}
+				}
+			}
+
+			point_grid_free(&grid);
+			point_grid_build(&grid, ids, n, chains->x, chains->y);
+		}
+	}
+
+	point_grid_free(&grid);
+	free(ids);
+}
+
+/**
+ * Renumbers the chains in the order of the tour, so chains that are close by
+ * are also close in memory.
+ *
+ * @param chains Chain set.
+ */
+void renumber_chains(chain_set_t *chains) {
+	size_t n = chains->count;
+	size_t *steps = malloc(sizeof(size_t) * (chains->start[n] + 1));
+	size_t *start = malloc(sizeof(size_t) * (n + 2));
+	int64_t *x = malloc(sizeof(int64_t) * ((n + 1) * 2));
+	int64_t *y = malloc(sizeof(int64_t) * ((n + 1) * 2));
+
+	// The origin keeps its number, so it doesn't clash with the others.
+	size_t step = 0;
+	for (size_t p = 1; p <= n; p++) {
+		size_t c = chains->tour[p];
+		size_t id = p - 1;
+
+		start[id] = step;
+		for (size_t i = chains->start[c]; i < chains->start[c + 1]; i++) {
+			steps[step++] = chains->steps[i];
+		}
+		x[id * 2] = chains->x[c * 2];
+		y[id * 2] = chains->y[c * 2];
+		x[(id * 2) + 1] = chains->x[(c * 2) + 1];
+		y[(id * 2) + 1] = chains->y[(c * 2) + 1];
+
+		chains->tour[p] = id;
+		chains->pos[id] = p;
+	}
+	start[n] = step;
+	x[n * 2] = x[(n * 2) + 1] = 0;
+	y[n * 2] = y[(n * 2) + 1] = 0;
+
+	free(chains->steps);
+	free(chains->start);
+	free(chains->x);
+	free(chains->y);
+	chains->steps = steps;
+	chains->start = start;
+	chains->x = x;
+	chains->y = y;
+}
+
+/**
+ * Gets the chain end the pen leaves a position of the tour from.
+ *
+ * @param  chains Chain set.
+ * @param  pos    Position in the tour.
+ * @return        Chain end.
+ */
+size_t exit_end(const chain_set_t *chains, const size_t pos) {
+	return (chains->tour[pos] * 2) + (chains->flip[pos] ? 0 : 1);
+}
+
+/**
+ * Gets the chain end the pen enters a position of the tour from.
+ *
+ * @param  chains Chain set.
+ * @param  pos    Position in the tour.
+ * @return        Chain end.
+ */
+size_t entry_end(const chain_set_t *chains, const size_t pos) {
+	return (chains->tour[pos] * 2) + (chains->flip[pos] ? 1 : 0);
+}
+
+/**
+ * Gets the length of the pen up travel after a position of the tour.
+ *
+ * @param  chains Chain set.
+ * @param  pos    Position in the tour.
+ * @return        Travel to the next position or 0 if it's the last one.
+ */
+double edge_length(const chain_set_t *chains, const size_t pos) {
+	if (pos >= chains->count) {
+		return 0;
+	}
+
+	size_t a = exit_end(chains, pos);
+	size_t b = entry_end(chains, pos + 1);
+	return distance(chains->x[a], chains->y[a], chains->x[b], chains->y[b]);
+}
+
+/**
+ * Calculates how much shorter the tour gets by reversing the positions after
+ * A up to B.
+ *
+ * @param  chains Chain set.
+ * @param  a      Position before the reversed run.
+ * @param  b      Last position of the reversed run.
+ * @return        Travel saved by the move.
+ */
+double move_gain(const chain_set_t *chains, size_t a, size_t b) {
+	size_t ea = exit_end(chains, a);
+	size_t eb = exit_end(chains, b);
+	size_t na = entry_end(chains, a + 1);
+	double gain = edge_length(chains, a) -
+		distance(chains->x[ea], chains->y[ea], chains->x[eb], chains->y[eb]);
+
+	if (b < chains->count) {
+		size_t nb = entry_end(chains, b + 1);
+
+		gain += edge_length(chains, b) -
+			distance(chains->x[na], chains->y[na], chains->x[nb],
+					 chains->y[nb]);
+	}
+
+	return gain;
+}
+
+/**
+ * Reverses the positions after A up to B, flipping every chain in them.
+ *
+ * @param chains Chain set.
+ * @param a      Position before the reversed run.
+ * @param b      Last position of the reversed run.
+ */
+void reverse_run(chain_set_t *chains, const size_t a, const size_t b) {
+	size_t i = a + 1;
+	size_t j = b;
+
+	while (i < j) {
+		size_t c = chains->tour[i];
+		bool f = chains->flip[i];
+
+		chains->tour[i] = chains->tour[j];
+		chains->flip[i] = !chains->flip[j];
+		chains->tour[j] = c;
+		chains->flip[j] = !f;
+		chains->pos[chains->tour[i]] = i;
+		chains->pos[c] = j;
+		i++;
+		j--;
+	}
+
+	if (i == j) {
+		chains->flip[i] = !chains->flip[i];
+	}
+}
+
+/**
+ * Improves the tour with 2-opt moves between nearby chain ends until none of
+ * them helps anymore.
+ *
+ * @param chains Chain set.
+ */
+void order_two_opt(chain_set_t *chains) {
+	point_grid_t grid;
+	size_t n = chains->count;
+	size_t *ids = malloc(sizeof(size_t) * ((n * 2) + 1));
+	size_t *stack = malloc(sizeof(size_t) * (n + 2));
+	bool *queued = malloc(sizeof(bool) * (n + 1));
+	size_t depth = 0;
+
+	if (n < 2) {
+		free(ids);
+		free(stack);
+		free(queued);
+		return;
+	}
+
+	for (size_t e = 0; e < (n * 2); e++) {
+		ids[e] = e;
+	}
+	point_grid_build(&grid, ids, n * 2, chains->x, chains->y);
+	free(ids);
+
+	// Go through the tour from the start.
+	for (size_t p = n + 1; p > 0; p--) {
+		stack[depth++] = chains->tour[p - 1];
+		queued[chains->tour[p - 1]] = true;
+	}
+
+	while (depth > 0) {
+		size_t c = stack[--depth];
+		size_t p = chains->pos[c];
+		queued[c] = false;
+
+		// Try both the travel leaving and entering the chain.
+		for (uint8_t side = 0; side < 2; side++) {
+			if (((side == 0) && (p >= n)) || ((side == 1) && (p == 0))) {
+				continue;
+			}
+
+			size_t i = (side == 0) ? p : (p - 1);
+			size_t end = (side == 0) ? exit_end(chains, i) :
+				entry_end(chains, i + 1);
+			double radius = edge_length(chains, i);
+			int64_t x = chains->x[end];
+			int64_t y = chains->y[end];
+			long col = (long)point_grid_col(&grid, x);
+			long row = (long)point_grid_row(&grid, y);
+			long rings = (long)ceil(radius / (double)grid.size);
+			if (rings > PATHORDER_CANDIDATE_RINGS) {
+				rings = PATHORDER_CANDIDATE_RINGS;
+			}
+			size_t best_a = 0;
+			size_t best_b = 0;
+			double best_gain = 1e-9;
+
+			for (long cr = row - rings; cr <= (row + rings); cr++) {
+				if ((cr < 0) || (cr >= (long)grid.rows)) {
+					continue;
+				}
+
+				for (long cc = col - rings; cc <= (col + rings); cc++) {
+					if ((cc < 0) || (cc >= (long)grid.cols)) {
+						continue;
+					}
+
+					size_t cell = ((size_t)cr * grid.cols) + (size_t)cc;
+					for (size_t k = grid.start[cell];
+							k < grid.start[cell + 1]; k++) {
+						size_t q = grid.items[k];
+						size_t j = chains->pos[q >> 1];
+
+						if (distance(x, y, chains->x[q], chains->y[q]) >=
+								radius) {
+							continue;
+						}
+
+						// Connect exit to exit, or entry to entry.
+						if (side == 0) {
+							if (q != exit_end(chains, j)) {
+								continue;
+							}
+						} else {
+							if ((j == 0) || (q != entry_end(chains, j))) {
+								continue;
+							}
+							j--;
+						}
+
+						if (j == i) {
+							continue;
+						}
+
+						size_t a = (i < j) ? i : j;
+						size_t b = (i < j) ? j : i;
+						if ((b - a) > PATHORDER_MAX_REVERSE) {
+							continue;
+						}
+
+						double gain = move_gain(chains, a, b);
+						if (gain > best_gain) {
+							best_gain = gain;
+							best_a = a;
+							best_b = b;
+						}
+					}
+				}
+			}
+
+			if (best_b == 0) {
+				continue;
+			}
+
+			// Apply the move and look around the changed edges again.
+			reverse_run(chains, best_a, best_b);
+			size_t touched[4] = { best_a, best_a + 1, best_b, best_b + 1 };
+			for (uint8_t t = 0; t < 4; t++) {
+				if (touched[t] > n) {
+					continue;
+				}
+
+				size_t tc = chains->tour[touched[t]];
+				if (!queued[tc]) {
+					queued[tc] = true;
+					stack[depth++] = tc;
+				}
+			}
+			break;
+		}
+	}
+
+	point_grid_free(&grid);
+	free(stack);
+	free(queued);
+}
+
+/**
+ * Rotates every closed chain so that the pen enters it at the vertex that
+ * makes the travel from the previous chain and to the next one the shortest.
+ *
+ * @param segs   Segments.
+ * @param chains Chain set.
+ */
+void rotate_closed_chains(const segment_list_t *segs, chain_set_t *chains) {
+	size_t *scratch = malloc(sizeof(size_t) * (segs->count + 1));
+
+	for (size_t p = 1; p <= chains->count; p++) {
+		size_t c = chains->tour[p];
+		size_t first = chains->start[c];
+		size_t last = chains->start[c + 1];
+
+		if (((last - first) < 2) ||
+				(chains->x[c * 2] != chains->x[(c * 2) + 1]) ||
+				(chains->y[c * 2] != chains->y[(c * 2) + 1])) {
+			continue;
+		}
+
+		// Every vertex of a loop is both where the pen enters and leaves it.
+		size_t prev = exit_end(chains, p - 1);
+		size_t next = (p < chains->count) ? entry_end(chains, p + 1) :
+			PATHORDER_NONE;
+		size_t best = first;
+		double best_travel = INFINITY;
+		for (size_t k = first; k < last; k++) {
+			int64_t vx = segs->x[chains->steps[k]];
+			int64_t vy = segs->y[chains->steps[k]];
+			double travel = distance(chains->x[prev], chains->y[prev], vx, vy);
+
+			if (next != PATHORDER_NONE) {
+				travel += distance(vx, vy, chains->x[next], chains->y[next]);
+			}
+
+			if (travel < best_travel) {
+				best_travel = travel;
+				best = k;
+			}
+		}
+
+		if (best == first) {
+			continue;
+		}
+
+		// Rotate the steps around so the best vertex comes first.
+		size_t count = last - first;
+		size_t head = best - first;
+		memcpy(scratch, &chains->steps[best], sizeof(size_t) * (count - head));
+		memcpy(&scratch[count - head], &chains->steps[first],
+			   sizeof(size_t) * head);
+		memcpy(&chains->steps[first], scratch, sizeof(size_t) * count);
+
+		chains->x[c * 2] = chains->x[(c * 2) + 1] =
+			segs->x[chains->steps[first]];
+		chains->y[c * 2] = chains->y[(c * 2) + 1] =
+			segs->y[chains->steps[first]];
+	}
+
+	free(scratch);
+}
+
+/**
+ * Calculates the pen up travel of the whole tour.
+ *
+ * @param  chains Chain set.
+ * @return        Total travel.
+ */
+double tour_travel(const chain_set_t *chains) {
+	double travel = 0;
+
+	for (size_t p = 0; p < chains->count; p++) {
+		travel += edge_length(chains, p);
+	}
+
+	return travel;
+}
+
+/**
+ * Replaces an order with the objects drawn just as they were commanded,
+ * starting a new chain wherever the pen has to be lifted.
+ *
+ * @param segs  Segments in command order.
+ * @param order Path order to be replaced.
+ */
+void order_commands(const segment_list_t *segs, path_order_t *order) {
+	order->chain_start = realloc(order->chain_start,
+								 sizeof(size_t) * (segs->count + 1));
+	order->chain_count = 0;
+	for (size_t s = 0; s < segs->count; s++) {
+		if ((s == 0) || (segs->x[s * 2] != segs->x[(s * 2) - 1]) ||
+				(segs->y[s * 2] != segs->y[(s * 2) - 1])) {
+			order->chain_start[order->chain_count++] = s;
+		}
+
+		order->object[s] = segs->object[s];
+		order->reversed[s] = false;
+	}
+	order->chain_start[order->chain_count] = segs->count;
+
+	order->travel_after = order->travel_before;
+}
@@ -0,0 +1,42 @@
+/**
+ * engine/pathorder.h
+ * Drawing order of the objects that keeps the pen travel of plotters and
+ * cutters short.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _PATHORDER_H
+#define _PATHORDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "nanocad.h"
+
+// Longest run of chains that gets reversed by a single 2-opt move.
+#define PATHORDER_MAX_REVERSE 1000
+
+// Objects in drawing order. Chains are runs of steps where the end of each
+// object is the start of the next one, so the pen doesn't have to be lifted.
+typedef struct {
+	size_t    count;
+	size_t   *object;       // Object index of each step.
+	bool     *reversed;     // Step is drawn from its last to its first point.
+	size_t    chain_count;
+	size_t   *chain_start;  // First step of each chain, plus the step count.
+
+	// Statistics.
+	double    travel_before;  // Pen up travel in command order.
+	double    travel_after;
+	double    travel_nearest;  // After the nearest neighbour pass only.
+} path_order_t;
+
+// Initialization and destruction.
+void pathorder_init(path_order_t *order);
+void pathorder_free(path_order_t *order);
+
+// Ordering.
+bool pathorder_build(const object_filter_t *filter, path_order_t *order);
+
+#endif
@@ -0,0 +1,1502 @@
+/**
+ * engine/planar.c
+ * Planar graph (half-edge structure) built out of a soup of line segments.
+ *
+ * Building the graph goes through a couple of passes:
+ *
+ *   1. Endpoints closer than the snapping distance are merged together.
+ *   2. Segments are put in a uniform grid and every pair sharing a cell is
+ *      tested for intersections, which are rounded to the integer grid. The
+ *      segments are split at them and this is repeated until no rounding was
+ *      needed, since rounding may introduce new crossings.
+ *   3. The pieces become edges between unique vertices, and duplicate edges
+ *      are merged keeping their net direction.
+ *   4. Dangling edges are optionally pruned away.
+ *   5. Outgoing half-edges are sorted by angle around each vertex, which
+ *      links them into faces.
+ *   6. Components that float inside of other faces get a parent face, found
+ *      by casting a ray upwards from their top vertex through a grid of the
+ *      edges, and winding numbers are propagated from the unbounded face
+ *      inwards.
+ *
+ * Every orientation test is done with exact 64-bit integer arithmetic, which
+ * is why the coordinates are limited to PLANAR_MAX_COORD.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "diagnostics.h"
+#include "planar.h"
+
+// Constants.
+#define PLANAR_MAX_CELLS_PER_SEGMENT 8
+#define PLANAR_MAX_PASSES            16
+
+// Spatial hash of unique points.
+typedef struct {
+	int64_t  cell;
+	size_t   mask;
+	size_t  *heads;
+	size_t  *chain;
+	int64_t *x;
+	int64_t *y;
+	size_t   count;
+	size_t   capacity;
+} point_index_t;
+
+// Point where a segment gets split.
+typedef struct {
+	size_t  seg;
+	int64_t t;  // Position along the segment (not normalized).
+	int64_t x;
+	int64_t y;
+} split_t;
+
+// Dynamic array of split points.
+typedef struct {
+	size_t   count;
+	size_t   capacity;
+	split_t *list;
+} split_list_t;
+
+// Edge before duplicates are merged.
+typedef struct {
+	size_t  lo;
+	size_t  hi;
+	uint8_t operand;
+	int8_t  dir;
+} raw_edge_t;
+
+// Uniform grid of segments.
+typedef struct {
+	int64_t  min_x;
+	int64_t  min_y;
+	int64_t  size;
+	size_t   cols;
+	size_t   rows;
+	size_t  *start;
+	size_t  *items;
+} seg_grid_t;
+
+// Internal functions.
+int64_t floor_div(const int64_t a, const int64_t b);
+int64_t orient(const int64_t ax, const int64_t ay, const int64_t bx,
+			   const int64_t by, const int64_t cx, const int64_t cy);
+void point_index_init(point_index_t *pi, const size_t expected,
+					  const int64_t tolerance);
+void point_index_free(point_index_t *pi);
+size_t point_index_add(point_index_t *pi, const int64_t x, const int64_t y,
+					   const int64_t tolerance);
+void snap_endpoints(planar_segment_t *segs, const size_t count,
+					const int64_t snap);
+size_t grid_cells(const seg_grid_t *grid, const planar_segment_t *seg,
+				  size_t *cells, const size_t max);
+void grid_build(seg_grid_t *grid, const planar_segment_t *segs,
+				const size_t count);
+void grid_free(seg_grid_t *grid);
+void add_split(split_list_t *splits, const planar_segment_t *segs,
+			   const size_t seg, const int64_t x, const int64_t y);
+size_t intersect_pair(split_list_t *splits, const planar_segment_t *segs,
+					  const size_t i, const size_t j, bool *inexact);
+size_t find_intersections(split_list_t *splits, const planar_segment_t *segs,
+						  const size_t count, bool *inexact);
+size_t split_segments(planar_segment_t **segs, const size_t count,
+					  split_list_t *splits);
+int compare_splits(const void *a, const void *b);
+int compare_raw_edges(const void *a, const void *b);
+int compare_angles(const void *a, const void *b);
+size_t build_edges(planar_graph_t *graph, const planar_segment_t *segs,
+				   const size_t count);
+void prune_dangling(planar_graph_t *graph);
+void link_half_edges(planar_graph_t *graph);
+void trace_faces(planar_graph_t *graph);
+void find_components(planar_graph_t *graph);
+bool edge_below(const planar_graph_t *graph, const size_t a, const size_t b);
+size_t cast_ray_up(const planar_graph_t *graph, const seg_grid_t *grid,
+				   const size_t *col_top, const size_t face);
+void find_parents(planar_graph_t *graph);
+void propagate_winding(planar_graph_t *graph);
+
+// Context for the comparisons (qsort has no user data). Graphs may be built
+// from several threads at once.
+__thread const planar_graph_t *angle_graph = NULL;
+
+
+/**
+ * Initializes an empty planar graph.
+ *
+ * @param graph Planar graph.
+ */
+void planar_init(planar_graph_t *graph) {
+	memset(graph, 0, sizeof(planar_graph_t));
+}
+
+/**
+ * Frees everything allocated by a planar graph.
+ *
+ * @param graph Planar graph.
+ */
+void planar_free(planar_graph_t *graph) {
+	free(graph->x);
+	free(graph->y);
+	free(graph->edge_wind);
+	free(graph->origin);
+	free(graph->next);
+	free(graph->face);
+	free(graph->faces);
+	free(graph->face_wind);
+
+	planar_init(graph);
+}
+
+/**
+ * Builds a planar graph out of a bunch of segments.
+ *
+ * @param  graph    Planar graph to be populated. Must be initialized.
+ * @param  segs     Input segments.
+ * @param  count    Number of input segments.
+ * @param  operands Number of separate inputs tracked for winding numbers.
+ * @param  snap     Endpoints closer than this get merged together.
+ * @param  prune    Remove dangling edges that don't bound any face?
+ * @return          TRUE if the graph was built.
+ */
+bool planar_build(planar_graph_t *graph, const planar_segment_t *segs,
+				  const size_t count, const uint8_t operands,
+				  const int64_t snap, const bool prune) {
+	planar_segment_t *work;
+	split_list_t splits = { 0, 0, NULL };
+	size_t valid = 0;
+
+	if ((operands == 0) || (operands > PLANAR_MAX_OPERANDS)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_GENERIC, operands, "Invalid number "
+					"of planar graph operands: %u.", operands);
+		return false;
+	}
+
+	planar_free(graph);
+	graph->operands = operands;
+
+	// Copy the segments that we can actually work with.
+	work = malloc(sizeof(planar_segment_t) * (count + 1));
+	for (size_t i = 0; i < count; i++) {
+		const planar_segment_t *seg = &segs[i];
+
+		if ((llabs(seg->x1) > PLANAR_MAX_COORD) ||
+				(llabs(seg->y1) > PLANAR_MAX_COORD) ||
+				(llabs(seg->x2) > PLANAR_MAX_COORD) ||
+				(llabs(seg->y2) > PLANAR_MAX_COORD) ||
+				(seg->operand >= operands)) {
+			diag_report(DIAG_WARNING, DIAG_CODE_GENERIC, 0, "Ignoring segment "
+						"outside of the supported range.");
+			continue;
+		}
+
+		work[valid++] = *seg;
+	}
+
+	// Merge endpoints that are close together and drop what became a point.
+	if (snap > 0) {
+		snap_endpoints(work, valid, snap);
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < valid; i++) {
+		if ((work[i].x1 != work[i].x2) || (work[i].y1 != work[i].y2)) {
+			work[kept++] = work[i];
+		}
+	}
+	graph->segment_count = kept;
+
+	// Split the segments where they cross or touch each other. Crossings get
+	// rounded to the integer grid, which may make the pieces cross something
+	// else, so keep going until nothing had to be rounded.
+	bool inexact = true;
+	for (uint8_t pass = 0; inexact && (pass < PLANAR_MAX_PASSES); pass++) {
+		size_t crossings = find_intersections(&splits, work, kept, &inexact);
+		if (pass == 0) {
+			graph->intersection_count = crossings;
+		}
+
+		kept = split_segments(&work, kept, &splits);
+		splits.count = 0;
+	}
+
+	if (inexact) {
+		diag_report(DIAG_WARNING, DIAG_CODE_GENERIC, 0, "Rounded "
+					"intersections didn't settle after %d passes.",
+					PLANAR_MAX_PASSES);
+	}
+
+	// Merge the pieces into edges between unique vertices.
+	build_edges(graph, work, kept);
+	free(splits.list);
+	free(work);
+
+	if (prune) {
+		prune_dangling(graph);
+	}
+
+	// Link everything together.
+	link_half_edges(graph);
+	trace_faces(graph);
+	find_components(graph);
+	find_parents(graph);
+	propagate_winding(graph);
+
+	return true;
+}
+
+/**
+ * Appends a segment to a growing list of segments.
+ *
+ * @param segs    Segment list.
+ * @param x1      Start point X.
+ * @param y1      Start point Y.
+ * @param x2      End point X.
+ * @param y2      End point Y.
+ * @param operand Input the segment belongs to.
+ */
+void planar_push_segment(planar_segments_t *segs, const int64_t x1,
+						 const int64_t y1, const int64_t x2, const int64_t y2,
+						 const uint8_t operand) {
+	if (segs->count >= segs->capacity) {
+		segs->capacity = (segs->capacity == 0) ? 256 : segs->capacity * 2;
+		segs->list = realloc(segs->list,
+							 sizeof(planar_segment_t) * segs->capacity);
+	}
+
+	planar_segment_t *seg = &segs->list[segs->count++];
+	seg->x1 = x1;
+	seg->y1 = y1;
+	seg->x2 = x2;
+	seg->y2 = y2;
+	seg->operand = operand;
+}
+
+/**
+ * Gets the net number of times an operand's input went along a half-edge.
+ *
+ * @param  graph   Planar graph.
+ * @param  he      Half-edge.
+ * @param  operand Operand.
+ * @return         Net winding along the half-edge.
+ */
+int32_t planar_wind_along(const planar_graph_t *graph, const size_t he,
+						  const uint8_t operand) {
+	int32_t wind = graph->edge_wind[((he / 2) * graph->operands) + operand];
+	return (he & 1) ? -wind : wind;
+}
+
+/**
+ * Checks if a point is inside of the boundary of a face (even-odd rule).
+ *
+ * @param  graph Planar graph.
+ * @param  face  Face.
+ * @param  x     Point X.
+ * @param  y     Point Y.
+ * @return       TRUE if the point is inside.
+ */
+bool planar_face_contains(const planar_graph_t *graph, const size_t face,
+						  const int64_t x, const int64_t y) {
+	const planar_face_t *f = &graph->faces[face];
+	bool inside = false;
+	size_t he = f->edge;
+
+	if ((x < f->min_x) || (x > f->max_x) || (y < f->min_y) ||
+			(y > f->max_y)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < f->edge_count; i++) {
+		int64_t ax = graph->x[graph->origin[he]];
+		int64_t ay = graph->y[graph->origin[he]];
+		int64_t bx = graph->x[graph->origin[he ^ 1]];
+		int64_t by = graph->y[graph->origin[he ^ 1]];
+
+		if ((ay > y) != (by > y)) {
+			// Which side of the edge is the point on (exactly)?
+			int64_t side = orient(ax, ay, bx, by, x, y);
+			if ((side > 0) == (by > ay)) {
+				inside = !inside;
+			}
+		}
+
+		he = graph->next[he];
+	}
+
+	return inside;
+}
+
+/**
+ * Integer division rounding towards negative infinity.
+ *
+ * @param  a Dividend.
+ * @param  b Divisor (positive).
+ * @return   Floor of a / b.
+ */
+int64_t floor_div(const int64_t a, const int64_t b) {
+	int64_t q = a / b;
+	return ((a % b) != 0 && (a < 0)) ? q - 1 : q;
+}
+
+/**
+ * Orientation of three points.
+ *
+ * @return Positive if a, b, c turn counter-clockwise, negative if clockwise
+ *         and zero if they're collinear.
+ */
+int64_t orient(const int64_t ax, const int64_t ay, const int64_t bx,
+			   const int64_t by, const int64_t cx, const int64_t cy) {
+	return ((bx - ax) * (cy - ay)) - ((by - ay) * (cx - ax));
+}
+
+/**
+ * Initializes a spatial hash of unique points.
+ *
+ * @param pi        Point index.
+ * @param expected  Expected number of points.
+ * @param tolerance Points closer than this are the same (0 for exact).
+ */
+void point_index_init(point_index_t *pi, const size_t expected,
+					  const int64_t tolerance) {
+	size_t buckets = 64;
+	while (buckets < (expected * 2)) {
+		buckets *= 2;
+	}
+
+	pi->cell = (tolerance > 0) ? tolerance : 1;
+	pi->mask = buckets - 1;
+	pi->heads = malloc(sizeof(size_t) * buckets);
+	memset(pi->heads, 0xFF, sizeof(size_t) * buckets);
+	pi->count = 0;
+	pi->capacity = (expected > 16) ? expected : 16;
+	pi->chain = malloc(sizeof(size_t) * pi->capacity);
+	pi->x = malloc(sizeof(int64_t) * pi->capacity);
+	pi->y = malloc(sizeof(int64_t) * pi->capacity);
+}
+
+/**
+ * Frees a spatial hash of unique points.
+ *
+ * @param pi Point index.
+ */
+void point_index_free(point_index_t *pi) {
+	free(pi->heads);
+	free(pi->chain);
+	free(pi->x);
+	free(pi->y);
+}
+
+/**
+ * Hashes a grid cell.
+ *
+ * @param  cx Cell column.
+ * @param  cy Cell row.
+ * @return    Hash of the cell.
+ */
+static inline size_t hash_cell(const int64_t cx, const int64_t cy) {
+	uint64_t h = ((uint64_t)cx * 0x9E3779B97F4A7C15ULL) ^
+		((uint64_t)cy * 0xC2B2AE3D27D4EB4FULL);
+	return (size_t)(h ^ (h >> 29));
+}
+
+/**
+ * Finds a point in the index, adding it if there isn't one close enough.
+ *
+ * @param  pi        Point index.
+ * @param  x         Point X.
+ * @param  y         Point Y.
+ * @param  tolerance Maximum distance (on each axis) to an existing point.
+ * @return           Index of the point.
+ */
+size_t point_index_add(point_index_t *pi, const int64_t x, const int64_t y,
+					   const int64_t tolerance) {
+	int64_t cx = floor_div(x, pi->cell);
+	int64_t cy = floor_div(y, pi->cell);
+	int64_t reach = (tolerance > 0) ? 1 : 0;
+
+	// Look around the neighbouring cells.
+	for (int64_t dy = -reach; dy <= reach; dy++) {
+		for (int64_t dx = -reach; dx <= reach; dx++) {
+			size_t i = pi->heads[hash_cell(cx + dx, cy + dy) & pi->mask];
+
+			for (; i != PLANAR_NONE; i = pi->chain[i]) {
+				if ((llabs(pi->x[i] - x) <= tolerance) &&
+						(llabs(pi->y[i] - y) <= tolerance)) {
+					return i;
+				}
+			}
+		}
+	}
+
+	// Add a new point.
+	if (pi->count >= pi->capacity) {
+		pi->capacity *= 2;
+		pi->chain = realloc(pi->chain, sizeof(size_t) * pi->capacity);
+		pi->x = realloc(pi->x, sizeof(int64_t) * pi->capacity);
+		pi->y = realloc(pi->y, sizeof(int64_t) * pi->capacity);
+	}
+
+	size_t bucket = hash_cell(cx, cy) & pi->mask;
+	size_t i = pi->count++;
+	pi->x[i] = x;
+	pi->y[i] = y;
+	pi->chain[i] = pi->heads[bucket];
+	pi->heads[bucket] = i;
+
+	return i;
+}
+
+/**
+ * Merges endpoints that are closer than the snapping distance.
+ *
+ * @param segs  Segments.
+ * @param count Number of segments.
+ * @param snap  Snapping distance.
+ */
+void snap_endpoints(planar_segment_t *segs, const size_t count,
+					const int64_t snap) {
+	point_index_t pi;
+	point_index_init(&pi, count * 2, snap);
+
+	for (size_t i = 0; i < count; i++) {
+		size_t a = point_index_add(&pi, segs[i].x1, segs[i].y1, snap);
+		size_t b = point_index_add(&pi, segs[i].x2, segs[i].y2, snap);
+
+		segs[i].x1 = pi.x[a];
+		segs[i].y1 = pi.y[a];
+		segs[i].x2 = pi.x[b];
+		segs[i].y2 = pi.y[b];
+	}
+
+	point_index_free(&pi);
+}
+
+/**
+ * Gets the grid cells a segment goes through, row by row.
+ *
+ * @param  grid  Segment grid.
+ * @param  seg   Segment.
+ * @param  cells Where to put the cell indices (NULL to just count them).
+ * @param  max   Maximum number of cells to be stored.
+ * @return       Number of cells the segment goes through.
+ */
+size_t grid_cells(const seg_grid_t *grid, const planar_segment_t *seg,
+				  size_t *cells, const size_t max) {
+	size_t count = 0;
+
+	// Most segments are shorter than a cell and fit in a single one.
+	int64_t c1 = (seg->x1 - grid->min_x) / grid->size;
+	int64_t r1 = (seg->y1 - grid->min_y) / grid->size;
+	if ((c1 == ((seg->x2 - grid->min_x) / grid->size)) &&
+			(r1 == ((seg->y2 - grid->min_y) / grid->size))) {
+		if ((cells != NULL) && (max > 0)) {
+			cells[0] = ((size_t)r1 * grid->cols) + (size_t)c1;
+		}
+
+		return 1;
+	}
+
+	double x1 = (double)(seg->x1 - grid->min_x) / grid->size;
+	double y1 = (double)(seg->y1 - grid->min_y) / grid->size;
+	double x2 = (double)(seg->x2 - grid->min_x) / grid->size;
+	double y2 = (double)(seg->y2 - grid->min_y) / grid->size;
+	size_t row_a = (size_t)floor(fmin(y1, y2));
+	size_t row_b = (size_t)floor(fmax(y1, y2));
+
+	row_b = (row_b >= grid->rows) ? grid->rows - 1 : row_b;
+	for (size_t row = row_a; row <= row_b; row++) {
+		double lo = x1;
+		double hi = x2;
+
+		// Clip the segment to the row.
+		if (y1 != y2) {
+			double ta = ((double)row - y1) / (y2 - y1);
+			double tb = ((double)(row + 1) - y1) / (y2 - y1);
+			ta = (ta < 0) ? 0 : ((ta > 1) ? 1 : ta);
+			tb = (tb < 0) ? 0 : ((tb > 1) ? 1 : tb);
+			lo = x1 + ((x2 - x1) * ta);
+			hi = x1 + ((x2 - x1) * tb);
+		}
+
+		// A bit of slack for the rounding errors.
+		size_t col_a = (size_t)fmax(0, floor(fmin(lo, hi) - 1e-9));
+		size_t col_b = (size_t)fmax(0, floor(fmax(lo, hi) + 1e-9));
+		col_b = (col_b >= grid->cols) ? grid->cols - 1 : col_b;
+
+		for (size_t col = col_a; col <= col_b; col++) {
+			if ((cells != NULL) && (count < max)) {
+				cells[count] = (row * grid->cols) + col;
+			}
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Puts every segment in the grid cells it goes through.
+ *
+ * @param grid  Segment grid to be built.
+ * @param segs  Segments.
+ * @param count Number of segments.
+ */
+void grid_build(seg_grid_t *grid, const planar_segment_t *segs,
+				const size_t count) {
+	int64_t max_x = 0;
+	int64_t max_y = 0;
+	double length = 0;
+	size_t total = 0;
+	size_t *cells = NULL;
+	size_t cells_capacity = 0;
+
+	// Get the extents and average length of the segments.
+	grid->min_x = 0;
+	grid->min_y = 0;
+	for (size_t i = 0; i < count; i++) {
+		const planar_segment_t *seg = &segs[i];
+		int64_t lx = (seg->x1 < seg->x2) ? seg->x1 : seg->x2;
+		int64_t ly = (seg->y1 < seg->y2) ? seg->y1 : seg->y2;
+		int64_t hx = (seg->x1 > seg->x2) ? seg->x1 : seg->x2;
+		int64_t hy = (seg->y1 > seg->y2) ? seg->y1 : seg->y2;
+
+		if ((i == 0) || (lx < grid->min_x)) grid->min_x = lx;
+		if ((i == 0) || (ly < grid->min_y)) grid->min_y = ly;
+		if ((i == 0) || (hx > max_x)) max_x = hx;
+		if ((i == 0) || (hy > max_y)) max_y = hy;
+		length += hypot((double)(seg->x2 - seg->x1),
+						(double)(seg->y2 - seg->y1));
+	}
+
+	// Pick a cell size that keeps both segments per cell and cells per
+	// segment low, without having too many cells.
+	double width = (double)(max_x - grid->min_x) + 1;
+	double height = (double)(max_y - grid->min_y) + 1;
+	double max_cells = (double)((count * PLANAR_MAX_CELLS_PER_SEGMENT) + 1);
+	double size = (count > 0) ? (length * 2) / count : 1;
+	size = fmax(size, sqrt((width * height) / max_cells));
+	size = fmax(size, 1);
+	while (((width / size) + 1) * ((height / size) + 1) > max_cells) {
+		size *= 1.25;
+	}
+
+	grid->size = (int64_t)ceil(size);
+	grid->cols = (size_t)((max_x - grid->min_x) / grid->size) + 1;
+	grid->rows = (size_t)((max_y - grid->min_y) / grid->size) + 1;
+	grid->start = calloc((grid->cols * grid->rows) + 1, sizeof(size_t));
+
+	// Count the segments in each cell.
+	for (size_t i = 0; i < count; i++) {
+		size_t n = grid_cells(grid, &segs[i], NULL, 0);
+		if (n > cells_capacity) {
+			cells_capacity = n;
+			cells = realloc(cells, sizeof(size_t) * cells_capacity);
+		}
+
+		grid_cells(grid, &segs[i], cells, n);
+		for (size_t c = 0; c < n; c++) {
+			grid->start[cells[c] + 1]++;
+		}
+		total += n;
+	}
+
+	for (size_t c = 0; c < (grid->cols * grid->rows); c++) {
+		grid->start[c + 1] += grid->start[c];
+	}
+
+	// Fill them in.
+	size_t *fill = malloc(sizeof(size_t) * (grid->cols * grid->rows));
+	memcpy(fill, grid->start, sizeof(size_t) * (grid->cols * grid->rows));
+	grid->items = malloc(sizeof(size_t) * (total + 1));
+	for (size_t i = 0; i < count; i++) {
+		size_t n = grid_cells(grid, &segs[i], cells, cells_capacity);
+		for (size_t c = 0; c < n; c++) {
+			grid->items[fill[cells[c]]++] = i;
+		}
+	}
+
+	free(fill);
+	free(cells);
+}
+
+/**
+ * Frees a segment grid.
+ *
+ * @param grid Segment grid.
+ */
+void grid_free(seg_grid_t *grid) {
+	free(grid->start);
+	free(grid->items);
+}
+
+/**
+ * Marks a point where a segment has to be split.
+ *
+ * @param splits Split points.
+ * @param segs   Segments.
+ * @param seg    Segment to be split.
+ * @param x      Split point X.
+ * @param y      Split point Y.
+ */
+void add_split(split_list_t *splits, const planar_segment_t *segs,
+			   const size_t seg, const int64_t x, const int64_t y) {
+	const planar_segment_t *s = &segs[seg];
+
+	// Segments already end at their endpoints.
+	if (((x == s->x1) && (y == s->y1)) || ((x == s->x2) && (y == s->y2))) {
+		return;
+	}
+
+	if (splits->count >= splits->capacity) {
+		splits->capacity = (splits->capacity == 0) ? 256 :
+			splits->capacity * 2;
+		splits->list = realloc(splits->list,
+							   sizeof(split_t) * splits->capacity);
+	}
+
+	split_t *split = &splits->list[splits->count++];
+	split->seg = seg;
+	split->t = ((x - s->x1) * (s->x2 - s->x1)) +
+		((y - s->y1) * (s->y2 - s->y1));
+	split->x = x;
+	split->y = y;
+}
+
+/**
+ * Finds where two segments touch and marks where they have to be split.
+ *
+ * @param  splits  Split points.
+ * @param  segs    Segments.
+ * @param  i       First segment.
+ * @param  j       Second segment.
+ * @param  inexact Gets set if the crossing point had to be rounded.
+ * @return         1 if they cross each other, 0 otherwise.
+ */
+size_t intersect_pair(split_list_t *splits, const planar_segment_t *segs,
+					  const size_t i, const size_t j, bool *inexact) {
+	const planar_segment_t *a = &segs[i];
+	const planar_segment_t *b = &segs[j];
+
+	// Quick bounding box rejection.
+	if ((((a->x1 > a->x2) ? a->x2 : a->x1) > ((b->x1 > b->x2) ? b->x1 : b->x2)) ||
+		(((b->x1 > b->x2) ? b->x2 : b->x1) > ((a->x1 > a->x2) ? a->x1 : a->x2)) ||
+		(((a->y1 > a->y2) ? a->y2 : a->y1) > ((b->y1 > b->y2) ? b->y1 : b->y2)) ||
+		(((b->y1 > b->y2) ? b->y2 : b->y1) > ((a->y1 > a->y2) ? a->y1 : a->y2))) {
+		return 0;
+	}
+
+	int64_t d1 = orient(a->x1, a->y1, a->x2, a->y2, b->x1, b->y1);
+	int64_t d2 = orient(a->x1, a->y1, a->x2, a->y2, b->x2, b->y2);
+	int64_t d3 = orient(b->x1, b->y1, b->x2, b->y2, a->x1, a->y1);
+	int64_t d4 = orient(b->x1, b->y1, b->x2, b->y2, a->x2, a->y2);
+
+	if ((d1 == 0) && (d2 == 0)) {
+		// Collinear, so split each one at the other's endpoints inside it.
+		int64_t len_a = ((a->x2 - a->x1) * (a->x2 - a->x1)) +
+			((a->y2 - a->y1) * (a->y2 - a->y1));
+		int64_t len_b = ((b->x2 - b->x1) * (b->x2 - b->x1)) +
+			((b->y2 - b->y1) * (b->y2 - b->y1));
+		int64_t t;
+
+		t = ((b->x1 - a->x1) * (a->x2 - a->x1)) +
+			((b->y1 - a->y1) * (a->y2 - a->y1));
+		if ((t > 0) && (t < len_a)) add_split(splits, segs, i, b->x1, b->y1);
+		t = ((b->x2 - a->x1) * (a->x2 - a->x1)) +
+			((b->y2 - a->y1) * (a->y2 - a->y1));
+		if ((t > 0) && (t < len_a)) add_split(splits, segs, i, b->x2, b->y2);
+		t = ((a->x1 - b->x1) * (b->x2 - b->x1)) +
+			((a->y1 - b->y1) * (b->y2 - b->y1));
+		if ((t > 0) && (t < len_b)) add_split(splits, segs, j, a->x1, a->y1);
+		t = ((a->x2 - b->x1) * (b->x2 - b->x1)) +
+			((a->y2 - b->y1) * (b->y2 - b->y1));
+		if ((t > 0) && (t < len_b)) add_split(splits, segs, j, a->x2, a->y2);
+
+		return 0;
+	}
+
+	// They don't touch at all.
+	if (((d1 > 0) && (d2 > 0)) || ((d1 < 0) && (d2 < 0)) ||
+			((d3 > 0) && (d4 > 0)) || ((d3 < 0) && (d4 < 0))) {
+		return 0;
+	}
+
+	// One endpoint touches the other segment.
+	if ((d1 == 0) || (d2 == 0) || (d3 == 0) || (d4 == 0)) {
+		if (d1 == 0) add_split(splits, segs, i, b->x1, b->y1);
+		if (d2 == 0) add_split(splits, segs, i, b->x2, b->y2);
+		if (d3 == 0) add_split(splits, segs, j, a->x1, a->y1);
+		if (d4 == 0) add_split(splits, segs, j, a->x2, a->y2);
+
+		return 0;
+	}
+
+	// Proper crossing. Round the intersection to the integer grid.
+	double t = (double)d3 / (double)(d3 - d4);
+	int64_t x = (int64_t)llround(a->x1 + (t * (double)(a->x2 - a->x1)));
+	int64_t y = (int64_t)llround(a->y1 + (t * (double)(a->y2 - a->y1)));
+	add_split(splits, segs, i, x, y);
+	add_split(splits, segs, j, x, y);
+
+	if ((orient(a->x1, a->y1, a->x2, a->y2, x, y) != 0) ||
+			(orient(b->x1, b->y1, b->x2, b->y2, x, y) != 0)) {
+		*inexact = true;
+	}
+
+	return 1;
+}
+
+/**
+ * Finds every intersection between segments that share a grid cell, testing
+ * each pair only once even if they share more than one cell.
+ *
+ * @param  splits  Where to store the split points.
+ * @param  segs    Segments.
+ * @param  count   Number of segments.
+ * @param  inexact Set if any crossing point had to be rounded.
+ * @return         Number of proper crossings found.
+ */
+size_t find_intersections(split_list_t *splits, const planar_segment_t *segs,
+						  const size_t count, bool *inexact) {
+	seg_grid_t grid;
+	size_t *seen = malloc(sizeof(size_t) * (count + 1));
+	size_t *cells = NULL;
+	size_t cells_capacity = 0;
+	size_t crossings = 0;
+
+	*inexact = false;
+	grid_build(&grid, segs, count);
+	memset(seen, 0xFF, sizeof(size_t) * (count + 1));
+	for (size_t i = 0; i < count; i++) {
+		size_t n = grid_cells(&grid, &segs[i], cells, cells_capacity);
+		if (n > cells_capacity) {
+			cells_capacity = n;
+			cells = realloc(cells, sizeof(size_t) * cells_capacity);
+			grid_cells(&grid, &segs[i], cells, cells_capacity);
+		}
+
+		for (size_t c = 0; c < n; c++) {
+			for (size_t k = grid.start[cells[c]]; k < grid.start[cells[c] + 1];
+					k++) {
+				size_t j = grid.items[k];
+				if ((j <= i) || (seen[j] == i)) {
+					continue;
+				}
+
+				seen[j] = i;
+				crossings += intersect_pair(splits, segs, i, j, inexact);
+			}
+		}
+	}
+
+	free(cells);
+	free(seen);
+	grid_free(&grid);
+
+	return crossings;
+}
+
+/**
+ * Splits the segments at their split points.
+ *
+ * @param  segs   Segments, which get replaced by their pieces.
+ * @param  count  Number of segments.
+ * @param  splits Split points.
+ * @return        Number of pieces.
+ */
+size_t split_segments(planar_segment_t **segs, const size_t count,
+					  split_list_t *splits) {
+	planar_segment_t *pieces;
+	size_t piece_count = 0;
+	size_t s = 0;
+
+	if (splits->count == 0) {
+		return count;
+	}
+
+	qsort(splits->list, splits->count, sizeof(split_t), compare_splits);
+	pieces = malloc(sizeof(planar_segment_t) * (count + splits->count + 1));
+	for (size_t i = 0; i < count; i++) {
+		const planar_segment_t *seg = &(*segs)[i];
+		int64_t x = seg->x1;
+		int64_t y = seg->y1;
+
+		// Walk the segment through its split points.
+		while (true) {
+			bool last = (s >= splits->count) || (splits->list[s].seg != i);
+			int64_t nx = (last) ? seg->x2 : splits->list[s].x;
+			int64_t ny = (last) ? seg->y2 : splits->list[s].y;
+
+			if ((nx != x) || (ny != y)) {
+				planar_segment_t *piece = &pieces[piece_count++];
+				piece->x1 = x;
+				piece->y1 = y;
+				piece->x2 = nx;
+				piece->y2 = ny;
+				piece->operand = seg->operand;
+			}
+
+			if (last) {
+				break;
+			}
+
+			x = nx;
+			y = ny;
+			s++;
+		}
+	}
+
+	free(*segs);
+	*segs = pieces;
+
+	return piece_count;
+}
+
+/**
+ * Orders split points by segment and then by position along it.
+ */
+int compare_splits(const void *a, const void *b) {
+	const split_t *sa = (const split_t *)a;
+	const split_t *sb = (const split_t *)b;
+
+	if (sa->seg != sb->seg) {
+		return (sa->seg < sb->seg) ? -1 : 1;
+	}
+
+	return (sa->t < sb->t) ? -1 : ((sa->t > sb->t) ? 1 : 0);
+}
+
+/**
+ * Orders raw edges by their vertices.
+ */
+int compare_raw_edges(const void *a, const void *b) {
+	const raw_edge_t *ea = (const raw_edge_t *)a;
+	const raw_edge_t *eb = (const raw_edge_t *)b;
+
+	if (ea->lo != eb->lo) {
+		return (ea->lo < eb->lo) ? -1 : 1;
+	}
+
+	return (ea->hi < eb->hi) ? -1 : ((ea->hi > eb->hi) ? 1 : 0);
+}
+
+/**
+ * Orders outgoing half-edges counter-clockwise starting from the positive X
+ * axis, exactly.
+ */
+int compare_angles(const void *a, const void *b) {
+	const planar_graph_t *g = angle_graph;
+	size_t ha = *(const size_t *)a;
+	size_t hb = *(const size_t *)b;
+	int64_t ax = g->x[g->origin[ha ^ 1]] - g->x[g->origin[ha]];
+	int64_t ay = g->y[g->origin[ha ^ 1]] - g->y[g->origin[ha]];
+	int64_t bx = g->x[g->origin[hb ^ 1]] - g->x[g->origin[hb]];
+	int64_t by = g->y[g->origin[hb ^ 1]] - g->y[g->origin[hb]];
+	int half_a = (ay < 0) || ((ay == 0) && (ax < 0));
+	int half_b = (by < 0) || ((by == 0) && (bx < 0));
+
+	if (half_a != half_b) {
+		return half_a - half_b;
+	}
+
+	int64_t cross = (ax * by) - (ay * bx);
+	return (cross > 0) ? -1 : ((cross < 0) ? 1 : 0);
+}
+
+/**
+ * Merges segments that don't cross each other anymore into edges between
+ * unique vertices, merging duplicate edges together.
+ *
+ * @param  graph Planar graph.
+ * @param  segs  Segments.
+ * @param  count Number of segments.
+ * @return       Number of edges.
+ */
+size_t build_edges(planar_graph_t *graph, const planar_segment_t *segs,
+				   const size_t count) {
+	point_index_t pi;
+	raw_edge_t *raw;
+
+	point_index_init(&pi, count * 2, 0);
+	raw = malloc(sizeof(raw_edge_t) * (count + 1));
+
+	for (size_t i = 0; i < count; i++) {
+		size_t a = point_index_add(&pi, segs[i].x1, segs[i].y1, 0);
+		size_t b = point_index_add(&pi, segs[i].x2, segs[i].y2, 0);
+
+		raw[i].lo = (a < b) ? a : b;
+		raw[i].hi = (a < b) ? b : a;
+		raw[i].operand = segs[i].operand;
+		raw[i].dir = (a < b) ? 1 : -1;
+	}
+
+	// Keep the vertices.
+	graph->vertex_count = pi.count;
+	graph->x = pi.x;
+	graph->y = pi.y;
+	pi.x = NULL;
+	pi.y = NULL;
+	point_index_free(&pi);
+
+	// Merge the duplicate edges keeping their net direction per operand.
+	qsort(raw, count, sizeof(raw_edge_t), compare_raw_edges);
+	graph->origin = malloc(sizeof(size_t) * ((count * 2) + 1));
+	graph->edge_wind = calloc((count * graph->operands) + 1, sizeof(int32_t));
+	graph->edge_count = 0;
+	for (size_t i = 0; i < count; i++) {
+		if ((i == 0) || (raw[i].lo != raw[i - 1].lo) ||
+				(raw[i].hi != raw[i - 1].hi)) {
+			size_t k = graph->edge_count++;
+			graph->origin[k * 2] = raw[i].lo;
+			graph->origin[(k * 2) + 1] = raw[i].hi;
+		}
+
+		graph->edge_wind[((graph->edge_count - 1) * graph->operands) +
+						 raw[i].operand] += raw[i].dir;
+	}
+
+	free(raw);
+	return graph->edge_count;
+}
+
+/**
+ * Removes the edges that dangle from the rest of the graph, since they don't
+ * bound any face.
+ *
+ * @param graph Planar graph.
+ */
+void prune_dangling(planar_graph_t *graph) {
+	size_t *degree = calloc(graph->vertex_count + 1, sizeof(size_t));
+	size_t *start = calloc(graph->vertex_count + 1, sizeof(size_t));
+	size_t *adj = malloc(sizeof(size_t) * ((graph->edge_count * 2) + 1));
+	size_t *queue = malloc(sizeof(size_t) * (graph->vertex_count + 1));
+	bool *removed = calloc(graph->edge_count + 1, sizeof(bool));
+	size_t head = 0;
+	size_t tail = 0;
+
+	// Build the vertex to edge adjacency.
+	for (size_t he = 0; he < (graph->edge_count * 2); he++) {
+		degree[graph->origin[he]]++;
+	}
+	for (size_t v = 1; v <= graph->vertex_count; v++) {
+		start[v] = start[v - 1] + degree[v - 1];
+	}
+	size_t *fill = malloc(sizeof(size_t) * (graph->vertex_count + 1));
+	memcpy(fill, start, sizeof(size_t) * (graph->vertex_count + 1));
+	for (size_t he = 0; he < (graph->edge_count * 2); he++) {
+		adj[fill[graph->origin[he]]++] = he / 2;
+	}
+	free(fill);
+
+	// Peel off the vertices with a single edge until there's none left.
+	for (size_t v = 0; v < graph->vertex_count; v++) {
+		if (degree[v] == 1) {
+			queue[tail++] = v;
+		}
+	}
+
+	while (head < tail) {
+		size_t v = queue[head++];
+		if (degree[v] != 1) {
+			continue;
+		}
+
+		for (size_t i = start[v]; i < start[v + 1]; i++) {
+			size_t k = adj[i];
+			if (removed[k]) {
+				continue;
+			}
+
+			size_t other = (graph->origin[k * 2] == v) ?
+				graph->origin[(k * 2) + 1] : graph->origin[k * 2];
+			removed[k] = true;
+			degree[v]--;
+			degree[other]--;
+			if (degree[other] == 1) {
+				queue[tail++] = other;
+			}
+			break;
+		}
+	}
+
+	// Compact the remaining edges.
+	size_t kept = 0;
+	for (size_t k = 0; k < graph->edge_count; k++) {
+		if (removed[k]) {
+			continue;
+		}
+
+		graph->origin[kept * 2] = graph->origin[k * 2];
+		graph->origin[(kept * 2) + 1] = graph->origin[(k * 2) + 1];
+		memmove(&graph->edge_wind[kept * graph->operands],
+				&graph->edge_wind[k * graph->operands],
+				sizeof(int32_t) * graph->operands);
+		kept++;
+	}
+	graph->pruned_count = graph->edge_count - kept;
+	graph->edge_count = kept;
+
+	free(degree);
+	free(start);
+	free(adj);
+	free(queue);
+	free(removed);
+}
+
+/**
+ * Sorts the outgoing half-edges around each vertex by angle and links each
+ * half-edge to the next one along its face.
+ *
+ * @param graph Planar graph.
+ */
+void link_half_edges(planar_graph_t *graph) {
+	size_t half_count = graph->edge_count * 2;
+	size_t *start = calloc(graph->vertex_count + 2, sizeof(size_t));
+	size_t *out = malloc(sizeof(size_t) * (half_count + 1));
+	size_t *pos = malloc(sizeof(size_t) * (half_count + 1));
+
+	// Group the half-edges by their origin.
+	for (size_t he = 0; he < half_count; he++) {
+		start[graph->origin[he] + 1]++;
+	}
+	for (size_t v = 0; v < graph->vertex_count; v++) {
+		start[v + 1] += start[v];
+	}
+	size_t *fill = malloc(sizeof(size_t) * (graph->vertex_count + 1));
+	memcpy(fill, start, sizeof(size_t) * (graph->vertex_count + 1));
+	for (size_t he = 0; he < half_count; he++) {
+		out[fill[graph->origin[he]]++] = he;
+	}
+	free(fill);
+
+	// Sort them counter-clockwise around each vertex.
+	angle_graph = graph;
+	for (size_t v = 0; v < graph->vertex_count; v++) {
+		size_t degree = start[v + 1] - start[v];
+		if (degree > 1) {
+			qsort(&out[start[v]], degree, sizeof(size_t), compare_angles);
+		}
+
+		for (size_t i = start[v]; i < start[v + 1]; i++) {
+			pos[out[i]] = i - start[v];
+		}
+	}
+	angle_graph = NULL;
+
+	// The next half-edge is the one right before the twin going clockwise.
+	graph->next = malloc(sizeof(size_t) * (half_count + 1));
+	for (size_t he = 0; he < half_count; he++) {
+		size_t twin = he ^ 1;
+		size_t v = graph->origin[twin];
+		size_t degree = start[v + 1] - start[v];
+
+		graph->next[he] = out[start[v] + ((pos[twin] + degree - 1) % degree)];
+	}
+
+	free(start);
+	free(out);
+	free(pos);
+}
+
+/**
+ * Walks around every face of the graph.
+ *
+ * @param graph Planar graph.
+ */
+void trace_faces(planar_graph_t *graph) {
+	size_t half_count = graph->edge_count * 2;
+	size_t capacity = 64;
+
+	graph->face = malloc(sizeof(size_t) * (half_count + 1));
+	memset(graph->face, 0xFF, sizeof(size_t) * (half_count + 1));
+	graph->faces = malloc(sizeof(planar_face_t) * capacity);
+	graph->face_count = 0;
+
+	for (size_t first = 0; first < half_count; first++) {
+		if (graph->face[first] != PLANAR_NONE) {
+			continue;
+		}
+
+		if (graph->face_count >= capacity) {
+			capacity *= 2;
+			graph->faces = realloc(graph->faces,
+								   sizeof(planar_face_t) * capacity);
+		}
+
+		size_t f = graph->face_count++;
+		planar_face_t *face = &graph->faces[f];
+		int64_t ox = graph->x[graph->origin[first]];
+		int64_t oy = graph->y[graph->origin[first]];
+		double area = 0;
+		size_t he = first;
+
+		face->edge = first;
+		face->edge_count = 0;
+		face->min_x = ox;
+		face->min_y = oy;
+		face->max_x = ox;
+		face->max_y = oy;
+		face->component = PLANAR_NONE;
+		face->parent = PLANAR_NONE;
+
+		// Walk around it, relative to its first vertex to keep the precision.
+		do {
+			int64_t ax = graph->x[graph->origin[he]];
+			int64_t ay = graph->y[graph->origin[he]];
+			int64_t bx = graph->x[graph->origin[he ^ 1]];
+			int64_t by = graph->y[graph->origin[he ^ 1]];
+
+			area += ((double)(ax - ox) * (double)(by - oy)) -
+				((double)(bx - ox) * (double)(ay - oy));
+			face->min_x = (ax < face->min_x) ? ax : face->min_x;
+			face->min_y = (ay < face->min_y) ? ay : face->min_y;
+			face->max_x = (ax > face->max_x) ? ax : face->max_x;
+			face->max_y = (ay > face->max_y) ? ay : face->max_y;
+
+			graph->face[he] = f;
+			face->edge_count++;
+			he = graph->next[he];
+		} while (he != first);
+
+		face->area = area / 2;
+	}
+}
+
+/**
+ * Finds the root of a vertex in a union-find forest.
+ *
+ * @param  parent Union-find forest.
+ * @param  v      Vertex.
+ * @return        Root of the vertex's set.
+ */
+static size_t find_root(size_t *parent, size_t v) {
+	while (parent[v] != v) {
+		parent[v] = parent[parent[v]];
+		v = parent[v];
+	}
+
+	return v;
+}
+
+/**
+ * Figures out which connected component each face belongs to.
+ *
+ * @param graph Planar graph.
+ */
+void find_components(planar_graph_t *graph) {
+	size_t *parent = malloc(sizeof(size_t) * (graph->vertex_count + 1));
+
+	for (size_t v = 0; v < graph->vertex_count; v++) {
+		parent[v] = v;
+	}
+
+	for (size_t k = 0; k < graph->edge_count; k++) {
+		size_t a = find_root(parent, graph->origin[k * 2]);
+		size_t b = find_root(parent, graph->origin[(k * 2) + 1]);
+		if (a != b) {
+			parent[a] = b;
+		}
+	}
+
+	for (size_t f = 0; f < graph->face_count; f++) {
+		graph->faces[f].component =
+			find_root(parent, graph->origin[graph->faces[f].edge]);
+	}
+
+	free(parent);
+}
+
+/**
+ * Checks if an edge passes below another one right after the vertical line
+ * they both go across. Edges of the graph only meet at their ends, so this
+ * can be done exactly by checking on which side of one the ends of the other
+ * are.
+ *
+ * @param  graph Planar graph.
+ * @param  a     Edge that might be below.
+ * @param  b     Edge that might be above.
+ * @return       TRUE if edge a is below edge b.
+ */
+bool edge_below(const planar_graph_t *graph, const size_t a, const size_t b) {
+	size_t a1 = graph->origin[a * 2];
+	size_t a2 = graph->origin[(a * 2) + 1];
+	size_t b1 = graph->origin[b * 2];
+	size_t b2 = graph->origin[(b * 2) + 1];
+	int64_t side;
+
+	// Make both of them go from left to right.
+	if (graph->x[a1] > graph->x[a2]) {
+		size_t tmp = a1;
+		a1 = a2;
+		a2 = tmp;
+	}
+	if (graph->x[b1] > graph->x[b2]) {
+		size_t tmp = b1;
+		b1 = b2;
+		b2 = tmp;
+	}
+
+	// Look at the one that starts further to the right from the other one.
+	if (graph->x[b1] >= graph->x[a1]) {
+		side = orient(graph->x[a1], graph->y[a1], graph->x[a2], graph->y[a2],
+					  graph->x[b1], graph->y[b1]);
+		if (side == 0) {
+			side = orient(graph->x[a1], graph->y[a1], graph->x[a2],
+						  graph->y[a2], graph->x[b2], graph->y[b2]);
+		}
+
+		return side > 0;
+	}
+
+	side = orient(graph->x[b1], graph->y[b1], graph->x[b2], graph->y[b2],
+				  graph->x[a1], graph->y[a1]);
+	if (side == 0) {
+		side = orient(graph->x[b1], graph->y[b1], graph->x[b2], graph->y[b2],
+					  graph->x[a2], graph->y[a2]);
+	}
+
+	return side < 0;
+}
+
+/**
+ * Finds the face right above the outer boundary of a component by casting a
+ * ray upwards from its top vertex, nudged ever so slightly to the right so
+ * that it never goes along a vertical edge.
+ *
+ * @param  graph   Planar graph.
+ * @param  grid    Grid of the edges of the graph.
+ * @param  col_top Highest row with any edges in each column of the grid.
+ * @param  face    Outer boundary of the component.
+ * @return         Face below the first edge hit by the ray or PLANAR_NONE if
+ *                 it didn't hit anything.
+ */
+size_t cast_ray_up(const planar_graph_t *graph, const seg_grid_t *grid,
+				   const size_t *col_top, const size_t face) {
+	const planar_face_t *f = &graph->faces[face];
+	size_t best = PLANAR_NONE;
+	size_t he = f->edge;
+	int64_t x;
+	int64_t y;
+
+	// Start from its top vertex, nothing of the component is above it.
+	while (graph->y[graph->origin[he]] != f->max_y) {
+		he = graph->next[he];
+	}
+	x = graph->x[graph->origin[he]];
+	y = f->max_y;
+
+	// Go up the column one row at a time until nothing closer can be found.
+	size_t col = (size_t)((x - grid->min_x) / grid->size);
+	for (size_t row = (size_t)((y - grid->min_y) / grid->size);
+			row <= col_top[col]; row++) {
+		size_t cell = (row * grid->cols) + col;
+
+		for (size_t i = grid->start[cell]; i < grid->start[cell + 1]; i++) {
+			size_t k = grid->items[i];
+			size_t lo = graph->origin[k * 2];
+			size_t hi = graph->origin[(k * 2) + 1];
+
+			if (graph->x[lo] > graph->x[hi]) {
+				size_t tmp = lo;
+				lo = hi;
+				hi = tmp;
+			}
+
+			// Must go across the ray, above the start, and not be ours.
+			if ((graph->x[lo] > x) || (graph->x[hi] <= x) ||
+					(orient(graph->x[lo], graph->y[lo], graph->x[hi],
+							graph->y[hi], x, y) >= 0) ||
+					(graph->faces[graph->face[k * 2]].component ==
+					 f->component)) {
+				continue;
+			}
+
+			if ((best == PLANAR_NONE) || edge_below(graph, k, best)) {
+				best = k;
+			}
+		}
+
+		// Anything in the rows above can only be further away.
+		if (best != PLANAR_NONE) {
+			size_t lo = graph->origin[best * 2];
+			size_t hi = graph->origin[(best * 2) + 1];
+			int64_t top = grid->min_y + ((int64_t)(row + 1) * grid->size);
+
+			if ((graph->y[lo] < top) && (graph->y[hi] < top)) {
+				break;
+			}
+		}
+	}
+
+	if (best == PLANAR_NONE) {
+		return PLANAR_NONE;
+	}
+
+	// The face below is on the left of the half-edge going to the left.
+	he = best * 2;
+	if (graph->x[graph->origin[he]] < graph->x[graph->origin[he ^ 1]]) {
+		he ^= 1;
+	}
+
+	return graph->face[he];
+}
+
+/**
+ * Finds the bounded face that contains each component's outer boundary.
+ *
+ * @param graph Planar graph.
+ */
+void find_parents(planar_graph_t *graph) {
+	planar_segment_t *segs;
+	seg_grid_t grid;
+	size_t *col_top;
+	size_t outer = 0;
+
+	// A lone component can't be inside of anything.
+	for (size_t f = 0; f < graph->face_count; f++) {
+		if (graph->faces[f].area <= 0) {
+			outer++;
+		}
+	}
+	if (outer < 2) {
+		return;
+	}
+
+	// Put the edges in a grid to cast the rays through.
+	segs = malloc(sizeof(planar_segment_t) * graph->edge_count);
+	for (size_t k = 0; k < graph->edge_count; k++) {
+		segs[k].x1 = graph->x[graph->origin[k * 2]];
+		segs[k].y1 = graph->y[graph->origin[k * 2]];
+		segs[k].x2 = graph->x[graph->origin[(k * 2) + 1]];
+		segs[k].y2 = graph->y[graph->origin[(k * 2) + 1]];
+		segs[k].operand = 0;
+	}
+	grid_build(&grid, segs, graph->edge_count);
+	free(segs);
+
+	col_top = calloc(grid.cols, sizeof(size_t));
+	for (size_t row = 0; row < grid.rows; row++) {
+		for (size_t col = 0; col < grid.cols; col++) {
+			size_t cell = (row * grid.cols) + col;
+			if (grid.start[cell] < grid.start[cell + 1]) {
+				col_top[col] = row;
+			}
+		}
+	}
+
+	// See what's right above each component.
+	for (size_t f = 0; f < graph->face_count; f++) {
+		if (graph->faces[f].area <= 0) {
+			graph->faces[f].parent = cast_ray_up(graph, &grid, col_top, f);
+		}
+	}
+
+	// Components that are right below another one are inside of whatever
+	// that one is in. Those are always higher up, so this never loops.
+	for (size_t f = 0; f < graph->face_count; f++) {
+		size_t parent = graph->faces[f].parent;
+		if (graph->faces[f].area > 0) {
+			continue;
+		}
+
+		while ((parent != PLANAR_NONE) && (graph->faces[parent].area <= 0)) {
+			parent = graph->faces[parent].parent;
+		}
+
+		// Shortcut the whole chain for the ones that come later.
+		size_t g = f;
+		while ((g != PLANAR_NONE) && (graph->faces[g].area <= 0)) {
+			size_t next = graph->faces[g].parent;
+			graph->faces[g].parent = parent;
+			g = next;
+		}
+	}
+
+	free(col_top);
+	grid_free(&grid);
+}
+
+/**
+ * Calculates the winding number of each face for each operand, starting from
+ * the unbounded face and crossing edges inwards.
+ *
+ * @param graph Planar graph.
+ */
+void propagate_winding(planar_graph_t *graph) {
+	size_t ops = graph->operands;
+	size_t *queue = malloc(sizeof(size_t) * (graph->face_count + 1));
+	bool *done = calloc(graph->face_count + 1, sizeof(bool));
+	size_t *child_start = calloc(graph->face_count + 2, sizeof(size_t));
+	size_t *children = malloc(sizeof(size_t) * (graph->face_count + 1));
+	size_t head = 0;
+	size_t tail = 0;
+
+	graph->face_wind = calloc((graph->face_count * ops) + 1, sizeof(int32_t));
+
+	// Group the floating components by the face they're in.
+	for (size_t f = 0; f < graph->face_count; f++) {
+		if (graph->faces[f].parent != PLANAR_NONE) {
+			child_start[graph->faces[f].parent + 1]++;
+		}
+	}
+	for (size_t f = 0; f < graph->face_count; f++) {
+		child_start[f + 1] += child_start[f];
+	}
+	size_t *fill = malloc(sizeof(size_t) * (graph->face_count + 1));
+	memcpy(fill, child_start, sizeof(size_t) * (graph->face_count + 1));
+	for (size_t f = 0; f < graph->face_count; f++) {
+		if (graph->faces[f].parent != PLANAR_NONE) {
+			children[fill[graph->faces[f].parent]++] = f;
+		}
+	}
+	free(fill);
+
+	// Everything starts from the unbounded faces.
+	for (size_t f = 0; f < graph->face_count; f++) {
+		if ((graph->faces[f].area <= 0) &&
+				(graph->faces[f].parent == PLANAR_NONE)) {
+			done[f] = true;
+			queue[tail++] = f;
+		}
+	}
+
+	while (head < tail) {
+		size_t f = queue[head++];
+		const int32_t *wind = &graph->face_wind[f * ops];
+
+		// Components floating inside this face share its winding numbers.
+		for (size_t i = child_start[f]; i < child_start[f + 1]; i++) {
+			size_t c = children[i];
+			if (!done[c]) {
+				memcpy(&graph->face_wind[c * ops], wind,
+					   sizeof(int32_t) * ops);
+				done[c] = true;
+				queue[tail++] = c;
+			}
+		}
+
+		// Cross every edge of the face to the one on the other side.
+		size_t he = graph->faces[f].edge;
+		do {
+			size_t g = graph->face[he ^ 1];
+			if (!done[g]) {
+				for (uint8_t op = 0; op < ops; op++) {
+					graph->face_wind[(g * ops) + op] = wind[op] -
+						planar_wind_along(graph, he, op);
+				}
+
+				done[g] = true;
+				queue[tail++] = g;
+			}
+
+			he = graph->next[he];
+		} while (he != graph->faces[f].edge);
+	}
+
+	free(queue);
+	free(done);
+	free(child_start);
+	free(children);
+}
@@ -0,0 +1,93 @@
+/**
+ * engine/planar.h
+ * Planar graph (half-edge structure) built out of a soup of line segments.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _PLANAR_H
+#define _PLANAR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Constants.
+#define PLANAR_MAX_COORD    (1L << 29)  // Keeps every product in 64 bits.
+#define PLANAR_MAX_OPERANDS 8
+#define PLANAR_NONE         SIZE_MAX
+
+// Input segment. The operand is used to keep track of winding numbers of
+// separate inputs, like the two sides of a boolean operation.
+typedef struct {
+	int64_t x1;
+	int64_t y1;
+	int64_t x2;
+	int64_t y2;
+	uint8_t operand;
+} planar_segment_t;
+
+// Growing list of segments.
+typedef struct {
+	size_t            count;
+	size_t            capacity;
+	planar_segment_t *list;
+} planar_segments_t;
+
+// Face of the graph. Bounded faces have a positive area and are traced
+// counter-clockwise. Faces with a negative area are the outer boundaries of
+// connected components, and their parent is the bounded face that contains
+// them (or PLANAR_NONE for the unbounded face).
+typedef struct {
+	size_t  edge;        // First half-edge of the boundary.
+	size_t  edge_count;
+	double  area;
+	int64_t min_x;
+	int64_t min_y;
+	int64_t max_x;
+	int64_t max_y;
+	size_t  component;
+	size_t  parent;
+} planar_face_t;
+
+// Planar graph. Half-edges 2k and 2k+1 are the two sides of edge k, with 2k
+// going from the lower to the higher numbered vertex.
+typedef struct {
+	size_t         vertex_count;
+	int64_t       *x;
+	int64_t       *y;
+	size_t         edge_count;
+	uint8_t        operands;
+	int32_t       *edge_wind;  // Net input direction along 2k, per operand.
+	size_t        *origin;     // Per half-edge.
+	size_t        *next;       // Per half-edge.
+	size_t        *face;       // Per half-edge.
+	size_t         face_count;
+	planar_face_t *faces;
+	int32_t       *face_wind;  // Winding number per face and operand.
+
+	// Statistics.
+	size_t         segment_count;
+	size_t         intersection_count;
+	size_t         pruned_count;
+} planar_graph_t;
+
+// Initialization and destruction.
+void planar_init(planar_graph_t *graph);
+void planar_free(planar_graph_t *graph);
+
+// Building.
+void planar_push_segment(planar_segments_t *segs, const int64_t x1,
+						 const int64_t y1, const int64_t x2, const int64_t y2,
+						 const uint8_t operand);
+bool planar_build(planar_graph_t *graph, const planar_segment_t *segs,
+				  const size_t count, const uint8_t operands,
+				  const int64_t snap, const bool prune);
+
+// Queries.
+int32_t planar_wind_along(const planar_graph_t *graph, const size_t he,
+						  const uint8_t operand);
+bool planar_face_contains(const planar_graph_t *graph, const size_t face,
+						  const int64_t x, const int64_t y);
+
+#endif
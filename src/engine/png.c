@@ -0,0 +1,454 @@
+/**
+ * engine/png.c
+ * PNG writer for images from the headless rasterizer.
+ *
+ * Images are written as 8-bit RGB. Each scanline gets the filter that leaves
+ * it with the smallest values (or always the same one in fast mode), and then
+ * pieces of a few rows at a time are compressed in parallel into runs of
+ * deflate blocks that are simply put one after the other, each using the end
+ * of the piece before it as history. Pieces are always split at the same rows,
+ * so the output doesn't depend on the number of threads.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "threadpool.h"
+#include "deflate.h"
+#include "png.h"
+
+// Scanline filter types.
+#define PNG_FILTER_NONE  0
+#define PNG_FILTER_SUB   1
+#define PNG_FILTER_UP    2
+#define PNG_FILTER_AVG   3
+#define PNG_FILTER_PAETH 4
+
+// PNG chunk being written.
+typedef struct {
+	writer_t *out;
+	uint32_t  crc;
+} png_chunk_t;
+
+// Everything the encoding tasks need.
+typedef struct {
+	const raster_t *raster;
+	uint8_t         mode;
+	size_t          stride;   // Bytes per filtered row, with its filter type.
+	uint8_t        *filtered;
+	uint32_t        piece_rows;
+	size_t          pieces;
+	uint8_t       **data;     // Compressed data of each piece.
+	size_t         *len;
+	uint32_t       *adler;
+} png_job_t;
+
+// PNG file signature.
+static const uint8_t png_signature[8] = {
+	0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+};
+
+// CRC-32 lookup table, built on first use.
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+// Internal functions.
+void crc_table_build();
+uint32_t crc_update(uint32_t crc, const uint8_t *data, const size_t len);
+void put_be32(uint8_t *buf, const uint32_t value);
+void chunk_begin(png_chunk_t *chunk, writer_t *out, const char *type,
+				 const uint32_t len);
+void chunk_data(png_chunk_t *chunk, const void *data, const size_t len);
+void chunk_end(png_chunk_t *chunk);
+void png_filter_task(void *data, const size_t index);
+void png_deflate_task(void *data, const size_t index);
+void png_filter_row(const uint8_t *row, const uint8_t *prev, const size_t len,
+					const uint8_t type, uint8_t *out);
+uint64_t png_filter_cost(const uint8_t *filtered, const size_t len);
+uint8_t paeth(const uint8_t a, const uint8_t b, const uint8_t c);
+
+
+/**
+ * Writes an image as PNG.
+ *
+ * @param  out    Writer to send the image to.
+ * @param  raster Image to be written.
+ * @param  mode   Encoding mode (PNG_*).
+ * @return        TRUE if nothing failed.
+ */
+bool png_write(writer_t *out, const raster_t *raster, const uint8_t mode) {
+	png_chunk_t chunk;
+	png_job_t job;
+	uint8_t buf[16];
+
+	pthread_once(&crc_table_once, crc_table_build);
+
+	// Filter the scanlines and compress them a piece at a time.
+	job.raster = raster;
+	job.mode = mode;
+	job.stride = 1 + ((size_t)raster->width * RASTER_CHANNELS);
+	job.piece_rows = (uint32_t)(PNG_PIECE_SIZE / job.stride);
+	job.piece_rows = (job.piece_rows == 0) ? 1 : job.piece_rows;
+	job.pieces = (raster->height + job.piece_rows - 1) / job.piece_rows;
+	job.pieces = (job.pieces == 0) ? 1 : job.pieces;
+	job.filtered = malloc((job.stride * raster->height) + 1);
+	job.data = malloc(sizeof(uint8_t *) * job.pieces);
+	job.len = malloc(sizeof(size_t) * job.pieces);
+	job.adler = malloc(sizeof(uint32_t) * job.pieces);
+
+	threadpool_run(png_filter_task, &job, job.pieces);
+	threadpool_run(png_deflate_task, &job, job.pieces);
+
+	size_t idat = 2 + 4;
+	uint32_t adler = job.adler[0];
+	for (size_t i = 0; i < job.pieces; i++) {
+		idat += job.len[i];
+		if (i > 0) {
+			size_t rows = raster->height - (i * job.piece_rows);
+			rows = (rows > job.piece_rows) ? job.piece_rows : rows;
+			adler = deflate_adler32_combine(adler, job.adler[i],
+											rows * job.stride);
+		}
+	}
+
+	writer_write(out, png_signature, sizeof(png_signature));
+
+	// Image header.
+	put_be32(buf, raster->width);
+	put_be32(buf + 4, raster->height);
+	buf[8] = 8;   // Bit depth.
+	buf[9] = 2;   // Truecolor.
+	buf[10] = 0;  // Deflate.
+	buf[11] = 0;  // Adaptive filtering.
+	buf[12] = 0;  // No interlacing.
+	chunk_begin(&chunk, out, "IHDR", 13);
+	chunk_data(&chunk, buf, 13);
+	chunk_end(&chunk);
+
+	// Image data, as a single zlib stream made out of every piece.
+	chunk_begin(&chunk, out, "IDAT", (uint32_t)idat);
+	buf[0] = 0x78;
+	buf[1] = (mode == PNG_FAST) ? 0x01 : 0x9C;
+	chunk_data(&chunk, buf, 2);
+	for (size_t i = 0; i < job.pieces; i++) {
+		chunk_data(&chunk, job.data[i], job.len[i]);
+		free(job.data[i]);
+	}
+	put_be32(buf, adler);
+	chunk_data(&chunk, buf, 4);
+	chunk_end(&chunk);
+
+	// End of the image.
+	chunk_begin(&chunk, out, "IEND", 0);
+	chunk_end(&chunk);
+
+	free(job.filtered);
+	free(job.data);
+	free(job.len);
+	free(job.adler);
+
+	return !out->failed;
+}
+
+/**
+ * Writes an image to a PNG file.
+ *
+ * @param  filename Path of the file to be written.
+ * @param  raster   Image to be written.
+ * @param  mode     Encoding mode (PNG_*).
+ * @return          TRUE if the file was written.
+ */
+bool png_write_file(const char *filename, const raster_t *raster,
+					const uint8_t mode) {
+	writer_t out;
+	if (!writer_open_file(&out, filename)) {
+		return false;
+	}
+
+	bool success = png_write(&out, raster, mode);
+	if (!writer_close(&out)) {
+		success = false;
+	}
+
+	return success;
+}
+
+/**
+ * Builds the CRC-32 lookup table.
+ */
+void crc_table_build() {
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (uint8_t k = 0; k < 8; k++) {
+			c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+		}
+
+		crc_table[n] = c;
+	}
+}
+
+/**
+ * Updates a running CRC-32 with some data.
+ *
+ * @param  crc  Running CRC, before its final inversion.
+ * @param  data Data to be added.
+ * @param  len  Length of the data.
+ * @return      Updated CRC.
+ */
+uint32_t crc_update(uint32_t crc, const uint8_t *data, const size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+/**
+ * Stores a 32-bit number in big-endian order.
+ *
+ * @param buf   Where to store it.
+ * @param value Number to be stored.
+ */
+void put_be32(uint8_t *buf, const uint32_t value) {
+	buf[0] = (uint8_t)(value >> 24);
+	buf[1] = (uint8_t)(value >> 16);
+	buf[2] = (uint8_t)(value >> 8);
+	buf[3] = (uint8_t)value;
+}
+
+/**
+ * Starts a chunk.
+ *
+ * @param chunk Chunk to be started.
+ * @param out   Writer to send it to.
+ * @param type  Four letter chunk type.
+ * @param len   Length of the data that will follow.
+ */
+void chunk_begin(png_chunk_t *chunk, writer_t *out, const char *type,
+				 const uint32_t len) {
+	uint8_t buf[4];
+
+	chunk->out = out;
+	chunk->crc = 0xFFFFFFFFu;
+
+	put_be32(buf, len);
+	writer_write(out, buf, 4);
+	chunk_data(chunk, type, 4);
+}
+
+/**
+ * Writes a piece of the data of a chunk.
+ *
+ * @param chunk Chunk being written.
+ * @param data  Data to be written.
+ * @param len   Length of the data.
+ */
+void chunk_data(png_chunk_t *chunk, const void *data, const size_t len) {
+	chunk->crc = crc_update(chunk->crc, (const uint8_t *)data, len);
+	writer_write(chunk->out, data, len);
+}
+
+/**
+ * Ends a chunk with its CRC.
+ *
+ * @param chunk Chunk being written.
+ */
+void chunk_end(png_chunk_t *chunk) {
+	uint8_t buf[4];
+
+	put_be32(buf, chunk->crc ^ 0xFFFFFFFFu);
+	writer_write(chunk->out, buf, 4);
+}
+
+/**
+ * Filters the scanlines of a piece.
+ *
+ * @param data  Encoding job.
+ * @param index Piece of the image.
+ */
+void png_filter_task(void *data, const size_t index) {
+	png_job_t *job = (png_job_t *)data;
+	const raster_t *raster = job->raster;
+	size_t len = job->stride - 1;
+	uint32_t start = (uint32_t)index * job->piece_rows;
+	uint32_t end = start + job->piece_rows;
+	end = (end > raster->height) ? raster->height : end;
+	uint8_t *trial = (job->mode == PNG_FAST) ? NULL : malloc(job->stride);
+
+	for (uint32_t y = start; y < end; y++) {
+		const uint8_t *row = raster->pixels + ((size_t)y * len);
+		const uint8_t *prev = (y == 0) ? NULL : (row - len);
+		uint8_t *out = job->filtered + ((size_t)y * job->stride);
+
+		if (job->mode == PNG_FAST) {
+			png_filter_row(row, prev, len, PNG_FILTER_SUB, out);
+			continue;
+		}
+
+		// Repeated scanlines are common in drawings and go to all zeros.
+		if ((prev != NULL) && (memcmp(row, prev, len) == 0)) {
+			png_filter_row(row, prev, len, PNG_FILTER_UP, out);
+			continue;
+		}
+
+		// Keep the filter that gives the smallest sum of signed values,
+		// swapping buffers rather than copying each better one over.
+		uint8_t *keep = out;
+		uint8_t *cand = trial;
+		uint64_t best = UINT64_MAX;
+		for (uint8_t type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH;
+				type++) {
+			png_filter_row(row, prev, len, type, cand);
+			uint64_t sum = png_filter_cost(cand + 1, len);
+
+			if (sum < best) {
+				uint8_t *swap = keep;
+				keep = cand;
+				cand = swap;
+				best = sum;
+
+				// Nothing beats a scanline of zeros.
+				if (best == 0) {
+					break;
+				}
+			}
+		}
+
+		if (keep != out) {
+			memcpy(out, keep, job->stride);
+		}
+	}
+
+	free(trial);
+}
+
+/**
+ * Compresses the filtered scanlines of a piece.
+ *
+ * @param data  Encoding job.
+ * @param index Piece of the image.
+ */
+void png_deflate_task(void *data, const size_t index) {
+	png_job_t *job = (png_job_t *)data;
+	size_t start = index * job->piece_rows;
+	size_t end = start + job->piece_rows;
+	end = (end > job->raster->height) ? job->raster->height : end;
+
+	start *= job->stride;
+	end *= job->stride;
+	job->data[index] = deflate_piece(job->filtered, start, end,
+		(job->mode == PNG_FAST) ? DEFLATE_FAST : DEFLATE_DEFAULT,
+		index == (job->pieces - 1), &job->len[index]);
+	job->adler[index] = deflate_adler32(1, job->filtered + start, end - start);
+}
+
+/**
+ * Filters a scanline.
+ *
+ * @param row  Pixels of the scanline.
+ * @param prev Pixels of the scanline above it or NULL for the first one.
+ * @param len  Length of the scanline in bytes.
+ * @param type Filter type (PNG_FILTER_*).
+ * @param out  Filtered scanline, starting with its filter type.
+ */
+void png_filter_row(const uint8_t *row, const uint8_t *prev, const size_t len,
+					const uint8_t type, uint8_t *out) {
+	const size_t bpp = RASTER_CHANNELS;
+	*out++ = type;
+
+	// The first scanline has nothing above it, which makes Up the same as
+	// None, Paeth the same as Sub, and halves the left neighbour for Avg.
+	if ((prev == NULL) && (type != PNG_FILTER_AVG)) {
+		if (type == PNG_FILTER_PAETH) {
+			png_filter_row(row, NULL, len, PNG_FILTER_SUB, out - 1);
+			out[-1] = type;
+			return;
+		} else if (type == PNG_FILTER_UP) {
+			memcpy(out, row, len);
+			return;
+		}
+	}
+
+	// Go through each filter on its own so the loops stay tight.
+	switch (type) {
+		case PNG_FILTER_SUB:
+			memcpy(out, row, bpp);
+			for (size_t i = bpp; i < len; i++) {
+				out[i] = (uint8_t)(row[i] - row[i - bpp]);
+			}
+			break;
+		case PNG_FILTER_UP:
+			for (size_t i = 0; i < len; i++) {
+				out[i] = (uint8_t)(row[i] - prev[i]);
+			}
+			break;
+		case PNG_FILTER_AVG:
+			for (size_t i = 0; i < bpp; i++) {
+				uint8_t b = (prev != NULL) ? prev[i] : 0;
+				out[i] = (uint8_t)(row[i] - (b / 2));
+			}
+			for (size_t i = bpp; i < len; i++) {
+				uint8_t b = (prev != NULL) ? prev[i] : 0;
+				out[i] = (uint8_t)(row[i] - ((row[i - bpp] + b) / 2));
+			}
+			break;
+		case PNG_FILTER_PAETH:
+			for (size_t i = 0; i < bpp; i++) {
+				out[i] = (uint8_t)(row[i] - prev[i]);
+			}
+			for (size_t i = bpp; i < len; i++) {
+				out[i] = (uint8_t)(row[i] - paeth(row[i - bpp], prev[i],
+												  prev[i - bpp]));
+			}
+			break;
+		default:
+			memcpy(out, row, len);
+			break;
+	}
+}
+
+/**
+ * Scores a filtered scanline by the sum of its bytes taken as signed values,
+ * which tends to be smaller the better it'll compress.
+ *
+ * @param  filtered Filtered bytes, without the filter type.
+ * @param  len      Number of bytes.
+ * @return          Sum of their absolute values.
+ */
+uint64_t png_filter_cost(const uint8_t *filtered, const size_t len) {
+	uint64_t sum = 0;
+
+	// Add up in runs short enough not to overflow so the loop vectorizes.
+	for (size_t start = 0; start < len; start += 65536) {
+		size_t end = ((len - start) > 65536) ? (start + 65536) : len;
+		uint32_t run = 0;
+
+		for (size_t i = start; i < end; i++) {
+			int8_t v = (int8_t)filtered[i];
+			run += (uint32_t)((v < 0) ? -v : v);
+		}
+
+		sum += run;
+	}
+
+	return sum;
+}
+
+/**
+ * Paeth predictor, picking whichever neighbour is closest to a + b - c.
+ *
+ * @param  a Byte to the left.
+ * @param  b Byte above.
+ * @param  c Byte above and to the left.
+ * @return   Predicted byte.
+ */
+uint8_t paeth(const uint8_t a, const uint8_t b, const uint8_t c) {
+	// Distances from a + b - c, written out so they compile without branches.
+	int pa = abs((int)b - c);
+	int pb = abs((int)a - c);
+	int pc = abs((int)a + b - (2 * c));
+	uint8_t near = (pb <= pc) ? b : c;
+
+	return ((pa <= pb) && (pa <= pc)) ? a : near;
+}
@@ -0,0 +1,29 @@
+/**
+ * engine/png.h
+ * PNG writer for images from the headless rasterizer.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _PNG_H
+#define _PNG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "raster.h"
+#include "writer.h"
+
+// Encoding modes.
+#define PNG_DEFAULT 0
+#define PNG_FAST    1  // Quicker and bigger, for previews.
+
+// Raw bytes compressed by each parallel task.
+#define PNG_PIECE_SIZE 65536
+
+// Writing.
+bool png_write(writer_t *out, const raster_t *raster, const uint8_t mode);
+bool png_write_file(const char *filename, const raster_t *raster,
+					const uint8_t mode);
+
+#endif
@@ -0,0 +1,230 @@
+/**
+ * engine/raster.c
+ * Headless software rasterizer for rendering drawings without a display.
+ *
+ * Everything is drawn as one pixel wide aliased lines, which is what the
+ * display looks like as well. Coordinates are in pixels, with the origin at
+ * the top-left corner of the image, and anything outside of it is clipped.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "raster.h"
+
+// Most segments a circle is approximated with.
+#define RASTER_MAX_CIRCLE_SEGMENTS 8192
+
+// Internal functions.
+bool clip_line(const raster_t *raster, double *x0, double *y0, double *x1,
+			   double *y1);
+bool clip_edge(const double p, const double q, double *t0, double *t1);
+
+
+/**
+ * Initializes an image filled with black.
+ *
+ * @param raster Image to be initialized.
+ * @param width  Width in pixels.
+ * @param height Height in pixels.
+ */
+void raster_init(raster_t *raster, const uint32_t width,
+				 const uint32_t height) {
+	raster->width = width;
+	raster->height = height;
+	raster->pixels = calloc((size_t)width * height, RASTER_CHANNELS);
+}
+
+/**
+ * Frees the pixels of an image.
+ *
+ * @param raster Image to be freed.
+ */
+void raster_free(raster_t *raster) {
+	free(raster->pixels);
+	raster->pixels = NULL;
+	raster->width = 0;
+	raster->height = 0;
+}
+
+/**
+ * Fills the whole image with a color.
+ *
+ * @param raster Image.
+ * @param color  Fill color.
+ */
+void raster_clear(raster_t *raster, const rgba_color_t color) {
+	size_t count = (size_t)raster->width * raster->height;
+	uint8_t *px = raster->pixels;
+
+	for (size_t i = 0; i < count; i++) {
+		*px++ = color.r;
+		*px++ = color.g;
+		*px++ = color.b;
+	}
+}
+
+/**
+ * Draws a line.
+ *
+ * @param raster Image.
+ * @param x0     Horizontal position of the start of the line.
+ * @param y0     Vertical position of the start of the line.
+ * @param x1     Horizontal position of the end of the line.
+ * @param y1     Vertical position of the end of the line.
+ * @param color  Line color.
+ */
+void raster_line(raster_t *raster, double x0, double y0, double x1,
+				 double y1, const rgba_color_t color) {
+	// Only go through the pixels that are actually in the image.
+	if (!clip_line(raster, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+
+	// Bresenham from the pixel of one end to the pixel of the other.
+	long px = (long)floor(x0);
+	long py = (long)floor(y0);
+	long ex = (long)floor(x1);
+	long ey = (long)floor(y1);
+	long dx = labs(ex - px);
+	long dy = -labs(ey - py);
+	long sx = (px < ex) ? 1 : -1;
+	long sy = (py < ey) ? 1 : -1;
+	long err = dx + dy;
+
+	while (true) {
+		if ((px >= 0) && (py >= 0) && (px < (long)raster->width) &&
+				(py < (long)raster->height)) {
+			uint8_t *p = raster->pixels +
+				((size_t)py * raster->width + (size_t)px) * RASTER_CHANNELS;
+			p[0] = color.r;
+			p[1] = color.g;
+			p[2] = color.b;
+		}
+
+		if ((px == ex) && (py == ey)) {
+			break;
+		}
+
+		long e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			px += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			py += sy;
+		}
+	}
+}
+
+/**
+ * Draws a circle, made out of segments short enough to look round.
+ *
+ * @param raster Image.
+ * @param cx     Horizontal position of the center.
+ * @param cy     Vertical position of the center.
+ * @param radius Radius in pixels.
+ * @param color  Line color.
+ */
+void raster_circle(raster_t *raster, const double cx, const double cy,
+				   const double radius, const rgba_color_t color) {
+	// Skip circles that don't touch the image at all.
+	if (((cx + radius) < 0) || ((cy + radius) < 0) ||
+			((cx - radius) > raster->width) ||
+			((cy - radius) > raster->height)) {
+		return;
+	}
+
+	// Keep the segments within half a pixel of the real circle.
+	size_t segments = 8;
+	if (radius > 0.5) {
+		double n = ceil(M_PI / acos(1.0 - (0.5 / radius)));
+		segments = (n < 8) ? 8 : (n > RASTER_MAX_CIRCLE_SEGMENTS) ?
+			RASTER_MAX_CIRCLE_SEGMENTS : (size_t)n;
+	}
+
+	double px = cx + radius;
+	double py = cy;
+	for (size_t i = 1; i <= segments; i++) {
+		double angle = (2.0 * M_PI * (double)i) / (double)segments;
+		double x = cx + (radius * cos(angle));
+		double y = cy + (radius * sin(angle));
+
+		raster_line(raster, px, py, x, y, color);
+		px = x;
+		py = y;
+	}
+}
+
+/**
+ * Clips a line to the image (Liang-Barsky), leaving a pixel of margin so that
+ * rounding never eats the pixels at the edges.
+ *
+ * @param  raster Image.
+ * @param  x0     Horizontal position of the start of the line.
+ * @param  y0     Vertical position of the start of the line.
+ * @param  x1     Horizontal position of the end of the line.
+ * @param  y1     Vertical position of the end of the line.
+ * @return        FALSE if the line is completely outside the image.
+ */
+bool clip_line(const raster_t *raster, double *x0, double *y0, double *x1,
+			   double *y1) {
+	double dx = *x1 - *x0;
+	double dy = *y1 - *y0;
+	double t0 = 0;
+	double t1 = 1;
+
+	if (!clip_edge(-dx, *x0 + 1, &t0, &t1) ||
+			!clip_edge(dx, (double)raster->width + 1 - *x0, &t0, &t1) ||
+			!clip_edge(-dy, *y0 + 1, &t0, &t1) ||
+			!clip_edge(dy, (double)raster->height + 1 - *y0, &t0, &t1)) {
+		return false;
+	}
+
+	if (t1 < 1) {
+		*x1 = *x0 + (t1 * dx);
+		*y1 = *y0 + (t1 * dy);
+	}
+	if (t0 > 0) {
+		*x0 += t0 * dx;
+		*y0 += t0 * dy;
+	}
+
+	return true;
+}
+
+/**
+ * Clips the parametric range of a line against one edge of the image.
+ *
+ * @param  p  Direction of the line towards the edge.
+ * @param  q  Distance from the start of the line to the edge.
+ * @param  t0 Start of the range that's inside.
+ * @param  t1 End of the range that's inside.
+ * @return    FALSE if nothing of the line is left inside.
+ */
+bool clip_edge(const double p, const double q, double *t0, double *t1) {
+	if (p == 0) {
+		return q >= 0;
+	}
+
+	double t = q / p;
+	if (p < 0) {
+		if (t > *t1) {
+			return false;
+		}
+		if (t > *t0) {
+			*t0 = t;
+		}
+	} else {
+		if (t < *t0) {
+			return false;
+		}
+		if (t < *t1) {
+			*t1 = t;
+		}
+	}
+
+	return true;
+}
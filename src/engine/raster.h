@@ -0,0 +1,37 @@
+/**
+ * engine/raster.h
+ * Headless software rasterizer for rendering drawings without a display.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _RASTER_H
+#define _RASTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "nanocad.h"
+
+// Bytes per pixel (RGB).
+#define RASTER_CHANNELS 3
+
+// Image in memory, with its rows from top to bottom.
+typedef struct {
+	uint32_t  width;
+	uint32_t  height;
+	uint8_t  *pixels;
+} raster_t;
+
+// Initialization and destruction.
+void raster_init(raster_t *raster, const uint32_t width, const uint32_t height);
+void raster_free(raster_t *raster);
+
+// Drawing.
+void raster_clear(raster_t *raster, const rgba_color_t color);
+void raster_line(raster_t *raster, double x0, double y0, double x1,
+				 double y1, const rgba_color_t color);
+void raster_circle(raster_t *raster, const double cx, const double cy,
+				   const double radius, const rgba_color_t color);
+
+#endif
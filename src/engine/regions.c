@@ -0,0 +1,293 @@
+/**
+ * engine/regions.c
+ * Closed regions (faces with their holes) formed by the lines of a drawing.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include "regions.h"
+
+// Segments being gathered from the document.
+typedef struct {
+	planar_segments_t *segs;
+	uint8_t            operand;
+} segment_collector_t;
+
+// Internal functions.
+bool collect_segments(const object_span_t *span, void *data);
+size_t add_ring(region_set_t *set, const planar_graph_t *graph,
+				const size_t face);
+
+
+/**
+ * Initializes an empty region set.
+ *
+ * @param set Region set.
+ */
+void regions_init(region_set_t *set) {
+	memset(set, 0, sizeof(region_set_t));
+}
+
+/**
+ * Frees everything allocated by a region set.
+ *
+ * @param set Region set.
+ */
+void regions_free(region_set_t *set) {
+	free(set->points);
+	free(set->rings);
+	free(set->holes);
+	free(set->list);
+
+	regions_init(set);
+}
+
+/**
+ * Finds every closed region formed by the lines of the document, splitting
+ * them where they cross each other.
+ *
+ * @param  filter Which objects should be taken into account.
+ * @param  snap   Endpoints closer than this are considered the same point.
+ * @param  set    Region set to be populated. Must be initialized.
+ * @return        TRUE if the regions were found.
+ */
+bool regions_find(const object_filter_t *filter, const long snap,
+				  region_set_t *set) {
+	planar_segments_t segs = { 0, 0, NULL };
+	planar_graph_t graph;
+
+	// Build the planar graph out of the document.
+	regions_collect(filter, 0, &segs);
+	planar_init(&graph);
+	if (!planar_build(&graph, segs.list, segs.count, 1, snap, true)) {
+		free(segs.list);
+		return false;
+	}
+	free(segs.list);
+
+	// Every bounded face is a region.
+	bool *selected = malloc(sizeof(bool) * (graph.face_count + 1));
+	for (size_t f = 0; f < graph.face_count; f++) {
+		selected[f] = graph.faces[f].area > 0;
+	}
+
+	regions_from_graph(set, &graph, selected);
+	free(selected);
+	planar_free(&graph);
+
+	return true;
+}
+
+/**
+ * Finds the regions enclosed by directed edges that go around them
+ * counter-clockwise (and clockwise around their holes). Wherever the edges
+ * overlap themselves, everything with a positive winding number is kept.
+ *
+ * @param  set   Region set to be populated. Must be initialized.
+ * @param  edges Directed edges.
+ * @param  count Number of edges.
+ * @return       TRUE if the regions were found.
+ */
+bool regions_from_boundary(region_set_t *set, const planar_segment_t *edges,
+						   const size_t count) {
+	planar_graph_t graph;
+
+	planar_init(&graph);
+	if (!planar_build(&graph, edges, count, 1, 0, true)) {
+		return false;
+	}
+
+	bool *inside = malloc(sizeof(bool) * (graph.face_count + 1));
+	for (size_t f = 0; f < graph.face_count; f++) {
+		inside[f] = graph.face_wind[f] > 0;
+	}
+
+	bool success = regions_merge_faces(set, &graph, inside);
+	free(inside);
+	planar_free(&graph);
+
+	return success;
+}
+
+/**
+ * Merges the faces of a planar graph that are inside of something into
+ * regions, dropping the edges between them.
+ *
+ * @param  set    Region set to be populated. Must be initialized.
+ * @param  graph  Planar graph.
+ * @param  inside Which faces are inside.
+ * @return        TRUE if the regions were found.
+ */
+bool regions_merge_faces(region_set_t *set, const planar_graph_t *graph,
+						 const bool *inside) {
+	planar_segments_t segs = { 0, 0, NULL };
+	bool merge = false;
+
+	// Get the edges with the inside on their left only.
+	for (size_t he = 0; he < (graph->edge_count * 2); he++) {
+		bool left = inside[graph->face[he]];
+		bool right = inside[graph->face[he ^ 1]];
+
+		merge |= left && right;
+		if (left && !right) {
+			planar_push_segment(&segs, graph->x[graph->origin[he]],
+								graph->y[graph->origin[he]],
+								graph->x[graph->origin[he ^ 1]],
+								graph->y[graph->origin[he ^ 1]], 0);
+		}
+	}
+
+	// Every face already stands on its own.
+	if (!merge) {
+		free(segs.list);
+		regions_from_graph(set, graph, inside);
+
+		return true;
+	}
+
+	// Build a new graph without the edges in the middle of the regions.
+	bool success = regions_from_boundary(set, segs.list, segs.count);
+	free(segs.list);
+
+	return success;
+}
+
+/**
+ * Turns the selected bounded faces of a planar graph into regions, with the
+ * components floating inside of them as their holes.
+ *
+ * @param set      Region set to be populated. Must be initialized.
+ * @param graph    Planar graph.
+ * @param selected Which faces should become regions.
+ */
+void regions_from_graph(region_set_t *set, const planar_graph_t *graph,
+						const bool *selected) {
+	regions_free(set);
+	set->segment_count = graph->segment_count;
+	set->intersection_count = graph->intersection_count;
+	set->pruned_count = graph->pruned_count;
+
+	size_t *region_of = malloc(sizeof(size_t) * (graph->face_count + 1));
+	set->list = malloc(sizeof(region_t) * (graph->face_count + 1));
+	set->rings = malloc(sizeof(region_ring_t) * (graph->face_count + 1));
+	set->holes = malloc(sizeof(size_t) * (graph->face_count + 1));
+	set->points = malloc(sizeof(coord_t) * ((graph->edge_count * 2) + 1));
+	for (size_t f = 0; f < graph->face_count; f++) {
+		region_of[f] = PLANAR_NONE;
+		if ((graph->faces[f].area <= 0) || !selected[f]) {
+			continue;
+		}
+
+		region_t *region = &set->list[set->count];
+		region->outer = add_ring(set, graph, f);
+		region->first_hole = 0;
+		region->hole_count = 0;
+		region->area = graph->faces[f].area;
+		region_of[f] = set->count++;
+	}
+
+	// Count the components floating inside of each region as its holes.
+	for (size_t f = 0; f < graph->face_count; f++) {
+		size_t parent = graph->faces[f].parent;
+		if ((graph->faces[f].area <= 0) && (parent != PLANAR_NONE) &&
+				(region_of[parent] != PLANAR_NONE)) {
+			set->list[region_of[parent]].hole_count++;
+		}
+	}
+
+	size_t first = 0;
+	for (size_t i = 0; i < set->count; i++) {
+		set->list[i].first_hole = first;
+		first += set->list[i].hole_count;
+		set->list[i].hole_count = 0;
+	}
+
+	for (size_t f = 0; f < graph->face_count; f++) {
+		size_t parent = graph->faces[f].parent;
+		if ((graph->faces[f].area <= 0) && (parent != PLANAR_NONE) &&
+				(region_of[parent] != PLANAR_NONE)) {
+			region_t *region = &set->list[region_of[parent]];
+			size_t ring = add_ring(set, graph, f);
+
+			set->holes[region->first_hole + region->hole_count++] = ring;
+			region->area += set->rings[ring].area;
+			set->hole_count++;
+		}
+	}
+
+	free(region_of);
+}
+
+/**
+ * Gathers the lines of the document as planar graph segments.
+ *
+ * @param filter  Which objects should be gathered.
+ * @param operand Input the segments belong to.
+ * @param segs    Segment list to append to.
+ */
+void regions_collect(const object_filter_t *filter, const uint8_t operand,
+					 planar_segments_t *segs) {
+	segment_collector_t collector = { segs, operand };
+	nanocad_visit_objects(filter, collect_segments, &collector);
+}
+
+/**
+ * Object visitor that turns lines into planar graph segments.
+ *
+ * @param  span Object being visited.
+ * @param  data Segment collector.
+ * @return      Always TRUE to keep going.
+ */
+bool collect_segments(const object_span_t *span, void *data) {
+	segment_collector_t *collector = (segment_collector_t *)data;
+
+	for (uint8_t i = 1; i < span->coord_count; i++) {
+		planar_push_segment(collector->segs, span->coord[i - 1].x,
+							span->coord[i - 1].y, span->coord[i].x,
+							span->coord[i].y, collector->operand);
+	}
+
+	return true;
+}
+
+/**
+ * Copies the corners of the boundary of a face into a new ring.
+ *
+ * @param  set   Region set.
+ * @param  graph Planar graph.
+ * @param  face  Face to be copied.
+ * @return       Index of the new ring.
+ */
+size_t add_ring(region_set_t *set, const planar_graph_t *graph,
+				const size_t face) {
+	const planar_face_t *f = &graph->faces[face];
+	region_ring_t *ring = &set->rings[set->ring_count];
+	size_t he = f->edge;
+
+	ring->start = set->point_count;
+	ring->area = f->area;
+	for (size_t i = 0; i < f->edge_count; i++) {
+		size_t prev = graph->origin[he];
+		size_t cur = graph->origin[graph->next[he]];
+		size_t next = graph->origin[graph->next[graph->next[he]]];
+		int64_t dx1 = graph->x[cur] - graph->x[prev];
+		int64_t dy1 = graph->y[cur] - graph->y[prev];
+		int64_t dx2 = graph->x[next] - graph->x[cur];
+		int64_t dy2 = graph->y[next] - graph->y[cur];
+		he = graph->next[he];
+
+		// Skip points in the middle of a straight run.
+		if ((((dx1 * dy2) - (dy1 * dx2)) == 0) &&
+				(((dx1 * dx2) + (dy1 * dy2)) > 0)) {
+			continue;
+		}
+
+		coord_t *point = &set->points[set->point_count++];
+		point->x = (long)graph->x[cur];
+		point->y = (long)graph->y[cur];
+	}
+	ring->count = set->point_count - ring->start;
+
+	return set->ring_count++;
+}
@@ -0,0 +1,66 @@
+/**
+ * engine/regions.h
+ * Closed regions (faces with their holes) formed by the lines of a drawing.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _REGIONS_H
+#define _REGIONS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "nanocad.h"
+#include "planar.h"
+
+// Closed ring of points. Outer rings go counter-clockwise and holes go
+// clockwise, so the area of a hole is negative.
+typedef struct {
+	size_t start;
+	size_t count;
+	double area;
+} region_ring_t;
+
+// Region with its outer boundary and holes (indices in the hole list).
+typedef struct {
+	size_t outer;
+	size_t first_hole;
+	size_t hole_count;
+	double area;  // Area of the outer ring minus the holes.
+} region_t;
+
+// Every region found in a drawing.
+typedef struct {
+	size_t         point_count;
+	coord_t       *points;
+	size_t         ring_count;
+	region_ring_t *rings;
+	size_t         hole_count;
+	size_t        *holes;  // Ring indices.
+	size_t         count;
+	region_t      *list;
+
+	// Statistics.
+	size_t         segment_count;
+	size_t         intersection_count;
+	size_t         pruned_count;
+} region_set_t;
+
+// Initialization and destruction.
+void regions_init(region_set_t *set);
+void regions_free(region_set_t *set);
+
+// Detection.
+void regions_collect(const object_filter_t *filter, const uint8_t operand,
+					 planar_segments_t *segs);
+bool regions_find(const object_filter_t *filter, const long snap,
+				  region_set_t *set);
+bool regions_from_boundary(region_set_t *set, const planar_segment_t *edges,
+						   const size_t count);
+bool regions_merge_faces(region_set_t *set, const planar_graph_t *graph,
+						 const bool *inside);
+void regions_from_graph(region_set_t *set, const planar_graph_t *graph,
+						const bool *selected);
+
+#endif
@@ -0,0 +1,1010 @@
+/**
+ * engine/snapshot.c
+ * Binary snapshots of the document, with a header that has its extents,
+ * statistics and a small preview thumbnail.
+ *
+ * A snapshot starts with a fixed size header, followed by the thumbnail as a
+ * PNG image and then the body with the layers, objects, dimensions and
+ * variables. All
+ * numbers are little-endian. Since the header and the thumbnail are right at
+ * the start, a file browser only has to read a couple of blocks to show a
+ * drawing, no matter how big it is.
+ *
+ *   Offset  Size  Field
+ *        0     8  Magic ("NCADSNAP")
+ *        8     2  Format version
+ *       10     2  Header size
+ *       12    16  Engine version, NUL padded
+ *       28    32  Extents (min x, min y, max x, max y)
+ *       60    24  Object, coordinate and dimension counts
+ *       84     4  Layer count
+ *       88     4  Thumbnail width and height
+ *       92     8  Thumbnail offset
+ *      100     4  Thumbnail length
+ *      104    16  Body offset and length
+ *      120     4  Variable count
+ *      124     4  Reserved
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "diagnostics.h"
+#include "raster.h"
+#include "png.h"
+#include "snapshot.h"
+
+// Number of objects fetched from the store at a time.
+#define SNAPSHOT_SPAN_BLOCK 256
+
+// Sizes of the records in the body.
+#define SNAPSHOT_LAYER_SIZE     7   // Without the name.
+#define SNAPSHOT_OBJECT_SIZE    3   // Without the coordinates.
+#define SNAPSHOT_COORD_SIZE     16
+#define SNAPSHOT_DIMENSION_SIZE ((SNAPSHOT_COORD_SIZE * 4) + 1)
+#define SNAPSHOT_VARIABLE_SIZE  3   // Without the name and value.
+
+// Position in a snapshot being read.
+typedef struct {
+	const uint8_t *data;
+	size_t         pos;
+	size_t         len;
+} snapshot_cursor_t;
+
+// Internal functions.
+size_t snapshot_variable_size(const variable_t *var,
+							  const object_container *objects);
+void snapshot_write_variable(writer_t *out, const variable_t *var,
+							 const object_container *objects);
+bool snapshot_decode(snapshot_t *snap, snapshot_cursor_t *cur);
+bool snapshot_decode_variable(snapshot_t *snap, snapshot_cursor_t *cur,
+							  variable_t *var);
+const uint8_t* snapshot_take(snapshot_cursor_t *cur, const size_t len);
+bool snapshot_extents(snapshot_header_t *header);
+bool snapshot_thumb(const snapshot_header_t *header, writer_t *thumb);
+void snapshot_header_pack(const snapshot_header_t *header, uint8_t *buf);
+bool snapshot_header_unpack(snapshot_header_t *header, const uint8_t *buf);
+bool snapshot_header_fits(const snapshot_header_t *header, const uint64_t size);
+uint8_t* put_le16(uint8_t *buf, const uint16_t value);
+uint8_t* put_le32(uint8_t *buf, const uint32_t value);
+uint8_t* put_le64(uint8_t *buf, const uint64_t value);
+uint16_t get_le16(const uint8_t *buf);
+uint32_t get_le32(const uint8_t *buf);
+uint64_t get_le64(const uint8_t *buf);
+
+
+/**
+ * Writes a snapshot of the document.
+ *
+ * @param  out    Writer to send the snapshot to.
+ * @param  header Where to put the header that was written. Can be NULL.
+ * @return        TRUE if nothing failed.
+ */
+bool snapshot_write(writer_t *out, snapshot_header_t *header) {
+	snapshot_header_t hdr;
+	object_container objects;
+	dimension_container dimensions;
+	layer_container layers;
+	variable_container variables;
+	variable_t *last_object;
+	writer_t thumb;
+	uint8_t buf[SNAPSHOT_HEADER_SIZE];
+
+	nanocad_get_object_container(&objects);
+	nanocad_get_dimension_container(&dimensions);
+	nanocad_get_layer_container(&layers);
+	nanocad_get_variable_container(&variables);
+	last_object = nanocad_get_variable("^");
+
+	// Gather the statistics and work out how big the body will be.
+	memset(&hdr, 0, sizeof(snapshot_header_t));
+	hdr.version = SNAPSHOT_VERSION;
+	strncpy(hdr.engine, ENGINE_VERSION, SNAPSHOT_ENGINE_SIZE - 1);
+	hdr.objects = objects.count;
+	hdr.dimensions = dimensions.count;
+	hdr.layers = (uint32_t)layers.count;
+	for (size_t i = 0; i < layers.count; i++) {
+		hdr.body_len += SNAPSHOT_LAYER_SIZE + strlen(layers.list[i].name);
+	}
+	for (size_t i = 0; i < objects.count; i++) {
+		hdr.coords += objects.list[i].coord_count;
+	}
+	hdr.body_len += (SNAPSHOT_OBJECT_SIZE * hdr.objects) +
+		(SNAPSHOT_COORD_SIZE * hdr.coords) +
+		(SNAPSHOT_DIMENSION_SIZE * hdr.dimensions);
+
+	// Variables, with the last object one going along as "^".
+	for (size_t i = 0; i <= variables.count; i++) {
+		const variable_t *var = (i < variables.count) ?
+			&variables.list[i] : last_object;
+		size_t size = (var != NULL) ?
+			snapshot_variable_size(var, &objects) : 0;
+
+		if (size > 0) {
+			hdr.body_len += size;
+			hdr.variables++;
+		}
+	}
+
+	// Render the thumbnail before anything gets written, since the header
+	// needs to know how big it is.
+	writer_init_memory(&thumb);
+	if (snapshot_extents(&hdr) && !snapshot_thumb(&hdr, &thumb)) {
+		writer_close(&thumb);
+		return false;
+	}
+
+	size_t png_len;
+	const char *png = writer_data(&thumb, &png_len);
+	hdr.thumb_offset = SNAPSHOT_HEADER_SIZE;
+	hdr.thumb_len = (uint32_t)png_len;
+	hdr.body_offset = hdr.thumb_offset + hdr.thumb_len;
+
+	snapshot_header_pack(&hdr, buf);
+	writer_write(out, buf, SNAPSHOT_HEADER_SIZE);
+	writer_write(out, png, png_len);
+	writer_close(&thumb);
+
+	// Layers.
+	for (size_t i = 0; i < layers.count; i++) {
+		const layer_t *layer = &layers.list[i];
+		size_t len = strlen(layer->name);
+		len = (len > UINT16_MAX) ? UINT16_MAX : len;
+
+		buf[0] = layer->num;
+		buf[1] = layer->color.r;
+		buf[2] = layer->color.g;
+		buf[3] = layer->color.b;
+		buf[4] = layer->color.alpha;
+		put_le16(buf + 5, (uint16_t)len);
+		writer_write(out, buf, SNAPSHOT_LAYER_SIZE);
+		writer_write(out, layer->name, len);
+	}
+
+	// Objects, with their coordinates right after them.
+	for (size_t i = 0; i < objects.count; i++) {
+		const object_t *obj = &objects.list[i];
+		uint8_t *p = (uint8_t *)writer_reserve(out, SNAPSHOT_OBJECT_SIZE +
+			(SNAPSHOT_COORD_SIZE * obj->coord_count));
+
+		*p++ = obj->type;
+		*p++ = obj->layer_num;
+		*p++ = obj->coord_count;
+		for (uint8_t c = 0; c < obj->coord_count; c++) {
+			p = put_le64(p, (uint64_t)obj->coord[c].x);
+			p = put_le64(p, (uint64_t)obj->coord[c].y);
+		}
+
+		writer_commit(out, SNAPSHOT_OBJECT_SIZE +
+					  (SNAPSHOT_COORD_SIZE * obj->coord_count));
+	}
+
+	// Dimensions.
+	for (size_t i = 0; i < dimensions.count; i++) {
+		const dimension_t *dimen = &dimensions.list[i];
+		uint8_t *p = buf;
+
+		p = put_le64(p, (uint64_t)dimen->start.x);
+		p = put_le64(p, (uint64_t)dimen->start.y);
+		p = put_le64(p, (uint64_t)dimen->end.x);
+		p = put_le64(p, (uint64_t)dimen->end.y);
+		p = put_le64(p, (uint64_t)dimen->line_start.x);
+		p = put_le64(p, (uint64_t)dimen->line_start.y);
+		p = put_le64(p, (uint64_t)dimen->line_end.x);
+		p = put_le64(p, (uint64_t)dimen->line_end.y);
+		*p = dimen->layer_num;
+		writer_write(out, buf, SNAPSHOT_DIMENSION_SIZE);
+	}
+
+	// Variables.
+	for (size_t i = 0; i <= variables.count; i++) {
+		const variable_t *var = (i < variables.count) ?
+			&variables.list[i] : last_object;
+
+		if ((var != NULL) && (snapshot_variable_size(var, &objects) > 0)) {
+			snapshot_write_variable(out, var, &objects);
+		}
+	}
+
+	if (header != NULL) {
+		*header = hdr;
+	}
+
+	return !out->failed;
+}
+
+/**
+ * Writes a snapshot of the document to a file.
+ *
+ * @param  filename Path of the file to be written.
+ * @param  header   Where to put the header that was written. Can be NULL.
+ * @return          TRUE if the file was written.
+ */
+bool snapshot_write_file(const char *filename, snapshot_header_t *header) {
+	writer_t out;
+	if (!writer_open_file(&out, filename)) {
+		return false;
+	}
+
+	bool success = snapshot_write(&out, header);
+	if (!writer_close(&out)) {
+		success = false;
+	}
+
+	if (!success) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Couldn't write the snapshot file: %s", filename);
+	}
+
+	return success;
+}
+
+/**
+ * Reads a whole snapshot back into memory.
+ *
+ * @param  filename Path of the snapshot.
+ * @param  snap     Where to put the document. Has to be freed with
+ *                  snapshot_free unless its containers are taken over.
+ * @return          TRUE if the snapshot was read.
+ */
+bool snapshot_read(const char *filename, snapshot_t *snap) {
+	snapshot_cursor_t cur;
+	struct stat st;
+
+	memset(snap, 0, sizeof(snapshot_t));
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+					"Couldn't open the snapshot: %s", filename);
+		return false;
+	}
+
+	// Read the whole thing in one go.
+	uint8_t *data = NULL;
+	size_t got = 0;
+	if (fstat(fd, &st) == 0) {
+		data = malloc((size_t)st.st_size + 1);
+		while (got < (size_t)st.st_size) {
+			ssize_t len = read(fd, data + got, (size_t)st.st_size - got);
+			if (len <= 0) {
+				break;
+			}
+
+			got += (size_t)len;
+		}
+	}
+	close(fd);
+
+	cur.data = data;
+	cur.pos = 0;
+	cur.len = got;
+	bool success = (data != NULL) && (got == (size_t)st.st_size) &&
+		(got >= SNAPSHOT_HEADER_SIZE) &&
+		snapshot_header_unpack(&snap->header, data) &&
+		snapshot_header_fits(&snap->header, got);
+	if (success) {
+		cur.pos = (size_t)snap->header.body_offset;
+		success = snapshot_decode(snap, &cur) && (cur.pos == cur.len);
+	}
+
+	free(data);
+	if (!success) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Not a snapshot we can read: %s", filename);
+		snapshot_free(snap);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Frees a document read back from a snapshot.
+ *
+ * @param snap Document to be freed.
+ */
+void snapshot_free(snapshot_t *snap) {
+	for (size_t i = 0; i < snap->layers.count; i++) {
+		free(snap->layers.list[i].name);
+	}
+	for (size_t i = 0; i < snap->objects.count; i++) {
+		free(snap->objects.list[i].coord);
+	}
+	for (size_t i = 0; i < snap->variables.count; i++) {
+		free(snap->variables.list[i].name);
+		if (snap->variables.list[i].type != VARIABLE_OBJECT) {
+			free(snap->variables.list[i].value);
+		}
+	}
+
+	free(snap->layers.list);
+	free(snap->objects.list);
+	free(snap->dimensions.list);
+	free(snap->variables.list);
+	memset(snap, 0, sizeof(snapshot_t));
+}
+
+/**
+ * Reads the header of a snapshot, without going into the rest of the file.
+ *
+ * @param  filename Path of the snapshot.
+ * @param  header   Where to put the header.
+ * @return          TRUE if it's a snapshot that we can read.
+ */
+bool snapshot_read_header(const char *filename, snapshot_header_t *header) {
+	uint8_t buf[SNAPSHOT_HEADER_SIZE];
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+					"Couldn't open the snapshot: %s", filename);
+		return false;
+	}
+
+	ssize_t len = read(fd, buf, SNAPSHOT_HEADER_SIZE);
+	close(fd);
+	if ((len != SNAPSHOT_HEADER_SIZE) ||
+			!snapshot_header_unpack(header, buf)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Not a snapshot we can read: %s", filename);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Copies the thumbnail of a snapshot to a PNG file. Only the header and the
+ * thumbnail are read.
+ *
+ * @param  filename Path of the snapshot.
+ * @param  png      Path of the PNG file to be written.
+ * @param  header   Where to put the header of the snapshot.
+ * @return          TRUE if the thumbnail was copied.
+ */
+bool snapshot_extract_thumb(const char *filename, const char *png,
+							snapshot_header_t *header) {
+	uint8_t buf[SNAPSHOT_HEADER_SIZE];
+	writer_t out;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+					"Couldn't open the snapshot: %s", filename);
+		return false;
+	}
+
+	// Get the header.
+	struct stat st;
+	if ((fstat(fd, &st) != 0) ||
+			(read(fd, buf, SNAPSHOT_HEADER_SIZE) != SNAPSHOT_HEADER_SIZE) ||
+			!snapshot_header_unpack(header, buf) ||
+			!snapshot_header_fits(header, (uint64_t)st.st_size)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Not a snapshot we can read: %s", filename);
+		close(fd);
+		return false;
+	}
+
+	if (header->thumb_len == 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0,
+					"The snapshot of an empty drawing has no thumbnail: %s",
+					filename);
+		close(fd);
+		return false;
+	}
+
+	// Copy the image straight into the writer's buffers.
+	if (!writer_open_file(&out, png)) {
+		close(fd);
+		return false;
+	}
+
+	bool success = true;
+	uint64_t offset = header->thumb_offset;
+	size_t left = header->thumb_len;
+	while (success && (left > 0)) {
+		size_t len = (left > WRITER_BUFFER_SIZE) ? WRITER_BUFFER_SIZE : left;
+		char *p = writer_reserve(&out, len);
+		ssize_t got = pread(fd, p, len, (off_t)offset);
+
+		if (got <= 0) {
+			diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+						"The thumbnail of the snapshot is cut short: %s",
+						filename);
+			success = false;
+			break;
+		}
+
+		writer_commit(&out, (size_t)got);
+		offset += (uint64_t)got;
+		left -= (size_t)got;
+	}
+
+	close(fd);
+	if (!writer_close(&out)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, 0,
+					"Couldn't write the thumbnail: %s", png);
+		success = false;
+	}
+
+	return success;
+}
+
+/**
+ * Gets how much room a variable takes in a snapshot.
+ *
+ * @param  var     Variable to be stored.
+ * @param  objects Objects of the document.
+ * @return         Size of the variable or 0 if it can't be stored, like an
+ *                 object variable that doesn't point to any object.
+ */
+size_t snapshot_variable_size(const variable_t *var,
+							  const object_container *objects) {
+	size_t size = SNAPSHOT_VARIABLE_SIZE + strlen(var->name);
+	uintptr_t first = (uintptr_t)objects->list;
+	uintptr_t obj = (uintptr_t)var->value;
+
+	if (var->value == NULL) {
+		return 0;
+	}
+
+	switch (var->type) {
+		case VARIABLE_FIXED:
+			return size + 8;
+		case VARIABLE_COORD:
+			return size + SNAPSHOT_COORD_SIZE;
+		case VARIABLE_OBJECT:
+			if ((obj < first) ||
+					(obj >= (first + (sizeof(object_t) * objects->count))) ||
+					(((obj - first) % sizeof(object_t)) != 0)) {
+				return 0;
+			}
+
+			return size + 8;
+	}
+
+	return 0;
+}
+
+/**
+ * Writes a variable to a snapshot. Object variables are stored as the index
+ * of their object.
+ *
+ * @param out     Writer to send the snapshot to.
+ * @param var     Variable to be written.
+ * @param objects Objects of the document.
+ */
+void snapshot_write_variable(writer_t *out, const variable_t *var,
+							 const object_container *objects) {
+	uint8_t buf[SNAPSHOT_VARIABLE_SIZE + SNAPSHOT_COORD_SIZE];
+	size_t len = strlen(var->name);
+	uint64_t bits;
+
+	buf[0] = var->type;
+	put_le16(buf + 1, (uint16_t)len);
+	writer_write(out, buf, SNAPSHOT_VARIABLE_SIZE);
+	writer_write(out, var->name, len);
+
+	switch (var->type) {
+		case VARIABLE_FIXED:
+			memcpy(&bits, var->value, 8);
+			put_le64(buf, bits);
+			writer_write(out, buf, 8);
+			break;
+		case VARIABLE_COORD:
+			put_le64(buf, (uint64_t)((const coord_t *)var->value)->x);
+			put_le64(buf + 8, (uint64_t)((const coord_t *)var->value)->y);
+			writer_write(out, buf, SNAPSHOT_COORD_SIZE);
+			break;
+		case VARIABLE_OBJECT:
+			put_le64(buf, (uint64_t)((const object_t *)var->value -
+									 objects->list));
+			writer_write(out, buf, 8);
+			break;
+	}
+}
+
+/**
+ * Decodes the body of a snapshot.
+ *
+ * @param  snap Document with the header already read. Whatever was decoded is
+ *              left in it, even if this fails.
+ * @param  cur  Body of the snapshot.
+ * @return      FALSE if the body is broken.
+ */
+bool snapshot_decode(snapshot_t *snap, snapshot_cursor_t *cur) {
+	const snapshot_header_t *hdr = &snap->header;
+	const uint8_t *p;
+
+	// Make sure the counts are sane before allocating anything for them.
+	if ((hdr->layers > (hdr->body_len / SNAPSHOT_LAYER_SIZE)) ||
+			(hdr->objects > (hdr->body_len / SNAPSHOT_OBJECT_SIZE)) ||
+			(hdr->dimensions > (hdr->body_len / SNAPSHOT_DIMENSION_SIZE)) ||
+			(hdr->variables > (hdr->body_len / SNAPSHOT_VARIABLE_SIZE))) {
+		return false;
+	}
+
+	snap->layers.list = malloc(sizeof(layer_t) * (hdr->layers + 1));
+	snap->objects.list = malloc(sizeof(object_t) * (hdr->objects + 1));
+	snap->dimensions.list = malloc(sizeof(dimension_t) *
+								   (hdr->dimensions + 1));
+	snap->variables.list = malloc(sizeof(variable_t) * (hdr->variables + 1));
+
+	// Layers.
+	for (uint32_t i = 0; i < hdr->layers; i++) {
+		layer_t *layer = &snap->layers.list[i];
+		if ((p = snapshot_take(cur, SNAPSHOT_LAYER_SIZE)) == NULL) {
+			return false;
+		}
+
+		size_t len = get_le16(p + 5);
+		layer->num = p[0];
+		layer->color.r = p[1];
+		layer->color.g = p[2];
+		layer->color.b = p[3];
+		layer->color.alpha = p[4];
+		if ((p = snapshot_take(cur, len)) == NULL) {
+			return false;
+		}
+
+		layer->name = malloc(len + 1);
+		memcpy(layer->name, p, len);
+		layer->name[len] = '\0';
+		snap->layers.count++;
+	}
+
+	// Objects.
+	for (uint64_t i = 0; i < hdr->objects; i++) {
+		object_t *obj = &snap->objects.list[i];
+		if ((p = snapshot_take(cur, SNAPSHOT_OBJECT_SIZE)) == NULL) {
+			return false;
+		}
+
+		obj->type = p[0];
+		obj->layer_num = p[1];
+		obj->coord_count = p[2];
+		if ((p = snapshot_take(cur, SNAPSHOT_COORD_SIZE *
+							   obj->coord_count)) == NULL) {
+			return false;
+		}
+
+		obj->coord = (obj->coord_count > 0) ?
+			malloc(sizeof(coord_t) * obj->coord_count) : NULL;
+		for (uint8_t c = 0; c < obj->coord_count; c++) {
+			obj->coord[c].x = (long)(int64_t)get_le64(p);
+			obj->coord[c].y = (long)(int64_t)get_le64(p + 8);
+			p += SNAPSHOT_COORD_SIZE;
+		}
+		snap->objects.count++;
+	}
+
+	// Dimensions.
+	for (uint64_t i = 0; i < hdr->dimensions; i++) {
+		dimension_t *dimen = &snap->dimensions.list[i];
+		if ((p = snapshot_take(cur, SNAPSHOT_DIMENSION_SIZE)) == NULL) {
+			return false;
+		}
+
+		dimen->start.x = (long)(int64_t)get_le64(p);
+		dimen->start.y = (long)(int64_t)get_le64(p + 8);
+		dimen->end.x = (long)(int64_t)get_le64(p + 16);
+		dimen->end.y = (long)(int64_t)get_le64(p + 24);
+		dimen->line_start.x = (long)(int64_t)get_le64(p + 32);
+		dimen->line_start.y = (long)(int64_t)get_le64(p + 40);
+		dimen->line_end.x = (long)(int64_t)get_le64(p + 48);
+		dimen->line_end.y = (long)(int64_t)get_le64(p + 56);
+		dimen->layer_num = p[64];
+		snap->dimensions.count++;
+	}
+
+	// Variables.
+	for (uint32_t i = 0; i < hdr->variables; i++) {
+		if (!snapshot_decode_variable(snap, cur,
+									  &snap->variables.list[i])) {
+			return false;
+		}
+
+		snap->variables.count++;
+	}
+
+	return true;
+}
+
+/**
+ * Decodes a variable of a snapshot.
+ *
+ * @param  snap Document with its objects already decoded.
+ * @param  cur  Body of the snapshot, at the variable.
+ * @param  var  Where to put the variable.
+ * @return      FALSE if the variable is broken.
+ */
+bool snapshot_decode_variable(snapshot_t *snap, snapshot_cursor_t *cur,
+							  variable_t *var) {
+	const uint8_t *p;
+	uint64_t bits;
+
+	if ((p = snapshot_take(cur, SNAPSHOT_VARIABLE_SIZE)) == NULL) {
+		return false;
+	}
+
+	uint8_t type = p[0];
+	size_t len = get_le16(p + 1);
+	size_t size = (type == VARIABLE_COORD) ? SNAPSHOT_COORD_SIZE : 8;
+	if (((type != VARIABLE_FIXED) && (type != VARIABLE_COORD) &&
+			(type != VARIABLE_OBJECT)) ||
+			((p = snapshot_take(cur, len + size)) == NULL)) {
+		return false;
+	}
+
+	// Check the object before anything gets allocated.
+	bits = get_le64(p + len);
+	if ((type == VARIABLE_OBJECT) && (bits >= snap->objects.count)) {
+		return false;
+	}
+
+	var->type = type;
+	var->name = malloc(len + 1);
+	memcpy(var->name, p, len);
+	var->name[len] = '\0';
+	p += len;
+
+	switch (type) {
+		case VARIABLE_FIXED:
+			var->value = malloc(sizeof(double));
+			memcpy(var->value, &bits, sizeof(double));
+			break;
+		case VARIABLE_COORD:
+			var->value = malloc(sizeof(coord_t));
+			((coord_t *)var->value)->x = (long)(int64_t)get_le64(p);
+			((coord_t *)var->value)->y = (long)(int64_t)get_le64(p + 8);
+			break;
+		default:
+			var->value = &snap->objects.list[bits];
+			break;
+	}
+
+	return true;
+}
+
+/**
+ * Takes the next few bytes of a snapshot being read.
+ *
+ * @param  cur Snapshot being read.
+ * @param  len Number of bytes to take.
+ * @return     The bytes or NULL if the snapshot is cut short.
+ */
+const uint8_t* snapshot_take(snapshot_cursor_t *cur, const size_t len) {
+	if ((cur->pos > cur->len) || (len > (cur->len - cur->pos))) {
+		return NULL;
+	}
+
+	const uint8_t *p = cur->data + cur->pos;
+	cur->pos += len;
+
+	return p;
+}
+
+/**
+ * Gets the extents of every object in the document and the size of the
+ * thumbnail that fits them.
+ *
+ * @param  header Header to put the extents and thumbnail size into.
+ * @return        FALSE if there's nothing to be drawn.
+ */
+bool snapshot_extents(snapshot_header_t *header) {
+	object_filter_t filter;
+	object_iterator_t iter;
+	object_span_t spans[SNAPSHOT_SPAN_BLOCK];
+	bounds_column bounds;
+	bool found_any = false;
+	size_t found;
+
+	nanocad_filter_init(&filter);
+	nanocad_get_bounds_column(&bounds);
+	nanocad_object_iter_init(&iter, &filter, 0, 1);
+	while ((found = nanocad_object_iter_next(&iter, spans,
+											 SNAPSHOT_SPAN_BLOCK)) > 0) {
+		for (size_t i = 0; i < found; i++) {
+			const object_span_t *span = &spans[i];
+			coord_t omin = { bounds.min_x[span->index],
+							 bounds.min_y[span->index] };
+			coord_t omax = { bounds.max_x[span->index],
+							 bounds.max_y[span->index] };
+
+			if (span->coord_count < 2) {
+				continue;
+			}
+
+			// Circles go beyond their points.
+			if (span->type == TYPE_CIRCLE) {
+				double dx = (double)(span->coord[1].x - span->coord[0].x);
+				double dy = (double)(span->coord[1].y - span->coord[0].y);
+				long r = (long)ceil(sqrt((dx * dx) + (dy * dy)));
+
+				omin.x = span->coord[0].x - r;
+				omin.y = span->coord[0].y - r;
+				omax.x = span->coord[0].x + r;
+				omax.y = span->coord[0].y + r;
+			}
+
+			if (!found_any) {
+				header->min = omin;
+				header->max = omax;
+				found_any = true;
+			} else {
+				header->min.x = (omin.x < header->min.x) ? omin.x :
+					header->min.x;
+				header->min.y = (omin.y < header->min.y) ? omin.y :
+					header->min.y;
+				header->max.x = (omax.x > header->max.x) ? omax.x :
+					header->max.x;
+				header->max.y = (omax.y > header->max.y) ? omax.y :
+					header->max.y;
+			}
+		}
+	}
+
+	if (!found_any) {
+		return false;
+	}
+
+	// Fit the longest side of the drawing in the thumbnail.
+	double width = (double)(header->max.x - header->min.x);
+	double height = (double)(header->max.y - header->min.y);
+	double side = (width > height) ? width : height;
+	double scale = (side > 0) ? ((SNAPSHOT_THUMB_SIZE - 1) / side) : 1.0;
+
+	header->thumb_width = (uint16_t)(floor(width * scale) + 1);
+	header->thumb_height = (uint16_t)(floor(height * scale) + 1);
+
+	return true;
+}
+
+/**
+ * Renders the thumbnail of the document as a PNG image.
+ *
+ * @param  header Header with the extents and size of the thumbnail.
+ * @param  thumb  Writer to send the image to.
+ * @return        TRUE if nothing failed.
+ */
+bool snapshot_thumb(const snapshot_header_t *header, writer_t *thumb) {
+	object_filter_t filter;
+	object_iterator_t iter;
+	object_span_t spans[SNAPSHOT_SPAN_BLOCK];
+	rgba_color_t colors[256];
+	rgba_color_t background = { 33, 40, 48, 255 };
+	raster_t raster;
+	size_t found;
+
+	// Layer colors, with the ones that don't exist falling back to layer 0.
+	for (uint16_t i = 0; i < 256; i++) {
+		layer_t *layer = nanocad_get_layer((uint8_t)i);
+		if (layer == NULL) {
+			layer = nanocad_get_layer(0);
+		}
+
+		colors[i] = layer->color;
+	}
+
+	double width = (double)(header->max.x - header->min.x);
+	double height = (double)(header->max.y - header->min.y);
+	double side = (width > height) ? width : height;
+	double scale = (side > 0) ? ((SNAPSHOT_THUMB_SIZE - 1) / side) : 1.0;
+
+	raster_init(&raster, header->thumb_width, header->thumb_height);
+	raster_clear(&raster, background);
+
+	nanocad_filter_init(&filter);
+	nanocad_object_iter_init(&iter, &filter, 0, 1);
+	while ((found = nanocad_object_iter_next(&iter, spans,
+											 SNAPSHOT_SPAN_BLOCK)) > 0) {
+		for (size_t i = 0; i < found; i++) {
+			const object_span_t *span = &spans[i];
+			rgba_color_t color = colors[span->layer_num];
+
+			if (span->coord_count < 2) {
+				continue;
+			}
+
+			// Convert to pixels, with Y going down.
+			double px = (double)(span->coord[0].x - header->min.x) * scale;
+			double py = (double)(header->max.y - span->coord[0].y) * scale;
+
+			if (span->type == TYPE_CIRCLE) {
+				double dx = (double)(span->coord[1].x - span->coord[0].x);
+				double dy = (double)(span->coord[1].y - span->coord[0].y);
+
+				raster_circle(&raster, px, py,
+							  sqrt((dx * dx) + (dy * dy)) * scale, color);
+				continue;
+			}
+
+			for (uint8_t c = 1; c < span->coord_count; c++) {
+				double x = (double)(span->coord[c].x - header->min.x) * scale;
+				double y = (double)(header->max.y - span->coord[c].y) * scale;
+
+				raster_line(&raster, px, py, x, y, color);
+				px = x;
+				py = y;
+			}
+		}
+	}
+
+	bool success = png_write(thumb, &raster, PNG_DEFAULT);
+	raster_free(&raster);
+
+	return success;
+}
+
+/**
+ * Lays out a header the way it's stored in the file.
+ *
+ * @param header Header to be stored.
+ * @param buf    Buffer of SNAPSHOT_HEADER_SIZE bytes.
+ */
+void snapshot_header_pack(const snapshot_header_t *header, uint8_t *buf) {
+	uint8_t *p = buf;
+
+	memset(buf, 0, SNAPSHOT_HEADER_SIZE);
+	memcpy(p, SNAPSHOT_MAGIC, 8);
+	p = put_le16(p + 8, header->version);
+	p = put_le16(p, SNAPSHOT_HEADER_SIZE);
+	memcpy(p, header->engine, SNAPSHOT_ENGINE_SIZE);
+	p += SNAPSHOT_ENGINE_SIZE;
+	p = put_le64(p, (uint64_t)header->min.x);
+	p = put_le64(p, (uint64_t)header->min.y);
+	p = put_le64(p, (uint64_t)header->max.x);
+	p = put_le64(p, (uint64_t)header->max.y);
+	p = put_le64(p, header->objects);
+	p = put_le64(p, header->coords);
+	p = put_le64(p, header->dimensions);
+	p = put_le32(p, header->layers);
+	p = put_le16(p, header->thumb_width);
+	p = put_le16(p, header->thumb_height);
+	p = put_le64(p, header->thumb_offset);
+	p = put_le32(p, header->thumb_len);
+	p = put_le64(p, header->body_offset);
+	p = put_le64(p, header->body_len);
+	put_le32(p, header->variables);
+}
+
+/**
+ * Reads a header the way it's stored in the file.
+ *
+ * @param  header Where to put the header.
+ * @param  buf    Buffer of SNAPSHOT_HEADER_SIZE bytes.
+ * @return        FALSE if it isn't a snapshot or has a version we can't read.
+ */
+bool snapshot_header_unpack(snapshot_header_t *header, const uint8_t *buf) {
+	const uint8_t *p = buf + 8;
+
+	if (memcmp(buf, SNAPSHOT_MAGIC, 8) != 0) {
+		return false;
+	}
+
+	header->version = get_le16(p);
+	if ((header->version != SNAPSHOT_VERSION) ||
+			(get_le16(p + 2) != SNAPSHOT_HEADER_SIZE)) {
+		return false;
+	}
+	p += 4;
+
+	memcpy(header->engine, p, SNAPSHOT_ENGINE_SIZE);
+	header->engine[SNAPSHOT_ENGINE_SIZE - 1] = '\0';
+	p += SNAPSHOT_ENGINE_SIZE;
+	header->min.x = (long)(int64_t)get_le64(p);
+	header->min.y = (long)(int64_t)get_le64(p + 8);
+	header->max.x = (long)(int64_t)get_le64(p + 16);
+	header->max.y = (long)(int64_t)get_le64(p + 24);
+	p += 32;
+	header->objects = get_le64(p);
+	header->coords = get_le64(p + 8);
+	header->dimensions = get_le64(p + 16);
+	header->layers = get_le32(p + 24);
+	header->thumb_width = get_le16(p + 28);
+	header->thumb_height = get_le16(p + 30);
+	p += 32;
+	header->thumb_offset = get_le64(p);
+	header->thumb_len = get_le32(p + 8);
+	header->body_offset = get_le64(p + 12);
+	header->body_len = get_le64(p + 20);
+	header->variables = get_le32(p + 28);
+
+	return true;
+}
+
+/**
+ * Checks if the thumbnail and body a header points to are inside the file,
+ * without any arithmetic that could wrap around on a crafted header.
+ *
+ * @param  header Header read from the file.
+ * @param  size   Size of the whole file in bytes.
+ * @return        TRUE if the body ends the file and the thumbnail is in it.
+ */
+bool snapshot_header_fits(const snapshot_header_t *header, const uint64_t size) {
+	return (header->body_offset >= SNAPSHOT_HEADER_SIZE) &&
+		(header->body_offset <= size) &&
+		(header->body_len == (size - header->body_offset)) &&
+		(header->thumb_offset >= SNAPSHOT_HEADER_SIZE) &&
+		(header->thumb_offset <= size) &&
+		(header->thumb_len <= (size - header->thumb_offset));
+}
+
+/**
+ * Stores a 16-bit number in little-endian order.
+ *
+ * @param  buf   Where to store it.
+ * @param  value Number to be stored.
+ * @return       Position right after it.
+ */
+uint8_t* put_le16(uint8_t *buf, const uint16_t value) {
+	buf[0] = (uint8_t)value;
+	buf[1] = (uint8_t)(value >> 8);
+
+	return buf + 2;
+}
+
+/**
+ * Stores a 32-bit number in little-endian order.
+ *
+ * @param  buf   Where to store it.
+ * @param  value Number to be stored.
+ * @return       Position right after it.
+ */
+uint8_t* put_le32(uint8_t *buf, const uint32_t value) {
+	put_le16(buf, (uint16_t)value);
+	put_le16(buf + 2, (uint16_t)(value >> 16));
+
+	return buf + 4;
+}
+
+/**
+ * Stores a 64-bit number in little-endian order.
+ *
+ * @param  buf   Where to store it.
+ * @param  value Number to be stored.
+ * @return       Position right after it.
+ */
+uint8_t* put_le64(uint8_t *buf, const uint64_t value) {
+	put_le32(buf, (uint32_t)value);
+	put_le32(buf + 4, (uint32_t)(value >> 32));
+
+	return buf + 8;
+}
+
+/**
+ * Reads a 16-bit little-endian number.
+ *
+ * @param  buf Where it's stored.
+ * @return     The number.
+ */
+uint16_t get_le16(const uint8_t *buf) {
+	return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+/**
+ * Reads a 32-bit little-endian number.
+ *
+ * @param  buf Where it's stored.
+ * @return     The number.
+ */
+uint32_t get_le32(const uint8_t *buf) {
+	return get_le16(buf) | ((uint32_t)get_le16(buf + 2) << 16);
+}
+
+/**
+ * Reads a 64-bit little-endian number.
+ *
+ * @param  buf Where it's stored.
+ * @return     The number.
+ */
+uint64_t get_le64(const uint8_t *buf) {
+	return get_le32(buf) | ((uint64_t)get_le32(buf + 4) << 32);
+}
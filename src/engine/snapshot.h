@@ -0,0 +1,68 @@
+/**
+ * engine/snapshot.h
+ * Binary snapshots of the document, with a header that has its extents,
+ * statistics and a small preview thumbnail.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "nanocad.h"
+#include "writer.h"
+
+// Format.
+#define SNAPSHOT_MAGIC       "NCADSNAP"
+#define SNAPSHOT_VERSION     1
+#define SNAPSHOT_HEADER_SIZE 128
+#define SNAPSHOT_ENGINE_SIZE 16
+
+// Thumbnail.
+#define SNAPSHOT_THUMB_SIZE  128  // Longest side in pixels.
+
+// Header at the very start of a snapshot. Everything in it can be read
+// without touching the rest of the file.
+typedef struct {
+	uint16_t version;
+	char     engine[SNAPSHOT_ENGINE_SIZE];  // Engine that wrote it.
+	coord_t  min;           // Extents of the drawing.
+	coord_t  max;
+	uint64_t objects;
+	uint64_t coords;
+	uint64_t dimensions;
+	uint32_t layers;
+	uint16_t thumb_width;
+	uint16_t thumb_height;
+	uint64_t thumb_offset;  // PNG image right after the header.
+	uint32_t thumb_len;     // 0 if the drawing is empty.
+	uint64_t body_offset;   // Layers, objects, dimensions and variables.
+	uint64_t body_len;
+	uint32_t variables;
+} snapshot_header_t;
+
+// Document read back from a snapshot. Object variables point to their objects
+// in the list.
+typedef struct {
+	snapshot_header_t   header;
+	layer_container     layers;
+	object_container    objects;
+	dimension_container dimensions;
+	variable_container  variables;
+} snapshot_t;
+
+// Writing.
+bool snapshot_write(writer_t *out, snapshot_header_t *header);
+bool snapshot_write_file(const char *filename, snapshot_header_t *header);
+
+// Reading.
+bool snapshot_read(const char *filename, snapshot_t *snap);
+void snapshot_free(snapshot_t *snap);
+bool snapshot_read_header(const char *filename, snapshot_header_t *header);
+bool snapshot_extract_thumb(const char *filename, const char *png,
+							snapshot_header_t *header);
+
+#endif
@@ -0,0 +1,228 @@
+/**
+ * engine/threadpool.c
+ * Shared pool of worker threads for splitting heavy jobs into tasks.
+ *
+ * Only one job runs at a time. The thread that starts a job works on it as
+ * well, grabbing task indices from the same atomic counter as the workers,
+ * and only returns once every task is done. Jobs started from inside of a
+ * task are simply run in the calling thread.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include "threadpool.h"
+#include "diagnostics.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+// Current job.
+typedef struct {
+	threadpool_task_t task;
+	void             *data;
+	size_t            count;
+	size_t            next;
+	size_t            done;
+} threadpool_job_t;
+
+// Workers.
+pthread_t pool_threads[THREADPOOL_MAX_THREADS];
+unsigned int pool_thread_count = 0;
+unsigned int pool_wanted_threads = 0;
+bool pool_stopping = false;
+
+// Job hand-off.
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t pool_run_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pool_finished = PTHREAD_COND_INITIALIZER;
+threadpool_job_t pool_job;
+uint64_t pool_generation = 0;
+unsigned int pool_active = 0;
+__thread bool pool_in_task = false;
+
+// Internal functions.
+void* pool_worker(void *arg);
+size_t pool_work(threadpool_job_t *job);
+void pool_start();
+
+
+/**
+ * Sets the number of threads used by jobs, including the one that starts
+ * them. Zero uses one thread per online processor.
+ *
+ * @param threads Number of threads.
+ */
+void threadpool_set_threads(const unsigned int threads) {
+	threadpool_shutdown();
+	pool_wanted_threads = (threads > THREADPOOL_MAX_THREADS) ?
+		THREADPOOL_MAX_THREADS : threads;
+}
+
+/**
+ * Gets the number of threads that work on each job.
+ *
+ * @return Number of threads.
+ */
+unsigned int threadpool_get_threads() {
+	if (pool_wanted_threads > 0) {
+		return pool_wanted_threads;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1) {
+		return 1;
+	}
+
+	return (cpus > THREADPOOL_MAX_THREADS) ? THREADPOOL_MAX_THREADS :
+		(unsigned int)cpus;
+}
+
+/**
+ * Runs a task for every index from 0 up to count across the pool and waits
+ * for all of them to finish. Tasks may run in any order and at the same time,
+ * so they must only touch their own part of the data.
+ *
+ * @param task  Task to run.
+ * @param data  Data passed to every task.
+ * @param count Number of tasks.
+ */
+void threadpool_run(threadpool_task_t task, void *data, const size_t count) {
+	threadpool_job_t job = { task, data, count, 0, 0 };
+
+	// Small jobs and nested ones aren't worth the hand-off.
+	if ((count < 2) || pool_in_task || (threadpool_get_threads() < 2)) {
+		for (size_t i = 0; i < count; i++) {
+			task(data, i);
+		}
+
+		return;
+	}
+
+	pthread_mutex_lock(&pool_run_lock);
+	pthread_mutex_lock(&pool_lock);
+	if (pool_thread_count == 0) {
+		pool_start();
+	}
+
+	// Publish the job once nobody is looking at the last one, and lend a hand.
+	while (pool_active > 0) {
+		pthread_cond_wait(&pool_finished, &pool_lock);
+	}
+	pool_job = job;
+	pool_generation++;
+	pthread_cond_broadcast(&pool_wake);
+	pthread_mutex_unlock(&pool_lock);
+
+	size_t finished = pool_work(&pool_job);
+
+	// Wait for the stragglers, and for every worker to let go of the job
+	// before it gets replaced by the next one.
+	pthread_mutex_lock(&pool_lock);
+	pool_job.done += finished;
+	while ((pool_job.done < pool_job.count) || (pool_active > 0)) {
+		pthread_cond_wait(&pool_finished, &pool_lock);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	pthread_mutex_unlock(&pool_run_lock);
+}
+
+/**
+ * Stops all the worker threads. They get started again by the next job.
+ */
+void threadpool_shutdown() {
+	pthread_mutex_lock(&pool_run_lock);
+	pthread_mutex_lock(&pool_lock);
+	pool_stopping = true;
+	pthread_cond_broadcast(&pool_wake);
+	pthread_mutex_unlock(&pool_lock);
+
+	for (unsigned int i = 0; i < pool_thread_count; i++) {
+		pthread_join(pool_threads[i], NULL);
+	}
+
+	pool_thread_count = 0;
+	pool_stopping = false;
+	pthread_mutex_unlock(&pool_run_lock);
+}
+
+/**
+ * Starts the worker threads. Must be called with the pool locked.
+ */
+void pool_start() {
+	unsigned int threads = threadpool_get_threads() - 1;
+
+	for (unsigned int i = 0; i < threads; i++) {
+		if (pthread_create(&pool_threads[pool_thread_count], NULL,
+						   pool_worker, NULL) != 0) {
+			diag_report(DIAG_WARNING, DIAG_CODE_GENERIC, i, "Couldn't start "
+						"worker thread %u, running with fewer.", i);
+			break;
+		}
+
+		pool_thread_count++;
+	}
+}
+
+/**
+ * Worker thread loop.
+ *
+ * @param  arg Unused.
+ * @return     Always NULL.
+ */
+void* pool_worker(void *arg) {
+	uint64_t seen = 0;
+
+	pool_in_task = true;
+	pthread_mutex_lock(&pool_lock);
+	while (true) {
+		while (!pool_stopping && (pool_generation == seen)) {
+			pthread_cond_wait(&pool_wake, &pool_lock);
+		}
+
+		if (pool_stopping) {
+			break;
+		}
+
+		seen = pool_generation;
+		pool_active++;
+		pthread_mutex_unlock(&pool_lock);
+
+		size_t finished = pool_work(&pool_job);
+
+		pthread_mutex_lock(&pool_lock);
+		pool_job.done += finished;
+		pool_active--;
+		if (pool_active == 0) {
+			pthread_cond_broadcast(&pool_finished);
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	return NULL;
+}
+
+/**
+ * Grabs tasks of a job until there are none left.
+ *
+ * @param  job Job being worked on.
+ * @return     Number of tasks done by this thread.
+ */
+size_t pool_work(threadpool_job_t *job) {
+	bool nested = pool_in_task;
+	size_t finished = 0;
+
+	pool_in_task = true;
+	while (true) {
+		size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (i >= job->count) {
+			break;
+		}
+
+		job->task(job->data, i);
+		finished++;
+	}
+	pool_in_task = nested;
+
+	return finished;
+}
@@ -0,0 +1,29 @@
+/**
+ * engine/threadpool.h
+ * Shared pool of worker threads for splitting heavy jobs into tasks.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Constants.
+#define THREADPOOL_MAX_THREADS 64
+
+// Task callback. Gets called once for every index of a job.
+typedef void (*threadpool_task_t)(void *data, const size_t index);
+
+// Configuration.
+void threadpool_set_threads(const unsigned int threads);
+unsigned int threadpool_get_threads();
+
+// Running.
+void threadpool_run(threadpool_task_t task, void *data, const size_t count);
+void threadpool_shutdown();
+
+#endif
@@ -0,0 +1,609 @@
+/**
+ * engine/tiles.c
+ * Deep zoom tile pyramid export for viewing drawings on the web.
+ *
+ * The drawing is rendered by the headless rasterizer into 256 pixel PNG tiles
+ * for every zoom level, from a single pixel up to the full resolution, along
+ * with a Deep Zoom (.dzi) descriptor that web viewers understand. The levels
+ * are gone through from the top down, with every tile handing the objects that
+ * touch it down to its four children, so deeper levels only ever look at the
+ * few objects that could be in them and tiles with nothing in them are never
+ * rendered nor written. The tiles of each level are split across the thread
+ * pool.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "diagnostics.h"
+#include "threadpool.h"
+#include "raster.h"
+#include "png.h"
+#include "writer.h"
+#include "tiles.h"
+
+// Pixels around a tile that still count as touching it.
+#define TILES_MARGIN 1.0
+
+// Number of objects fetched from the store at a time.
+#define TILES_SPAN_BLOCK 256
+
+// Tile with the objects that may touch it.
+typedef struct {
+	uint32_t col;
+	uint32_t row;
+	size_t   start;  // First object in the object list of the level.
+	size_t   count;
+} tile_t;
+
+// Level of the pyramid.
+typedef struct {
+	uint8_t   num;
+	uint32_t  width;   // Size in pixels.
+	uint32_t  height;
+	uint32_t  cols;
+	uint32_t  rows;
+	double    scale;   // Pixels per millimeter.
+	size_t    count;
+	tile_t   *tiles;
+	size_t   *objects; // Objects of every tile, one after the other.
+} tile_level_t;
+
+// Objects that touch the children of a tile, found while rendering it.
+typedef struct {
+	size_t  count[4];
+	size_t  capacity[4];
+	size_t *objects[4];
+	bool    failed;
+} tile_children_t;
+
+// Everything the tile rendering tasks need.
+typedef struct {
+	const tiles_options_t *opts;
+	char                   dir[TILES_PATH_MAX - 64];  // Room for the tiles.
+	coord_t                min;  // Extents of the drawing.
+	coord_t                max;
+	rgba_color_t           colors[256];
+	const tile_level_t    *level;
+	const tile_level_t    *next;
+	tile_children_t       *children;
+} tiles_job_t;
+
+// Internal functions.
+bool tiles_extents(const object_filter_t *filter, coord_t *min, coord_t *max,
+				   size_t **objects, size_t *count);
+void tiles_level_init(tile_level_t *level, const uint8_t num,
+					  const uint8_t deepest, const tiles_stats_t *stats,
+					  const long resolution);
+bool tiles_write_dzi(const char *name, const tiles_stats_t *stats);
+void tiles_task(void *data, const size_t index);
+void tiles_render(const tiles_job_t *job, const tile_t *tile,
+				  raster_t *raster);
+bool tiles_touches(const tiles_job_t *job, const object_t *obj,
+				   const double scale, const double x0, const double y0,
+				   const double x1, const double y1);
+bool tiles_segment_touches(double ax, double ay, double bx, double by,
+						   const double x0, const double y0, const double x1,
+						   const double y1);
+void tiles_children_push(tile_children_t *children, const uint8_t child,
+						 const size_t object);
+
+
+/**
+ * Initializes the tile pyramid settings with the defaults.
+ *
+ * @param opts Tile pyramid settings.
+ */
+void tiles_options_init(tiles_options_t *opts) {
+	nanocad_filter_init(&opts->filter);
+	opts->resolution = TILES_RESOLUTION;
+	opts->background.r = 33;
+	opts->background.g = 40;
+	opts->background.b = 48;
+	opts->background.alpha = 255;
+	opts->png_mode = PNG_DEFAULT;
+}
+
+/**
+ * Exports the document as a deep zoom tile pyramid, made out of a descriptor
+ * (<name>.dzi) and a folder of tiles (<name>_files/<level>/<col>_<row>.png).
+ *
+ * @param  name  Path of the pyramid without any extension.
+ * @param  opts  Tile pyramid settings.
+ * @param  stats Tile pyramid statistics or NULL if they aren't needed.
+ * @return       TRUE if everything was written.
+ */
+bool tiles_export(const char *name, const tiles_options_t *opts,
+				  tiles_stats_t *stats) {
+	tiles_stats_t dummy;
+	tiles_job_t job;
+	tile_level_t level;
+	tile_level_t next;
+	bool success = true;
+
+	stats = (stats == NULL) ? &dummy : stats;
+	memset(stats, 0, sizeof(tiles_stats_t));
+
+	if (opts->resolution < 1) {
+		diag_report(DIAG_ERROR, DIAG_CODE_PARSE, opts->resolution,
+					"Invalid tile resolution of %ld millimeters per pixel.",
+					opts->resolution);
+		return false;
+	}
+
+	// Find out how big the drawing is, with every object in the first tile.
+	level.count = 1;
+	level.tiles = malloc(sizeof(tile_t));
+	level.tiles[0].col = 0;
+	level.tiles[0].row = 0;
+	level.tiles[0].start = 0;
+	if (!tiles_extents(&opts->filter, &job.min, &job.max, &level.objects,
+					   &level.tiles[0].count)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0,
+					"There's nothing to be tiled.");
+		free(level.tiles);
+		return false;
+	}
+
+	uint64_t width = ((uint64_t)(job.max.x - job.min.x) /
+					  (uint64_t)opts->resolution) + 1;
+	uint64_t height = ((uint64_t)(job.max.y - job.min.y) /
+					   (uint64_t)opts->resolution) + 1;
+	uint64_t side = (width > height) ? width : height;
+	if (side > INT32_MAX) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0,
+					"The tiles would be too big, use a lower resolution.");
+		free(level.tiles);
+		free(level.objects);
+		return false;
+	}
+
+	stats->width = (uint32_t)width;
+	stats->height = (uint32_t)height;
+	while (((uint64_t)1 << stats->levels) < side) {
+		stats->levels++;
+	}
+	stats->levels++;
+
+	// Get everything the tasks need ready.
+	job.opts = opts;
+	snprintf(job.dir, sizeof(job.dir), "%s_files", name);
+	for (uint16_t i = 0; i < 256; i++) {
+		layer_t *layer = nanocad_get_layer((uint8_t)i);
+		if (layer == NULL) {
+			layer = nanocad_get_layer(0);
+		}
+
+		job.colors[i] = layer->color;
+	}
+
+	if ((mkdir(job.dir, 0755) != 0) && (errno != EEXIST)) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+					"Couldn't create the tile folder: %s", job.dir);
+		free(level.tiles);
+		free(level.objects);
+		return false;
+	}
+
+	// Go down the levels, rendering the tiles and finding out what's in their
+	// children.
+	tiles_level_init(&level, 0, stats->levels - 1, stats, opts->resolution);
+	for (uint8_t num = 0; num < stats->levels; num++) {
+		char path[TILES_PATH_MAX];
+		bool last = num == (stats->levels - 1);
+
+		snprintf(path, TILES_PATH_MAX, "%s/%u", job.dir, num);
+		if ((mkdir(path, 0755) != 0) && (errno != EEXIST)) {
+			diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+						"Couldn't create the tile folder: %s", path);
+			free(level.tiles);
+			free(level.objects);
+			success = false;
+			break;
+		}
+
+		if (!last) {
+			tiles_level_init(&next, num + 1, stats->levels - 1, stats,
+							 opts->resolution);
+		}
+
+		job.level = &level;
+		job.next = last ? NULL : &next;
+		job.children = calloc(level.count, sizeof(tile_children_t));
+		threadpool_run(tiles_task, &job, level.count);
+
+		stats->written += level.count;
+		stats->skipped += ((size_t)level.cols * level.rows) - level.count;
+
+		// Gather the children that have something in them, in order.
+		size_t total = 0;
+		for (size_t i = 0; i < level.count; i++) {
+			tile_children_t *children = &job.children[i];
+			success = success && !children->failed;
+
+			for (uint8_t c = 0; c < 4; c++) {
+				total += children->count[c];
+			}
+		}
+
+		if (!last) {
+			next.tiles = malloc(sizeof(tile_t) * ((level.count * 4) + 1));
+			next.objects = malloc(sizeof(size_t) * (total + 1));
+			next.count = 0;
+
+			size_t pos = 0;
+			for (size_t i = 0; i < level.count; i++) {
+				tile_children_t *children = &job.children[i];
+
+				for (uint8_t c = 0; c < 4; c++) {
+					if (children->count[c] == 0) {
+						continue;
+					}
+
+					tile_t *tile = &next.tiles[next.count++];
+					tile->col = (level.tiles[i].col * 2) + (c & 1);
+					tile->row = (level.tiles[i].row * 2) + (c >> 1);
+					tile->start = pos;
+					tile->count = children->count[c];
+
+					memcpy(next.objects + pos, children->objects[c],
+						   sizeof(size_t) * children->count[c]);
+					pos += children->count[c];
+				}
+			}
+		}
+
+		for (size_t i = 0; i < level.count; i++) {
+			for (uint8_t c = 0; c < 4; c++) {
+				free(job.children[i].objects[c]);
+			}
+		}
+		free(job.children);
+		free(level.tiles);
+		free(level.objects);
+
+		if (last) {
+			break;
+		}
+		if (!success) {
+			free(next.tiles);
+			free(next.objects);
+			break;
+		}
+		level = next;
+	}
+
+	if (success && !tiles_write_dzi(name, stats)) {
+		success = false;
+	}
+
+	return success;
+}
+
+/**
+ * Gets the extents of the objects that match a filter, and a list of them.
+ *
+ * @param  filter  Objects to be tiled.
+ * @param  min     Bottom-left corner of the extents.
+ * @param  max     Top-right corner of the extents.
+ * @param  objects List of the matching objects. Has to be freed by the caller.
+ * @param  count   Number of matching objects.
+ * @return         FALSE if nothing matched.
+ */
+bool tiles_extents(const object_filter_t *filter, coord_t *min, coord_t *max,
+				   size_t **objects, size_t *count) {
+	object_iterator_t iter;
+	object_span_t spans[TILES_SPAN_BLOCK];
+	bounds_column bounds;
+	size_t found;
+	size_t capacity = 64;
+
+	*count = 0;
+	*objects = malloc(sizeof(size_t) * capacity);
+	nanocad_get_bounds_column(&bounds);
+
+	nanocad_object_iter_init(&iter, filter, 0, 1);
+	while ((found = nanocad_object_iter_next(&iter, spans,
+											 TILES_SPAN_BLOCK)) > 0) {
+		for (size_t i = 0; i < found; i++) {
+			const object_span_t *span = &spans[i];
+			coord_t omin = { bounds.min_x[span->index],
+							 bounds.min_y[span->index] };
+			coord_t omax = { bounds.max_x[span->index],
+							 bounds.max_y[span->index] };
+
+			if (span->coord_count < 2) {
+				continue;
+			}
+
+			// Circles go beyond their points.
+			if (span->type == TYPE_CIRCLE) {
+				double dx = (double)(span->coord[1].x - span->coord[0].x);
+				double dy = (double)(span->coord[1].y - span->coord[0].y);
+				long r = (long)ceil(sqrt((dx * dx) + (dy * dy)));
+
+				omin.x = span->coord[0].x - r;
+				omin.y = span->coord[0].y - r;
+				omax.x = span->coord[0].x + r;
+				omax.y = span->coord[0].y + r;
+			}
+
+			if (*count == 0) {
+				*min = omin;
+				*max = omax;
+			} else {
+				min->x = (omin.x < min->x) ? omin.x : min->x;
+				min->y = (omin.y < min->y) ? omin.y : min->y;
+				max->x = (omax.x > max->x) ? omax.x : max->x;
+				max->y = (omax.y > max->y) ? omax.y : max->y;
+			}
+
+			if (*count == capacity) {
+				capacity *= 2;
+				*objects = realloc(*objects, sizeof(size_t) * capacity);
+			}
+			(*objects)[(*count)++] = span->index;
+		}
+	}
+
+	if (*count == 0) {
+		free(*objects);
+		*objects = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Sets up the size of a level of the pyramid.
+ *
+ * @param level      Level to be set up.
+ * @param num        Level number, 0 being a single pixel.
+ * @param deepest    Number of the level with the full resolution.
+ * @param stats      Pyramid statistics with the full size.
+ * @param resolution Millimeters per pixel at the deepest level.
+ */
+void tiles_level_init(tile_level_t *level, const uint8_t num,
+					  const uint8_t deepest, const tiles_stats_t *stats,
+					  const long resolution) {
+	uint64_t div = (uint64_t)1 << (deepest - num);
+
+	level->num = num;
+	level->width = (uint32_t)((stats->width + div - 1) / div);
+	level->height = (uint32_t)((stats->height + div - 1) / div);
+	level->cols = (level->width + TILES_SIZE - 1) / TILES_SIZE;
+	level->rows = (level->height + TILES_SIZE - 1) / TILES_SIZE;
+	level->scale = 1.0 / ((double)resolution * (double)div);
+}
+
+/**
+ * Writes the Deep Zoom descriptor of the pyramid.
+ *
+ * @param  name  Path of the pyramid without any extension.
+ * @param  stats Pyramid statistics with the full size.
+ * @return       TRUE if the file was written.
+ */
+bool tiles_write_dzi(const char *name, const tiles_stats_t *stats) {
+	char path[TILES_PATH_MAX];
+	writer_t out;
+
+	snprintf(path, TILES_PATH_MAX, "%s.dzi", name);
+	if (!writer_open_file(&out, path)) {
+		return false;
+	}
+
+	writer_str(&out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			   "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" "
+			   "Format=\"png\" Overlap=\"0\" TileSize=\"");
+	writer_long(&out, TILES_SIZE);
+	writer_str(&out, "\">\n  <Size Width=\"");
+	writer_long(&out, stats->width);
+	writer_str(&out, "\" Height=\"");
+	writer_long(&out, stats->height);
+	writer_str(&out, "\"/>\n</Image>\n");
+
+	return writer_close(&out);
+}
+
+/**
+ * Renders a tile, writes it out and finds the objects of its children.
+ *
+ * @param data  Tile job.
+ * @param index Tile in the current level.
+ */
+void tiles_task(void *data, const size_t index) {
+	const tiles_job_t *job = (const tiles_job_t *)data;
+	const tile_level_t *level = job->level;
+	const tile_t *tile = &level->tiles[index];
+	tile_children_t *children = &job->children[index];
+	char path[TILES_PATH_MAX];
+	raster_t raster;
+
+	// Edge tiles only have what's left of the level.
+	uint32_t x = tile->col * TILES_SIZE;
+	uint32_t y = tile->row * TILES_SIZE;
+	uint32_t width = level->width - x;
+	uint32_t height = level->height - y;
+	width = (width > TILES_SIZE) ? TILES_SIZE : width;
+	height = (height > TILES_SIZE) ? TILES_SIZE : height;
+
+	raster_init(&raster, width, height);
+	tiles_render(job, tile, &raster);
+
+	snprintf(path, TILES_PATH_MAX, "%s/%u/%u_%u.png", job->dir, level->num,
+			 tile->col, tile->row);
+	if (!png_write_file(path, &raster, job->opts->png_mode)) {
+		children->failed = true;
+	}
+	raster_free(&raster);
+
+	if (job->next == NULL) {
+		return;
+	}
+
+	// Hand the objects down to the children that exist in the next level.
+	const tile_level_t *next = job->next;
+	for (uint8_t c = 0; c < 4; c++) {
+		uint32_t col = (tile->col * 2) + (c & 1);
+		uint32_t row = (tile->row * 2) + (c >> 1);
+		if ((col >= next->cols) || (row >= next->rows)) {
+			continue;
+		}
+
+		double x0 = ((double)col * TILES_SIZE) - TILES_MARGIN;
+		double y0 = ((double)row * TILES_SIZE) - TILES_MARGIN;
+		double x1 = ((double)(col + 1) * TILES_SIZE) + TILES_MARGIN;
+		double y1 = ((double)(row + 1) * TILES_SIZE) + TILES_MARGIN;
+
+		for (size_t i = 0; i < tile->count; i++) {
+			size_t num = level->objects[tile->start + i];
+			object_t obj = nanocad_get_object(num);
+
+			if (tiles_touches(job, &obj, next->scale, x0, y0, x1, y1)) {
+				tiles_children_push(children, c, num);
+			}
+		}
+	}
+}
+
+/**
+ * Renders the objects of a tile.
+ *
+ * @param job    Tile job.
+ * @param tile   Tile to be rendered.
+ * @param raster Image of the tile.
+ */
+void tiles_render(const tiles_job_t *job, const tile_t *tile,
+				  raster_t *raster) {
+	double scale = job->level->scale;
+	double ox = (double)tile->col * TILES_SIZE;
+	double oy = (double)tile->row * TILES_SIZE;
+
+	raster_clear(raster, job->opts->background);
+	for (size_t i = 0; i < tile->count; i++) {
+		object_t obj = nanocad_get_object(job->level->objects[tile->start + i]);
+		rgba_color_t color = job->colors[obj.layer_num];
+
+		// Convert to the pixels of the tile, with Y going down.
+		double px = ((double)(obj.coord[0].x - job->min.x) * scale) - ox;
+		double py = ((double)(job->max.y - obj.coord[0].y) * scale) - oy;
+
+		if (obj.type == TYPE_CIRCLE) {
+			double dx = (double)(obj.coord[1].x - obj.coord[0].x);
+			double dy = (double)(obj.coord[1].y - obj.coord[0].y);
+
+			raster_circle(raster, px, py, sqrt((dx * dx) + (dy * dy)) * scale,
+						  color);
+			continue;
+		}
+
+		for (uint8_t c = 1; c < obj.coord_count; c++) {
+			double x = ((double)(obj.coord[c].x - job->min.x) * scale) - ox;
+			double y = ((double)(job->max.y - obj.coord[c].y) * scale) - oy;
+
+			raster_line(raster, px, py, x, y, color);
+			px = x;
+			py = y;
+		}
+	}
+}
+
+/**
+ * Checks if an object touches a rectangle of a level.
+ *
+ * @param  job   Tile job.
+ * @param  obj   Object to be checked.
+ * @param  scale Pixels per millimeter of the level.
+ * @param  x0    Left side of the rectangle in pixels.
+ * @param  y0    Top side of the rectangle in pixels.
+ * @param  x1    Right side of the rectangle in pixels.
+ * @param  y1    Bottom side of the rectangle in pixels.
+ * @return       TRUE if the object touches the rectangle.
+ */
+bool tiles_touches(const tiles_job_t *job, const object_t *obj,
+				   const double scale, const double x0, const double y0,
+				   const double x1, const double y1) {
+	double px = (double)(obj->coord[0].x - job->min.x) * scale;
+	double py = (double)(job->max.y - obj->coord[0].y) * scale;
+
+	if (obj->type == TYPE_CIRCLE) {
+		double dx = (double)(obj->coord[1].x - obj->coord[0].x);
+		double dy = (double)(obj->coord[1].y - obj->coord[0].y);
+		double r = sqrt((dx * dx) + (dy * dy)) * scale;
+
+		return ((px + r) >= x0) && ((px - r) <= x1) && ((py + r) >= y0) &&
+			((py - r) <= y1);
+	}
+
+	for (uint8_t c = 1; c < obj->coord_count; c++) {
+		double x = (double)(obj->coord[c].x - job->min.x) * scale;
+		double y = (double)(job->max.y - obj->coord[c].y) * scale;
+
+		if (tiles_segment_touches(px, py, x, y, x0, y0, x1, y1)) {
+			return true;
+		}
+
+		px = x;
+		py = y;
+	}
+
+	return false;
+}
+
+/**
+ * Checks if a segment touches a rectangle.
+ *
+ * @param  ax Horizontal position of the start of the segment.
+ * @param  ay Vertical position of the start of the segment.
+ * @param  bx Horizontal position of the end of the segment.
+ * @param  by Vertical position of the end of the segment.
+ * @param  x0 Left side of the rectangle.
+ * @param  y0 Top side of the rectangle.
+ * @param  x1 Right side of the rectangle.
+ * @param  y1 Bottom side of the rectangle.
+ * @return    TRUE if they touch.
+ */
+bool tiles_segment_touches(double ax, double ay, double bx, double by,
+						   const double x0, const double y0, const double x1,
+						   const double y1) {
+	// Boxes that don't overlap.
+	if ((((ax < bx) ? ax : bx) > x1) || (((ax > bx) ? ax : bx) < x0) ||
+			(((ay < by) ? ay : by) > y1) || (((ay > by) ? ay : by) < y0)) {
+		return false;
+	}
+
+	// Corners of the rectangle that are all on the same side of the line.
+	double dx = bx - ax;
+	double dy = by - ay;
+	double s0 = (dx * (y0 - ay)) - (dy * (x0 - ax));
+	double s1 = (dx * (y0 - ay)) - (dy * (x1 - ax));
+	double s2 = (dx * (y1 - ay)) - (dy * (x0 - ax));
+	double s3 = (dx * (y1 - ay)) - (dy * (x1 - ax));
+
+	return !(((s0 > 0) && (s1 > 0) && (s2 > 0) && (s3 > 0)) ||
+			 ((s0 < 0) && (s1 < 0) && (s2 < 0) && (s3 < 0)));
+}
+
+/**
+ * Adds an object to a child of a tile.
+ *
+ * @param children Children of the tile.
+ * @param child    Child number (left to right, top to bottom).
+ * @param object   Object index.
+ */
+void tiles_children_push(tile_children_t *children, const uint8_t child,
+						 const size_t object) {
+	if (children->count[child] == children->capacity[child]) {
+		children->capacity[child] = (children->capacity[child] == 0) ? 16 :
+			children->capacity[child] * 2;
+		children->objects[child] = realloc(children->objects[child],
+			sizeof(size_t) * children->capacity[child]);
+	}
+
+	children->objects[child][children->count[child]++] = object;
+}
@@ -0,0 +1,46 @@
+/**
+ * engine/tiles.h
+ * Deep zoom tile pyramid export for viewing drawings on the web.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _TILES_H
+#define _TILES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "nanocad.h"
+
+// Defaults.
+#define TILES_SIZE        256
+#define TILES_MAX_LEVELS  32
+#define TILES_PATH_MAX    512
+#define TILES_RESOLUTION  1   // Millimeters per pixel at the deepest level.
+
+// Tile pyramid settings.
+typedef struct {
+	object_filter_t filter;
+	long            resolution;  // Millimeters per pixel at the deepest level.
+	rgba_color_t    background;
+	uint8_t         png_mode;    // PNG encoding mode (PNG_*).
+} tiles_options_t;
+
+// Statistics of a tile pyramid.
+typedef struct {
+	uint32_t width;    // Size of the deepest level in pixels.
+	uint32_t height;
+	uint8_t  levels;
+	size_t   written;  // Tiles with something in them.
+	size_t   skipped;  // Empty tiles that weren't rendered.
+} tiles_stats_t;
+
+// Settings.
+void tiles_options_init(tiles_options_t *opts);
+
+// Exporting.
+bool tiles_export(const char *name, const tiles_options_t *opts,
+				  tiles_stats_t *stats);
+
+#endif
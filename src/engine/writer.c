@@ -0,0 +1,383 @@
+/**
+ * engine/writer.c
+ * Buffered output sink shared by every exporter, writing to a file
+ * descriptor (file or socket) or to memory.
+ *
+ * When writing to a file descriptor the data goes through a set of page
+ * aligned buffers, which are only sent out once all of them are full, with
+ * a single writev. Pieces bigger than a buffer skip the copying and go out
+ * straight from where they are, along with whatever was buffered before them.
+ * In memory mode everything goes into a single buffer that keeps growing.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "diagnostics.h"
+#include "numfmt.h"
+#include "writer.h"
+
+// Internal functions.
+void writer_reset(writer_t *w);
+void writer_next_buffer(writer_t *w);
+bool writer_send(writer_t *w, const void *extra, const size_t extra_len);
+
+
+/**
+ * Initializes a writer that sends its output to a file descriptor. The
+ * descriptor is left open when the writer is closed.
+ *
+ * @param w  Writer.
+ * @param fd File descriptor of a file, pipe or socket.
+ */
+void writer_init_fd(writer_t *w, const int fd) {
+	writer_reset(w);
+	w->mode = WRITER_FD;
+	w->fd = fd;
+
+	for (size_t i = 0; i < WRITER_BUFFER_COUNT; i++) {
+		if (posix_memalign((void **)&w->bufs[i], WRITER_ALIGNMENT,
+						   WRITER_BUFFER_SIZE) != 0) {
+			w->bufs[i] = malloc(WRITER_BUFFER_SIZE);
+		}
+	}
+
+	w->buf = w->bufs[0];
+	w->capacity = WRITER_BUFFER_SIZE;
+}
+
+/**
+ * Initializes a writer that creates a file and writes to it.
+ *
+ * @param  w        Writer.
+ * @param  filename Path of the file to be written.
+ * @return          TRUE if the file could be created.
+ */
+bool writer_open_file(writer_t *w, const char *filename) {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+					"Couldn't open the file for writing: %s", filename);
+		return false;
+	}
+
+	writer_init_fd(w, fd);
+	w->owns_fd = true;
+
+	return true;
+}
+
+/**
+ * Initializes a writer that keeps its output in memory.
+ *
+ * @param w Writer.
+ */
+void writer_init_memory(writer_t *w) {
+	writer_reset(w);
+	w->mode = WRITER_MEMORY;
+	w->capacity = WRITER_BUFFER_SIZE;
+	w->buf = malloc(w->capacity);
+}
+
+/**
+ * Sends out everything that's left and frees the writer. In memory mode the
+ * data is freed as well, unless it was taken before.
+ *
+ * @param  w Writer.
+ * @return   TRUE if everything was written.
+ */
+bool writer_close(writer_t *w) {
+	bool success = writer_flush(w);
+
+	if (w->mode == WRITER_FD) {
+		for (size_t i = 0; i < WRITER_BUFFER_COUNT; i++) {
+			free(w->bufs[i]);
+		}
+
+		if (w->owns_fd && (close(w->fd) != 0)) {
+			success = false;
+		}
+	} else {
+		free(w->buf);
+	}
+
+	w->buf = NULL;
+	w->capacity = 0;
+	w->len = 0;
+
+	return success;
+}
+
+/**
+ * Appends a piece of data to the output.
+ *
+ * @param w    Writer.
+ * @param data Data to be appended.
+ * @param len  Length of the data.
+ */
+void writer_write(writer_t *w, const void *data, const size_t len) {
+	const char *src = (const char *)data;
+
+	// Big pieces go out straight from where they are.
+	if ((w->mode == WRITER_FD) && (len >= WRITER_BUFFER_SIZE)) {
+		writer_send(w, data, len);
+		return;
+	}
+
+	if (w->mode == WRITER_MEMORY) {
+		memcpy(writer_reserve(w, len), src, len);
+		w->len += len;
+		return;
+	}
+
+	// Fill up the buffers.
+	size_t left = len;
+	while (left > 0) {
+		size_t room = w->capacity - w->len;
+		if (room == 0) {
+			writer_next_buffer(w);
+			continue;
+		}
+
+		size_t piece = (left < room) ? left : room;
+		memcpy(w->buf + w->len, src, piece);
+		w->len += piece;
+		src += piece;
+		left -= piece;
+	}
+}
+
+/**
+ * Appends a string to the output.
+ *
+ * @param w   Writer.
+ * @param str String to be appended.
+ */
+void writer_str(writer_t *w, const char *str) {
+	writer_write(w, str, strlen(str));
+}
+
+/**
+ * Appends a single character to the output.
+ *
+ * @param w Writer.
+ * @param c Character to be appended.
+ */
+void writer_char(writer_t *w, const char c) {
+	if (w->len == w->capacity) {
+		writer_reserve(w, 1);
+	}
+
+	w->buf[w->len++] = c;
+}
+
+/**
+ * Appends an integer to the output.
+ *
+ * @param w     Writer.
+ * @param value Number to be appended.
+ */
+void writer_long(writer_t *w, const long value) {
+	w->len += numfmt_long(writer_reserve(w, NUMFMT_MAX_SIZE), value);
+}
+
+/**
+ * Appends a double to the output, with the shortest number of digits that
+ * reads back as the same value.
+ *
+ * @param w     Writer.
+ * @param value Number to be appended.
+ */
+void writer_double(writer_t *w, const double value) {
+	w->len += numfmt_double(writer_reserve(w, NUMFMT_MAX_SIZE), value);
+}
+
+/**
+ * Makes room for a piece of data to be written straight into the buffer.
+ * Has to be followed by writer_commit with the length actually written.
+ *
+ * @param  w   Writer.
+ * @param  len Number of bytes needed (up to WRITER_BUFFER_SIZE).
+ * @return     Where the data should be written to.
+ */
+char* writer_reserve(writer_t *w, const size_t len) {
+	if ((w->capacity - w->len) >= len) {
+		return w->buf + w->len;
+	}
+
+	if (w->mode == WRITER_MEMORY) {
+		while ((w->capacity - w->len) < len) {
+			w->capacity *= 2;
+		}
+		w->buf = realloc(w->buf, w->capacity);
+	} else {
+		writer_next_buffer(w);
+	}
+
+	return w->buf + w->len;
+}
+
+/**
+ * Commits the data that was written into a reserved piece of the buffer.
+ *
+ * @param w   Writer.
+ * @param len Number of bytes written.
+ */
+void writer_commit(writer_t *w, const size_t len) {
+	w->len += len;
+}
+
+/**
+ * Sends out everything that's buffered.
+ *
+ * @param  w Writer.
+ * @return   TRUE if nothing failed so far.
+ */
+bool writer_flush(writer_t *w) {
+	if (w->mode == WRITER_FD) {
+		writer_send(w, NULL, 0);
+	} else {
+		w->stats.bytes = w->taken + w->len;
+	}
+
+	return !w->failed;
+}
+
+/**
+ * Gets the data of a writer in memory mode.
+ *
+ * @param  w   Writer.
+ * @param  len Length of the data.
+ * @return     Data written so far.
+ */
+const char* writer_data(const writer_t *w, size_t *len) {
+	*len = w->len;
+	return w->buf;
+}
+
+/**
+ * Takes ownership of the data of a writer in memory mode, which starts over
+ * empty.
+ *
+ * @param  w   Writer.
+ * @param  len Length of the data.
+ * @return     Data written so far. Has to be freed by the caller.
+ */
+char* writer_take_data(writer_t *w, size_t *len) {
+	char *data = w->buf;
+
+	*len = w->len;
+	w->taken += w->len;
+	w->capacity = WRITER_BUFFER_SIZE;
+	w->buf = malloc(w->capacity);
+	w->len = 0;
+
+	return data;
+}
+
+/**
+ * Throws away the data of a writer in memory mode, keeping its buffer around
+ * to be filled again.
+ *
+ * @param w Writer.
+ */
+void writer_rewind(writer_t *w) {
+	w->len = 0;
+}
+
+/**
+ * Clears everything in a writer.
+ *
+ * @param w Writer.
+ */
+void writer_reset(writer_t *w) {
+	memset(w, 0, sizeof(writer_t));
+	w->fd = -1;
+}
+
+/**
+ * Moves on to the next buffer, sending them all out if they're all full.
+ *
+ * @param w Writer.
+ */
+void writer_next_buffer(writer_t *w) {
+	w->lens[w->current] = w->len;
+	if ((w->current + 1) == WRITER_BUFFER_COUNT) {
+		writer_send(w, NULL, 0);
+		return;
+	}
+
+	w->current++;
+	w->buf = w->bufs[w->current];
+	w->len = 0;
+}
+
+/**
+ * Sends out every buffer, followed by an optional piece of data, with as few
+ * writev calls as possible.
+ *
+ * @param  w         Writer.
+ * @param  extra     Data to be written after the buffers or NULL.
+ * @param  extra_len Length of the extra data.
+ * @return           TRUE if everything was written.
+ */
+bool writer_send(writer_t *w, const void *extra, const size_t extra_len) {
+	struct iovec iov[WRITER_BUFFER_COUNT + 1];
+	int count = 0;
+
+	w->lens[w->current] = w->len;
+	for (size_t i = 0; i <= w->current; i++) {
+		if (w->lens[i] > 0) {
+			iov[count].iov_base = w->bufs[i];
+			iov[count].iov_len = w->lens[i];
+			count++;
+		}
+	}
+	if (extra_len > 0) {
+		iov[count].iov_base = (void *)extra;
+		iov[count].iov_len = extra_len;
+		count++;
+	}
+
+	// Start over with the first buffer.
+	w->current = 0;
+	w->buf = w->bufs[0];
+	w->len = 0;
+	memset(w->lens, 0, sizeof(w->lens));
+
+	// Keep going until everything was written, since sockets and pipes may
+	// take only part of it.
+	struct iovec *vec = iov;
+	while ((count > 0) && !w->failed) {
+		ssize_t written = writev(w->fd, vec, count);
+		w->stats.syscalls++;
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			diag_report(DIAG_ERROR, DIAG_CODE_IO, errno,
+						"Couldn't write the output: %s", strerror(errno));
+			w->failed = true;
+			break;
+		}
+
+		w->stats.bytes += (uint64_t)written;
+		while ((count > 0) && ((size_t)written >= vec->iov_len)) {
+			written -= (ssize_t)vec->iov_len;
+			vec++;
+			count--;
+		}
+		if (count > 0) {
+			vec->iov_base = (char *)vec->iov_base + written;
+			vec->iov_len -= (size_t)written;
+		}
+	}
+
+	return !w->failed;
+}
@@ -0,0 +1,71 @@
+/**
+ * engine/writer.h
+ * Buffered output sink shared by every exporter, writing to a file
+ * descriptor (file or socket) or to memory.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _WRITER_H
+#define _WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Output modes.
+#define WRITER_FD     0
+#define WRITER_MEMORY 1
+
+// Buffering.
+#define WRITER_BUFFER_SIZE  65536  // Largest piece that can be reserved.
+#define WRITER_BUFFER_COUNT 8      // Buffers sent out in a single writev.
+#define WRITER_ALIGNMENT    4096
+
+// Output statistics.
+typedef struct {
+	uint64_t bytes;
+	uint64_t syscalls;
+} writer_stats_t;
+
+// Output sink. Data goes into the current buffer, and full buffers pile up
+// until they're all sent out in one go.
+typedef struct {
+	uint8_t         mode;
+	int             fd;
+	bool            owns_fd;
+	bool            failed;
+
+	char           *buf;       // Buffer being filled.
+	size_t          len;
+	size_t          capacity;
+	char           *bufs[WRITER_BUFFER_COUNT];
+	size_t          lens[WRITER_BUFFER_COUNT];
+	size_t          current;   // Index of the buffer being filled.
+	size_t          taken;     // Bytes taken out of a memory writer.
+
+	writer_stats_t  stats;
+} writer_t;
+
+// Initialization and destruction.
+void writer_init_fd(writer_t *w, const int fd);
+bool writer_open_file(writer_t *w, const char *filename);
+void writer_init_memory(writer_t *w);
+bool writer_close(writer_t *w);
+
+// Writing.
+void writer_write(writer_t *w, const void *data, const size_t len);
+void writer_str(writer_t *w, const char *str);
+void writer_char(writer_t *w, const char c);
+void writer_long(writer_t *w, const long value);
+void writer_double(writer_t *w, const double value);
+char* writer_reserve(writer_t *w, const size_t len);
+void writer_commit(writer_t *w, const size_t len);
+bool writer_flush(writer_t *w);
+
+// Memory mode.
+const char* writer_data(const writer_t *w, size_t *len);
+char* writer_take_data(writer_t *w, size_t *len);
+void writer_rewind(writer_t *w);
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * graphics/damage.c
+ * Keeps track of the areas of the screen that need to be redrawn.
+ *
+ * Rectangles that touch each other are merged as they are added. When the
+ * list gets full the new rectangle gets merged with the one that grows the
+ * least, and when most of the screen is damaged it's cheaper to just redraw
+ * everything.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include "damage.h"
+
+// Internal functions.
+long rect_area(const SDL_Rect *rect);
+void merge_touching(damage_t *damage, size_t i);
+
+
+/**
+ * Clears the damage list.
+ *
+ * @param damage Damage list.
+ */
+void damage_reset(damage_t *damage) {
+	damage->full = false;
+	damage->count = 0;
+}
+
+/**
+ * Marks a rectangle of the screen as damaged.
+ *
+ * @param damage Damage list.
+ * @param rect   Damaged rectangle.
+ */
+void damage_add(damage_t *damage, const SDL_Rect *rect) {
+	if (damage->full || (rect->w <= 0) || (rect->h <= 0)) {
+		return;
+	}
+
+	// Merge with a rectangle that already touches it.
+	for (size_t i = 0; i < damage->count; i++) {
+		if (SDL_HasIntersection(&damage->rects[i], rect)) {
+			SDL_UnionRect(&damage->rects[i], rect, &damage->rects[i]);
+			merge_touching(damage, i);
+			return;
+		}
+	}
+
+	// Append it if there's still space.
+	if (damage->count < DAMAGE_MAX_RECTS) {
+		damage->rects[damage->count++] = *rect;
+		return;
+	}
+
+	// Merge with the rectangle that grows the least.
+	size_t best = 0;
+	long best_growth = -1;
+	for (size_t i = 0; i < damage->count; i++) {
+		SDL_Rect merged;
+		SDL_UnionRect(&damage->rects[i], rect, &merged);
+
+		long growth = rect_area(&merged) - rect_area(&damage->rects[i]);
+		if ((best_growth < 0) || (growth < best_growth)) {
+			best = i;
+			best_growth = growth;
+		}
+	}
+
+	SDL_UnionRect(&damage->rects[best], rect, &damage->rects[best]);
+	merge_touching(damage, best);
+}
+
+/**
+ * Marks the whole screen as damaged.
+ *
+ * @param damage Damage list.
+ */
+void damage_add_all(damage_t *damage) {
+	damage->full = true;
+	damage->count = 0;
+}
+
+/**
+ * Clips the damaged rectangles to the screen, dropping the ones that aren't
+ * visible. If most of the screen is damaged it gets fully damaged instead.
+ *
+ * @param  damage Damage list.
+ * @param  screen Visible area of the screen.
+ * @return        TRUE if there's anything to be redrawn.
+ */
+bool damage_clip(damage_t *damage, const SDL_Rect *screen) {
+	long area = 0;
+	size_t count = 0;
+
+	if (damage->full) {
+		return true;
+	}
+
+	for (size_t i = 0; i < damage->count; i++) {
+		SDL_Rect clipped;
+		if (SDL_IntersectRect(&damage->rects[i], screen, &clipped)) {
+			damage->rects[count++] = clipped;
+			area += rect_area(&clipped);
+		}
+	}
+	damage->count = count;
+
+	if (area > (rect_area(screen) / 2)) {
+		damage_add_all(damage);
+	}
+
+	return damage->full || (damage->count > 0);
+}
+
+/**
+ * Calculates the area of a rectangle.
+ *
+ * @param  rect Rectangle.
+ * @return      Area of the rectangle.
+ */
+long rect_area(const SDL_Rect *rect) {
+	return (long)rect->w * (long)rect->h;
+}
+
+/**
+ * Merges every rectangle that touches a recently grown one into it.
+ *
+ * @param damage Damage list.
+ * @param i      Index of the rectangle that grew.
+ */
+void merge_touching(damage_t *damage, size_t i) {
+	bool merged = true;
+
+	while (merged) {
+		merged = false;
+
+		for (size_t j = 0; j < damage->count; j++) {
+			if ((j == i) || !SDL_HasIntersection(&damage->rects[i],
+												 &damage->rects[j])) {
+				continue;
+			}
+
+			// Swallow the other rectangle and remove it from the list.
+			SDL_UnionRect(&damage->rects[i], &damage->rects[j],
+						  &damage->rects[i]);
+			damage->rects[j] = damage->rects[--damage->count];
+			if (i == damage->count) {
+				i = j;
+			}
+
+			merged = true;
+			break;
+		}
+	}
+}
@@ -0,0 +1,31 @@
+/**
+ * graphics/damage.h
+ * Keeps track of the areas of the screen that need to be redrawn.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _DAMAGE_H
+#define _DAMAGE_H
+
+#include <SDL.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Constants.
+#define DAMAGE_MAX_RECTS 16
+
+// Damaged screen areas.
+typedef struct {
+	bool     full;
+	size_t   count;
+	SDL_Rect rects[DAMAGE_MAX_RECTS];
+} damage_t;
+
+// Tracking.
+void damage_reset(damage_t *damage);
+void damage_add(damage_t *damage, const SDL_Rect *rect);
+void damage_add_all(damage_t *damage);
+bool damage_clip(damage_t *damage, const SDL_Rect *screen);
+
+#endif
@@ -0,0 +1,671 @@
+/**
+ * graphics/display_list.c
+ * Type-sorted batches of primitives built from the engine's document.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../engine/diagnostics.h"
+#include "display_list.h"
+
+// Constants.
+#define DL_CHUNK_SIZE      256
+#define DL_DIMEN_PIN_SIZE  10
+#define DL_LAYER_COUNT     256
+
+// Internal functions.
+void start_build(display_list_t *dl);
+void stage_objects(display_list_t *dl);
+void stage_dimensions(display_list_t *dl);
+void finish_build(display_list_t *dl);
+void free_staging(dl_staging_t *st);
+void* dl_grow(void *arr, size_t *capacity, const size_t needed,
+			  const size_t size);
+void stage_segment(dl_staging_t *st, const int32_t x1, const int32_t y1,
+				   const int32_t x2, const int32_t y2, const uint8_t layer_num);
+void stage_vertex(dl_staging_t *st, const coord_t coord);
+void stage_chain_start(dl_staging_t *st, const object_span_t *span);
+void stage_chain_end(dl_staging_t *st);
+void stage_dimension(dl_staging_t *st, const dimension_t *dimen);
+void sort_segments(display_list_t *dl, const dl_staging_t *st);
+void sort_polylines(display_list_t *dl, const dl_staging_t *st);
+size_t display_list_bytes(const display_list_t *dl);
+
+
+/**
+ * Initializes an empty display list.
+ *
+ * @param dl Display list to be initialized.
+ */
+void display_list_init(display_list_t *dl) {
+	memset(dl, 0, sizeof(display_list_t));
+	dl->valid = false;
+
+	// Everything is drawn from it, so it can't give anything up.
+	dl->cache_id = cachemgr_register("display list", dl, NULL, NULL);
+}
+
+/**
+ * Frees everything allocated by a display list.
+ *
+ * @param dl Display list to be freed.
+ */
+void display_list_free(display_list_t *dl) {
+	free(dl->segments.x1);
+	free(dl->segments.y1);
+	free(dl->segments.x2);
+	free(dl->segments.y2);
+	free(dl->segments.runs);
+	free(dl->polylines.x);
+	free(dl->polylines.y);
+	free(dl->polylines.runs);
+	free(dl->texts.list);
+	free_staging(&dl->staging);
+
+	cachemgr_unregister(dl->cache_id);
+	memset(dl, 0, sizeof(display_list_t));
+	dl->valid = false;
+	dl->cache_id = -1;
+}
+
+/**
+ * Rebuilds the display list if the document has changed since it was built.
+ * A build that was left halfway by the idle steps is picked up from where it
+ * stopped.
+ *
+ * @param  dl Display list to be updated.
+ * @return    TRUE if the display list was rebuilt.
+ */
+bool display_list_update(display_list_t *dl) {
+	if (dl->valid && (dl->revision == nanocad_get_revision())) {
+		cachemgr_hit(dl->cache_id);
+		return false;
+	}
+
+	while (display_list_step(dl)) {
+	}
+
+	return true;
+}
+
+/**
+ * Does a small step of rebuilding the display list if the document has
+ * changed since it was built. Lines are joined and dimensions are broken down
+ * into the staging area a chunk at a time, then sorting the segments and the
+ * polylines into the display list gets a step each, with the texts swapped
+ * in by the last one. A build is started over if the document changes
+ * halfway through it.
+ *
+ * @param  dl Display list to be updated.
+ * @return    TRUE if there's still work to be done.
+ */
+bool display_list_step(display_list_t *dl) {
+	dl_staging_t *st = &dl->staging;
+	uint32_t revision = nanocad_get_revision();
+
+	// Check if there's anything to be done at all.
+	if (dl->valid && (dl->revision == revision)) {
+		if (st->stage != DL_STAGE_IDLE) {
+			free_staging(st);
+		}
+
+		return false;
+	}
+
+	// Start over if the document changed since the build was started.
+	if ((st->stage == DL_STAGE_IDLE) || (st->revision != revision)) {
+		cachemgr_miss(dl->cache_id);
+		start_build(dl);
+	}
+
+	switch (st->stage) {
+	case DL_STAGE_OBJECTS:
+		stage_objects(dl);
+		break;
+	case DL_STAGE_DIMENSIONS:
+		stage_dimensions(dl);
+		break;
+	case DL_STAGE_SEGMENTS:
+		sort_segments(dl, st);
+		st->stage = DL_STAGE_POLYLINES;
+		break;
+	case DL_STAGE_POLYLINES:
+		sort_polylines(dl, st);
+		finish_build(dl);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Builds the display list from the engine's document in one go. Consecutive
+ * connected lines on the same layer are joined into polylines, lone lines
+ * become segments and dimensions are broken down into segments and text.
+ * Everything ends up sorted by layer so that each run can be rendered in a
+ * tight loop.
+ *
+ * @param dl Display list to be (re)built.
+ */
+void display_list_build(display_list_t *dl) {
+	start_build(dl);
+	while (display_list_step(dl)) {
+	}
+}
+
+/**
+ * Throws away any build in progress and gets ready to start a new one.
+ *
+ * @param dl Display list to be built.
+ */
+void start_build(display_list_t *dl) {
+	dl_staging_t *st = &dl->staging;
+
+	free_staging(st);
+	st->stage = DL_STAGE_OBJECTS;
+	st->revision = nanocad_get_revision();
+	nanocad_object_iter_init(&st->iter, NULL, 0, 1);
+
+	dl->valid = false;
+	dl->skipped = 0;
+}
+
+/**
+ * Joins the next chunk of lines into chains.
+ *
+ * @param dl Display list being built.
+ */
+void stage_objects(display_list_t *dl) {
+	dl_staging_t *st = &dl->staging;
+	object_span_t spans[DL_CHUNK_SIZE];
+	size_t processed = 0;
+	size_t count = 0;
+
+	// Go through the objects in chunks.
+	while ((processed < DL_STEP_OBJECTS) &&
+		   ((count = nanocad_object_iter_next(&st->iter, spans,
+											  DL_CHUNK_SIZE)) > 0)) {
+		processed += count;
+
+		for (size_t i = 0; i < count; i++) {
+			const object_span_t *span = &spans[i];
+
+			// Skip anything we don't have a kernel for.
+			if ((span->type != TYPE_LINE) || (span->coord_count < 2)) {
+				if (st->chain_open) {
+					stage_chain_end(st);
+					st->chain_open = false;
+				}
+
+				dl->skipped++;
+				continue;
+			}
+
+			// Check if this line continues the current chain.
+			if (st->chain_open) {
+				const dl_run_t *chain = &st->chains[st->chain_count - 1];
+				size_t last = chain->start + chain->count - 1;
+
+				if ((chain->layer_num == span->layer_num) &&
+						(st->x[last] == span->coord[0].x) &&
+						(st->y[last] == span->coord[0].y)) {
+					stage_vertex(st, span->coord[1]);
+					st->chains[st->chain_count - 1].count++;
+					continue;
+				}
+
+				stage_chain_end(st);
+			}
+
+			// Start a new chain.
+			stage_chain_start(st, span);
+			st->chain_open = true;
+		}
+	}
+
+	// Move on once we've gone through every object.
+	if (st->iter.pos < st->iter.end) {
+		return;
+	}
+
+	if (st->chain_open) {
+		stage_chain_end(st);
+		st->chain_open = false;
+	}
+
+	st->next_dimension = 0;
+	st->stage = DL_STAGE_DIMENSIONS;
+}
+
+/**
+ * Breaks down the next chunk of dimensions.
+ *
+ * @param dl Display list being built.
+ */
+void stage_dimensions(display_list_t *dl) {
+	dl_staging_t *st = &dl->staging;
+	dimension_container dimensions;
+	size_t processed = 0;
+
+	nanocad_get_dimension_container(&dimensions);
+	while ((st->next_dimension < dimensions.count) &&
+		   (processed++ < DL_STEP_OBJECTS)) {
+		stage_dimension(st, &dimensions.list[st->next_dimension++]);
+	}
+
+	if (st->next_dimension >= dimensions.count) {
+		st->stage = DL_STAGE_SEGMENTS;
+	}
+}
+
+/**
+ * Wraps up a build once everything has been sorted into the display list.
+ *
+ * @param dl Display list that was built.
+ */
+void finish_build(display_list_t *dl) {
+	// Swap in the texts of the dimensions.
+	free(dl->texts.list);
+	dl->texts = dl->staging.texts;
+	dl->staging.texts.list = NULL;
+
+	dl->revision = dl->staging.revision;
+	dl->valid = true;
+	free_staging(&dl->staging);
+	cachemgr_resize(dl->cache_id, display_list_bytes(dl),
+					dl->segments.count + dl->polylines.run_count +
+					dl->texts.count);
+
+	// Report the things we couldn't render only once per build.
+	if (dl->skipped > 0) {
+		diag_report(DIAG_WARNING, DIAG_CODE_RENDER, (long)dl->skipped,
+					"Skipped %zu objects of a type that can't be rendered.",
+					dl->skipped);
+	}
+
+#ifdef DEBUG
+	printf("Display list: %zu segments (%zu runs), %zu polylines (%zu "
+		   "vertices), %zu texts\n", dl->segments.count,
+		   dl->segments.run_count, dl->polylines.run_count,
+		   dl->polylines.vertex_count, dl->texts.count);
+#endif
+}
+
+/**
+ * Frees the staging area of a build and leaves it idle.
+ *
+ * @param st Staging area.
+ */
+void free_staging(dl_staging_t *st) {
+	free(st->segs);
+	free(st->x);
+	free(st->y);
+	free(st->chains);
+	free(st->texts.list);
+
+	memset(st, 0, sizeof(dl_staging_t));
+	st->stage = DL_STAGE_IDLE;
+}
+
+/**
+ * Adds a segment to the staging area.
+ *
+ * @param st        Staging area.
+ * @param x1        Starting X coordinate.
+ * @param y1        Starting Y coordinate.
+ * @param x2        Ending X coordinate.
+ * @param y2        Ending Y coordinate.
+ * @param layer_num Layer number of the segment.
+ */
+void stage_segment(dl_staging_t *st, const int32_t x1, const int32_t y1,
+				   const int32_t x2, const int32_t y2, const uint8_t layer_num) {
+	st->segs = dl_grow(st->segs, &st->seg_capacity, st->seg_count + 1,
+					   sizeof(dl_staged_segment_t));
+
+	dl_staged_segment_t *seg = &st->segs[st->seg_count++];
+	seg->x1 = x1;
+	seg->y1 = y1;
+	seg->x2 = x2;
+	seg->y2 = y2;
+	seg->layer_num = layer_num;
+}
+
+/**
+ * Appends a vertex to the staging area.
+ *
+ * @param st    Staging area.
+ * @param coord Vertex coordinate.
+ */
+void stage_vertex(dl_staging_t *st, const coord_t coord) {
+	size_t capacity = st->vertex_capacity;
+
+	// Both arrays share the same capacity.
+	st->x = dl_grow(st->x, &capacity, st->vertex_count + 1, sizeof(int32_t));
+	st->y = dl_grow(st->y, &st->vertex_capacity, st->vertex_count + 1,
+					sizeof(int32_t));
+
+	st->x[st->vertex_count] = (int32_t)coord.x;
+	st->y[st->vertex_count] = (int32_t)coord.y;
+	st->vertex_count++;
+}
+
+/**
+ * Starts a new chain of vertices with a line.
+ *
+ * @param st   Staging area.
+ * @param span Line that starts the chain.
+ */
+void stage_chain_start(dl_staging_t *st, const object_span_t *span) {
+	st->chains = dl_grow(st->chains, &st->chain_capacity, st->chain_count + 1,
+						 sizeof(dl_run_t));
+
+	dl_run_t *chain = &st->chains[st->chain_count++];
+	chain->layer_num = span->layer_num;
+	chain->start = st->vertex_count;
+	chain->count = 2;
+
+	stage_vertex(st, span->coord[0]);
+	stage_vertex(st, span->coord[1]);
+}
+
+/**
+ * Finishes the current chain. Chains made out of a single line are turned
+ * into segments since it's cheaper to render them in a batch.
+ *
+ * @param st Staging area.
+ */
+void stage_chain_end(dl_staging_t *st) {
+	dl_run_t *chain = &st->chains[st->chain_count - 1];
+
+	if (chain->count == 2) {
+		size_t i = chain->start;
+		stage_segment(st, st->x[i], st->y[i], st->x[i + 1], st->y[i + 1],
+					  chain->layer_num);
+
+		st->vertex_count -= 2;
+		st->chain_count--;
+	}
+}
+
+/**
+ * Breaks down a dimension into its lines and text. Everything is calculated in
+ * screen space with the origin at (0, 0) and then converted back to world
+ * coordinates, which is the same as the renderer would do for any origin.
+ *
+ * @param st    Staging area.
+ * @param dimen Dimension to be broken down.
+ */
+void stage_dimension(dl_staging_t *st, const dimension_t *dimen) {
+	int pin_offset = DL_DIMEN_PIN_SIZE;
+	uint8_t layer_num = dimen->layer_num;
+
+	// Transpose the coordinates to the screen orientation.
+	int x1 = dimen->line_start.x;
+	int y1 = -dimen->line_start.y;
+	int x2 = dimen->line_end.x;
+	int y2 = -dimen->line_end.y;
+	int sx = dimen->start.x;
+	int sy = -dimen->start.y;
+	int ex = dimen->end.x;
+	int ey = -dimen->end.y;
+
+	// Make sure all dimension lines are going from left to right.
+	if (x1 > x2) {
+		int xt = x1;
+		int yt = y1;
+		x1 = x2;
+		y1 = y2;
+		x2 = xt;
+		y2 = yt;
+	}
+
+	// Make sure all measured lines are going from left to right.
+	if (sx > ex) {
+		int xt = sx;
+		int yt = sy;
+		sx = ex;
+		sy = ey;
+		ex = xt;
+		ey = yt;
+	}
+
+	// Main dimension line.
+	stage_segment(st, x1, -y1, x2, -y2, layer_num);
+
+	// Calculate the perpendicular line parameters.
+	int dx = x1 - x2;
+	int dy = y1 - y2;
+	int dist = (int)round(sqrt((dx * dx) + (dy * dy)));
+	if (dist == 0) {
+		return;
+	}
+	dx = (int)nearbyint((double)dx / dist);
+	dy = (int)nearbyint((double)dy / dist);
+
+	// Text position variables will be the mid-point between marker pins.
+	int tx[2] = { 0, 0 };
+	int ty[2] = { 0, 0 };
+	int px[2] = { x1, x2 };
+	int py[2] = { y1, y2 };
+
+	for (uint8_t i = 0; i < 2; i++) {
+		// Marker pin.
+		int x3 = px[i] + (pin_offset * dy);
+		int y3 = py[i] - (pin_offset * dx);
+		int x4 = px[i] - (pin_offset * dy);
+		int y4 = py[i] + (pin_offset * dx);
+		stage_segment(st, x3, -y3, x4, -y4, layer_num);
+
+		// Check the line direction and determine which marker position to use.
+		if ((sy > y1) && (ey > y2)) {
+			// Dimension line above measured line.
+			tx[i] = x4;
+			ty[i] = y4 - (int)((float)FONT_SIZE * 0.2);
+		} else if ((sy < y1) && (ey < y2)) {
+			// Dimension line below the measured line.
+			tx[i] = x3;
+			ty[i] = y3;
+		} else if ((sx > x1) && (ex > x2)) {
+			// Dimension line to the left of measured line.
+			tx[i] = x4 - (int)((float)FONT_SIZE * 0.2);
+			ty[i] = y4;
+		} else if ((sx < x1) && (ex < x2)) {
+			// Dimension line to the right of measured line.
+			tx[i] = x4;
+			ty[i] = y4;
+		}
+	}
+
+	// Add the measurement text.
+	st->texts.list = realloc(st->texts.list,
+							 sizeof(dl_text_t) * (st->texts.count + 1));
+	dl_text_t *text = &st->texts.list[st->texts.count++];
+	text->layer_num = layer_num;
+
+	// Build the measurement string.
+	double distance = sqrt(pow(dimen->end.x - dimen->start.x, 2) +
+						   pow(dimen->end.y - dimen->start.y, 2));
+	snprintf(text->text, DIMENSION_TEXT_MAX_SIZE, "%.0f", distance);
+
+	// Text position back in world coordinates.
+	text->pos.x = (tx[0] + tx[1]) / 2;
+	text->pos.y = -((ty[0] + ty[1]) / 2);
+
+	// Calculate the dimension text rotation angle.
+	double perpangle = atan2(y1 - y2, x1 - x2);
+	text->angle = perpangle * (180.0 / M_PI);
+
+	// Fix the rotation on opposite sides (remember that Y is inverted in SDL).
+	if ((sy > y1) && (ey > y2)) {
+		text->angle += 180;
+	} else if ((sy < y1) && (ey < y2)) {
+		text->angle += 180;
+	} else if ((sx > x1) && (ex > x2)) {
+		text->angle += 180;
+	}
+}
+
+/**
+ * Sorts the staged segments by layer into the display list.
+ *
+ * @param dl Display list.
+ * @param st Staging area.
+ */
+void sort_segments(display_list_t *dl, const dl_staging_t *st) {
+	dl_segments_t *segs = &dl->segments;
+	size_t offsets[DL_LAYER_COUNT];
+	size_t start = 0;
+
+	// Make sure we have enough space.
+	if (segs->capacity < st->seg_count) {
+		segs->capacity = st->seg_count;
+		segs->x1 = realloc(segs->x1, sizeof(int32_t) * segs->capacity);
+		segs->y1 = realloc(segs->y1, sizeof(int32_t) * segs->capacity);
+		segs->x2 = realloc(segs->x2, sizeof(int32_t) * segs->capacity);
+		segs->y2 = realloc(segs->y2, sizeof(int32_t) * segs->capacity);
+	}
+
+	// Count the segments in each layer.
+	memset(offsets, 0, sizeof(offsets));
+	for (size_t i = 0; i < st->seg_count; i++) {
+		offsets[st->segs[i].layer_num]++;
+	}
+
+	// Create a run for each layer that has segments.
+	segs->run_count = 0;
+	segs->runs = realloc(segs->runs, sizeof(dl_run_t) * DL_LAYER_COUNT);
+	for (size_t l = 0; l < DL_LAYER_COUNT; l++) {
+		size_t count = offsets[l];
+		if (count == 0) {
+			continue;
+		}
+
+		segs->runs[segs->run_count].layer_num = (uint8_t)l;
+		segs->runs[segs->run_count].start = start;
+		segs->runs[segs->run_count].count = count;
+		segs->run_count++;
+
+		offsets[l] = start;
+		start += count;
+	}
+
+	// Scatter the segments into their runs.
+	for (size_t i = 0; i < st->seg_count; i++) {
+		const dl_staged_segment_t *seg = &st->segs[i];
+		size_t j = offsets[seg->layer_num]++;
+
+		segs->x1[j] = seg->x1;
+		segs->y1[j] = seg->y1;
+		segs->x2[j] = seg->x2;
+		segs->y2[j] = seg->y2;
+	}
+
+	segs->count = st->seg_count;
+}
+
+/**
+ * Sorts the staged polylines by layer into the display list.
+ *
+ * @param dl Display list.
+ * @param st Staging area.
+ */
+void sort_polylines(display_list_t *dl, const dl_staging_t *st) {
+	dl_polylines_t *lines = &dl->polylines;
+	size_t run_offsets[DL_LAYER_COUNT];
+	size_t vertex_offsets[DL_LAYER_COUNT];
+	size_t run = 0;
+	size_t vertex = 0;
+
+	// Make sure we have enough space.
+	if (lines->capacity < st->vertex_count) {
+		lines->capacity = st->vertex_count;
+		lines->x = realloc(lines->x, sizeof(int32_t) * lines->capacity);
+		lines->y = realloc(lines->y, sizeof(int32_t) * lines->capacity);
+	}
+	lines->runs = realloc(lines->runs, sizeof(dl_run_t) * (st->chain_count + 1));
+
+	// Count the polylines and vertices in each layer.
+	memset(run_offsets, 0, sizeof(run_offsets));
+	memset(vertex_offsets, 0, sizeof(vertex_offsets));
+	for (size_t i = 0; i < st->chain_count; i++) {
+		run_offsets[st->chains[i].layer_num]++;
+		vertex_offsets[st->chains[i].layer_num] += st->chains[i].count;
+	}
+
+	// Turn the counts into starting offsets.
+	for (size_t l = 0; l < DL_LAYER_COUNT; l++) {
+		size_t runs = run_offsets[l];
+		size_t vertices = vertex_offsets[l];
+
+		run_offsets[l] = run;
+		vertex_offsets[l] = vertex;
+		run += runs;
+		vertex += vertices;
+	}
+
+	// Scatter the polylines into place keeping their order inside each layer.
+	for (size_t i = 0; i < st->chain_count; i++) {
+		const dl_run_t *chain = &st->chains[i];
+		size_t r = run_offsets[chain->layer_num]++;
+		size_t v = vertex_offsets[chain->layer_num];
+
+		memcpy(&lines->x[v], &st->x[chain->start],
+			   sizeof(int32_t) * chain->count);
+		memcpy(&lines->y[v], &st->y[chain->start],
+			   sizeof(int32_t) * chain->count);
+
+		lines->runs[r].layer_num = chain->layer_num;
+		lines->runs[r].start = v;
+		lines->runs[r].count = chain->count;
+		vertex_offsets[chain->layer_num] += chain->count;
+	}
+
+	lines->run_count = st->chain_count;
+	lines->vertex_count = st->vertex_count;
+}
+
+/**
+ * Works out how much memory a display list is taking up.
+ *
+ * @param  dl Display list.
+ * @return    Size of everything it has allocated in bytes.
+ */
+size_t display_list_bytes(const display_list_t *dl) {
+	size_t bytes = sizeof(int32_t) * 4 * dl->segments.capacity;
+
+	if (dl->segments.runs != NULL) {
+		bytes += sizeof(dl_run_t) * DL_LAYER_COUNT;
+	}
+
+	bytes += sizeof(int32_t) * 2 * dl->polylines.capacity;
+	bytes += sizeof(dl_run_t) * (dl->polylines.run_count + 1);
+	bytes += sizeof(dl_text_t) * dl->texts.count;
+
+	return bytes;
+}
+
+/**
+ * Makes sure a dynamic array has enough space for a number of items.
+ *
+ * @param  arr      Array to be grown.
+ * @param  capacity Pointer to the current capacity of the array.
+ * @param  needed   Number of items that must fit.
+ * @param  size     Size of each item.
+ * @return          Pointer to the (possibly) reallocated array.
+ */
+void* dl_grow(void *arr, size_t *capacity, const size_t needed,
+			  const size_t size) {
+	if (needed <= *capacity) {
+		return arr;
+	}
+
+	*capacity = (*capacity == 0) ? 64 : *capacity;
+	while (*capacity < needed) {
+		*capacity *= 2;
+	}
+
+	return realloc(arr, size * *capacity);
+}
@@ -0,0 +1,121 @@
+/**
+ * graphics/display_list.h
+ * Type-sorted batches of primitives built from the engine's document.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _DISPLAY_LIST_H
+#define _DISPLAY_LIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../engine/nanocad.h"
+#include "sdl_graphics.h"
+#include "../engine/cachemgr.h"
+
+// Constants.
+#define DL_STEP_OBJECTS 65536  // Objects to go through per build step.
+
+// Build stages.
+#define DL_STAGE_IDLE       0  // Not building anything.
+#define DL_STAGE_OBJECTS    1  // Joining lines into chains.
+#define DL_STAGE_DIMENSIONS 2  // Breaking down the dimensions.
+#define DL_STAGE_SEGMENTS   3  // Sorting the segments by layer.
+#define DL_STAGE_POLYLINES  4  // Sorting the polylines by layer.
+
+// Run of primitives that share the same layer.
+typedef struct {
+	uint8_t layer_num;
+	size_t  start;
+	size_t  count;
+} dl_run_t;
+
+// Batch of independent line segments sorted by layer.
+typedef struct {
+	size_t    count;
+	size_t    capacity;
+	int32_t  *x1;
+	int32_t  *y1;
+	int32_t  *x2;
+	int32_t  *y2;
+	size_t    run_count;
+	dl_run_t *runs;
+} dl_segments_t;
+
+// Batch of polylines sorted by layer. Each run is a single polyline.
+typedef struct {
+	size_t    vertex_count;
+	size_t    capacity;
+	int32_t  *x;
+	int32_t  *y;
+	size_t    run_count;
+	dl_run_t *runs;
+} dl_polylines_t;
+
+// Text item.
+typedef struct {
+	char    text[DIMENSION_TEXT_MAX_SIZE];
+	coord_t pos;
+	double  angle;
+	uint8_t layer_num;
+} dl_text_t;
+
+// Batch of text items.
+typedef struct {
+	size_t     count;
+	dl_text_t *list;
+} dl_texts_t;
+
+// Segment waiting to be sorted by layer.
+typedef struct {
+	int32_t x1;
+	int32_t y1;
+	int32_t x2;
+	int32_t y2;
+	uint8_t layer_num;
+} dl_staged_segment_t;
+
+// Unsorted primitives collected while building.
+typedef struct {
+	uint8_t              stage;
+	uint32_t             revision;  // Revision of the document being built.
+	object_iterator_t    iter;
+	bool                 chain_open;
+	size_t               next_dimension;
+	size_t               seg_count;
+	size_t               seg_capacity;
+	dl_staged_segment_t *segs;
+	size_t               vertex_count;
+	size_t               vertex_capacity;
+	int32_t             *x;
+	int32_t             *y;
+	size_t               chain_count;
+	size_t               chain_capacity;
+	dl_run_t            *chains;
+	dl_texts_t           texts;
+} dl_staging_t;
+
+// Display list.
+typedef struct {
+	bool           valid;
+	uint32_t       revision;
+	size_t         skipped;
+	dl_segments_t  segments;
+	dl_polylines_t polylines;
+	dl_texts_t     texts;
+	dl_staging_t   staging;
+	int            cache_id;
+} display_list_t;
+
+// Initialization and destruction.
+void display_list_init(display_list_t *dl);
+void display_list_free(display_list_t *dl);
+
+// Building.
+bool display_list_update(display_list_t *dl);
+bool display_list_step(display_list_t *dl);
+void display_list_build(display_list_t *dl);
+
+#endif
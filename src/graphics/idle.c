@@ -0,0 +1,184 @@
+/**
+ * graphics/idle.c
+ * Runs low-priority incremental jobs while the event loop has nothing to do.
+ *
+ * Jobs are split into small steps by their owners. The scheduler runs the
+ * most important pending job one step at a time until its time slice is over
+ * or any input arrives, so it never gets in the way of the user.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <SDL.h>
+#include <stdio.h>
+#include "../engine/diagnostics.h"
+#include "idle.h"
+
+// Scheduled jobs.
+idle_job_t idle_jobs[IDLE_MAX_JOBS];
+size_t idle_job_count = 0;
+
+// Internal functions.
+idle_job_t* idle_find(idle_step_t step, void *data);
+idle_job_t* idle_next();
+bool idle_preempted();
+
+
+/**
+ * Schedules a job to be run while idle. If the same job is already scheduled
+ * it just gets reactivated.
+ *
+ * @param  name     Job name for debugging purposes.
+ * @param  priority Job priority.
+ * @param  step     Function that runs a single step of the job.
+ * @param  data     User data to be passed to the step function.
+ * @return          TRUE if the job was scheduled.
+ */
+bool idle_schedule(const char *name, const uint8_t priority,
+				   idle_step_t step, void *data) {
+	idle_job_t *job = idle_find(step, data);
+
+	// Reuse an existing or finished job slot.
+	if (job == NULL) {
+		for (size_t i = 0; i < idle_job_count; i++) {
+			if (!idle_jobs[i].active) {
+				job = &idle_jobs[i];
+				break;
+			}
+		}
+	}
+
+	// Grab a new slot.
+	if (job == NULL) {
+		if (idle_job_count == IDLE_MAX_JOBS) {
+			diag_report(DIAG_WARNING, DIAG_CODE_GENERIC, 0, "Too many idle "
+						"jobs scheduled, ignoring '%s'.", name);
+			return false;
+		}
+
+		job = &idle_jobs[idle_job_count++];
+	}
+
+	if (!job->active || (job->step != step) || (job->data != data)) {
+		job->steps = 0;
+	}
+
+	job->name = name;
+	job->priority = priority;
+	job->step = step;
+	job->data = data;
+	job->active = true;
+
+	return true;
+}
+
+/**
+ * Cancels a scheduled job.
+ *
+ * @param step Step function of the job.
+ * @param data User data of the job.
+ */
+void idle_cancel(idle_step_t step, void *data) {
+	idle_job_t *job = idle_find(step, data);
+
+	if (job != NULL) {
+		job->active = false;
+	}
+}
+
+/**
+ * Cancels all of the scheduled jobs.
+ */
+void idle_clear() {
+	idle_job_count = 0;
+}
+
+/**
+ * Checks if there's any job waiting to be run.
+ *
+ * @return TRUE if there are jobs waiting.
+ */
+bool idle_pending() {
+	return idle_next() != NULL;
+}
+
+/**
+ * Runs the scheduled jobs until the time budget is exhausted, there's nothing
+ * left to do or an event arrives.
+ *
+ * @param  budget_ms Time budget in milliseconds.
+ * @return           Number of steps that were run.
+ */
+size_t idle_run(const uint32_t budget_ms) {
+	uint32_t start = SDL_GetTicks();
+	size_t steps = 0;
+	idle_job_t *job;
+
+	while ((job = idle_next()) != NULL) {
+		// Run a single step of the most important job.
+		job->active = job->step(job->data);
+		job->steps++;
+		steps++;
+
+#ifdef DEBUG
+		if (!job->active) {
+			printf("Idle job '%s' finished after %u steps.\n", job->name,
+				   job->steps);
+		}
+#endif
+
+		// Get out of the way as soon as the user needs us.
+		if (((SDL_GetTicks() - start) >= budget_ms) || idle_preempted()) {
+			break;
+		}
+	}
+
+	return steps;
+}
+
+/**
+ * Finds a scheduled job.
+ *
+ * @param  step Step function of the job.
+ * @param  data User data of the job.
+ * @return      The job or NULL if it isn't scheduled.
+ */
+idle_job_t* idle_find(idle_step_t step, void *data) {
+	for (size_t i = 0; i < idle_job_count; i++) {
+		if (idle_jobs[i].active && (idle_jobs[i].step == step) &&
+				(idle_jobs[i].data == data)) {
+			return &idle_jobs[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Gets the next job to be run. Jobs with the same priority are run in the
+ * order they were scheduled.
+ *
+ * @return Next job to be run or NULL if there's nothing to do.
+ */
+idle_job_t* idle_next() {
+	idle_job_t *next = NULL;
+
+	for (size_t i = 0; i < idle_job_count; i++) {
+		if (idle_jobs[i].active &&
+				((next == NULL) || (idle_jobs[i].priority > next->priority))) {
+			next = &idle_jobs[i];
+		}
+	}
+
+	return next;
+}
+
+/**
+ * Checks if any event arrived and we should stop working.
+ *
+ * @return TRUE if there are events waiting to be handled.
+ */
+bool idle_preempted() {
+	SDL_PumpEvents();
+	return SDL_HasEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+}
@@ -0,0 +1,47 @@
+/**
+ * graphics/idle.h
+ * Runs low-priority incremental jobs while the event loop has nothing to do.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _IDLE_H
+#define _IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Constants.
+#define IDLE_MAX_JOBS  16
+#define IDLE_SLICE_MS  8
+
+// Job priorities.
+#define IDLE_PRIORITY_LOW    0
+#define IDLE_PRIORITY_NORMAL 1
+#define IDLE_PRIORITY_HIGH   2
+
+// Does a small step of a job. Returns TRUE if there's still work to be done.
+typedef bool (*idle_step_t)(void *data);
+
+// Idle job structure.
+typedef struct {
+	const char  *name;
+	uint8_t      priority;
+	idle_step_t  step;
+	void        *data;
+	bool         active;
+	uint32_t     steps;
+} idle_job_t;
+
+// Scheduling.
+bool idle_schedule(const char *name, const uint8_t priority,
+				   idle_step_t step, void *data);
+void idle_cancel(idle_step_t step, void *data);
+void idle_clear();
+bool idle_pending();
+
+// Running.
+size_t idle_run(const uint32_t budget_ms);
+
+#endif
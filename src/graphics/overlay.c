@@ -0,0 +1,197 @@
+/**
+ * graphics/overlay.c
+ * Interactive cursor feedback drawn on top of the cached scene.
+ *
+ * The overlay is drawn every frame straight to the window after the cached
+ * scene is copied, so moving the mouse around never touches the scene itself.
+ * The only thing that depends on the document is the snap search, which goes
+ * to the snap index for the points close to the cursor. Right after the
+ * document changes, and until the index has caught up with it, it goes
+ * through the objects whose bounding boxes are close to the cursor instead.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include "overlay.h"
+
+// Snap search state.
+typedef struct {
+	long    x;
+	long    y;
+	double  best;
+	coord_t point;
+	bool    found;
+} snap_search_t;
+
+// Internal functions.
+bool snap_visitor(const object_span_t *span, void *data);
+
+
+/**
+ * Initializes the overlay state.
+ *
+ * @param overlay Overlay state.
+ */
+void overlay_init(overlay_t *overlay) {
+	overlay->visible = false;
+	overlay->snapped = false;
+	overlay->rubber_band = false;
+	overlay->cursor.x = 0;
+	overlay->cursor.y = 0;
+	overlay->snap = overlay->cursor;
+	overlay->band_start = overlay->cursor;
+}
+
+/**
+ * Moves the cursor and looks for an object endpoint close enough to snap to.
+ *
+ * @param overlay Overlay state.
+ * @param x       Cursor X position in the window.
+ * @param y       Cursor Y position in the window.
+ * @param origin  Current view origin.
+ * @param scale   Current view scale.
+ * @param index   Snap index of the document.
+ */
+void overlay_move(overlay_t *overlay, const int x, const int y,
+				  const coord_t origin, const float scale,
+				  const snap_index_t *index) {
+	object_filter_t filter;
+	snap_search_t search;
+	long radius;
+
+	overlay->visible = true;
+	overlay->cursor.x = x;
+	overlay->cursor.y = y;
+	overlay->snapped = false;
+
+	if (scale <= 0) {
+		return;
+	}
+
+	// Transpose the cursor to world coordinates.
+	radius = (long)(OVERLAY_SNAP_DISTANCE / scale) + 1;
+	search.x = (long)(x / scale) - origin.x;
+	search.y = origin.y - (long)(y / scale);
+	search.best = (double)radius * radius;
+	search.found = false;
+
+	if (!snap_index_is_stale(index)) {
+		// Only look at the points in the cells around the cursor.
+		search.found = snap_index_nearest(index, search.x, search.y, radius,
+										  &search.point);
+	} else {
+		// Only look at the objects around the cursor.
+		nanocad_filter_init(&filter);
+		filter.use_bounds = true;
+		filter.min.x = search.x - radius;
+		filter.min.y = search.y - radius;
+		filter.max.x = search.x + radius;
+		filter.max.y = search.y + radius;
+		nanocad_visit_objects(&filter, snap_visitor, &search);
+	}
+
+	// Transpose the snapping point back to the window.
+	if (search.found) {
+		overlay->snapped = true;
+		overlay->snap.x = (int)((origin.x + search.point.x) * scale);
+		overlay->snap.y = (int)((origin.y - search.point.y) * scale);
+	}
+}
+
+/**
+ * Hides the overlay when the cursor leaves the window.
+ *
+ * @param overlay Overlay state.
+ */
+void overlay_hide(overlay_t *overlay) {
+	overlay->visible = false;
+	overlay->snapped = false;
+}
+
+/**
+ * Starts a rubber band line preview at the current snapping point or cursor.
+ *
+ * @param overlay Overlay state.
+ */
+void overlay_start_band(overlay_t *overlay) {
+	overlay->rubber_band = true;
+	overlay->band_start = (overlay->snapped) ? overlay->snap : overlay->cursor;
+}
+
+/**
+ * Stops the rubber band line preview.
+ *
+ * @param overlay Overlay state.
+ */
+void overlay_stop_band(overlay_t *overlay) {
+	overlay->rubber_band = false;
+}
+
+/**
+ * Draws the overlay on top of whatever is on the current render target.
+ *
+ * @param overlay  Overlay state.
+ * @param renderer Renderer to draw with.
+ */
+void overlay_render(const overlay_t *overlay, SDL_Renderer *renderer) {
+	int width;
+	int height;
+
+	if (!overlay->visible) {
+		return;
+	}
+
+	// Crosshair.
+	SDL_GetRendererOutputSize(renderer, &width, &height);
+	SDL_SetRenderDrawColor(renderer, 110, 120, 130, 255);
+	SDL_RenderDrawLine(renderer, 0, overlay->cursor.y, width - 1,
+					   overlay->cursor.y);
+	SDL_RenderDrawLine(renderer, overlay->cursor.x, 0, overlay->cursor.x,
+					   height - 1);
+
+	// Rubber band line preview.
+	if (overlay->rubber_band) {
+		const SDL_Point *end = (overlay->snapped) ? &overlay->snap :
+			&overlay->cursor;
+
+		SDL_SetRenderDrawColor(renderer, 80, 200, 230, 255);
+		SDL_RenderDrawLine(renderer, overlay->band_start.x,
+						   overlay->band_start.y, end->x, end->y);
+	}
+
+	// Snap marker.
+	if (overlay->snapped) {
+		SDL_Rect marker = { overlay->snap.x - OVERLAY_SNAP_SIZE,
+							overlay->snap.y - OVERLAY_SNAP_SIZE,
+							(OVERLAY_SNAP_SIZE * 2) + 1,
+							(OVERLAY_SNAP_SIZE * 2) + 1 };
+
+		SDL_SetRenderDrawColor(renderer, 240, 200, 60, 255);
+		SDL_RenderDrawRect(renderer, &marker);
+	}
+}
+
+/**
+ * Checks the endpoints of an object for the closest one to the cursor.
+ *
+ * @param  span Object being checked.
+ * @param  data Snap search state.
+ * @return      Always TRUE to keep looking.
+ */
+bool snap_visitor(const object_span_t *span, void *data) {
+	snap_search_t *search = (snap_search_t *)data;
+
+	for (uint8_t i = 0; i < span->coord_count; i++) {
+		double dx = (double)(span->coord[i].x - search->x);
+		double dy = (double)(span->coord[i].y - search->y);
+		double dist = (dx * dx) + (dy * dy);
+
+		if (dist <= search->best) {
+			search->best = dist;
+			search->point = span->coord[i];
+			search->found = true;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,44 @@
+/**
+ * graphics/overlay.h
+ * Interactive cursor feedback drawn on top of the cached scene.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _OVERLAY_H
+#define _OVERLAY_H
+
+#include <SDL.h>
+#include <stdbool.h>
+#include "../engine/nanocad.h"
+#include "snap_index.h"
+
+// Constants.
+#define OVERLAY_SNAP_DISTANCE 8  // Pixels.
+#define OVERLAY_SNAP_SIZE     5
+
+// Overlay state. Everything is in window pixels.
+typedef struct {
+	bool      visible;
+	SDL_Point cursor;
+	bool      snapped;
+	SDL_Point snap;
+	bool      rubber_band;
+	SDL_Point band_start;
+} overlay_t;
+
+// Initialization.
+void overlay_init(overlay_t *overlay);
+
+// Interaction.
+void overlay_move(overlay_t *overlay, const int x, const int y,
+				  const coord_t origin, const float scale,
+				  const snap_index_t *index);
+void overlay_hide(overlay_t *overlay);
+void overlay_start_band(overlay_t *overlay);
+void overlay_stop_band(overlay_t *overlay);
+
+// Rendering.
+void overlay_render(const overlay_t *overlay, SDL_Renderer *renderer);
+
+#endif
@@ -0,0 +1,418 @@
+/**
+ * graphics/pyramid.c
+ * Multi-resolution simplified versions of the display list polylines.
+ *
+ * Every vertex of every polyline gets a significance from a Douglas-Peucker
+ * pass, which is the largest tolerance that would still keep it, clamped so
+ * that it never exceeds the one of the vertex that split its range. Dropping
+ * every vertex at or below a tolerance gives the same result as running the
+ * whole algorithm with it, so each level is a single filtering pass.
+ *
+ * Levels have tolerances that double at each step, and a level is only kept
+ * if it has at most half of the vertices of the previous one, so the whole
+ * pyramid never takes more memory than the polylines themselves. It's built
+ * a few steps at a time while the application is idle, and until it's done
+ * the polylines are drawn at full detail. If the cache manager takes the
+ * levels away they're only built again once the document changes, and until
+ * then the polylines are drawn at full detail as well.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "pyramid.h"
+
+// Internal functions.
+void reset_pyramid(polyline_pyramid_t *pyr, const display_list_t *dl);
+void simplify_run(polyline_pyramid_t *pyr, const dl_polylines_t *lines,
+				  const dl_run_t *run);
+bool build_level(polyline_pyramid_t *pyr, const dl_polylines_t *lines,
+				 const float tolerance);
+double segment_distance(const int32_t px, const int32_t py, const int32_t ax,
+						const int32_t ay, const int32_t bx, const int32_t by);
+void free_level(pyramid_level_t *level);
+bool pyramid_victim(void *data, cachemgr_victim_t *victim);
+void pyramid_evict(void *data);
+
+
+/**
+ * Initializes an empty polyline pyramid.
+ *
+ * @param pyr Pyramid to be initialized.
+ */
+void pyramid_init(polyline_pyramid_t *pyr) {
+	memset(pyr, 0, sizeof(polyline_pyramid_t));
+	pyr->complete = false;
+	pyr->cache_id = cachemgr_register("pyramid", pyr, pyramid_victim,
+									  pyramid_evict);
+}
+
+/**
+ * Frees everything allocated by a polyline pyramid.
+ *
+ * @param pyr Pyramid to be freed.
+ */
+void pyramid_free(polyline_pyramid_t *pyr) {
+	for (size_t i = 0; i < pyr->level_count; i++) {
+		free_level(&pyr->levels[i]);
+	}
+
+	free(pyr->significance);
+	free(pyr->stack);
+	cachemgr_unregister(pyr->cache_id);
+	memset(pyr, 0, sizeof(polyline_pyramid_t));
+	pyr->complete = false;
+	pyr->cache_id = -1;
+}
+
+/**
+ * Checks if the pyramid still has to be (re)built for a display list.
+ *
+ * @param  pyr Polyline pyramid.
+ * @param  dl  Display list it's built from.
+ * @return     TRUE if there's work to be done.
+ */
+bool pyramid_is_stale(const polyline_pyramid_t *pyr,
+					  const display_list_t *dl) {
+	if (!dl->valid || (dl->polylines.vertex_count < PYRAMID_MIN_VERTICES)) {
+		return false;
+	}
+
+	return !pyr->complete || (pyr->revision != dl->revision);
+}
+
+/**
+ * Does a small step of building the pyramid.
+ *
+ * @param  pyr Polyline pyramid.
+ * @param  dl  Display list to build it from.
+ * @return     TRUE if there's still work to be done.
+ */
+bool pyramid_step(polyline_pyramid_t *pyr, const display_list_t *dl) {
+	const dl_polylines_t *lines = &dl->polylines;
+	size_t processed = 0;
+
+	if (!pyramid_is_stale(pyr, dl)) {
+		return false;
+	}
+	uint64_t start = cachemgr_now_us();
+
+	// Start over if the display list was rebuilt.
+	if (pyr->revision != dl->revision) {
+		reset_pyramid(pyr, dl);
+	}
+
+	// Calculate the significance of the vertices a few polylines at a time.
+	while ((pyr->next_run < lines->run_count) &&
+		   (processed < PYRAMID_STEP_VERTICES)) {
+		const dl_run_t *run = &lines->runs[pyr->next_run++];
+
+		simplify_run(pyr, lines, run);
+		processed += run->count;
+	}
+
+	if (pyr->next_run < lines->run_count) {
+		pyr->cost += cachemgr_now_us() - start;
+		return true;
+	}
+
+	// Build a single level per step.
+	if (pyr->next_level < PYRAMID_MAX_LEVELS) {
+		float tolerance = (float)(1 << pyr->next_level++);
+		if (build_level(pyr, lines, tolerance)) {
+			pyr->cost += cachemgr_now_us() - start;
+			return true;
+		}
+	}
+
+	// We're done. The significances aren't needed anymore.
+	free(pyr->significance);
+	free(pyr->stack);
+	pyr->significance = NULL;
+	pyr->sig_capacity = 0;
+	pyr->stack = NULL;
+	pyr->stack_capacity = 0;
+	pyr->complete = true;
+	pyr->used = cachemgr_tick();
+	pyr->cost += cachemgr_now_us() - start;
+	cachemgr_resize(pyr->cache_id, pyr->bytes, pyr->level_count);
+
+	return false;
+}
+
+/**
+ * Picks the coarsest version of the polylines whose error is below a pixel.
+ *
+ * @param  pyr   Polyline pyramid.
+ * @param  dl    Display list it was built from.
+ * @param  scale Rendering scale in pixels per document unit.
+ * @return       Polylines to be rendered.
+ */
+const dl_polylines_t* pyramid_select(polyline_pyramid_t *pyr,
+									 const display_list_t *dl,
+									 const float scale) {
+	const dl_polylines_t *lines = &dl->polylines;
+
+	// Small drawings never get a pyramid, so they can't miss it.
+	if (lines->vertex_count < PYRAMID_MIN_VERTICES) {
+		return lines;
+	}
+
+	// Only use levels that are complete and up to date.
+	if (!pyr->complete || (pyr->revision != dl->revision) || pyr->evicted) {
+		cachemgr_miss(pyr->cache_id);
+		return lines;
+	}
+	pyr->used = cachemgr_tick();
+	cachemgr_hit(pyr->cache_id);
+
+	for (size_t i = 0; i < pyr->level_count; i++) {
+		if ((pyr->levels[i].tolerance * scale) > 1.0f) {
+			break;
+		}
+
+		lines = &pyr->levels[i].lines;
+	}
+
+	return lines;
+}
+
+/**
+ * Throws away the current pyramid and gets ready to build a new one.
+ *
+ * @param pyr Polyline pyramid.
+ * @param dl  Display list to build it from.
+ */
+void reset_pyramid(polyline_pyramid_t *pyr, const display_list_t *dl) {
+	for (size_t i = 0; i < pyr->level_count; i++) {
+		free_level(&pyr->levels[i]);
+	}
+
+	pyr->revision = dl->revision;
+	pyr->complete = false;
+	pyr->evicted = false;
+	pyr->next_run = 0;
+	pyr->next_level = 0;
+	pyr->level_count = 0;
+	pyr->bytes = 0;
+	pyr->cost = 0;
+	cachemgr_resize(pyr->cache_id, 0, 0);
+
+	if (pyr->sig_capacity < dl->polylines.vertex_count) {
+		pyr->sig_capacity = dl->polylines.vertex_count;
+		pyr->significance = realloc(pyr->significance,
+									sizeof(float) * pyr->sig_capacity);
+	}
+}
+
+/**
+ * Calculates the significance of each vertex of a polyline.
+ *
+ * @param pyr   Polyline pyramid.
+ * @param lines Polylines.
+ * @param run   Polyline to be simplified.
+ */
+void simplify_run(polyline_pyramid_t *pyr, const dl_polylines_t *lines,
+				  const dl_run_t *run) {
+	const int32_t *x = lines->x;
+	const int32_t *y = lines->y;
+	float *sig = pyr->significance;
+	size_t first = run->start;
+	size_t last = run->start + run->count - 1;
+	size_t depth = 0;
+
+	// Endpoints are always kept.
+	sig[first] = FLT_MAX;
+	sig[last] = FLT_MAX;
+	if (run->count < 3) {
+		return;
+	}
+
+	// Each stack frame is a range to be split.
+	if (pyr->stack_capacity < (run->count * 2)) {
+		pyr->stack_capacity = run->count * 2;
+		pyr->stack = realloc(pyr->stack, sizeof(size_t) * pyr->stack_capacity);
+	}
+	pyr->stack[depth++] = first;
+	pyr->stack[depth++] = last;
+
+	while (depth > 0) {
+		size_t b = pyr->stack[--depth];
+		size_t a = pyr->stack[--depth];
+		size_t split = a;
+		double max_dist = -1;
+
+		// Find the vertex furthest away from the range's chord.
+		for (size_t i = a + 1; i < b; i++) {
+			double dist = segment_distance(x[i], y[i], x[a], y[a], x[b], y[b]);
+			if (dist > max_dist) {
+				max_dist = dist;
+				split = i;
+			}
+		}
+
+		if (split == a) {
+			continue;
+		}
+
+		// Never more significant than the vertices that split this range.
+		float limit = (sig[a] < sig[b]) ? sig[a] : sig[b];
+		sig[split] = ((float)max_dist < limit) ? (float)max_dist : limit;
+
+		if ((split - a) > 1) {
+			pyr->stack[depth++] = a;
+			pyr->stack[depth++] = split;
+		}
+
+		if ((b - split) > 1) {
+			pyr->stack[depth++] = split;
+			pyr->stack[depth++] = b;
+		}
+	}
+}
+
+/**
+ * Builds a level of the pyramid with every vertex more significant than a
+ * tolerance. The level is only kept if it's at most half the size of the
+ * previous one.
+ *
+ * @param  pyr       Polyline pyramid.
+ * @param  lines     Full detail polylines.
+ * @param  tolerance Maximum error in document units.
+ * @return           FALSE if there's no point in building any more levels.
+ */
+bool build_level(polyline_pyramid_t *pyr, const dl_polylines_t *lines,
+				 const float tolerance) {
+	const float *sig = pyr->significance;
+	size_t previous = (pyr->level_count > 0) ?
+		pyr->levels[pyr->level_count - 1].lines.vertex_count :
+		lines->vertex_count;
+	size_t count = 0;
+
+	// Count the vertices that survive.
+	for (size_t i = 0; i < lines->vertex_count; i++) {
+		count += (sig[i] > tolerance);
+	}
+
+	// Every polyline is down to its endpoints, nothing else to simplify.
+	if (count <= (lines->run_count * 2)) {
+		return false;
+	}
+
+	// Not enough of a reduction to be worth the memory.
+	if (count > (previous / 2)) {
+		return true;
+	}
+
+	// Copy the surviving vertices over.
+	pyramid_level_t *level = &pyr->levels[pyr->level_count++];
+	level->tolerance = tolerance;
+	level->lines.capacity = count;
+	level->lines.vertex_count = count;
+	level->lines.x = malloc(sizeof(int32_t) * count);
+	level->lines.y = malloc(sizeof(int32_t) * count);
+	level->lines.run_count = lines->run_count;
+	level->lines.runs = malloc(sizeof(dl_run_t) * lines->run_count);
+	pyr->bytes += (sizeof(int32_t) * 2 * count) +
+		(sizeof(dl_run_t) * lines->run_count);
+
+	size_t v = 0;
+	for (size_t r = 0; r < lines->run_count; r++) {
+		const dl_run_t *run = &lines->runs[r];
+		dl_run_t *out = &level->lines.runs[r];
+
+		out->layer_num = run->layer_num;
+		out->start = v;
+		for (size_t i = run->start; i < (run->start + run->count); i++) {
+			if (sig[i] > tolerance) {
+				level->lines.x[v] = lines->x[i];
+				level->lines.y[v] = lines->y[i];
+				v++;
+			}
+		}
+		out->count = v - out->start;
+	}
+
+	return true;
+}
+
+/**
+ * Calculates the distance between a point and a line segment.
+ *
+ * @param  px Point X.
+ * @param  py Point Y.
+ * @param  ax Segment start X.
+ * @param  ay Segment start Y.
+ * @param  bx Segment end X.
+ * @param  by Segment end Y.
+ * @return    Distance between them.
+ */
+double segment_distance(const int32_t px, const int32_t py, const int32_t ax,
+						const int32_t ay, const int32_t bx, const int32_t by) {
+	double dx = (double)bx - ax;
+	double dy = (double)by - ay;
+	double len = (dx * dx) + (dy * dy);
+	double t = 0;
+
+	// Project the point onto the segment.
+	if (len > 0) {
+		t = ((((double)px - ax) * dx) + (((double)py - ay) * dy)) / len;
+		t = (t < 0) ? 0 : ((t > 1) ? 1 : t);
+	}
+
+	return hypot((double)px - (ax + (t * dx)), (double)py - (ay + (t * dy)));
+}
+
+/**
+ * Frees a level of the pyramid.
+ *
+ * @param level Level to be freed.
+ */
+void free_level(pyramid_level_t *level) {
+	free(level->lines.x);
+	free(level->lines.y);
+	free(level->lines.runs);
+	memset(level, 0, sizeof(pyramid_level_t));
+}
+
+/**
+ * Offers the whole pyramid to the cache manager once it's built.
+ *
+ * @param  data   Polyline pyramid.
+ * @param  victim Where to put the details of the pyramid.
+ * @return        FALSE if there's nothing to give up.
+ */
+bool pyramid_victim(void *data, cachemgr_victim_t *victim) {
+	polyline_pyramid_t *pyr = (polyline_pyramid_t *)data;
+	if (!pyr->complete || (pyr->bytes == 0)) {
+		return false;
+	}
+
+	victim->bytes = pyr->bytes;
+	victim->used = pyr->used;
+	victim->cost = pyr->cost;
+
+	return true;
+}
+
+/**
+ * Throws away every level of the pyramid for the cache manager. It stays
+ * complete so that it's only built again when the document changes.
+ *
+ * @param data Polyline pyramid.
+ */
+void pyramid_evict(void *data) {
+	polyline_pyramid_t *pyr = (polyline_pyramid_t *)data;
+
+	for (size_t i = 0; i < pyr->level_count; i++) {
+		free_level(&pyr->levels[i]);
+	}
+
+	pyr->level_count = 0;
+	pyr->bytes = 0;
+	pyr->evicted = true;
+	cachemgr_resize(pyr->cache_id, 0, 0);
+	cachemgr_evicted(pyr->cache_id);
+}
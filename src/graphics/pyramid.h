@@ -0,0 +1,61 @@
+/**
+ * graphics/pyramid.h
+ * Multi-resolution simplified versions of the display list polylines.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _PYRAMID_H
+#define _PYRAMID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "display_list.h"
+#include "../engine/cachemgr.h"
+
+// Constants.
+#define PYRAMID_MAX_LEVELS    12
+#define PYRAMID_MIN_VERTICES  1024   // Not worth simplifying anything smaller.
+#define PYRAMID_STEP_VERTICES 65536  // Vertices to process per step.
+
+// Simplified version of the polylines.
+typedef struct {
+	float          tolerance;  // Maximum error in document units.
+	dl_polylines_t lines;
+} pyramid_level_t;
+
+// Polyline pyramid.
+typedef struct {
+	uint32_t        revision;
+	bool            complete;
+	size_t          next_run;
+	size_t          next_level;
+	float          *significance;
+	size_t          sig_capacity;
+	size_t         *stack;
+	size_t          stack_capacity;
+	size_t          level_count;
+	pyramid_level_t levels[PYRAMID_MAX_LEVELS];
+	bool            evicted;  // Levels were given up to the cache manager.
+	size_t          bytes;
+	uint64_t        used;     // Cache manager tick.
+	uint64_t        cost;     // Microseconds it took to build.
+	int             cache_id;
+} polyline_pyramid_t;
+
+// Initialization and destruction.
+void pyramid_init(polyline_pyramid_t *pyr);
+void pyramid_free(polyline_pyramid_t *pyr);
+
+// Building.
+bool pyramid_is_stale(const polyline_pyramid_t *pyr,
+					  const display_list_t *dl);
+bool pyramid_step(polyline_pyramid_t *pyr, const display_list_t *dl);
+
+// Level selection.
+const dl_polylines_t* pyramid_select(polyline_pyramid_t *pyr,
+									 const display_list_t *dl,
+									 const float scale);
+
+#endif
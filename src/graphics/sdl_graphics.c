@@ -10,36 +10,100 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <limits.h>
 #include "../engine/nanocad.h"
+#include "../engine/diagnostics.h"
+#include "../engine/cachemgr.h"
+#include "../engine/doccache.h"
 #include "osifont.h"
 #include "sdl_graphics.h"
+#include "display_list.h"
+#include "idle.h"
+#include "damage.h"
+#include "overlay.h"
+#include "text_cache.h"
+#include "pyramid.h"
 
 // Constants
-#define ZOOM_INTENSITY 10
-#define FONT_SIZE      20
+#define ZOOM_INTENSITY      10
+#define MAX_VIEWPORTS       4
+#define DAMAGE_PADDING      2
+#define DAMAGE_TEXT_PADDING ((DIMENSION_TEXT_MAX_SIZE * FONT_SIZE) / 2)
 
 // SDL context.
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
-TTF_Font *font = NULL;
+text_cache_t text_cache;
 const uint8_t *keystates;
 bool running = false;
-coord_t origin;
-int zoom_level = 100;
+float pixel_scale = 1.0f;
+float render_scale = 1.0f;
+display_list_t display_list;
+polyline_pyramid_t pyramid;
+SDL_Point *point_buffer = NULL;
+size_t point_buffer_size = 0;
+
+// View of the document in a pane of the window, with its own cached frame.
+typedef struct {
+	SDL_Rect     rect;  // Area of the window it occupies.
+	coord_t      origin;
+	int          zoom_level;
+	SDL_Texture *texture;
+	bool         dirty;
+	damage_t     damage;
+} viewport_t;
+
+// Viewports.
+viewport_t viewports[MAX_VIEWPORTS];
+size_t viewport_count = 0;
+viewport_t *view = NULL;         // Viewport being rendered.
+viewport_t *active_view = NULL;  // Viewport that gets the input.
+uint32_t scene_revision = 0;
+bool window_visible = true;
+
+// Partial redraws.
+SDL_Rect render_clip;
+bool render_clipped = false;
+
+// Interactive overlay.
+overlay_t overlay;
+snap_index_t snap_index;
 
 // Internal functions.
 bool is_key_down(const SDL_Scancode key);
-void set_origin(const int x, const int y);
-void reset_origin();
-void zoom(const int percentage);
+void set_origin(viewport_t *vp, const int x, const int y);
+void reset_origin(viewport_t *vp);
+void zoom(viewport_t *vp, const int percentage);
+viewport_t* add_viewport(const viewport_t *base);
+void layout_viewports();
+void toggle_split();
+viewport_t* viewport_at(const int x, const int y);
+void invalidate_viewports();
+layer_t* set_layer_color(const uint8_t layer_num);
+SDL_Point* get_point_buffer(const size_t count);
 int draw_text(const char *text, const coord_t pos, const double angle,
 			  const uint8_t layer_num);
-int draw_line(const coord_t start, const coord_t end, const uint8_t layer_num);
-int draw_dimension(const coord_t start, const coord_t end,
-				   const coord_t line_start, const coord_t line_end,
-				   const uint8_t layer_num);
+int render_segments(const dl_segments_t *segs);
+int render_polylines(const dl_polylines_t *lines);
+int render_texts(const dl_texts_t *texts);
 void graphics_render();
+void graphics_present();
+bool render_scene(viewport_t *vp);
+void render_direct(viewport_t *vp, const SDL_Rect *area);
+void destroy_scene_texture(viewport_t *vp);
+void update_pixel_scale();
+float view_scale(const viewport_t *vp);
+void collect_document_damage();
+bool get_scene_rect(const viewport_t *vp, SDL_Rect *rect);
+bool is_clipped_out(const int x1, const int y1, const int x2, const int y2,
+					const int pad);
+void handle_window_event(const SDL_WindowEvent *event);
 void graphics_eventloop();
+bool graphics_wait_event(SDL_Event *event);
+bool idle_drain_diagnostics(void *data);
+bool idle_update_display_list(void *data);
+bool idle_build_pyramid(void *data);
+bool idle_build_snap_index(void *data);
 
 
 /**
@@ -69,7 +133,8 @@ bool graphics_init(const int width, const int height) {
 	// Create a window.
 	window = SDL_CreateWindow("nanoCAD", SDL_WINDOWPOS_CENTERED, 
 							  SDL_WINDOWPOS_CENTERED, width, height,
-							  SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
+							  SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN |
+							  SDL_WINDOW_ALLOW_HIGHDPI);
 
 	// Create the renderer.
 	if (window != 0) {
@@ -79,10 +144,9 @@ bool graphics_init(const int width, const int height) {
 		return false;
 	}
 		
-	// Create the font object.
-	font = TTF_OpenFontRW(SDL_RWFromConstMem(osifont_ttf, osifont_ttf_length),
-						  1, FONT_SIZE);
-	if (font == NULL) {
+	// Create the text cache with our font.
+	if (!text_cache_init(&text_cache, renderer, osifont_ttf,
+						 osifont_ttf_length)) {
 		printf("Failed to load the embedded font. SDL_ttf Error: %s\n",
 			   TTF_GetError());
 		return false;
@@ -90,7 +154,20 @@ bool graphics_init(const int width, const int height) {
 
 	// Initialize variables.
 	running = true;
-	reset_origin();
+	display_list_init(&display_list);
+	pyramid_init(&pyramid);
+	overlay_init(&overlay);
+	snap_index_init(&snap_index);
+	update_pixel_scale();
+	window_visible = !(SDL_GetWindowFlags(window) &
+					   (SDL_WINDOW_HIDDEN | SDL_WINDOW_MINIMIZED));
+
+	// Start with a single view of the document.
+	viewport_count = 0;
+	active_view = add_viewport(NULL);
+	view = active_view;
+	layout_viewports();
+	reset_origin(active_view);
 
 	return true;
 }
@@ -101,9 +178,21 @@ bool graphics_init(const int width, const int height) {
 void graphics_clean() {
 	running = false;
 	
-	// Free our font.
-	TTF_CloseFont(font);
-	font = NULL;
+	// Free our font and text.
+	text_cache_free(&text_cache);
+
+	// Free the display list and our scratch buffers.
+	idle_clear();
+	for (size_t i = 0; i < viewport_count; i++) {
+		destroy_scene_texture(&viewports[i]);
+	}
+	viewport_count = 0;
+	pyramid_free(&pyramid);
+	display_list_free(&display_list);
+	snap_index_free(&snap_index);
+	free(point_buffer);
+	point_buffer = NULL;
+	point_buffer_size = 0;
 
 	// Destroy window.
 	SDL_DestroyWindow(window);
@@ -120,77 +209,191 @@ void graphics_clean() {
  * Render the CAD graphics on screen.
  */
 void graphics_render() {
-	object_container objects;
-	dimension_container dimensions;
+	// Make sure our display list is up to date with the document.
+	display_list_update(&display_list);
+
+	// Render each type of primitive with its own kernel.
+	if (render_segments(&display_list.segments) < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0,
+					"Error rendering segments: %s", SDL_GetError());
+	}
+
+	// Polylines are simplified as much as we can get away with at this scale.
+	if (render_polylines(pyramid_select(&pyramid, &display_list,
+										render_scale)) < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0,
+					"Error rendering polylines: %s", SDL_GetError());
+	}
+
+	if (render_texts(&display_list.texts) < 0) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0,
+					"Error rendering text: %s", SDL_GetError());
+	}
+}
+
+/**
+ * Renders a batch of segments sorted by layer.
+ *
+ * @param  segs Segment batch from the display list.
+ * @return      Negative number if there was an error.
+ */
+int render_segments(const dl_segments_t *segs) {
 	int ret = 0;
-	
-	// Get the containers from the engine.
-	nanocad_get_object_container(&objects);
-	nanocad_get_dimension_container(&dimensions);
-
-	// Loop through each object and render it.
-	ret = 0;
-	for (size_t i = 0; i < objects.count; i++) {
-		object_t obj = objects.list[i];
-		
-		// Do something different according to each type of object.
-		switch (obj.type) {
-		case TYPE_LINE:
-			ret = draw_line(obj.coord[0], obj.coord[1], obj.layer_num);
-			break;
-		default:
-			printf("Invalid object type.\n");
-			exit(EXIT_FAILURE);
+
+	for (size_t r = 0; r < segs->run_count; r++) {
+		const dl_run_t *run = &segs->runs[r];
+		const int32_t *x1 = segs->x1 + run->start;
+		const int32_t *y1 = segs->y1 + run->start;
+		const int32_t *x2 = segs->x2 + run->start;
+		const int32_t *y2 = segs->y2 + run->start;
+		const int ox = (int)view->origin.x;
+		const int oy = (int)view->origin.y;
+		SDL_Point *points = get_point_buffer(run->count * 2);
+		size_t count = 0;
+
+		// Transpose the whole run to our own origin, leaving out anything
+		// that's outside of the area being redrawn.
+		for (size_t i = 0; i < run->count; i++) {
+			SDL_Point *pt = &points[count * 2];
+			pt[0].x = ox + x1[i];
+			pt[0].y = oy - y1[i];
+			pt[1].x = ox + x2[i];
+			pt[1].y = oy - y2[i];
+
+			if (!is_clipped_out((pt[0].x < pt[1].x) ? pt[0].x : pt[1].x,
+								(pt[0].y < pt[1].y) ? pt[0].y : pt[1].y,
+								(pt[0].x > pt[1].x) ? pt[0].x : pt[1].x,
+								(pt[0].y > pt[1].y) ? pt[0].y : pt[1].y,
+								DAMAGE_PADDING)) {
+				count++;
+			}
 		}
 
-		// Report any errors if there were any.
-		if (ret < 0) {
-			printf("Error rendering line: %s\n", SDL_GetError());
+		if (count == 0) {
+			continue;
+		}
+
+		// Draw the run.
+		set_layer_color(run->layer_num);
+		for (size_t i = 0; i < count; i++) {
+			ret |= SDL_RenderDrawLine(renderer, points[i * 2].x,
+									  points[i * 2].y, points[(i * 2) + 1].x,
+									  points[(i * 2) + 1].y);
 		}
 	}
-	
-	// Loop through each dimension and render it.
-	ret = 0;
-	for (size_t i = 0; i < dimensions.count; i++) {
-		dimension_t dimen = dimensions.list[i];
-		
-		// Draw the dimension.
-		ret = draw_dimension(dimen.start, dimen.end,
-							 dimen.line_start, dimen.line_end, dimen.layer_num);
-		
-		// Report any errors if there were any.
-		if (ret < 0) {
-			printf("Error rendering line: %s\n", SDL_GetError());
+
+	return ret;
+}
+
+/**
+ * Renders a batch of polylines sorted by layer.
+ *
+ * @param  lines Polyline batch from the display list.
+ * @return       Negative number if there was an error.
+ */
+int render_polylines(const dl_polylines_t *lines) {
+	int ret = 0;
+	int last_layer = -1;
+
+	for (size_t r = 0; r < lines->run_count; r++) {
+		const dl_run_t *run = &lines->runs[r];
+		const int32_t *x = lines->x + run->start;
+		const int32_t *y = lines->y + run->start;
+		const int ox = (int)view->origin.x;
+		const int oy = (int)view->origin.y;
+		SDL_Point *points = get_point_buffer(run->count);
+		SDL_Point min = { INT_MAX, INT_MAX };
+		SDL_Point max = { INT_MIN, INT_MIN };
+
+		// Transpose the whole polyline to our own origin.
+		for (size_t i = 0; i < run->count; i++) {
+			points[i].x = ox + x[i];
+			points[i].y = oy - y[i];
+
+			min.x = (points[i].x < min.x) ? points[i].x : min.x;
+			min.y = (points[i].y < min.y) ? points[i].y : min.y;
+			max.x = (points[i].x > max.x) ? points[i].x : max.x;
+			max.y = (points[i].y > max.y) ? points[i].y : max.y;
+		}
+
+		// Skip it if it's outside of the area being redrawn.
+		if (is_clipped_out(min.x, min.y, max.x, max.y, DAMAGE_PADDING)) {
+			continue;
 		}
+
+		// Only change colors when we switch layers.
+		if (run->layer_num != last_layer) {
+			set_layer_color(run->layer_num);
+			last_layer = run->layer_num;
+		}
+
+		// Draw the whole polyline in one go.
+		ret |= SDL_RenderDrawLines(renderer, points, (int)run->count);
 	}
+
+	return ret;
 }
 
 /**
- * Draws a line between two points.
+ * Renders a batch of text items.
  *
- * @param  start     Starting point for a line.
- * @param  end       Ending point.
- * @param  layer_num Layer number where the line should be rendered.
- * @return           SDL_RenderDrawLine return value.
+ * @param  texts Text batch from the display list.
+ * @return       Negative number if there was an error.
  */
-int draw_line(const coord_t start, const coord_t end, const uint8_t layer_num) {
-	// Transpose the coordinates to our own origin.
-	int x1 = origin.x + start.x;
-	int y1 = origin.y - start.y;
-	int x2 = origin.x + end.x;
-	int y2 = origin.y - end.y;
-	
-	// Get the line's layer.
+int render_texts(const dl_texts_t *texts) {
+	int ret = 0;
+
+	for (size_t i = 0; i < texts->count; i++) {
+		const dl_text_t *text = &texts->list[i];
+		const int x = (int)(view->origin.x + text->pos.x);
+		const int y = (int)(view->origin.y - text->pos.y);
+
+		// Skip it if it's outside of the area being redrawn.
+		if (is_clipped_out(x, y, x, y, DAMAGE_TEXT_PADDING)) {
+			continue;
+		}
+
+		ret |= draw_text(text->text, text->pos, text->angle, text->layer_num);
+	}
+
+	return ret;
+}
+
+/**
+ * Sets the renderer draw color to the one of a layer.
+ *
+ * @param  layer_num Layer number.
+ * @return           The layer that was used, falling back to the 0 layer if
+ *                   the requested one doesn't exist.
+ */
+layer_t* set_layer_color(const uint8_t layer_num) {
+	// Get the layer.
 	layer_t *layer = nanocad_get_layer(layer_num);
 	if (layer == NULL) {
-		printf("Warning: Invalid layer '%d' to be rendered, falling back to "
-			   "layer 0.\n", layer_num);
+		diag_report(DIAG_WARNING, DIAG_CODE_LAYER, layer_num, "Invalid layer "
+					"'%d' to be rendered, falling back to layer 0.", layer_num);
 		layer = nanocad_get_layer(0);
 	}
-	
+
 	SDL_SetRenderDrawColor(renderer, layer->color.r, layer->color.g,
 						   layer->color.b, layer->color.alpha);
-	return SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+	return layer;
+}
+
+/**
+ * Gets a scratch buffer of points big enough for a run.
+ *
+ * @param  count Number of points needed.
+ * @return       Scratch point buffer.
+ */
+SDL_Point* get_point_buffer(const size_t count) {
+	if (count > point_buffer_size) {
+		point_buffer_size = (count < 1024) ? 1024 : count;
+		point_buffer = realloc(point_buffer,
+							   sizeof(SDL_Point) * point_buffer_size);
+	}
+
+	return point_buffer;
 }
 
 /**
@@ -208,31 +411,31 @@ int draw_text(const char *text, const coord_t pos, const double angle,
 	int ret = 0;
 	
 	// Transpose the coordinates to our own origin.
-	int x1 = origin.x + pos.x;
-	int y1 = origin.y - pos.y;
+	int x1 = view->origin.x + pos.x;
+	int y1 = view->origin.y - pos.y;
 	
 	// Get the line's layer.
 	layer_t *layer = nanocad_get_layer(layer_num);
 	if (layer == NULL) {
-		printf("Warning: Invalid layer '%d' to be rendered, falling back to "
-			   "layer 0.\n", layer_num);
+		diag_report(DIAG_WARNING, DIAG_CODE_LAYER, layer_num, "Invalid layer "
+					"'%d' to be rendered, falling back to layer 0.", layer_num);
 		layer = nanocad_get_layer(0);
 	}
 	
-	// Create the text's surface.
+	// Get the text rasterized at the size it'll have on screen.
 	SDL_Color color = { layer->color.r, layer->color.g, layer->color.b,
 						layer->color.alpha };
-	SDL_Surface *surface = TTF_RenderText_Solid(font, text, color);
+	text_entry_t *entry = text_cache_get(&text_cache, text, color,
+										 text_pixel_size(render_scale));
+	if (entry == NULL) {
+		return -1;
+	}
+
+	// Create text area rectangle, bringing it back to our own scale.
+	float scale = (float)text_pixel_size(render_scale) / FONT_SIZE;
+	int width = (int)lroundf(entry->width / scale);
+	int height = (int)lroundf(entry->height / scale);
 
-	// Create a texture for the text.
-	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-	
-	// Get the text dimensions and free the surface.
-	int width = surface->w;
-	int height = surface->h;
-    SDL_FreeSurface(surface);
-	
-	// Create text area rectangle.
 	SDL_Rect rect;
 	rect.x = x1 - (width / 2);
 	rect.y = y1 - (height / 2);
@@ -240,216 +443,8 @@ int draw_text(const char *text, const coord_t pos, const double angle,
 	rect.h = height;
 	
 	// Copy the texture to the renderer.
-	ret = SDL_RenderCopyEx(renderer, texture, NULL, &rect, angle, NULL,
+	ret = SDL_RenderCopyEx(renderer, entry->texture, NULL, &rect, angle, NULL,
 						   SDL_FLIP_NONE);
-	if (ret < 0) {
-		return ret;
-	}
-	
-	// Destroy the temporary texture.
-	SDL_DestroyTexture(texture);
-	
-	return ret;
-}
-
-/**
- * Draws a dimension between two points.
- *
- * @param  start      Starting point for the measurement.
- * @param  end        Ending point for the measurement.
- * @param  line_start Starting point for the dimension line.
- * @param  line_end   Ending point for the dimension line.
- * @param  layer_num  Layer number where the line should be rendered.
- * @return            SDL_RenderDrawLine return value.
- */
-int draw_dimension(const coord_t start, const coord_t end,
-				   const coord_t line_start, const coord_t line_end,
-				   const uint8_t layer_num) {
-	int ret = 0;
-	int pin_offset = 10;
-
-	// Transpose the coordinates to our own origin.
-	int x1 = origin.x + line_start.x;
-	int y1 = origin.y - line_start.y;
-	int x2 = origin.x + line_end.x;
-	int y2 = origin.y - line_end.y;
-	int sx = origin.x + start.x;
-	int sy = origin.y - start.y;
-	int ex = origin.x + end.x;
-	int ey = origin.y - end.y;
-	
-	// Make sure all dimension lines are going from left to right.
-	if (x1 > x2) {
-		int xt = x1;
-		int yt = y1;
-		x1 = x2;
-		y1 = y2;
-		x2 = xt;
-		y2 = yt;
-	}
-	
-	// Make sure all measured lines are going from left to right.
-	if (sx > ex) {
-		int xt = sx;
-		int yt = sy;
-		sx = ex;
-		sy = ey;
-		ex = xt;
-		ey = yt;
-	}
-	
-	// Get the line's layer.
-	layer_t *layer = nanocad_get_layer(layer_num);
-	if (layer == NULL) {
-		printf("Warning: Invalid layer '%d' to be rendered, falling back to "
-			   "layer 0.\n", layer_num);
-		layer = nanocad_get_layer(0);
-	}
-	
-	// Set the layer color.
-	SDL_SetRenderDrawColor(renderer, layer->color.r, layer->color.g,
-						   layer->color.b, layer->color.alpha);
-	
-	// Draw the main dimension line.
-	ret = SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-	if (ret < 0) {
-		return ret;
-	}
-	
-	// Text position variables will be the mid-point between marker pins.
-	int tx1 = 0;
-	int ty1 = 0;
-	int tx2 = 0;
-	int ty2 = 0;
-	
-	// Calculate the perpendicular line parameters.
-	int dx = x1 - x2;
-	int dy = y1 - y2;
-	int dist = (int)round(sqrt((dx * dx) + (dy * dy)));
-	dx = (int)nearbyint((double)dx / dist);
-	dy = (int)nearbyint((double)dy / dist);
-	
-	// Draw the first marker pin.
-	int x3 = x1 + (pin_offset * dy);
-	int y3 = y1 - (pin_offset * dx);
-	int x4 = x1 - (pin_offset * dy);
-	int y4 = y1 + (pin_offset * dx);
-	ret = SDL_RenderDrawLine(renderer, x3, y3, x4, y4);
-	if (ret < 0) {
-		return ret;
-	}
-
-	// Check the line direction and determine which marker position to use.
-	if ((sy > y1) && (ey > y2)) {
-		// Dimension line above measured line.
-		tx1 = x4;
-		ty1 = y4;
-		ty1 -= (int)((float)FONT_SIZE * 0.2);
-	} else if ((sy < y1) && (ey < y2)) {
-		// Dimension line below the measured line.
-		tx1 = x3;
-		ty1 = y3;
-	} else if ((sx > x1) && (ex > x2)) {
-		// Dimension line to the left of measured line.
-		tx1 = x4;
-		ty1 = y4;
-		tx1 -= (int)((float)FONT_SIZE * 0.2);
-	} else if ((sx < x1) && (ex < x2)) {
-		// Dimension line to the right of measured line.
-		tx1 = x4;
-		ty1 = y4;
-	}
-	
-#ifdef DEBUG
-	printf("Dimension Line:\n");
-	printf("    Start:    (%ld, %ld) -> (%d, %d)\n", line_start.x, line_start.y,
-		   x1, y1);
-	printf("    End:      (%ld, %ld) -> (%d, %d)\n", line_end.x, line_end.y,
-		   x2, y2);
-	printf("    Middle:   (%ld, %ld) -> (%d, %d)\n",
-		   (line_start.x + line_end.x) / 2, (line_start.y + line_end.y) / 2,
-		   (x1 + x2) / 2, (y1 + y2) / 2);
-	printf("Marker Pins:\n");
-	printf("    Distance:    %d        (%d, %d)\n", dist, dx, dy);
-	printf("    1. Start:               (%d, %d)\n", x3, y3);
-	printf("    1. End:                 (%d, %d)\n", x4, y4);
-#endif
-	
-	// Draw the second marker pin.
-	x3 = x2 + (pin_offset * dy);
-	y3 = y2 - (pin_offset * dx);
-	x4 = x2 - (pin_offset * dy);
-	y4 = y2 + (pin_offset * dx);
-	ret = SDL_RenderDrawLine(renderer, x3, y3, x4, y4);
-	if (ret < 0) {
-		return ret;
-	}
-	
-	// Check the line direction and determine which marker position to use.
-	if ((sy > y1) && (ey > y2)) {
-		// Dimension line above measured line.
-		tx2 = x4;
-		ty2 = y4;
-		ty2 -= (int)((float)FONT_SIZE * 0.2);
-	} else if ((sy < y1) && (ey < y2)) {
-		// Dimension line below the measured line.
-		tx2 = x3;
-		ty2 = y3;
-	} else if ((sx > x1) && (ex > x2)) {
-		// Dimension line to the left of measured line.
-		tx2 = x4;
-		ty2 = y4;
-		tx2 -= (int)((float)FONT_SIZE * 0.2);
-	} else if ((sx < x1) && (ex < x2)) {
-		// Dimension line to the right of measured line.
-		tx2 = x4;
-		ty2 = y4;
-	}
-	
-#ifdef DEBUG
-	printf("    2. Start:               (%d, %d)\n", x3, y3);
-	printf("    2. End:                 (%d, %d)\n", x4, y4);
-#endif
-		
-	// Build the measurement string.
-	// TODO: Put the distance function inside the engine and return a string and
-	//       can have a unit set.
-	double distance = sqrt(pow(end.x - start.x, 2) + pow(end.y - start.y, 2));
-	char text[DIMENSION_TEXT_MAX_SIZE];
-	snprintf(text, DIMENSION_TEXT_MAX_SIZE, "%.0f", distance);
-	
-	// Calculate text position with the origin reset.
-	coord_t text_pos;
-    text_pos.x = ((tx1 + tx2) / 2) - origin.x;
-	text_pos.y = origin.y - ((ty1 + ty2) / 2);
-
-	// Calculate the dimension text rotation angle.
-	double perpangle = atan2(y1 - y2, x1 - x2);
-	double text_angle = perpangle * (180.0 / M_PI);
-	
-	// Fix the rotation on opposite sides (remember that Y is inverted in SDL).
-	if ((sy > y1) && (ey > y2)) {
-		// Dimension line above measured line.
-		text_angle += 180;
-	} else if ((sy < y1) && (ey < y2)) {
-		// Dimension line below the measured line.
-		text_angle += 180;
-	} else if ((sx > x1) && (ex > x2)) {
-		// Dimension line to the left of measured line.
-		text_angle += 180;
-	}
-	
-#ifdef DEBUG
-	printf("Dimension Text:\n");
-	printf("    Distance:    %d        (%d, %d)\n", dist, dx, dy);
-	printf("    Position: (%ld, %ld) -> (%d, %d)\n", text_pos.x, text_pos.y,
-		   (int)(origin.x + text_pos.x), (int)(origin.y - text_pos.y));
-	printf("    Angle:       %.0f°\n", text_angle);
-	printf("\n");
-#endif
-	
-	// Render the dimension text.
-	draw_text(text, text_pos, text_angle, layer_num);
 	
 	return ret;
 }
@@ -460,14 +455,14 @@ int draw_dimension(const coord_t start, const coord_t end,
 void graphics_eventloop() {
 	keystates = SDL_GetKeyboardState(0);
 	SDL_Event event;
+	viewport_t *vp;
 	int zoom_amount = 0;
+	bool needs_present;
 
 	// TODO: Handle touch events.
 
-	while (running && SDL_WaitEvent(&event)) {
-		// Set the background color and clear the window.
-		SDL_SetRenderDrawColor(renderer, 33, 40, 48, 255);
-		SDL_RenderClear(renderer);
+	while (running && graphics_wait_event(&event)) {
+		needs_present = false;
 
 		switch (event.type) {
 		case SDL_KEYDOWN:
@@ -476,44 +471,100 @@ void graphics_eventloop() {
 				// Escape
 				SDL_Quit();
 				exit(EXIT_SUCCESS);
+			} else if (is_key_down(SDL_SCANCODE_F2)) {
+				// Split the window in two views or go back to a single one.
+				toggle_split();
+				needs_present = true;
+			} else if (is_key_down(SDL_SCANCODE_F3)) {
+				// Show how the caches are doing.
+				cachemgr_print_stats();
+				doccache_print_stats();
 			}
 			break;
 		case SDL_MOUSEMOTION:
 			// Mouse movement.
 			if (event.motion.state & SDL_BUTTON(SDL_BUTTON_LEFT)) {
-				// Pan around the view.
-				set_origin(origin.x + event.motion.xrel,
-						   origin.y + event.motion.yrel);
+				// Pan around the view where the drag started.
+				set_origin(active_view,
+						   active_view->origin.x + event.motion.xrel,
+						   active_view->origin.y + event.motion.yrel);
+			} else if ((vp = viewport_at(event.motion.x, event.motion.y)) !=
+					   active_view) {
+				// Input now goes to the view under the cursor.
+				overlay_stop_band(&overlay);
+				active_view = vp;
+			}
+
+			// Move the cursor feedback around.
+			overlay_move(&overlay, event.motion.x - active_view->rect.x,
+						 event.motion.y - active_view->rect.y,
+						 active_view->origin,
+						 (float)active_view->zoom_level / 100, &snap_index);
+			needs_present = true;
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+			// Mouse button pressed.
+			if (event.button.button == SDL_BUTTON_RIGHT) {
+				// Start a rubber band line preview.
+				overlay_start_band(&overlay);
+				needs_present = true;
+			}
+			break;
+		case SDL_MOUSEBUTTONUP:
+			// Mouse button released.
+			if (event.button.button == SDL_BUTTON_RIGHT) {
+				overlay_stop_band(&overlay);
+				needs_present = true;
 			}
 			break;
 		case SDL_MOUSEWHEEL:
 			// Mouse wheel turned.
-			zoom_amount = zoom_level + (event.wheel.y * ZOOM_INTENSITY);
-			zoom(zoom_amount);
+			zoom_amount = active_view->zoom_level +
+				(event.wheel.y * ZOOM_INTENSITY);
+			zoom(active_view, zoom_amount);
 #ifdef DEBUG
 			printf("Zoom level: %d%%\n", zoom_amount);
 #endif
 			break;
 		case SDL_WINDOWEVENT:
 			// Window stuff.
-			switch (event.window.event) {
-			case SDL_WINDOWEVENT_RESIZED:
-#ifdef DEBUG
-				SDL_Log("Window %d resized to %dx%d",
-						event.window.windowID, event.window.data1,
-						event.window.data2);
-#endif
-				reset_origin();
-				break;
+			handle_window_event(&event.window);
+			needs_present = true;
+			break;
+		case SDL_RENDER_DEVICE_RESET:
+			// All of our textures are gone.
+			text_cache_clear(&text_cache);
+			for (size_t i = 0; i < viewport_count; i++) {
+				destroy_scene_texture(&viewports[i]);
 			}
 			break;
+		case SDL_RENDER_TARGETS_RESET:
+			// Our cached frames are gone.
+			invalidate_viewports();
+			break;
 		}
 
-		// Update the graphics on the screen.
-		graphics_render();
+		// Keep the caches under the budget while nobody holds their entries.
+		cachemgr_trim();
 
-		// Show the window.
-		SDL_RenderPresent(renderer);
+		// Report whatever happens during this frame once we're idle. This
+		// has to keep going even when hidden, or the queue would overflow.
+		idle_schedule("diagnostics", IDLE_PRIORITY_NORMAL,
+					  idle_drain_diagnostics, NULL);
+
+		// Don't waste any time drawing things nobody can see.
+		if (!window_visible) {
+			continue;
+		}
+
+		// Update the graphics on the screen if anything changed.
+		for (size_t i = 0; i < viewport_count; i++) {
+			needs_present |= viewports[i].dirty;
+		}
+
+		if (needs_present || (scene_revision != nanocad_get_revision())) {
+			graphics_present();
+		}
 	}
 
 	// Clean up the house after the party.
@@ -521,40 +572,558 @@ void graphics_eventloop() {
 }
 
 /**
- * Sets the current zoom level.
+ * Handles the window events, keeping track of its visibility and size.
+ *
+ * @param event Window event.
+ */
+void handle_window_event(const SDL_WindowEvent *event) {
+	switch (event->event) {
+	case SDL_WINDOWEVENT_HIDDEN:
+	case SDL_WINDOWEVENT_MINIMIZED:
+		// Nobody is looking, so stop working on things only needed to draw.
+		window_visible = false;
+		idle_cancel(idle_update_display_list, &display_list);
+		idle_cancel(idle_build_pyramid, &pyramid);
+		idle_cancel(idle_build_snap_index, &snap_index);
+		break;
+	case SDL_WINDOWEVENT_SHOWN:
+	case SDL_WINDOWEVENT_RESTORED:
+	case SDL_WINDOWEVENT_MAXIMIZED:
+	case SDL_WINDOWEVENT_EXPOSED:
+		// Back on screen. The cached frames will be used if still valid.
+		window_visible = true;
+		break;
+	case SDL_WINDOWEVENT_LEAVE:
+		// No cursor feedback while the mouse is somewhere else.
+		overlay_hide(&overlay);
+		break;
+	case SDL_WINDOWEVENT_SIZE_CHANGED:
+		// The cached frames no longer fit the window.
+		layout_viewports();
+		break;
+	case SDL_WINDOWEVENT_RESIZED:
+#ifdef DEBUG
+		SDL_Log("Window %d resized to %dx%d", event->windowID, event->data1,
+				event->data2);
+#endif
+		for (size_t i = 0; i < viewport_count; i++) {
+			reset_origin(&viewports[i]);
+		}
+		break;
+	}
+}
+
+/**
+ * Puts the views on screen, only redrawing the parts of them that have changed
+ * since the last time they were drawn.
+ */
+void graphics_present() {
+	bool cached[MAX_VIEWPORTS];
+
+	// Gather everything that changed since the last frame.
+	collect_document_damage();
+
+	// Render the changes into the cached frame of each view.
+	for (size_t i = 0; i < viewport_count; i++) {
+		viewport_t *vp = &viewports[i];
+		if (vp->dirty || (vp->texture == NULL)) {
+			damage_add_all(&vp->damage);
+		}
+
+		cached[i] = true;
+		if (vp->damage.full || (vp->damage.count > 0)) {
+			// Whatever we were snapping to may have moved.
+			if (overlay.visible && (vp == active_view)) {
+				overlay_move(&overlay, overlay.cursor.x, overlay.cursor.y,
+							 vp->origin, (float)vp->zoom_level / 100,
+							 &snap_index);
+			}
+
+			cached[i] = render_scene(vp);
+		}
+	}
+	scene_revision = nanocad_get_revision();
+
+	// Put the views together in the window.
+	SDL_SetRenderDrawColor(renderer, 33, 40, 48, 255);
+	SDL_RenderClear(renderer);
+	for (size_t i = 0; i < viewport_count; i++) {
+		viewport_t *vp = &viewports[i];
+		SDL_Rect dest = { (int)lroundf(vp->rect.x * pixel_scale),
+						  (int)lroundf(vp->rect.y * pixel_scale),
+						  (int)lroundf(vp->rect.w * pixel_scale),
+						  (int)lroundf(vp->rect.h * pixel_scale) };
+
+		if (cached[i] && (vp->texture != NULL)) {
+			SDL_RenderCopy(renderer, vp->texture, NULL, &dest);
+		} else {
+			// No cached frame available, so draw straight to the window.
+			render_direct(vp, &dest);
+		}
+
+		// Separate the views.
+		if (i > 0) {
+			SDL_SetRenderDrawColor(renderer, 70, 80, 92, 255);
+			SDL_RenderDrawLine(renderer, dest.x, dest.y, dest.x,
+							   dest.y + dest.h - 1);
+		}
+	}
+
+	// Put the overlay on top of the view that has the cursor.
+	SDL_RenderSetScale(renderer, pixel_scale, pixel_scale);
+	SDL_RenderSetViewport(renderer, &active_view->rect);
+	overlay_render(&overlay, renderer);
+	SDL_RenderSetViewport(renderer, NULL);
+	SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+
+	SDL_RenderPresent(renderer);
+}
+
+/**
+ * Renders the damaged parts of a view into its cached frame texture.
  *
+ * @param  vp View to be rendered.
+ * @return    TRUE if the view was rendered into its cached frame.
+ */
+bool render_scene(viewport_t *vp) {
+	SDL_Rect screen;
+
+	// Create the cached frame texture if we don't have one.
+	if (vp->texture == NULL) {
+		vp->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+										SDL_TEXTUREACCESS_TARGET,
+										(int)lroundf(vp->rect.w * pixel_scale),
+										(int)lroundf(vp->rect.h * pixel_scale));
+		if (vp->texture == NULL) {
+			return false;
+		}
+
+		damage_add_all(&vp->damage);
+	}
+
+	// Draw the scene into it.
+	if (SDL_SetRenderTarget(renderer, vp->texture) < 0) {
+		destroy_scene_texture(vp);
+		return false;
+	}
+
+	view = vp;
+	SDL_SetRenderDrawColor(renderer, 33, 40, 48, 255);
+	render_scale = view_scale(vp);
+	SDL_RenderSetScale(renderer, render_scale, render_scale);
+
+	bool has_size = get_scene_rect(vp, &screen);
+	if (has_size && damage_clip(&vp->damage, &screen) && !vp->damage.full) {
+		// Only redraw the damaged rectangles.
+		for (size_t i = 0; i < vp->damage.count; i++) {
+			render_clip = vp->damage.rects[i];
+			render_clipped = true;
+
+			SDL_RenderSetClipRect(renderer, &render_clip);
+			SDL_SetRenderDrawColor(renderer, 33, 40, 48, 255);
+			SDL_RenderFillRect(renderer, &render_clip);
+			graphics_render();
+		}
+
+		SDL_RenderSetClipRect(renderer, NULL);
+		render_clipped = false;
+	} else if (vp->damage.full) {
+		// Redraw everything, leaving out what's outside of the view.
+		render_clip = screen;
+		render_clipped = has_size;
+
+		SDL_RenderClear(renderer);
+		graphics_render();
+		render_clipped = false;
+	}
+
+	SDL_SetRenderTarget(renderer, NULL);
+
+	damage_reset(&vp->damage);
+	vp->dirty = false;
+
+	return true;
+}
+
+/**
+ * Renders a view straight into its area of the window. Used when render
+ * targets aren't available.
+ *
+ * @param vp   View to be rendered.
+ * @param area Area of the window in device pixels.
+ */
+void render_direct(viewport_t *vp, const SDL_Rect *area) {
+	view = vp;
+	render_scale = view_scale(vp);
+	SDL_RenderSetViewport(renderer, area);
+	SDL_RenderSetScale(renderer, render_scale, render_scale);
+	graphics_render();
+	SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+	SDL_RenderSetViewport(renderer, NULL);
+
+	damage_reset(&vp->damage);
+	vp->dirty = false;
+}
+
+/**
+ * Updates the number of device pixels per window unit, which is more than 1
+ * on HiDPI screens, and sizes the caches to the resolution being used.
+ */
+void update_pixel_scale() {
+	int window_width = 0;
+	int output_width = 0;
+	int output_height = 0;
+
+	SDL_GetWindowSize(window, &window_width, NULL);
+	SDL_GetRendererOutputSize(renderer, &output_width, &output_height);
+	if ((window_width <= 0) || (output_width <= 0)) {
+		return;
+	}
+
+	if ((float)output_width / window_width != pixel_scale) {
+		pixel_scale = (float)output_width / window_width;
+		invalidate_viewports();
+	}
+
+	// Keep about a screen worth of text around. It's shared by every view.
+	text_cache_set_budget(&text_cache,
+						  (size_t)output_width * (size_t)output_height * 4);
+}
+
+/**
+ * Gets the scale used to render a view, in device pixels per unit.
+ *
+ * @param  vp View.
+ * @return    Rendering scale of the view.
+ */
+float view_scale(const viewport_t *vp) {
+	return ((float)vp->zoom_level / 100) * pixel_scale;
+}
+
+/**
+ * Takes the areas of the document that have changed and marks them as damaged
+ * in every view.
+ */
+void collect_document_damage() {
+	damage_list doc;
+	nanocad_take_damage(&doc);
+
+	if (doc.full) {
+		invalidate_viewports();
+		return;
+	}
+
+	for (size_t v = 0; v < viewport_count; v++) {
+		viewport_t *vp = &viewports[v];
+
+		for (size_t i = 0; i < doc.count; i++) {
+			const damage_rect_t *dmg = &doc.list[i];
+			long pad = dmg->text ? DAMAGE_TEXT_PADDING : DAMAGE_PADDING;
+
+			// Transpose the coordinates to the view's origin.
+			long x1 = vp->origin.x + dmg->min.x - pad;
+			long y1 = vp->origin.y - dmg->max.y - pad;
+			long x2 = vp->origin.x + dmg->max.x + pad;
+			long y2 = vp->origin.y - dmg->min.y + pad;
+
+			// Anything this far away can't be on the screen anyway.
+			x1 = (x1 < INT_MIN / 4) ? INT_MIN / 4 : x1;
+			y1 = (y1 < INT_MIN / 4) ? INT_MIN / 4 : y1;
+			x2 = (x2 > INT_MAX / 4) ? INT_MAX / 4 : x2;
+			y2 = (y2 > INT_MAX / 4) ? INT_MAX / 4 : y2;
+			if ((x1 > x2) || (y1 > y2)) {
+				continue;
+			}
+
+			SDL_Rect rect = { (int)x1, (int)y1, (int)(x2 - x1 + 1),
+							  (int)(y2 - y1 + 1) };
+			damage_add(&vp->damage, &rect);
+		}
+	}
+}
+
+/**
+ * Gets the area of a view that's visible, in the same coordinates used to
+ * render it.
+ *
+ * @param  vp   View.
+ * @param  rect Where to put the visible area.
+ * @return      TRUE if the view has a size.
+ */
+bool get_scene_rect(const viewport_t *vp, SDL_Rect *rect) {
+	float scale = view_scale(vp);
+	int width;
+	int height;
+
+	if ((vp->texture == NULL) || (scale <= 0) ||
+			(SDL_QueryTexture(vp->texture, NULL, NULL, &width, &height) < 0)) {
+		return false;
+	}
+
+	rect->x = 0;
+	rect->y = 0;
+	rect->w = (int)ceilf(width / scale);
+	rect->h = (int)ceilf(height / scale);
+
+	return true;
+}
+
+/**
+ * Checks if a box is completely outside of the area being redrawn.
+ *
+ * @param  x1  Left side of the box.
+ * @param  y1  Top side of the box.
+ * @param  x2  Right side of the box.
+ * @param  y2  Bottom side of the box.
+ * @param  pad How much the box may spill over its sides.
+ * @return     TRUE if the box doesn't need to be drawn.
+ */
+bool is_clipped_out(const int x1, const int y1, const int x2, const int y2,
+					const int pad) {
+	if (!render_clipped) {
+		return false;
+	}
+
+	return ((x2 + pad) < render_clip.x) ||
+		((x1 - pad) >= (render_clip.x + render_clip.w)) ||
+		((y2 + pad) < render_clip.y) ||
+		((y1 - pad) >= (render_clip.y + render_clip.h));
+}
+
+/**
+ * Destroys the cached frame texture of a view.
+ *
+ * @param vp View.
+ */
+void destroy_scene_texture(viewport_t *vp) {
+	if (vp->texture != NULL) {
+		SDL_DestroyTexture(vp->texture);
+		vp->texture = NULL;
+	}
+
+	vp->dirty = true;
+}
+
+/**
+ * Adds a new view of the document.
+ *
+ * @param  base View to copy the view transform from or NULL for the default.
+ * @return      New view or NULL if there's no room for it.
+ */
+viewport_t* add_viewport(const viewport_t *base) {
+	if (viewport_count >= MAX_VIEWPORTS) {
+		return NULL;
+	}
+
+	viewport_t *vp = &viewports[viewport_count++];
+	vp->texture = NULL;
+	vp->dirty = true;
+	damage_add_all(&vp->damage);
+
+	if (base != NULL) {
+		vp->rect = base->rect;
+		vp->origin = base->origin;
+		vp->zoom_level = base->zoom_level;
+	} else {
+		vp->rect.x = 0;
+		vp->rect.y = 0;
+		vp->rect.w = 0;
+		vp->rect.h = 0;
+		vp->origin.x = 0;
+		vp->origin.y = 0;
+		vp->zoom_level = 100;
+	}
+
+	return vp;
+}
+
+/**
+ * Splits the window between the views side by side.
+ */
+void layout_viewports() {
+	int width = 0;
+	int height = 0;
+	int x = 0;
+
+	SDL_GetWindowSize(window, &width, &height);
+	update_pixel_scale();
+
+	for (size_t i = 0; i < viewport_count; i++) {
+		viewport_t *vp = &viewports[i];
+		int next = (int)((width * (i + 1)) / viewport_count);
+
+		vp->rect.x = x;
+		vp->rect.y = 0;
+		vp->rect.w = next - x;
+		vp->rect.h = height;
+		x = next;
+
+		// The cached frame no longer fits.
+		destroy_scene_texture(vp);
+	}
+}
+
+/**
+ * Splits the window into two views or goes back to a single one.
+ */
+void toggle_split() {
+	if (viewport_count > 1) {
+		for (size_t i = 1; i < viewport_count; i++) {
+			destroy_scene_texture(&viewports[i]);
+		}
+
+		viewport_count = 1;
+	} else {
+		add_viewport(&viewports[0]);
+	}
+
+	active_view = &viewports[0];
+	overlay_stop_band(&overlay);
+	layout_viewports();
+}
+
+/**
+ * Finds the view under a point of the window.
+ *
+ * @param  x X position in the window.
+ * @param  y Y position in the window.
+ * @return   View under the point, the first one if there's none.
+ */
+viewport_t* viewport_at(const int x, const int y) {
+	SDL_Point pt = { x, y };
+
+	for (size_t i = 0; i < viewport_count; i++) {
+		if (SDL_PointInRect(&pt, &viewports[i].rect)) {
+			return &viewports[i];
+		}
+	}
+
+	return &viewports[0];
+}
+
+/**
+ * Marks every view as needing to be fully redrawn.
+ */
+void invalidate_viewports() {
+	for (size_t i = 0; i < viewport_count; i++) {
+		viewports[i].dirty = true;
+		damage_add_all(&viewports[i].damage);
+	}
+}
+
+/**
+ * Waits for the next event, running the idle jobs while there's none.
+ *
+ * @param  event Pointer to where the event will be stored.
+ * @return       FALSE if there was an error while waiting for events.
+ */
+bool graphics_wait_event(SDL_Event *event) {
+	// Keep the derived data up to date if the document was changed.
+	if (window_visible && (display_list.revision != nanocad_get_revision())) {
+		idle_schedule("display list", IDLE_PRIORITY_LOW,
+					  idle_update_display_list, &display_list);
+	} else if (window_visible && pyramid_is_stale(&pyramid, &display_list)) {
+		idle_schedule("polyline pyramid", IDLE_PRIORITY_LOW,
+					  idle_build_pyramid, &pyramid);
+	}
+
+	// Snapping doesn't depend on anything else being built first.
+	if (window_visible && snap_index_is_stale(&snap_index)) {
+		idle_schedule("snap index", IDLE_PRIORITY_LOW, idle_build_snap_index,
+					  &snap_index);
+	}
+
+	// Work in small slices until an event arrives or there's nothing to do.
+	while (idle_pending()) {
+		if (SDL_PollEvent(event)) {
+			return true;
+		}
+
+		idle_run(IDLE_SLICE_MS);
+	}
+
+	return SDL_WaitEvent(event) != 0;
+}
+
+/**
+ * Idle job that drains the diagnostics queue.
+ *
+ * @param  data Unused.
+ * @return      Always FALSE since it's done in a single step.
+ */
+bool idle_drain_diagnostics(void *data) {
+	diag_drain();
+	return false;
+}
+
+/**
+ * Idle job that rebuilds the display list ahead of the next frame.
+ *
+ * @param  data Display list to be updated.
+ * @return      TRUE while there's still work to be done.
+ */
+bool idle_update_display_list(void *data) {
+	return display_list_step((display_list_t*)data);
+}
+
+/**
+ * Idle job that builds the simplified versions of the polylines.
+ *
+ * @param  data Polyline pyramid to be built.
+ * @return      TRUE while there's still work to be done.
+ */
+bool idle_build_pyramid(void *data) {
+	return pyramid_step((polyline_pyramid_t*)data, &display_list);
+}
+
+/**
+ * Idle job that builds the grid of points the cursor can snap to.
+ *
+ * @param  data Snap index to be built.
+ * @return      TRUE while there's still work to be done.
+ */
+bool idle_build_snap_index(void *data) {
+	return snap_index_step((snap_index_t*)data);
+}
+
+/**
+ * Sets the zoom level of a view.
+ *
+ * @param vp         View to be zoomed.
  * @param percentage Percentage of zoom to be applied to the viewport.
  */
-void zoom(const int percentage) {
-	zoom_level = percentage;
-	float scale = (float)zoom_level / 100;
-	SDL_RenderSetScale(renderer, scale, scale);
+void zoom(viewport_t *vp, const int percentage) {
+	// The scale is only applied when rendering the scene.
+	vp->zoom_level = percentage;
+	vp->dirty = true;
 }
 
 /**
- * Sets a new origin point relative to the SDL origin.
+ * Sets a new origin point of a view relative to its top-left corner.
  *
- * @param x New x coordinate.
- * @param y New y coordinate.
+ * @param vp View.
+ * @param x  New x coordinate.
+ * @param y  New y coordinate.
  */
-void set_origin(const int x, const int y) {
-	origin.x = x;
-	origin.y = y;
+void set_origin(viewport_t *vp, const int x, const int y) {
+	vp->origin.x = x;
+	vp->origin.y = y;
+	vp->dirty = true;
 
 #ifdef DEBUG
-	printf("New origin set: (%d, %d)\n", (int)origin.x, (int)origin.y);
+	printf("New origin set: (%d, %d)\n", (int)vp->origin.x,
+		   (int)vp->origin.y);
 #endif
 }
 
 /**
- * Resets the origin back to a more cartesian place.
+ * Resets the origin of a view back to a more cartesian place.
+ *
+ * @param vp View.
  */
-void reset_origin() {
-	int y = 0;
-
-	// Get window size and set the Y coordinate only.
-	SDL_GetWindowSize(window, NULL, &y);
-	set_origin(0, y);
+void reset_origin(viewport_t *vp) {
+	// Set the Y coordinate only.
+	set_origin(vp, 0, vp->rect.h);
 }
 
 /**
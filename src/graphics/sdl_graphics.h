@@ -12,6 +12,7 @@
 
 // Constants.
 #define DIMENSION_TEXT_MAX_SIZE 20
+#define FONT_SIZE               20
 
 // Initialization and destruction.
 bool graphics_init(const int width, const int height);
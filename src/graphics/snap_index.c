@@ -0,0 +1,321 @@
+/**
+ * graphics/snap_index.c
+ * Uniform grid of the points the cursor can snap to.
+ *
+ * Every point of every object goes into a grid sized for about one point per
+ * cell, so finding the closest one to the cursor only has to look at the few
+ * cells around it instead of going through the whole document every time the
+ * mouse moves. It's built a chunk of objects at a time while the application
+ * is idle, and until it's caught up with the document the snap search falls
+ * back to going through the objects.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "snap_index.h"
+
+// Constants.
+#define SNAP_CHUNK_SIZE 256
+
+// Internal functions.
+void reset_snap_index(snap_index_t *index);
+void add_snap_point(snap_index_t *index, const coord_t coord);
+void bucket_snap_points(snap_index_t *index);
+size_t snap_index_col(const snap_index_t *index, const int64_t x);
+size_t snap_index_row(const snap_index_t *index, const int64_t y);
+size_t snap_index_bytes(const snap_index_t *index);
+
+
+/**
+ * Initializes an empty snap index.
+ *
+ * @param index Snap index to be initialized.
+ */
+void snap_index_init(snap_index_t *index) {
+	memset(index, 0, sizeof(snap_index_t));
+	index->building = false;
+	index->complete = false;
+
+	// Searching for something to snap to can't do without it.
+	index->cache_id = cachemgr_register("snap index", index, NULL, NULL);
+}
+
+/**
+ * Frees everything allocated by a snap index.
+ *
+ * @param index Snap index to be freed.
+ */
+void snap_index_free(snap_index_t *index) {
+	free(index->x);
+	free(index->y);
+	free(index->start);
+
+	cachemgr_unregister(index->cache_id);
+	memset(index, 0, sizeof(snap_index_t));
+	index->building = false;
+	index->complete = false;
+	index->cache_id = -1;
+}
+
+/**
+ * Checks if the snap index still has to be (re)built for the document.
+ *
+ * @param  index Snap index.
+ * @return       TRUE if it can't be searched right now.
+ */
+bool snap_index_is_stale(const snap_index_t *index) {
+	return !index->complete || (index->revision != nanocad_get_revision());
+}
+
+/**
+ * Does a small step of building the snap index.
+ *
+ * @param  index Snap index.
+ * @return       TRUE if there's still work to be done.
+ */
+bool snap_index_step(snap_index_t *index) {
+	object_span_t spans[SNAP_CHUNK_SIZE];
+	size_t processed = 0;
+	size_t count = 0;
+
+	if (!snap_index_is_stale(index)) {
+		return false;
+	}
+
+	// Start over if the document changed since the build was started.
+	if (!index->building || (index->revision != nanocad_get_revision())) {
+		reset_snap_index(index);
+	}
+
+	// Collect the points a chunk of objects at a time.
+	while ((processed < SNAP_STEP_OBJECTS) &&
+		   ((count = nanocad_object_iter_next(&index->iter, spans,
+											  SNAP_CHUNK_SIZE)) > 0)) {
+		processed += count;
+
+		for (size_t i = 0; i < count; i++) {
+			for (uint8_t j = 0; j < spans[i].coord_count; j++) {
+				add_snap_point(index, spans[i].coord[j]);
+			}
+		}
+	}
+
+	if (index->iter.pos < index->iter.end) {
+		return true;
+	}
+
+	// Put them in the grid in a single pass.
+	bucket_snap_points(index);
+	index->building = false;
+	index->complete = true;
+	cachemgr_resize(index->cache_id, snap_index_bytes(index), index->count);
+
+	return false;
+}
+
+/**
+ * Finds the closest point to a position within a radius.
+ *
+ * @param  index  Snap index that isn't stale.
+ * @param  x      X coordinate to search around.
+ * @param  y      Y coordinate to search around.
+ * @param  radius Largest distance a point can be from the position.
+ * @param  point  Pointer to where the closest point will be stored.
+ * @return        TRUE if there was a point within the radius.
+ */
+bool snap_index_nearest(const snap_index_t *index, const long x, const long y,
+						const long radius, coord_t *point) {
+	double best = (double)radius * radius;
+	bool found = false;
+
+	// Check if the search area is anywhere near the grid.
+	if ((index->count == 0) || ((x + radius) < index->min_x) ||
+			((x - radius) > index->max_x) || ((y + radius) < index->min_y) ||
+			((y - radius) > index->max_y)) {
+		return false;
+	}
+
+	// Only look at the cells that overlap with the search area.
+	size_t col_min = snap_index_col(index, x - radius);
+	size_t col_max = snap_index_col(index, x + radius);
+	size_t row_min = snap_index_row(index, y - radius);
+	size_t row_max = snap_index_row(index, y + radius);
+
+	for (size_t row = row_min; row <= row_max; row++) {
+		for (size_t col = col_min; col <= col_max; col++) {
+			size_t cell = (row * index->cols) + col;
+
+			for (size_t i = index->start[cell]; i < index->start[cell + 1];
+					i++) {
+				double dx = (double)(index->x[i] - x);
+				double dy = (double)(index->y[i] - y);
+				double dist = (dx * dx) + (dy * dy);
+
+				if (dist <= best) {
+					best = dist;
+					point->x = (long)index->x[i];
+					point->y = (long)index->y[i];
+					found = true;
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+/**
+ * Throws away the current index and gets ready to build a new one.
+ *
+ * @param index Snap index.
+ */
+void reset_snap_index(snap_index_t *index) {
+	free(index->start);
+	index->start = NULL;
+	index->cols = 0;
+	index->rows = 0;
+
+	index->revision = nanocad_get_revision();
+	index->building = true;
+	index->complete = false;
+	index->count = 0;
+	index->min_x = INT64_MAX;
+	index->min_y = INT64_MAX;
+	index->max_x = INT64_MIN;
+	index->max_y = INT64_MIN;
+	nanocad_object_iter_init(&index->iter, NULL, 0, 1);
+}
+
+/**
+ * Adds a point to the ones waiting to be put in the grid.
+ *
+ * @param index Snap index.
+ * @param coord Point to be added.
+ */
+void add_snap_point(snap_index_t *index, const coord_t coord) {
+	if (index->count == index->capacity) {
+		index->capacity = (index->capacity == 0) ? 1024 : index->capacity * 2;
+		index->x = realloc(index->x, sizeof(int64_t) * index->capacity);
+		index->y = realloc(index->y, sizeof(int64_t) * index->capacity);
+	}
+
+	index->x[index->count] = coord.x;
+	index->y[index->count] = coord.y;
+	index->count++;
+
+	if (coord.x < index->min_x) index->min_x = coord.x;
+	if (coord.y < index->min_y) index->min_y = coord.y;
+	if (coord.x > index->max_x) index->max_x = coord.x;
+	if (coord.y > index->max_y) index->max_y = coord.y;
+}
+
+/**
+ * Sizes the grid for about one point per cell and sorts the collected points
+ * by cell, keeping the order they were collected in inside each cell.
+ *
+ * @param index Snap index.
+ */
+void bucket_snap_points(snap_index_t *index) {
+	size_t count = index->count;
+
+	if (count == 0) {
+		index->min_x = index->min_y = index->max_x = index->max_y = 0;
+	}
+
+	// Size the cells for about one point each.
+	double width = (double)(index->max_x - index->min_x) + 1;
+	double height = (double)(index->max_y - index->min_y) + 1;
+	index->size = (int64_t)ceil(sqrt((width * height) / (double)(count + 1)));
+	if (index->size < 1) {
+		index->size = 1;
+	}
+	while ((((width / index->size) + 1) * ((height / index->size) + 1)) >
+			((double)count * 2) + 16) {
+		index->size = (index->size * 5 / 4) + 1;
+	}
+	index->cols = (size_t)((index->max_x - index->min_x) / index->size) + 1;
+	index->rows = (size_t)((index->max_y - index->min_y) / index->size) + 1;
+
+	// Count the points in each cell and turn that into starting offsets.
+	size_t cells = index->cols * index->rows;
+	index->start = calloc(cells + 1, sizeof(size_t));
+	for (size_t i = 0; i < count; i++) {
+		size_t cell = (snap_index_row(index, index->y[i]) * index->cols) +
+			snap_index_col(index, index->x[i]);
+		index->start[cell + 1]++;
+	}
+	for (size_t cell = 0; cell < cells; cell++) {
+		index->start[cell + 1] += index->start[cell];
+	}
+
+	// Scatter the points into their cells.
+	int64_t *x = malloc(sizeof(int64_t) * (count + 1));
+	int64_t *y = malloc(sizeof(int64_t) * (count + 1));
+	size_t *next = malloc(sizeof(size_t) * (cells + 1));
+	memcpy(next, index->start, sizeof(size_t) * (cells + 1));
+	for (size_t i = 0; i < count; i++) {
+		size_t cell = (snap_index_row(index, index->y[i]) * index->cols) +
+			snap_index_col(index, index->x[i]);
+		size_t j = next[cell]++;
+
+		x[j] = index->x[i];
+		y[j] = index->y[i];
+	}
+	free(next);
+
+	free(index->x);
+	free(index->y);
+	index->x = x;
+	index->y = y;
+	index->capacity = count + 1;
+}
+
+/**
+ * Gets the grid column of a coordinate, clamped to the grid.
+ *
+ * @param  index Snap index.
+ * @param  x     X coordinate.
+ * @return       Column index.
+ */
+size_t snap_index_col(const snap_index_t *index, const int64_t x) {
+	if (x <= index->min_x) {
+		return 0;
+	}
+
+	size_t col = (size_t)((x - index->min_x) / index->size);
+	return (col >= index->cols) ? (index->cols - 1) : col;
+}
+
+/**
+ * Gets the grid row of a coordinate, clamped to the grid.
+ *
+ * @param  index Snap index.
+ * @param  y     Y coordinate.
+ * @return       Row index.
+ */
+size_t snap_index_row(const snap_index_t *index, const int64_t y) {
+	if (y <= index->min_y) {
+		return 0;
+	}
+
+	size_t row = (size_t)((y - index->min_y) / index->size);
+	return (row >= index->rows) ? (index->rows - 1) : row;
+}
+
+/**
+ * Works out how much memory a snap index is taking up.
+ *
+ * @param  index Snap index.
+ * @return       Size of everything it has allocated in bytes.
+ */
+size_t snap_index_bytes(const snap_index_t *index) {
+	size_t bytes = sizeof(int64_t) * 2 * index->capacity;
+
+	if (index->start != NULL) {
+		bytes += sizeof(size_t) * ((index->cols * index->rows) + 1);
+	}
+
+	return bytes;
+}
@@ -0,0 +1,58 @@
+/**
+ * graphics/snap_index.h
+ * Uniform grid of the points the cursor can snap to.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _SNAP_INDEX_H
+#define _SNAP_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../engine/nanocad.h"
+#include "../engine/cachemgr.h"
+
+// Constants.
+#define SNAP_STEP_OBJECTS 65536  // Objects to go through per step.
+
+// Snap index.
+typedef struct {
+	uint32_t          revision;
+	bool              building;
+	bool              complete;
+	object_iterator_t iter;
+
+	// Points collected from the objects, sorted by cell once it's complete.
+	size_t            count;
+	size_t            capacity;
+	int64_t          *x;
+	int64_t          *y;
+
+	// Grid.
+	int64_t           min_x;
+	int64_t           min_y;
+	int64_t           max_x;
+	int64_t           max_y;
+	int64_t           size;
+	size_t            cols;
+	size_t            rows;
+	size_t           *start;  // First point of each cell.
+
+	int               cache_id;
+} snap_index_t;
+
+// Initialization and destruction.
+void snap_index_init(snap_index_t *index);
+void snap_index_free(snap_index_t *index);
+
+// Building.
+bool snap_index_is_stale(const snap_index_t *index);
+bool snap_index_step(snap_index_t *index);
+
+// Searching.
+bool snap_index_nearest(const snap_index_t *index, const long x, const long y,
+						const long radius, coord_t *point);
+
+#endif
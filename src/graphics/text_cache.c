@@ -0,0 +1,363 @@
+/**
+ * graphics/text_cache.c
+ * Cache of rasterized text textures keyed by their pixel size.
+ *
+ * Text is rasterized at the size it'll actually have on the screen, taking
+ * into account the device pixel density and the zoom level, so it never gets
+ * scaled up and blurry. Textures are kept in a hash table with a LRU list and
+ * the least recently used ones are thrown away once the memory budget, which
+ * follows the resolution of the screen, is exceeded. The cache manager may
+ * also take the oldest ones away to keep everything under the global budget.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#include <string.h>
+#include <math.h>
+#include "../engine/diagnostics.h"
+#include "text_cache.h"
+
+// Internal functions.
+uint32_t text_hash(const char *text, const uint32_t color, const int size);
+TTF_Font* get_font(text_cache_t *cache, const int size);
+void unlink_entry(text_cache_t *cache, text_entry_t *entry);
+void push_newest(text_cache_t *cache, text_entry_t *entry);
+void evict_oldest(text_cache_t *cache);
+bool text_cache_victim(void *data, cachemgr_victim_t *victim);
+void text_cache_evict(void *data);
+
+
+/**
+ * Initializes the text cache.
+ *
+ * @param  cache       Text cache.
+ * @param  renderer    Renderer that will own the textures.
+ * @param  font_data   TTF font file contents. Must outlive the cache.
+ * @param  font_length Size of the font file.
+ * @return             TRUE if the font could be loaded.
+ */
+bool text_cache_init(text_cache_t *cache, SDL_Renderer *renderer,
+					 const void *font_data, const int font_length) {
+	memset(cache, 0, sizeof(text_cache_t));
+	cache->renderer = renderer;
+	cache->font_data = font_data;
+	cache->font_length = font_length;
+	cache->budget = SIZE_MAX;
+	cache->cache_id = cachemgr_register("text", cache, text_cache_victim,
+										text_cache_evict);
+
+	// Make sure the font can actually be used.
+	return get_font(cache, FONT_SIZE) != NULL;
+}
+
+/**
+ * Frees every texture and font in the cache.
+ *
+ * @param cache Text cache.
+ */
+void text_cache_free(text_cache_t *cache) {
+	text_cache_clear(cache);
+
+	for (uint8_t i = 0; i < TEXT_CACHE_FONTS; i++) {
+		if (cache->fonts[i].font != NULL) {
+			TTF_CloseFont(cache->fonts[i].font);
+			cache->fonts[i].font = NULL;
+		}
+	}
+
+	cachemgr_unregister(cache->cache_id);
+	cache->cache_id = -1;
+}
+
+/**
+ * Throws away every cached texture, for example when the renderer loses them.
+ *
+ * @param cache Text cache.
+ */
+void text_cache_clear(text_cache_t *cache) {
+	while (cache->oldest != NULL) {
+		evict_oldest(cache);
+	}
+}
+
+/**
+ * Sets how much texture memory the cache may use, evicting whatever doesn't
+ * fit anymore.
+ *
+ * @param cache Text cache.
+ * @param bytes Memory budget in bytes.
+ */
+void text_cache_set_budget(text_cache_t *cache, const size_t bytes) {
+	cache->budget = bytes;
+
+	while ((cache->bytes > cache->budget) && (cache->oldest != NULL)) {
+		evict_oldest(cache);
+	}
+}
+
+/**
+ * Calculates the pixel size of the font for a given rendering scale.
+ *
+ * @param  scale Rendering scale (device pixels per unit).
+ * @return       Font size in pixels.
+ */
+int text_pixel_size(const float scale) {
+	int size = (int)lroundf(FONT_SIZE * scale);
+
+	if (size < TEXT_MIN_PIXEL_SIZE) {
+		return TEXT_MIN_PIXEL_SIZE;
+	} else if (size > TEXT_MAX_PIXEL_SIZE) {
+		return TEXT_MAX_PIXEL_SIZE;
+	}
+
+	return size;
+}
+
+/**
+ * Gets the texture of a piece of text, rasterizing it if it isn't cached.
+ *
+ * @param  cache Text cache.
+ * @param  text  Text to be rendered.
+ * @param  color Text color.
+ * @param  size  Font size in pixels.
+ * @return       Cached entry or NULL if the text couldn't be rasterized.
+ */
+text_entry_t* text_cache_get(text_cache_t *cache, const char *text,
+							 const SDL_Color color, const int size) {
+	uint32_t rgba = ((uint32_t)color.r << 24) | ((uint32_t)color.g << 16) |
+		((uint32_t)color.b << 8) | color.a;
+	uint32_t hash = text_hash(text, rgba, size);
+	text_entry_t **bucket = &cache->buckets[hash & (TEXT_CACHE_BUCKETS - 1)];
+
+	// Look for it in the cache.
+	for (text_entry_t *entry = *bucket; entry != NULL; entry = entry->chain) {
+		if ((entry->hash == hash) && (entry->color == rgba) &&
+				(entry->size == size) &&
+				(strncmp(entry->text, text, DIMENSION_TEXT_MAX_SIZE) == 0)) {
+			unlink_entry(cache, entry);
+			push_newest(cache, entry);
+			entry->used = cachemgr_tick();
+			cachemgr_hit(cache->cache_id);
+
+			return entry;
+		}
+	}
+	cachemgr_miss(cache->cache_id);
+
+	// Rasterize the text.
+	uint64_t start = cachemgr_now_us();
+	TTF_Font *font = get_font(cache, size);
+	if (font == NULL) {
+		return NULL;
+	}
+
+	SDL_Surface *surface = TTF_RenderText_Blended(font, text, color);
+	if (surface == NULL) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0, "Couldn't rasterize "
+					"text: %s", TTF_GetError());
+		return NULL;
+	}
+
+	SDL_Texture *texture = SDL_CreateTextureFromSurface(cache->renderer,
+														surface);
+	if (texture == NULL) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, 0, "Couldn't create text "
+					"texture: %s", SDL_GetError());
+		SDL_FreeSurface(surface);
+		return NULL;
+	}
+
+	// Create the new entry.
+	text_entry_t *entry = (text_entry_t *)malloc(sizeof(text_entry_t));
+	strncpy(entry->text, text, DIMENSION_TEXT_MAX_SIZE - 1);
+	entry->text[DIMENSION_TEXT_MAX_SIZE - 1] = '\0';
+	entry->color = rgba;
+	entry->size = size;
+	entry->hash = hash;
+	entry->texture = texture;
+	entry->width = surface->w;
+	entry->height = surface->h;
+	entry->bytes = (size_t)surface->w * (size_t)surface->h * 4;
+	entry->used = cachemgr_tick();
+	entry->cost = cachemgr_now_us() - start;
+	SDL_FreeSurface(surface);
+
+	// Make room for it and put it in the cache.
+	while (((cache->bytes + entry->bytes) > cache->budget) &&
+			(cache->oldest != NULL)) {
+		evict_oldest(cache);
+	}
+
+	entry->chain = *bucket;
+	*bucket = entry;
+	push_newest(cache, entry);
+	cache->count++;
+	cache->bytes += entry->bytes;
+	cachemgr_resize(cache->cache_id, cache->bytes, cache->count);
+
+	return entry;
+}
+
+/**
+ * Hashes the key of a cache entry (FNV-1a).
+ *
+ * @param  text  Text.
+ * @param  color Text color as RGBA.
+ * @param  size  Font size in pixels.
+ * @return       Hash of the key.
+ */
+uint32_t text_hash(const char *text, const uint32_t color, const int size) {
+	uint32_t hash = 2166136261u;
+
+	for (uint8_t i = 0; (i < DIMENSION_TEXT_MAX_SIZE) && (text[i] != '\0');
+			i++) {
+		hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+	}
+
+	hash = (hash ^ color) * 16777619u;
+	hash = (hash ^ (uint32_t)size) * 16777619u;
+
+	return hash;
+}
+
+/**
+ * Gets the font opened at a specific pixel size, replacing the least recently
+ * used one if it isn't open yet.
+ *
+ * @param  cache Text cache.
+ * @param  size  Font size in pixels.
+ * @return       Font or NULL if it couldn't be opened.
+ */
+TTF_Font* get_font(text_cache_t *cache, const int size) {
+	text_font_t *slot = &cache->fonts[0];
+	cache->font_clock++;
+
+	for (uint8_t i = 0; i < TEXT_CACHE_FONTS; i++) {
+		text_font_t *font = &cache->fonts[i];
+
+		if ((font->font != NULL) && (font->size == size)) {
+			font->last_used = cache->font_clock;
+			return font->font;
+		}
+
+		// Keep track of the best slot to be replaced.
+		if ((slot->font != NULL) &&
+				((font->font == NULL) || (font->last_used < slot->last_used))) {
+			slot = font;
+		}
+	}
+
+	// Open the font at the new size.
+	if (slot->font != NULL) {
+		TTF_CloseFont(slot->font);
+	}
+
+	slot->size = size;
+	slot->last_used = cache->font_clock;
+	slot->font = TTF_OpenFontRW(SDL_RWFromConstMem(cache->font_data,
+												   cache->font_length),
+								1, size);
+	if (slot->font == NULL) {
+		diag_report(DIAG_ERROR, DIAG_CODE_RENDER, size, "Couldn't open the "
+					"font at %dpx: %s", size, TTF_GetError());
+	}
+
+	return slot->font;
+}
+
+/**
+ * Removes an entry from the LRU list.
+ *
+ * @param cache Text cache.
+ * @param entry Entry to be removed.
+ */
+void unlink_entry(text_cache_t *cache, text_entry_t *entry) {
+	if (entry->newer != NULL) {
+		entry->newer->older = entry->older;
+	} else {
+		cache->newest = entry->older;
+	}
+
+	if (entry->older != NULL) {
+		entry->older->newer = entry->newer;
+	} else {
+		cache->oldest = entry->newer;
+	}
+
+	entry->newer = NULL;
+	entry->older = NULL;
+}
+
+/**
+ * Puts an entry at the most recently used end of the LRU list.
+ *
+ * @param cache Text cache.
+ * @param entry Entry to be inserted.
+ */
+void push_newest(text_cache_t *cache, text_entry_t *entry) {
+	entry->newer = NULL;
+	entry->older = cache->newest;
+
+	if (cache->newest != NULL) {
+		cache->newest->newer = entry;
+	} else {
+		cache->oldest = entry;
+	}
+
+	cache->newest = entry;
+}
+
+/**
+ * Throws away the least recently used entry.
+ *
+ * @param cache Text cache.
+ */
+void evict_oldest(text_cache_t *cache) {
+	text_entry_t *entry = cache->oldest;
+	text_entry_t **link = &cache->buckets[entry->hash &
+										  (TEXT_CACHE_BUCKETS - 1)];
+
+	// Remove it from its bucket.
+	while (*link != entry) {
+		link = &(*link)->chain;
+	}
+	*link = entry->chain;
+
+	// Remove it from the LRU list and free it.
+	unlink_entry(cache, entry);
+	SDL_DestroyTexture(entry->texture);
+	cache->count--;
+	cache->bytes -= entry->bytes;
+	cachemgr_resize(cache->cache_id, cache->bytes, cache->count);
+	cachemgr_evicted(cache->cache_id);
+	free(entry);
+}
+
+/**
+ * Offers the least recently used texture to the cache manager.
+ *
+ * @param  data   Text cache.
+ * @param  victim Where to put the details of the texture.
+ * @return        FALSE if the cache is empty.
+ */
+bool text_cache_victim(void *data, cachemgr_victim_t *victim) {
+	text_entry_t *entry = ((text_cache_t *)data)->oldest;
+	if (entry == NULL) {
+		return false;
+	}
+
+	victim->bytes = entry->bytes;
+	victim->used = entry->used;
+	victim->cost = entry->cost;
+
+	return true;
+}
+
+/**
+ * Evicts the texture that was offered to the cache manager.
+ *
+ * @param data Text cache.
+ */
+void text_cache_evict(void *data) {
+	evict_oldest((text_cache_t *)data);
+}
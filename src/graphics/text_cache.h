@@ -0,0 +1,79 @@
+/**
+ * graphics/text_cache.h
+ * Cache of rasterized text textures keyed by their pixel size.
+ *
+ * @author Nathan Campos <nathanpc@dreamintech.net>
+ */
+
+#ifndef _TEXT_CACHE_H
+#define _TEXT_CACHE_H
+
+#include <SDL.h>
+#include <SDL_ttf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "sdl_graphics.h"
+#include "../engine/cachemgr.h"
+
+// Constants.
+#define TEXT_CACHE_BUCKETS  256  // Must be a power of 2.
+#define TEXT_CACHE_FONTS    4
+#define TEXT_MIN_PIXEL_SIZE 4
+#define TEXT_MAX_PIXEL_SIZE 256
+
+// Cached text texture.
+typedef struct text_entry_s {
+	char                 text[DIMENSION_TEXT_MAX_SIZE];
+	uint32_t             color;
+	int                  size;
+	uint32_t             hash;
+	SDL_Texture         *texture;
+	int                  width;
+	int                  height;
+	size_t               bytes;
+	uint64_t             used;  // Cache manager tick.
+	uint64_t             cost;  // Microseconds it took to rasterize.
+	struct text_entry_s *chain;
+	struct text_entry_s *newer;
+	struct text_entry_s *older;
+} text_entry_t;
+
+// Font opened at a specific pixel size.
+typedef struct {
+	int       size;
+	TTF_Font *font;
+	uint32_t  last_used;
+} text_font_t;
+
+// Text cache.
+typedef struct {
+	SDL_Renderer *renderer;
+	const void   *font_data;
+	int           font_length;
+	text_font_t   fonts[TEXT_CACHE_FONTS];
+	uint32_t      font_clock;
+	text_entry_t *buckets[TEXT_CACHE_BUCKETS];
+	text_entry_t *newest;
+	text_entry_t *oldest;
+	size_t        count;
+	size_t        bytes;
+	size_t        budget;
+	int           cache_id;
+} text_cache_t;
+
+// Initialization and destruction.
+bool text_cache_init(text_cache_t *cache, SDL_Renderer *renderer,
+					 const void *font_data, const int font_length);
+void text_cache_free(text_cache_t *cache);
+void text_cache_clear(text_cache_t *cache);
+
+// Sizing.
+void text_cache_set_budget(text_cache_t *cache, const size_t bytes);
+int text_pixel_size(const float scale);
+
+// Lookup.
+text_entry_t* text_cache_get(text_cache_t *cache, const char *text,
+							 const SDL_Color color, const int size);
+
+#endif